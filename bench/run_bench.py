@@ -0,0 +1,101 @@
+# PlatformIO post script for the bench environments: runs the benchmark firmware
+# under simavr and compares the cycle counts against the env's baseline,
+# bench/baseline_<env>.txt (bench and bench_speed).
+#
+#   pio run -e bench                    run and check against the baseline
+#   BENCH_UPDATE=1 pio run -e bench     run and save the results as the new baseline
+#
+# A benchmark more than BENCH_TOLERANCE percent (default 5) slower than its
+# baseline fails the build, and so does a missing baseline or a benchmark without
+# one: record it with BENCH_UPDATE=1 and commit the file.
+# A benchmark over its entry in BUDGETS fails the build whatever the baseline says.
+# BENCH_REPORT_ONLY=1 prints the results without checking or saving them (used by
+# bench/station_matrix.py, whose station and profile builds have no baseline).
+
+Import("env")
+
+import os
+import re
+import subprocess
+
+BASELINE = os.path.join(env.subst("$PROJECT_DIR"), "bench", "baseline_%s.txt" % env.subst("$PIOENV"))
+RESULT = re.compile(r"BENCH (\S+) (\d+)")
+
+# Cycles at 16 MHz a benchmark must stay under. These are limits worked out from what
+# the code has time for, not measurements: none has been run on the target yet
+BUDGETS = {
+    # Half of LED_FRAME_INTERVAL (10 ms, the flash's frame rate), the rest is left to the NFC session
+    "led_frame_3_layers": 80000,
+    # A full rule table run when an orb connects, 200 and 500 us: small next to the tens of
+    # milliseconds of its NFC session
+    "rules_flash_16": 3200,
+    "rules_eeprom_16": 8000,
+}
+
+
+def read_baseline():
+    baseline = {}
+    if os.path.exists(BASELINE):
+        with open(BASELINE) as f:
+            for line in f:
+                parts = line.split()
+                if len(parts) == 2 and not line.startswith("#"):
+                    baseline[parts[0]] = int(parts[1])
+    return baseline
+
+
+def write_baseline(results):
+    with open(BASELINE, "w") as f:
+        f.write("# Cycles per call on the ATmega328 at 16 MHz, written by bench/run_bench.py\n")
+        for name, cycles in results:
+            f.write("%s %d\n" % (name, cycles))
+
+
+def run_bench(source, target, env):
+    simavr = os.path.join(env.PioPlatform().get_package_dir("tool-simavr") or "", "bin", "simavr")
+    elf = str(target[0])
+    output = subprocess.run([simavr, "-m", "atmega328p", "-f", "16000000", elf],
+                            stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                            universal_newlines=True, timeout=600).stdout
+    results = [(m.group(1), int(m.group(2))) for m in RESULT.finditer(output)]
+    if "BENCH_DONE" not in output or not results:
+        print(output)
+        env.Exit("Benchmark firmware did not finish under simavr")
+
+    if os.environ.get("BENCH_REPORT_ONLY"):
+        for name, cycles in results:
+            print("%-18s %12d" % (name, cycles))
+        return
+
+    baseline = read_baseline()
+    tolerance = float(os.environ.get("BENCH_TOLERANCE", "5"))
+    regressions = []
+    missing = []
+    print("%-18s %12s %12s %8s" % ("benchmark", "cycles", "baseline", "change"))
+    for name, cycles in results:
+        base = baseline.get(name)
+        if base:
+            change = 100.0 * (cycles - base) / base
+            print("%-18s %12d %12d %+7.1f%%" % (name, cycles, base, change))
+            if change > tolerance:
+                regressions.append(name)
+        else:
+            print("%-18s %12d %12s" % (name, cycles, "-"))
+            missing.append(name)
+
+    over_budget = ["%s (%d > %d cycles)" % (name, cycles, BUDGETS[name])
+                   for name, cycles in results if name in BUDGETS and cycles > BUDGETS[name]]
+    if over_budget:
+        env.Exit("Over budget: %s" % ", ".join(over_budget))
+
+    if os.environ.get("BENCH_UPDATE"):
+        write_baseline(results)
+        print("Baseline written to %s" % BASELINE)
+    elif missing:
+        env.Exit("No baseline in %s for: %s (record one with BENCH_UPDATE=1 and commit it)" % (
+            BASELINE, ", ".join(missing)))
+    elif regressions:
+        env.Exit("Performance regression (> %.0f%% slower): %s" % (tolerance, ", ".join(regressions)))
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", run_bench)
@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+# Builds every station in both profiles (see the per-station environments in
+# platformio.ini) and reports flash, SRAM and loop() cycles, with the profile to ship:
+# the fastest one that leaves headroom in flash and SRAM.
+#
+#   python3 bench/station_matrix.py [station ...]
+#
+# Flash and SRAM come from the real firmware (<station>_<profile>). loop() cycles come
+# from the same station built into the bench firmware (bench / bench_speed, with the
+# in-memory tag instead of the PN532) and run under simavr with an orb on the reader.
+# The table is printed and written to bench/station_report.txt, with each figure's change
+# against bench/station_baseline.txt. Flash, SRAM or loop() more than BENCH_TOLERANCE
+# percent (default 5) over the baseline fails, and so does a station and profile without
+# one. BENCH_UPDATE=1 saves the results as the new baseline instead; commit it.
+
+import os
+import re
+import subprocess
+import sys
+
+STATIONS = ["basic", "basic_battery", "configurizer", "casino", "ledstrip", "comms", "comms_i2c", "trigger",
+            "rules", "rules_trigger", "rules_casino"]
+PROFILES = ["size", "speed"]
+BENCH_ENVS = {"size": "bench", "speed": "bench_speed"}
+# Build flags besides -DORB_STATION_<NAME>, keep in sync with platformio.ini
+STATION_FLAGS = {
+    "ledstrip": "-DLED_DRIVER=LED_DRIVER_FASTLED -DLED_COUNT=16",
+    "comms_i2c": "-DORB_STATION_COMMS -DCOMMS_I2C_ADDRESS=0x30",
+    "basic_battery": "-DORB_STATION_BASIC -DIDLE_AFTER_MS=60000",
+    "rules_trigger": "-DORB_STATION_RULES -DRULES_STATION=PIPES -DRULES_PRESET=RULES_TRIGGER "
+                     "-DRULES_FEATURES=FEATURE_ENERGY",
+    "rules_casino": "-DORB_STATION_RULES -DRULES_STATION=CASINO -DRULES_PRESET=RULES_CASINO -DRULES_BUTTONS",
+}
+# Rule table stations (src/StationRules.h) and the subclass each one replaces
+RULES_REPLACES = {"rules": "basic", "rules_trigger": "trigger", "rules_casino": "casino"}
+
+# Headroom a shipped profile must leave: SRAM for the stack and the NeoPixel buffer
+# (allocated at runtime, so not in the static RAM figure), flash for new features
+FLASH_BUDGET = 90.0
+RAM_BUDGET = 75.0
+CPU_MHZ = 16
+
+PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+REPORT = os.path.join(PROJECT_DIR, "bench", "station_report.txt")
+BASELINE = os.path.join(PROJECT_DIR, "bench", "station_baseline.txt")
+FIGURES = ["flash", "ram", "loop_avg", "loop_max"]
+USAGE = re.compile(r"^(RAM|Flash):.*?([\d.]+)% \(used (\d+) bytes", re.M)
+LOOP = re.compile(r"^(loop_avg|loop_max)\s+(\d+)", re.M)
+
+
+def pio(env_name, extra_env=None):
+    env = dict(os.environ)
+    env.update(extra_env or {})
+    result = subprocess.run(["pio", "run", "-e", env_name], cwd=PROJECT_DIR, env=env,
+                            stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+    if result.returncode != 0:
+        print(result.stdout)
+        sys.exit("pio run -e %s failed" % env_name)
+    return result.stdout
+
+
+def measure(station, profile):
+    usage = {}
+    for name, percent, used in USAGE.findall(pio("%s_%s" % (station, profile))):
+        usage[name] = (int(used), float(percent))
+    # A build directory per station, so switching the station flag never reuses objects
+    output = pio(BENCH_ENVS[profile], {
+        "PLATFORMIO_BUILD_FLAGS": "-DORB_STATION_%s %s" % (station.upper(), STATION_FLAGS.get(station, "")),
+        "PLATFORMIO_BUILD_DIR": os.path.join(PROJECT_DIR, ".pio", "station-bench", station),
+        "BENCH_REPORT_ONLY": "1",
+    })
+    loop = dict((name, int(cycles)) for name, cycles in LOOP.findall(output))
+    return {
+        "flash": usage["Flash"], "ram": usage["RAM"],
+        "loop_avg": loop["loop_avg"], "loop_max": loop["loop_max"],
+    }
+
+
+# {(station, profile): {figure: value}} from BASELINE
+def read_baseline():
+    baseline = {}
+    if os.path.exists(BASELINE):
+        with open(BASELINE) as f:
+            for line in f:
+                parts = line.split()
+                if len(parts) == 2 + len(FIGURES) and not line.startswith("#"):
+                    baseline[(parts[0], parts[1])] = dict(zip(FIGURES, map(int, parts[2:])))
+    return baseline
+
+
+def write_baseline(baseline):
+    with open(BASELINE, "w") as f:
+        f.write("# station profile %s, written by bench/station_matrix.py\n" % " ".join(FIGURES))
+        for (station, profile), values in sorted(baseline.items()):
+            f.write("%s %s %s\n" % (station, profile, " ".join(str(values[name]) for name in FIGURES)))
+
+
+def figure(result, name):
+    return result[name][0] if name in ("flash", "ram") else result[name]
+
+
+def fits(result):
+    return result["flash"][1] <= FLASH_BUDGET and result["ram"][1] <= RAM_BUDGET
+
+
+def main():
+    stations = sys.argv[1:] or STATIONS
+    baseline = read_baseline()
+    tolerance = float(os.environ.get("BENCH_TOLERANCE", "5"))
+    lines = ["%-13s %-6s %15s %13s %14s %14s  %-11s %s" % (
+        "station", "profile", "flash", "sram", "loop avg us", "loop max us", "ship", "vs baseline")]
+    measured = {}
+    failures = []
+    for station in stations:
+        results = dict((profile, measure(station, profile)) for profile in PROFILES)
+        measured[station] = results
+        fitting = [profile for profile in PROFILES if fits(results[profile])]
+        ship = min(fitting, key=lambda p: (results[p]["loop_max"], results[p]["loop_avg"])) if fitting else None
+        for profile in PROFILES:
+            result = results[profile]
+            base = baseline.get((station, profile))
+            if base:
+                changes = dict((name, 100.0 * (figure(result, name) - base[name]) / max(base[name], 1))
+                               for name in FIGURES)
+                change = " ".join("%s %+.1f%%" % (name, changes[name]) for name in FIGURES)
+                failures += ["%s %s %s" % (station, profile, name) for name in FIGURES if changes[name] > tolerance]
+            else:
+                change = "no baseline"
+                failures.append("%s %s (no baseline)" % (station, profile))
+            lines.append("%-13s %-6s %7d (%4.1f%%) %5d (%4.1f%%) %14.1f %14.1f  %-11s %s" % (
+                station, profile, result["flash"][0], result["flash"][1], result["ram"][0], result["ram"][1],
+                result["loop_avg"] / float(CPU_MHZ), result["loop_max"] / float(CPU_MHZ),
+                "<-" if profile == ship else ("over budget" if not fits(result) else ""), change))
+    for station, subclass in sorted(RULES_REPLACES.items()):
+        if station in measured and subclass in measured:
+            for profile in PROFILES:
+                lines.append("%s vs %s (%s): flash %+d bytes, SRAM %+d bytes" % (
+                    station, subclass, profile,
+                    measured[station][profile]["flash"][0] - measured[subclass][profile]["flash"][0],
+                    measured[station][profile]["ram"][0] - measured[subclass][profile]["ram"][0]))
+    lines.append("Budget: flash <= %.0f%%, SRAM <= %.0f%% of the ATmega328" % (FLASH_BUDGET, RAM_BUDGET))
+    print("\n".join(lines))
+    with open(REPORT, "w") as f:
+        f.write("\n".join(lines) + "\n")
+
+    if os.environ.get("BENCH_UPDATE"):
+        for station in measured:
+            for profile in PROFILES:
+                baseline[(station, profile)] = dict(
+                    (name, figure(measured[station][profile], name)) for name in FIGURES)
+        write_baseline(baseline)
+        print("Baseline written to %s" % BASELINE)
+    elif failures:
+        sys.exit("Over the baseline by more than %.0f%%: %s" % (tolerance, ", ".join(failures)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,92 @@
+/**
+ * Stand-in for the Adafruit PN532 library in benchmark builds
+ *
+ * Implements the part of the Adafruit_PN532 API that OrbDock uses on top of an
+ * in-memory NTAG213, so NFC code paths can be timed without a reader. Commands
+ * complete instantly - benchmarks measure the dock's CPU cost, not RF time -
+ * unless the tag is timed, which tools/fleet-sim uses to model reader latency.
+ *
+ * Used by the bench environment in platformio.ini (the other environments
+ * lib_ignore it and use the real library) and by tools/fleet-sim.
+ */
+
+#ifndef FAKE_PN532_H
+#define FAKE_PN532_H
+
+#include <Arduino.h>
+
+#define PN532_MIFARE_ISO14443A (0x00)
+#define PN532_COMMAND_POWERDOWN (0x16)
+#define FAKE_NTAG_PAGES 45
+
+// Rough software SPI estimates for timed tags, not measurements
+#define FAKE_PN532_SELECT_US 6000      // InListPassiveTarget with a tag in the field
+#define FAKE_PN532_NO_TAG_US 25000     // InListPassiveTarget giving up after its passive activation retries
+#define FAKE_PN532_EXCHANGE_US 1500    // InDataExchange frame overhead
+#define FAKE_PN532_BYTE_US 90          // Per byte sent or received
+#define FAKE_PN532_WRITE_US 4100       // NTAG EEPROM programming time per page
+#define FAKE_PN532_ACK_TIMEOUT_US 100000   // Library waiting for the ACK of a wedged reader
+#define FAKE_PN532_WAKE_US 2000        // First command after PowerDown, waiting for the PN532 to wake
+
+// fakeField is per thread in the fleet simulator, which runs docks on worker threads
+#ifndef FAKE_PN532_THREAD_LOCAL
+#define FAKE_PN532_THREAD_LOCAL
+#endif
+
+// The tag in the fake reader's field
+struct FakeNTAG {
+    bool present;
+    uint8_t pages[FAKE_NTAG_PAGES][4];
+    uint32_t exchanges;   // inDataExchange calls, for counting transactions
+    uint32_t selects;     // inListPassiveTarget calls that found the tag
+    bool timed;           // Commands take FAKE_PN532_* time (delayMicroseconds)
+
+    FakeNTAG();
+    // Writes an orb header, trait and one energy ring record at ringPage (ENERGY_RING_PAGE
+    // of src/OrbRegistry.h, which this library doesn't include)
+    void formatOrb(uint8_t trait, uint8_t energy, uint8_t ringPage);
+};
+
+extern FakeNTAG fakeTag;
+// The tag in the reader's field, &fakeTag unless the fleet simulator moved an orb there
+extern FAKE_PN532_THREAD_LOCAL FakeNTAG* fakeField;
+
+// A wedged reader answers no command until what clears it happens, for testing the
+// dock's recovery (see NFCHealth.h). Per thread like fakeField
+enum FakePN532Wedge {
+    FAKE_PN532_OK,
+    FAKE_PN532_WEDGED_SAMCONFIG,    // Cleared by SAMConfig()
+    FAKE_PN532_WEDGED_BEGIN,        // Cleared by begin()
+    FAKE_PN532_WEDGED_DEAD          // Nothing clears it - unplugged, or needs a power cycle
+};
+extern FAKE_PN532_THREAD_LOCAL uint8_t fakePN532Wedge;
+
+// How a timed reader spent its time, for tools/idle-power. Per thread like fakeField
+struct FakePN532Power {
+    bool down;                  // In PowerDown, until the next command
+    unsigned long downSince;    // micros()
+    uint32_t powerDowns;
+    uint64_t downMicros;        // In PowerDown
+    uint64_t fieldMicros;       // Running commands, its RF field on
+};
+extern FAKE_PN532_THREAD_LOCAL FakePN532Power fakePN532Power;
+
+class Adafruit_PN532 {
+public:
+    Adafruit_PN532(uint8_t clk, uint8_t miso, uint8_t mosi, uint8_t ss);
+
+    void begin();
+    uint32_t getFirmwareVersion();
+    bool SAMConfig();
+    bool setPassiveActivationRetries(uint8_t maxRetries);
+    bool inListPassiveTarget();
+    bool inDataExchange(uint8_t* send, uint8_t sendLength, uint8_t* response, uint8_t* responseLength);
+    // Only PN532_COMMAND_POWERDOWN, which the next command wakes it from
+    bool sendCommandCheckAck(uint8_t* cmd, uint8_t cmdlen, uint16_t timeout = 100);
+
+private:
+    // Private in the real library too, so the dock can't come to depend on it
+    void readdata(uint8_t* buff, uint8_t n);
+};
+
+#endif
@@ -0,0 +1,170 @@
+#include "Adafruit_PN532.h"
+
+FakeNTAG fakeTag;
+FAKE_PN532_THREAD_LOCAL FakeNTAG* fakeField = &fakeTag;
+FAKE_PN532_THREAD_LOCAL uint8_t fakePN532Wedge = FAKE_PN532_OK;
+FAKE_PN532_THREAD_LOCAL FakePN532Power fakePN532Power = {false, 0, 0, 0, 0};
+
+// Every command wakes a reader in PowerDown, which takes a while on a timed one
+static void wake() {
+    FakePN532Power& power = fakePN532Power;
+    if (!power.down) {
+        return;
+    }
+    power.down = false;
+    power.downMicros += micros() - power.downSince;
+    if (fakeField->timed) {
+        delayMicroseconds(FAKE_PN532_WAKE_US);
+    }
+}
+
+// A timed command's RF time
+static void fieldOn(unsigned long us) {
+    if (fakeField->timed) {
+        delayMicroseconds(us);
+        fakePN532Power.fieldMicros += us;
+    }
+}
+
+// A wedged reader never ACKs, so a timed command waits out the library's ACK timeout
+static bool wedged() {
+    wake();
+    if (fakePN532Wedge == FAKE_PN532_OK) {
+        return false;
+    }
+    if (fakeField->timed) {
+        delayMicroseconds(FAKE_PN532_ACK_TIMEOUT_US);
+    }
+    return true;
+}
+
+FakeNTAG::FakeNTAG() {
+    present = true;
+    exchanges = 0;
+    selects = 0;
+    timed = false;
+    memset(pages, 0, sizeof(pages));
+    // 7 byte UID with its check bytes, and the NTAG213 capability container
+    const uint8_t header[16] = {
+        0x04, 0x0B, 0x1E, 0x88 ^ 0x04 ^ 0x0B ^ 0x1E,
+        0x2A, 0x5C, 0x61, 0x80,
+        0x2A ^ 0x5C ^ 0x61 ^ 0x80, 0x48, 0x00, 0x00,
+        0xE1, 0x10, 0x12, 0x00
+    };
+    memcpy(pages, header, sizeof(header));
+}
+
+void FakeNTAG::formatOrb(uint8_t trait, uint8_t energy, uint8_t ringPage) {
+    memcpy(pages[4], "ORBS", 4);
+    pages[5][0] = trait;
+    // First energy ring record (see EnergyRing.h), right after the station pages
+    pages[ringPage][0] = energy;
+    pages[ringPage][1] = 0;
+    pages[ringPage][2] = energy ^ 0x5A;
+    pages[ringPage][3] = 'E';
+}
+
+Adafruit_PN532::Adafruit_PN532(uint8_t clk, uint8_t miso, uint8_t mosi, uint8_t ss) {
+}
+
+void Adafruit_PN532::begin() {
+    wake();
+    if (fakePN532Wedge != FAKE_PN532_WEDGED_DEAD) {
+        fakePN532Wedge = FAKE_PN532_OK;
+    }
+}
+
+uint32_t Adafruit_PN532::getFirmwareVersion() {
+    if (wedged()) {
+        return 0;
+    }
+    return 0x32010607;  // PN532 firmware 1.6
+}
+
+bool Adafruit_PN532::SAMConfig() {
+    if (fakePN532Wedge == FAKE_PN532_WEDGED_SAMCONFIG) {
+        fakePN532Wedge = FAKE_PN532_OK;
+    }
+    return !wedged();
+}
+
+bool Adafruit_PN532::setPassiveActivationRetries(uint8_t maxRetries) {
+    wake();
+    return true;
+}
+
+bool Adafruit_PN532::inListPassiveTarget() {
+    FakeNTAG& tag = *fakeField;
+    if (wedged()) {
+        return false;
+    }
+    fieldOn(tag.present ? FAKE_PN532_SELECT_US : FAKE_PN532_NO_TAG_US);
+    if (tag.present) {
+        tag.selects++;
+    }
+    return tag.present;
+}
+
+bool Adafruit_PN532::inDataExchange(uint8_t* send, uint8_t sendLength, uint8_t* response, uint8_t* responseLength) {
+    FakeNTAG& tag = *fakeField;
+    tag.exchanges++;
+    if (wedged()) {
+        return false;
+    }
+    fieldOn(FAKE_PN532_EXCHANGE_US + (sendLength + *responseLength) * FAKE_PN532_BYTE_US);
+    if (!tag.present || sendLength < 1) {
+        return false;
+    }
+    // Like the real library, answers longer than the response buffer are cut short
+    uint8_t capacity = *responseLength;
+    uint8_t length = 0;
+    switch (send[0]) {
+        case 0x60: {  // GET_VERSION - NTAG213
+            const uint8_t version[8] = {0x00, 0x04, 0x04, 0x02, 0x01, 0x00, 0x0F, 0x03};
+            for (; length < sizeof(version) && length < capacity; length++) {
+                response[length] = version[length];
+            }
+            break;
+        }
+        case 0x30:    // READ - 4 pages, wrapping around
+            for (; length < 16 && length < capacity; length++) {
+                response[length] = tag.pages[(send[1] + length / 4) % FAKE_NTAG_PAGES][length % 4];
+            }
+            break;
+        case 0x3A: {  // FAST_READ
+            if (sendLength < 3 || send[2] < send[1] || send[2] >= FAKE_NTAG_PAGES) return false;
+            uint16_t total = (send[2] - send[1] + 1) * 4;
+            for (; length < total && length < capacity; length++) {
+                response[length] = tag.pages[send[1] + length / 4][length % 4];
+            }
+            break;
+        }
+        case 0xA2:    // WRITE - pages 0-3 are not user memory
+            if (sendLength < 6 || send[1] < 4 || send[1] >= FAKE_NTAG_PAGES) return false;
+            memcpy(tag.pages[send[1]], send + 2, 4);
+            fieldOn(FAKE_PN532_WRITE_US);
+            break;
+        default:
+            return false;
+    }
+    *responseLength = length;
+    return true;
+}
+
+bool Adafruit_PN532::sendCommandCheckAck(uint8_t* cmd, uint8_t cmdlen, uint16_t timeout) {
+    if (wedged() || cmdlen < 1 || cmd[0] != PN532_COMMAND_POWERDOWN) {
+        return false;
+    }
+    fakePN532Power.down = true;
+    fakePN532Power.downSince = micros();
+    fakePN532Power.powerDowns++;
+    return true;
+}
+
+// The PowerDown response, status 0, which the PN532 sends before it goes down
+void Adafruit_PN532::readdata(uint8_t* buff, uint8_t n) {
+    static const uint8_t response[] = {0x00, 0x00, 0xFF, 0x03, 0xFD, 0xD5, PN532_COMMAND_POWERDOWN + 1, 0x00, 0x14, 0x00};
+    for (uint8_t i = 0; i < n; i++) {
+        buff[i] = i < sizeof(response) ? response[i] : 0;
+    }
+}
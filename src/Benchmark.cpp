@@ -0,0 +1,223 @@
+/**
+ * Cycle count benchmarks for the ATmega328 firmware
+ *
+ * Only built in the bench environment (platformio.ini), which swaps the PN532 library
+ * for the in-memory tag in lib/FakePN532 and runs the firmware under simavr.
+ * bench/run_bench.py compares the results against bench/baseline.txt and fails the
+ * build on a regression.
+ *
+ * Timer1 runs at the CPU clock, so its count (extended with an overflow counter) is a
+ * cycle count. Results are printed as "BENCH <name> <cycles>" lines.
+ *
+ * Built with a station flag (see StationSelect.h), it times that station's loop() with an
+ * orb on the reader instead - bench/station_matrix.py does this for every station.
+ */
+
+#ifdef ORB_BENCHMARK
+
+#include <Arduino.h>
+#include <avr/sleep.h>
+#include <EEPROM.h>
+#include "OrbDock.h"
+#include "ButtonDisplay.h"
+#include "StationRules.h"
+#include "StationSelect.h"
+
+#define BENCH_LOOP_MS 2000
+
+static volatile uint16_t timer1Overflows;
+
+ISR(TIMER1_OVF_vect) {
+    timer1Overflows++;
+}
+
+static void startCycleCounter() {
+    TCCR1A = 0;
+    TCCR1B = 0;
+    TCNT1 = 0;
+    timer1Overflows = 0;
+    TIFR1 = _BV(TOV1);
+    TIMSK1 = _BV(TOIE1);
+    TCCR1B = _BV(CS10);  // No prescaler
+}
+
+static uint32_t readCycles() {
+    uint8_t sreg = SREG;
+    cli();
+    uint16_t count = TCNT1;
+    uint16_t overflows = timer1Overflows;
+    // Overflow that happened since interrupts were disabled
+    if ((TIFR1 & _BV(TOV1)) && count < 0x8000) {
+        overflows++;
+    }
+    SREG = sreg;
+    return ((uint32_t)overflows << 16) | count;
+}
+
+static void report(const __FlashStringHelper* name, uint32_t cycles) {
+    Serial.print(F("BENCH "));
+    Serial.print(name);
+    Serial.print(F(" "));
+    Serial.println(cycles);
+}
+
+// Average cycles of one run of code, minus the cost of reading the counter
+#define BENCH(name, iterations, code) {                         \
+    uint32_t start = readCycles();                              \
+    for (uint16_t benchIteration = 0; benchIteration < (iterations); benchIteration++) { \
+        code;                                                   \
+    }                                                           \
+    uint32_t cycles = readCycles() - start - counterOverhead;   \
+    report(F(name), cycles / (iterations));                     \
+}
+
+// Cycles of loop() over BENCH_LOOP_MS, as loop_avg and loop_max
+template <class Dock>
+static void benchLoop(Dock& dock, uint32_t counterOverhead) {
+    uint32_t loops = 0;
+    uint32_t total = 0;
+    uint32_t worst = 0;
+    unsigned long startMillis = millis();
+    while (millis() - startMillis < BENCH_LOOP_MS) {
+        uint32_t loopStart = readCycles();
+        dock.loop();
+        uint32_t cycles = readCycles() - loopStart - counterOverhead;
+        total += cycles;
+        if (cycles > worst) worst = cycles;
+        loops++;
+    }
+    report(F("loop_avg"), total / loops);
+    report(F("loop_max"), worst);
+}
+
+#ifdef ORB_STATION_DOCK
+
+ORB_STATION_DOCK;
+
+static void runBenchmarks() {
+    fakeTag.formatOrb(TraitId::DOUBT, 100, ENERGY_RING_PAGE);
+    orbDock.begin();
+    uint32_t start = readCycles();
+    uint32_t counterOverhead = readCycles() - start;
+    benchLoop(orbDock, counterOverhead);
+}
+
+#else
+
+// A full rule table where every rule matches an orb connecting, the most a run can do
+const StationRule BENCH_RULES[RULES_MAX] PROGMEM = {
+    {RULE_ON_CONNECT, RULE_ANY_TRAIT, 0, 255, RULE_VISITED_ANY, RULE_ENERGY, 1, 0},
+    {RULE_ON_CONNECT, (uint8_t)TraitId::DOUBT, 0, 255, RULE_VISITED_ANY, RULE_ENERGY, 2, 0},
+    {RULE_ON_CONNECT, RULE_ANY_TRAIT, 50, 150, RULE_VISITED_ANY, RULE_SET_CUSTOM, 7, 0},
+    {RULE_ON_CONNECT, RULE_ANY_TRAIT, 0, 255, RULE_NOT_VISITED, RULE_PULSE_PIN, 12, 20},
+    {RULE_ON_CONNECT, RULE_ANY_TRAIT, 0, 255, RULE_VISITED_ANY, RULE_LED, RULE_LED_FLASH, 0},
+    {RULE_ON_CONNECT, (uint8_t)TraitId::DOUBT, 100, 100, RULE_NOT_VISITED, RULE_ENERGY, (uint8_t)-3, 0},
+    {RULE_ON_CONNECT, RULE_ANY_TRAIT, 0, 255, RULE_VISITED_ANY, RULE_ENERGY, 1, 0},
+    {RULE_ON_CONNECT, RULE_ANY_TRAIT, 0, 255, RULE_VISITED_ANY, RULE_SET_CUSTOM, 8, 0},
+    {RULE_ON_CONNECT, RULE_ANY_TRAIT, 0, 255, RULE_VISITED_ANY, RULE_ENERGY, 1, 0},
+    {RULE_ON_CONNECT, (uint8_t)TraitId::DOUBT, 0, 255, RULE_VISITED_ANY, RULE_ENERGY, 2, 0},
+    {RULE_ON_CONNECT, RULE_ANY_TRAIT, 50, 150, RULE_VISITED_ANY, RULE_SET_CUSTOM, 7, 0},
+    {RULE_ON_CONNECT, RULE_ANY_TRAIT, 0, 255, RULE_NOT_VISITED, RULE_PULSE_PIN, 12, 20},
+    {RULE_ON_CONNECT, RULE_ANY_TRAIT, 0, 255, RULE_VISITED_ANY, RULE_LED, RULE_LED_ERROR, 0},
+    {RULE_ON_CONNECT, (uint8_t)TraitId::DOUBT, 100, 100, RULE_NOT_VISITED, RULE_ENERGY, (uint8_t)-3, 0},
+    {RULE_ON_CONNECT, RULE_ANY_TRAIT, 0, 255, RULE_VISITED_ANY, RULE_ENERGY, 1, 0},
+    {RULE_ON_CONNECT, RULE_ANY_TRAIT, 0, 255, RULE_VISITED_ANY, RULE_SET_CUSTOM, 9, 0},
+};
+
+class OrbDockBenchmark : public OrbDock<OrbDockBenchmark> {
+public:
+    static const uint8_t FEATURES = FEATURE_LED_PATTERNS | FEATURE_ENERGY | FEATURE_FORMAT;
+
+    OrbDockBenchmark() : OrbDock(StationId::CASINO) {
+    }
+
+    void run() {
+        uint32_t start = readCycles();
+        counterOverhead = readCycles() - start;
+
+        // LED patterns, without and with pushing the frame out to the ring
+        orbInfo.trait = TraitId::DOUBT;
+        orbInfo.energy = 100;
+        BENCH("dimColor", 1000, dimColor(traitColor(orbInfo.trait), benchIteration));
+        BENCH("led_rainbow", 100, led_rainbow());
+        BENCH("led_trait_chase", 100, led_trait_chase());
+        BENCH("led_flash", 100, led_flash());
+        setLEDPattern(LED_PATTERN_ORB_CONNECTED);
+        BENCH("runLEDPatterns", 100, currentMillis += 1000; runLEDPatterns());
+        // The rainbow fading out under the chase with the flash on top, pushed out to the
+        // ring - must stay well inside LED_FRAME_INTERVAL (see BUDGETS in bench/run_bench.py)
+        ledLayers[LED_PATTERN_NO_ORB].alpha = 128;
+        ledLayers[LED_PATTERN_ORB_CONNECTED].alpha = 128;
+        ledLayers[LED_PATTERN_FLASH].alpha = 128;
+        BENCH("led_frame_3_layers", 100, composeLEDs(); leds.show());
+
+        // Orb session against the fake tag
+        fakeTag.formatOrb(TraitId::DOUBT, 100, ENERGY_RING_PAGE);
+        BENCH("isNFCPresent", 10, isNFCPresent());
+        BENCH("readOrbInfo", 10, readOrbInfo());
+        BENCH("setEnergy", 10, setEnergy(100));
+        BENCH("setVisited", 10, setVisited(true));
+        BENCH("isNFCActive", 10, isNFCActive());
+        endOrbSession();
+        // An event through the queue to the station's (empty) callback, with the handler timing
+        BENCH("event_dispatch", 100, postEvent(EVENT_BUTTON, 1); dispatchEvents());
+
+        // Rule tables (see StationRules.h): the Casino's preset on a button press, and a
+        // full table from flash and from the EEPROM (see BUDGETS in bench/run_bench.py)
+        RuleOrb ruleOrb = {(uint8_t)TraitId::DOUBT, 100, false};
+        RuleActions ruleActions;
+        RulesInFlash casinoRules = {RULES_CASINO, sizeof(RULES_CASINO) / sizeof(RULES_CASINO[0])};
+        BENCH("rules_casino_button", 100, stationRulesRun(casinoRules, RULE_ON_BUTTON2, ruleOrb, ruleActions));
+        RulesInFlash flashRules = {BENCH_RULES, RULES_MAX};
+        BENCH("rules_flash_16", 100, stationRulesRun(flashRules, RULE_ON_CONNECT, ruleOrb, ruleActions));
+        {
+            StationRule rules[RULES_MAX];
+            uint8_t table[RULES_TABLE_SIZE(RULES_MAX)];
+            memcpy_P(rules, BENCH_RULES, sizeof(rules));
+            for (uint16_t i = 0; i < stationRulesEncode(table, rules, RULES_MAX); i++) {
+                EEPROM.update(RULES_EEPROM_START + i, table[i]);
+            }
+        }
+        RulesInStorage<EEPROMClass> storedRules = {EEPROM};
+        BENCH("rules_eeprom_16", 100, stationRulesRun(storedRules, RULE_ON_CONNECT, ruleOrb, ruleActions));
+
+        // Full screen redraw - there is no SSD1306 on the simulated I2C bus, so the transfer is NAKed
+        ButtonDisplay display(u8g_font_fub49n);
+        display.begin();
+        BENCH("updateDisplay", 5, display.clearDisplay(); display.println("123"); display.flush());
+        // One page of a frame, the most a loop() pass spends on the display
+        BENCH("displayRefresh", 40, if (benchIteration % 8 == 0) { display.clearDisplay(); display.println("123"); display.updateDisplay(); } display.refresh());
+
+        // loop() with an orb connected, over enough time to include NFC polls
+        benchLoop(*this, counterOverhead);
+    }
+
+private:
+    uint32_t counterOverhead;
+};
+
+OrbDockBenchmark benchmark;
+
+static void runBenchmarks() {
+    benchmark.begin();
+    benchmark.run();
+}
+
+#endif
+
+void setup() {
+    Serial.begin(115200);
+    startCycleCounter();
+    runBenchmarks();
+    Serial.println(F("BENCH_DONE"));
+    Serial.flush();
+    // Sleeping with interrupts off ends the simavr run
+    cli();
+    sleep_enable();
+    sleep_cpu();
+}
+
+void loop() {
+}
+
+#endif
@@ -37,6 +37,14 @@ ButtonDisplay::ButtonDisplay(const uint8_t* font) : display(U8G_I2C_OPT_NONE), d
     defaultFont = font;
     textLines[0][0] = '\0';
     numLines = 0;
+    frameNumLines = 0;
+    frameInProgress = false;
+    redrawRequested = false;
+    requestMillis = 0;
+    frameMillis = 0;
+    buttonsRaw = 0;
+    buttonsRawMillis = 0;
+    buttonsDebounced = 0;
 }
 
 void ButtonDisplay::initButtons() {
@@ -74,6 +82,7 @@ void ButtonDisplay::initDisplay() {
         cursorY = 0;
         displayInitialized = true;
         numLines = 0;
+        textLines[0][0] = '\0';
         lastText[0] = '\0';
     }
 }
@@ -87,36 +96,73 @@ void ButtonDisplay::clearDisplay() {
     cursorX = 0;
     cursorY = 0;
     numLines = 0;  // Reset line counter
-    display.firstPage();
-    do {
-        // Empty draw - clears display
-    } while(display.nextPage());
+    textLines[0][0] = '\0';
+    needsUpdate = true;
 }
 
 void ButtonDisplay::updateDisplay() {
     if (needsUpdate) {
-        display.firstPage();
-        do {
-            // Calculate total height of all lines
-            uint8_t totalHeight = numLines * charHeight;
-            
-            // Calculate starting Y position to center vertically
-            uint8_t startY = (DISPLAY_HEIGHT - totalHeight) / 2;
-            uint8_t y = startY;
-            
-            // Draw all stored lines
-            for (uint8_t i = 0; i < numLines; i++) {
-                // Calculate width of text and center position horizontally
-                uint8_t strWidth = display.getStrWidth(textLines[i]);
-                uint8_t x = (DISPLAY_WIDTH - strWidth) / 2;
-                display.drawStr(x, y, textLines[i]);
-                y += charHeight;
-            }
-        } while(display.nextPage());
+        // Requests made before the frame starts are drawn by the same frame
+        if (!redrawRequested) {
+            redrawRequested = true;
+            requestMillis = millis();
+        }
         needsUpdate = false;
     }
 }
 
+void ButtonDisplay::refresh() {
+    if (!frameInProgress) {
+        if (!redrawRequested) {
+            return;
+        }
+        // Later changes go into the next frame
+        memcpy(frameLines, textLines, sizeof(frameLines));
+        frameNumLines = numLines;
+        if (numLines < MAX_LINES && textLines[numLines][0] != '\0') {
+            frameNumLines++;  // Line still being printed
+        }
+        redrawRequested = false;
+        frameInProgress = true;
+        display.firstPage();
+    }
+    drawPage();
+    if (!display.nextPage()) {
+        frameInProgress = false;
+        frameMillis = millis() - requestMillis;
+    }
+}
+
+void ButtonDisplay::flush() {
+    updateDisplay();
+    while (frameInProgress || redrawRequested) {
+        refresh();
+    }
+}
+
+uint16_t ButtonDisplay::getFrameMillis() {
+    return frameMillis;
+}
+
+// Draws the frame's lines into u8glib's buffer for the page being sent
+void ButtonDisplay::drawPage() {
+    // Calculate total height of all lines
+    uint8_t totalHeight = frameNumLines * charHeight;
+    
+    // Calculate starting Y position to center vertically
+    uint8_t startY = (DISPLAY_HEIGHT - totalHeight) / 2;
+    uint8_t y = startY;
+    
+    // Draw all stored lines
+    for (uint8_t i = 0; i < frameNumLines; i++) {
+        // Calculate width of text and center position horizontally
+        uint8_t strWidth = display.getStrWidth(frameLines[i]);
+        uint8_t x = (DISPLAY_WIDTH - strWidth) / 2;
+        display.drawStr(x, y, frameLines[i]);
+        y += charHeight;
+    }
+}
+
 void ButtonDisplay::setCursor(uint8_t x, uint8_t y) {
     if (x < DISPLAY_WIDTH) cursorX = x;  // Added bounds checking
     if (y < DISPLAY_HEIGHT) cursorY = y;     // Added bounds checking
@@ -126,7 +172,13 @@ void ButtonDisplay::print(const char* text) {
     // Store position and text for next update
     strncpy(lastText, text, sizeof(lastText)-1);
     lastText[sizeof(lastText)-1] = '\0';
-    display.drawStr(cursorX, cursorY, text);
+    // Appended to the line being printed - drawing only happens in refresh()
+    if (numLines < MAX_LINES) {
+        char* line = textLines[numLines];
+        size_t length = strlen(line);
+        strncpy(line + length, text, sizeof(textLines[0]) - 1 - length);
+        line[sizeof(textLines[0]) - 1] = '\0';
+    }
     cursorX += display.getStrWidth(text);
     needsUpdate = true;
 }
@@ -142,10 +194,12 @@ void ButtonDisplay::print(byte number) {
 }
 
 void ButtonDisplay::println(const char* text) {
-    if (text != nullptr && numLines < MAX_LINES) {
-        strncpy(textLines[numLines], text, sizeof(textLines[0])-1);
-        textLines[numLines][sizeof(textLines[0])-1] = '\0';
+    if (text != nullptr) {
+        print(text);
+    }
+    if (numLines < MAX_LINES && textLines[numLines][0] != '\0') {
         numLines++;
+        if (numLines < MAX_LINES) textLines[numLines][0] = '\0';
     }
     cursorX = 0;
     cursorY += charHeight;
@@ -175,20 +229,43 @@ bool ButtonDisplay::isButton4Pressed() {
     return !digitalRead(BTN4_PIN);
 }
 
-void ButtonDisplay::showMessage(const char* message, uint16_t duration) {
+uint8_t ButtonDisplay::getButtonPin(uint8_t button) {
+    const uint8_t pins[4] = {BTN1_PIN, BTN2_PIN, BTN3_PIN, BTN4_PIN};
+    return pins[(button - 1) & 3];
+}
+
+uint8_t ButtonDisplay::readPresses() {
+    uint8_t raw = isButton1Pressed() | isButton2Pressed() << 1 | isButton3Pressed() << 2 | isButton4Pressed() << 3;
+    unsigned long now = millis();
+    if (raw != buttonsRaw) {
+        buttonsRaw = raw;
+        buttonsRawMillis = now;
+        return 0;
+    }
+    if (now - buttonsRawMillis < BUTTON_DEBOUNCE_MS) {
+        return 0;
+    }
+    uint8_t presses = raw & ~buttonsDebounced;
+    buttonsDebounced = raw;
+    return presses;
+}
+
+uint8_t ButtonDisplay::getHeldButtons() {
+    return buttonsDebounced;
+}
+
+void ButtonDisplay::showMessage(const char* message) {
     clearDisplay();
     setCursor(0, 0);
     print(message);
-    updateDisplay();  // Add explicit update
-    if (duration > 0) {
-        delay(duration);
-    }
+    updateDisplay();
 }
 
 void ButtonDisplay::showError(const char* errorMessage) {
     clearDisplay();
     setCursor(0, 0);
     println(errorMessage);
+    updateDisplay();
 }
 
 U8GLIB_SSD1306_128X64* ButtonDisplay::getDisplay() {
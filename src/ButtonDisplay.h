@@ -13,7 +13,13 @@
 #define BTN2_PIN 9
 #define BTN3_PIN 10
 #define BTN4_PIN 11
+#define BUTTON_DEBOUNCE_MS 30
+#define ERROR_DISPLAY_MS 2000   // How long the stations leave an error on the display
 
+// Redraws are time-sliced: updateDisplay() only requests a frame, and refresh(), called
+// once per loop() pass, draws and sends one of the display's 8 pages. Text changed while a
+// frame is being sent goes into the next frame, so a loop() pass never waits for more
+// than one page on the I2C bus.
 class ButtonDisplay {
 private:
     U8GLIB_SSD1306_128X64 display;
@@ -25,18 +31,39 @@ private:
     bool needsUpdate;
     char lastText[16];
     const uint8_t* defaultFont;
-    static const int MAX_LINES = 8;  // Maximum number of lines to store
+    static const int MAX_LINES = 4;  // Maximum number of lines to store - 3 fit in the 17 px font
     char textLines[MAX_LINES][16];
     uint8_t numLines;
 
+    // The frame being sent, copied from textLines when it starts
+    char frameLines[MAX_LINES][16];
+    uint8_t frameNumLines;
+    bool frameInProgress;
+    bool redrawRequested;
+    unsigned long requestMillis;
+    uint16_t frameMillis;
+
+    // Button states, bit 0 for button 1
+    uint8_t buttonsRaw;
+    unsigned long buttonsRawMillis;
+    uint8_t buttonsDebounced;
+
     void initButtons();
     void initDisplay();
+    void drawPage();
 
 public:
     ButtonDisplay(const uint8_t* font);
     void begin();
     void clearDisplay();
+    // Requests a frame with the current text, drawn by the following refresh() calls
     void updateDisplay();
+    // Sends the next page of the frame in progress; call once per loop() pass
+    void refresh();
+    // Sends the rest of the frame in progress and any requested one, blocking
+    void flush();
+    // Milliseconds from the last completed frame's request to its last page
+    uint16_t getFrameMillis();
     void setCursor(uint8_t x, uint8_t y);
     void print(const char* text);
     void print(int number);
@@ -47,7 +74,16 @@ public:
     bool isButton2Pressed();
     bool isButton3Pressed();
     bool isButton4Pressed();
-    void showMessage(const char* message, uint16_t duration = 2000);
+    // Buttons pressed since the last call, bit 0 for button 1. A press counts once the
+    // button has read pressed for BUTTON_DEBOUNCE_MS, and once however long it is held
+    uint8_t readPresses();
+    // Buttons held down as of the last readPresses(), debounced, bit 0 for button 1
+    uint8_t getHeldButtons();
+    // Pin of a button, from 1 - for waking an idle dock (OrbDockCore::wakeOnPin)
+    uint8_t getButtonPin(uint8_t button);
+    // Replace the text and request a frame, sent by refresh() like any other; it's up to
+    // the station how long the text stays (ERROR_DISPLAY_MS for errors)
+    void showMessage(const char* message);
     void showError(const char* errorMessage);
     U8GLIB_SSD1306_128X64* getDisplay();
 };
@@ -0,0 +1,29 @@
+/**
+ * CRC-16/CCITT (polynomial 0x1021), for checking frames sent over serial
+ *
+ * No Arduino dependencies, so the host tools in tools/ can use it too.
+ */
+
+#ifndef CRC16_H
+#define CRC16_H
+
+#include <stdint.h>
+
+#define CRC16_INIT 0xFFFF
+
+inline uint16_t crc16Update(uint16_t crc, uint8_t data) {
+    crc ^= (uint16_t)data << 8;
+    for (uint8_t i = 0; i < 8; i++) {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+inline uint16_t crc16(const uint8_t* data, uint16_t length, uint16_t crc = CRC16_INIT) {
+    for (uint16_t i = 0; i < length; i++) {
+        crc = crc16Update(crc, data[i]);
+    }
+    return crc;
+}
+
+#endif
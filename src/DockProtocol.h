@@ -0,0 +1,136 @@
+/**
+ * Dock <-> gateway serial protocol
+ *
+ * OrbDockComms docks send event frames to a gateway (tools/orb-gateway) over USB
+ * serial, and take command frames back. Frames share the serial port with the
+ * dock's debug text, so each starts with a 4 character magic and ends with a CRC.
+ *
+ * Frame: magic, type, seq, payload length, payload, CRC-16 of type to payload
+ * (low byte first). Events use DOCK_EVENT_MAGIC, commands DOCK_COMMAND_MAGIC.
+ * Replies (PONG, RESULT) carry the seq of the command they answer.
+ *
+ * Orb events go through the dock's EEPROM journal (EventJournal.h) and are sent as
+ * JOURNAL frames, which the gateway acknowledges with JOURNAL_ACK. Each frame names the
+ * record sent before it (prev), or the record itself when the dock starts again from
+ * the first one not acknowledged. The gateway takes a record only if it has prev, or it
+ * starts a resend, so a lost frame holds it back until the dock sends it again. Gaps in
+ * the journal (records broken by a power cut, or overwritten) don't. The ORB_* and
+ * ENERGY frames are still understood, but docks no longer send them.
+ *
+ * No Arduino dependencies, so the gateway and its load test use it too.
+ */
+
+#ifndef DOCK_PROTOCOL_H
+#define DOCK_PROTOCOL_H
+
+#include <stdint.h>
+#include <string.h>
+#include "Crc16.h"
+
+#define DOCK_EVENT_MAGIC "ORBE"
+#define DOCK_COMMAND_MAGIC "ORBC"
+#define DOCK_MAX_PAYLOAD 24
+#define DOCK_FRAME_OVERHEAD 9   // Magic, type, seq, length and CRC
+#define DOCK_MAX_FRAME (DOCK_FRAME_OVERHEAD + DOCK_MAX_PAYLOAD)
+#define DOCK_UID_LENGTH 7
+#define DOCK_JOURNAL_PAYLOAD 22 // See DOCK_EVENT_JOURNAL
+
+// Dock -> gateway
+enum DockEvent {
+    DOCK_EVENT_HELLO = 1,          // station id - sent on boot
+    DOCK_EVENT_ORB_CONNECTED,      // uid[7], trait, energy, visited stations bitmask (16 bits)
+    DOCK_EVENT_ORB_DISCONNECTED,   // uid[7]
+    DOCK_EVENT_ENERGY,             // uid[7], energy
+    DOCK_EVENT_PONG,               // no payload
+    DOCK_EVENT_RESULT,             // status (STATUS_* from OrbDock.h)
+    DOCK_EVENT_JOURNAL             // journal record (EventJournal.h, JOURNAL_RECORD_DATA bytes), prev (16 bits),
+                                   // the dock's boot and seconds (16 bits) now
+};
+
+// Gateway -> dock
+enum DockCommand {
+    DOCK_COMMAND_PING = 1,         // no payload
+    DOCK_COMMAND_SET_ENERGY,       // energy - written to the connected orb, answered with a RESULT
+    DOCK_COMMAND_SET_TRAIT,        // trait - written to the connected orb, answered with a RESULT
+    DOCK_COMMAND_JOURNAL_ACK       // seq (16 bits) - every journal record up to it is stored, not answered
+};
+
+// Fills out with a frame, returns its length
+inline uint8_t dockFrameEncode(const char* magic, uint8_t type, uint8_t seq, const uint8_t* payload, uint8_t length, uint8_t* out) {
+    memcpy(out, magic, 4);
+    out[4] = type;
+    out[5] = seq;
+    out[6] = length;
+    if (length > 0) {
+        memcpy(out + 7, payload, length);
+    }
+    uint16_t crc = crc16(out + 4, 3 + length);
+    out[7 + length] = crc & 0xFF;
+    out[8 + length] = crc >> 8;
+    return DOCK_FRAME_OVERHEAD + length;
+}
+
+enum DockParseResult {
+    DOCK_PARSE_IDLE,    // Byte isn't part of a frame
+    DOCK_PARSE_BUSY,    // Byte taken, frame not complete yet
+    DOCK_PARSE_FRAME    // Frame complete, type/seq/length/payload are valid until the next byte
+};
+
+// Byte-at-a-time frame parser, so frames can be picked out of other serial output
+struct DockFrameParser {
+    const char* magic;
+    uint8_t position;   // Bytes of the current frame received so far
+    uint8_t type;
+    uint8_t seq;
+    uint8_t length;
+    uint8_t payload[DOCK_MAX_PAYLOAD];
+    uint16_t crc;
+};
+
+inline void dockParserInit(DockFrameParser& parser, const char* magic) {
+    parser.magic = magic;
+    parser.position = 0;
+}
+
+inline DockParseResult dockParserFeed(DockFrameParser& parser, uint8_t byte) {
+    uint8_t position = parser.position;
+    if (position < 4) {
+        if (byte == (uint8_t)parser.magic[position]) {
+            parser.position++;
+            return DOCK_PARSE_BUSY;
+        }
+        // A mismatch drops the partial magic, but the byte may start a new one
+        parser.position = (byte == (uint8_t)parser.magic[0]) ? 1 : 0;
+        return parser.position ? DOCK_PARSE_BUSY : DOCK_PARSE_IDLE;
+    }
+    parser.position++;
+    if (position == 4) {
+        parser.type = byte;
+        parser.crc = crc16Update(CRC16_INIT, byte);
+    } else if (position == 5) {
+        parser.seq = byte;
+        parser.crc = crc16Update(parser.crc, byte);
+    } else if (position == 6) {
+        if (byte > DOCK_MAX_PAYLOAD) {
+            parser.position = 0;
+            return DOCK_PARSE_IDLE;
+        }
+        parser.length = byte;
+        parser.crc = crc16Update(parser.crc, byte);
+    } else if (position < 7 + parser.length) {
+        parser.payload[position - 7] = byte;
+        parser.crc = crc16Update(parser.crc, byte);
+    } else if (position == 7 + parser.length) {
+        if (byte != (parser.crc & 0xFF)) {
+            parser.position = 0;
+        }
+    } else {
+        parser.position = 0;
+        if (byte == (parser.crc >> 8)) {
+            return DOCK_PARSE_FRAME;
+        }
+    }
+    return DOCK_PARSE_BUSY;
+}
+
+#endif
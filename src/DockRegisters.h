@@ -0,0 +1,179 @@
+/**
+ * Dock I2C register map
+ *
+ * An OrbDockComms built with COMMS_I2C_ADDRESS is an I2C target instead of driving its
+ * three PWM pins, so one controller can poll many docks on a shared bus. The controller
+ * writes a register number, then reads from it onwards (one transaction each, or a write
+ * and a repeated start). Reads start at the register last written, the map doesn't
+ * advance between transactions.
+ *
+ * Whenever something in the map changes, the dock sets a bit in DOCK_REG_CHANGES and
+ * pulls its data-ready line low (open drain, so the lines of several docks can be wired
+ * together). A read that starts at DOCK_REG_CHANGES clears the bits and releases the
+ * line, so a controller that reads DOCK_READ_EVENT bytes from there on each falling edge
+ * gets every change with one transaction.
+ *
+ * Commands: write the command and its argument to DOCK_REG_COMMAND in one transaction.
+ * DOCK_REG_RESULT reads DOCK_RESULT_PENDING until the dock has run it (an NFC write, in
+ * loop() rather than in the interrupt), then the STATUS_* of OrbDock.h, with
+ * DOCK_CHANGED_RESULT set.
+ *
+ * Multi-byte registers are little endian. The dock updates the map with interrupts off,
+ * and the interrupt side answers from it in one go, so a read never sees half an update.
+ *
+ * No Arduino dependencies, so the host tools in tools/ can use it too.
+ */
+
+#ifndef DOCK_REGISTERS_H
+#define DOCK_REGISTERS_H
+
+#include <stdint.h>
+#include <string.h>
+#include "DockProtocol.h"
+
+#define DOCK_REGISTERS_ID 0x0B          // DOCK_REG_ID, tells a dock from other targets on the bus
+#define DOCK_REGISTERS_VERSION 2
+#define DOCK_I2C_BUFFER 32              // Bytes the AVR Wire library moves per transaction
+#define DOCK_RESULT_PENDING 0xFF
+#define DOCK_RESULT_NONE 0xFE           // No command since boot
+
+enum DockRegister {
+    DOCK_REG_ID,                        // DOCK_REGISTERS_ID
+    DOCK_REG_VERSION,                   // DOCK_REGISTERS_VERSION
+    DOCK_REG_STATION,                   // StationId
+    DOCK_REG_CHANGES,                   // DOCK_CHANGED_* since the last read from here, cleared by it
+    DOCK_REG_STATUS,                    // DOCK_STATUS_*
+    DOCK_REG_UID,                       // 7 bytes, of the orb on the dock or the last one
+    DOCK_REG_TRAIT = DOCK_REG_UID + DOCK_UID_LENGTH,
+    DOCK_REG_ENERGY,
+    DOCK_REG_VISITED,                   // 16 bit mask of the stations the orb has visited
+    DOCK_REG_NFC_ERRORS = DOCK_REG_VISITED + 2,     // 16 bit NFC failure counts since boot (see RetryPolicy.h)
+    DOCK_REG_NFC_WRONG_LENGTHS = DOCK_REG_NFC_ERRORS + 2,
+    DOCK_REG_NFC_WEDGES = DOCK_REG_NFC_WRONG_LENGTHS + 2,   // PN532 wedges since boot (see NFCHealth.h)
+    DOCK_REG_COMMAND,                   // Writable: DockCommand
+    DOCK_REG_ARGUMENT,                  // Writable
+    DOCK_REG_RESULT,                    // STATUS_* of the last command, DOCK_RESULT_PENDING or DOCK_RESULT_NONE
+    DOCK_REGISTERS
+};
+
+// The read a controller does on data-ready: DOCK_REG_CHANGES up to the counters
+#define DOCK_READ_EVENT (DOCK_REG_NFC_ERRORS - DOCK_REG_CHANGES)
+
+// DOCK_REG_CHANGES
+#define DOCK_CHANGED_ORB    (1 << 0)    // Orb placed or lifted: status, UID, trait, energy and visited are new
+#define DOCK_CHANGED_ENERGY (1 << 1)
+#define DOCK_CHANGED_TRAIT  (1 << 2)
+#define DOCK_CHANGED_STATUS (1 << 3)    // A DOCK_STATUS_* other than DOCK_STATUS_ORB
+#define DOCK_CHANGED_RESULT (1 << 4)    // A command finished
+
+// DOCK_REG_STATUS
+#define DOCK_STATUS_ORB          (1 << 0)
+#define DOCK_STATUS_UNFORMATTED  (1 << 1)   // A tag that isn't an orb is on the dock
+#define DOCK_STATUS_READER_FAULT (1 << 2)   // The PN532 isn't answering, the dock is recovering it
+
+struct DockRegisterMap {
+    uint8_t bytes[DOCK_REGISTERS];
+    uint8_t pointer;            // Register the next read starts at
+    bool commandPending;        // Written by the controller, not run yet
+};
+
+inline void dockRegistersInit(DockRegisterMap& map, uint8_t station) {
+    memset(map.bytes, 0, sizeof(map.bytes));
+    map.bytes[DOCK_REG_ID] = DOCK_REGISTERS_ID;
+    map.bytes[DOCK_REG_VERSION] = DOCK_REGISTERS_VERSION;
+    map.bytes[DOCK_REG_STATION] = station;
+    map.bytes[DOCK_REG_RESULT] = DOCK_RESULT_NONE;
+    map.pointer = DOCK_REG_CHANGES;
+    map.commandPending = false;
+}
+
+inline void dockRegistersPut16(DockRegisterMap& map, uint8_t reg, uint16_t value) {
+    map.bytes[reg] = value & 0xFF;
+    map.bytes[reg + 1] = value >> 8;
+}
+
+inline uint16_t dockRegistersGet16(const uint8_t* bytes, uint8_t reg) {
+    return bytes[reg] | (bytes[reg + 1] << 8);
+}
+
+// Whether the data-ready line should be pulled low
+inline bool dockRegistersDataReady(const DockRegisterMap& map) {
+    return map.bytes[DOCK_REG_CHANGES] != 0;
+}
+
+// Dock side: the orb placed (present) or lifted
+inline void dockRegistersSetOrb(DockRegisterMap& map, bool present, const uint8_t* uid, uint8_t trait, uint8_t energy, uint16_t visited) {
+    map.bytes[DOCK_REG_STATUS] = present
+        ? map.bytes[DOCK_REG_STATUS] | DOCK_STATUS_ORB
+        : map.bytes[DOCK_REG_STATUS] & ~DOCK_STATUS_ORB;
+    memcpy(map.bytes + DOCK_REG_UID, uid, DOCK_UID_LENGTH);
+    map.bytes[DOCK_REG_TRAIT] = present ? trait : 0;
+    map.bytes[DOCK_REG_ENERGY] = present ? energy : 0;
+    dockRegistersPut16(map, DOCK_REG_VISITED, present ? visited : 0);
+    map.bytes[DOCK_REG_CHANGES] |= DOCK_CHANGED_ORB;
+}
+
+// Dock side: a register changed, with the DOCK_CHANGED_* bit it raises
+inline void dockRegistersSet(DockRegisterMap& map, uint8_t reg, uint8_t value, uint8_t change) {
+    if (map.bytes[reg] != value) {
+        map.bytes[reg] = value;
+        map.bytes[DOCK_REG_CHANGES] |= change;
+    }
+}
+
+// Dock side: the command taken off the map, false if there is none
+inline bool dockRegistersTakeCommand(DockRegisterMap& map, uint8_t& command, uint8_t& argument) {
+    if (!map.commandPending) {
+        return false;
+    }
+    map.commandPending = false;
+    command = map.bytes[DOCK_REG_COMMAND];
+    argument = map.bytes[DOCK_REG_ARGUMENT];
+    return true;
+}
+
+inline void dockRegistersCommandDone(DockRegisterMap& map, uint8_t status) {
+    map.bytes[DOCK_REG_RESULT] = status;
+    map.bytes[DOCK_REG_CHANGES] |= DOCK_CHANGED_RESULT;
+}
+
+// Target side, a write transaction: the register, then bytes for the writable registers
+// from there on. Returns true if it wrote a command
+inline bool dockRegistersReceive(DockRegisterMap& map, const uint8_t* data, uint8_t length) {
+    if (length == 0 || data[0] >= DOCK_REGISTERS) {
+        return false;
+    }
+    map.pointer = data[0];
+    bool command = false;
+    for (uint8_t i = 1; i < length; i++) {
+        uint8_t reg = map.pointer + i - 1;
+        if (reg == DOCK_REG_COMMAND) {
+            command = true;
+        } else if (reg != DOCK_REG_ARGUMENT) {
+            continue;
+        }
+        map.bytes[reg] = data[i];
+    }
+    // A command written while the last one is still pending replaces it
+    if (command) {
+        map.bytes[DOCK_REG_RESULT] = DOCK_RESULT_PENDING;
+        map.commandPending = true;
+    }
+    return command;
+}
+
+// Target side, a read transaction: fills out with the registers from the pointer on,
+// returns how many. The controller may take fewer
+inline uint8_t dockRegistersRequest(DockRegisterMap& map, uint8_t* out) {
+    uint8_t length = DOCK_REGISTERS - map.pointer;
+    if (length > DOCK_I2C_BUFFER) {
+        length = DOCK_I2C_BUFFER;
+    }
+    memcpy(out, map.bytes + map.pointer, length);
+    if (map.pointer == DOCK_REG_CHANGES) {
+        map.bytes[DOCK_REG_CHANGES] = 0;
+    }
+    return length;
+}
+
+#endif
@@ -0,0 +1,66 @@
+/**
+ * Wear-leveled energy record
+ *
+ * Energy is written round-robin into ENERGY_RING_SLOTS spare user pages instead of
+ * rewriting a single page, so each page takes 1/ENERGY_RING_SLOTS of the writes.
+ *
+ * Each page holds one record:
+ *  byte 0: energy
+ *  byte 1: sequence number, incremented on every write (wraps at 255)
+ *  byte 2: check byte (energy ^ seq ^ ENERGY_RECORD_CHECK)
+ *  byte 3: ENERGY_RECORD_MARKER
+ *
+ * The newest record is the valid one with the highest sequence number (modulo 256).
+ * A torn or failed write leaves an invalid record, so the previous value is used.
+ *
+ * No Arduino dependencies, so the host tools in tools/ can use it too.
+ */
+
+#ifndef ENERGY_RING_H
+#define ENERGY_RING_H
+
+#include <stdint.h>
+
+#define ENERGY_RING_SLOTS 8    // Ring size on an NTAG213, bigger tags get more (see TAG_LAYOUTS)
+#define ENERGY_RECORD_MARKER 'E'
+#define ENERGY_RECORD_CHECK 0x5A
+
+// Fills a 4 byte page with an energy record
+inline void energyRingEncode(uint8_t* page, uint8_t energy, uint8_t seq) {
+    page[0] = energy;
+    page[1] = seq;
+    page[2] = energy ^ seq ^ ENERGY_RECORD_CHECK;
+    page[3] = ENERGY_RECORD_MARKER;
+}
+
+inline bool energyRingIsValid(const uint8_t* page) {
+    return page[3] == ENERGY_RECORD_MARKER &&
+        page[2] == (uint8_t)(page[0] ^ page[1] ^ ENERGY_RECORD_CHECK);
+}
+
+// Whether sequence number seq was written after than. Sequence numbers in the ring are
+// never more than the ring size apart, so they are compared modulo 256
+inline bool energyRingIsNewer(uint8_t seq, uint8_t than) {
+    uint8_t ahead = seq - than;
+    return ahead > 0 && ahead < 128;
+}
+
+// Returns the slot of the newest valid record in the ring pages, or -1 if there is none
+inline int8_t energyRingFindNewest(const uint8_t* pages, uint8_t slots) {
+    int8_t newest = -1;
+    for (uint8_t i = 0; i < slots; i++) {
+        const uint8_t* page = pages + i * 4;
+        if (!energyRingIsValid(page)) continue;
+        if (newest < 0 || energyRingIsNewer(page[1], pages[newest * 4 + 1])) {
+            newest = i;
+        }
+    }
+    return newest;
+}
+
+// Slot the next record goes in, given the newest slot (or -1 for an empty ring)
+inline uint8_t energyRingNextSlot(int8_t newest, uint8_t slots) {
+    return newest < 0 ? 0 : (newest + 1) % slots;
+}
+
+#endif
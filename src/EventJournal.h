@@ -0,0 +1,262 @@
+/**
+ * Store-and-forward event journal in EEPROM
+ *
+ * OrbDockComms records every orb connect, energy change, disconnect and error here before
+ * it is sent, so nothing is lost while the gateway is away or misses frames. The journal
+ * is a ring of JOURNAL_RECORDS fixed size records, each with its own CRC. Uploaded
+ * records stay until the gateway acknowledges them, and are then overwritten by new ones.
+ * When the ring is full of records that were never acknowledged, the oldest goes and
+ * is counted in overwritten.
+ *
+ * Wear is spread over the ring. The write position isn't stored anywhere: after a
+ * reset journalBegin() finds it from the sequence numbers of the records, like
+ * EnergyRing.h does for tags. The acknowledged sequence number goes round-robin into
+ * JOURNAL_ACK_SLOTS small records, and only every JOURNAL_ACK_PERSIST records. So each
+ * EEPROM cell is written about once per JOURNAL_RECORDS events.
+ *
+ * A power cut in the middle of a write leaves a record that fails its CRC. It is
+ * skipped, and only the event being written is lost. A cut before an acknowledgement
+ * was persisted means up to JOURNAL_ACK_PERSIST records are uploaded again. Delivery is
+ * at least once, and the gateway drops duplicates by sequence number.
+ *
+ * journalUpload() is the gateway's side of the upload (see DOCK_EVENT_JOURNAL).
+ *
+ * The functions take the EEPROM as a template parameter: anything with
+ * read(address) and update(address, value), such as Arduino's EEPROM or the fakes of the
+ * host tools.
+ *
+ * No Arduino dependencies, so the host tools in tools/ can use it too.
+ */
+
+#ifndef EVENT_JOURNAL_H
+#define EVENT_JOURNAL_H
+
+#include <stdint.h>
+#include <string.h>
+#include "Crc16.h"
+
+#ifndef JOURNAL_EEPROM_START
+#define JOURNAL_EEPROM_START 0
+#endif
+#ifndef JOURNAL_EEPROM_SIZE
+#define JOURNAL_EEPROM_SIZE 1024    // All of an ATmega328's
+#endif
+#define JOURNAL_ACK_SLOTS 8
+#define JOURNAL_ACK_SIZE 4          // Sequence number and CRC
+#define JOURNAL_ACK_PERSIST 8       // Acknowledged records between two writes of the acknowledgement
+#define JOURNAL_RECORD_DATA 17      // A record without its CRC, as uploaded
+#define JOURNAL_RECORD_SIZE (JOURNAL_RECORD_DATA + 2)
+#define JOURNAL_RECORDS ((JOURNAL_EEPROM_SIZE - JOURNAL_ACK_SLOTS * JOURNAL_ACK_SIZE) / JOURNAL_RECORD_SIZE)
+#define JOURNAL_RECORDS_START (JOURNAL_EEPROM_START + JOURNAL_ACK_SLOTS * JOURNAL_ACK_SIZE)
+#define JOURNAL_DETAIL 10
+#define JOURNAL_CRC_INIT 0x4A52     // Not CRC16_INIT, so nothing else in the EEPROM passes for a record
+
+// One event. Stored little endian, in this order
+struct JournalRecord {
+    uint16_t seq;
+    uint8_t type;               // EventType (EventQueue.h)
+    uint8_t value;              // Energy
+    uint8_t boot;               // Resets since the journal was started, wraps
+    uint16_t seconds;           // Since that reset, wraps after 18 hours
+    // Orb events: UID (7 bytes), trait, visited stations mask (16 bits). Errors: the
+    // message's first JOURNAL_DETAIL - 1 characters, NUL terminated
+    uint8_t detail[JOURNAL_DETAIL];
+};
+
+struct EventJournal {
+    uint16_t nextSeq;           // Of the next record
+    uint8_t nextSlot;           // Where it goes
+    uint16_t acked;             // Every record up to this one is acknowledged
+    uint16_t persistedAck;      // The newest acknowledgement in the EEPROM
+    uint8_t nextAckSlot;
+    uint8_t boot;
+    uint16_t overwritten;       // Records overwritten before they were acknowledged, since the reset
+};
+
+inline void journalEncode(const JournalRecord& record, uint8_t* data) {
+    data[0] = record.seq & 0xFF;
+    data[1] = record.seq >> 8;
+    data[2] = record.type;
+    data[3] = record.value;
+    data[4] = record.boot;
+    data[5] = record.seconds & 0xFF;
+    data[6] = record.seconds >> 8;
+    memcpy(data + 7, record.detail, JOURNAL_DETAIL);
+}
+
+inline void journalDecode(const uint8_t* data, JournalRecord& record) {
+    record.seq = data[0] | (data[1] << 8);
+    record.type = data[2];
+    record.value = data[3];
+    record.boot = data[4];
+    record.seconds = data[5] | (data[6] << 8);
+    memcpy(record.detail, data + 7, JOURNAL_DETAIL);
+}
+
+// Whether seq was written after than, for sequence numbers less than 32768 apart
+inline bool journalIsNewer(uint16_t seq, uint16_t than) {
+    uint16_t ahead = seq - than;
+    return ahead > 0 && ahead < 0x8000;
+}
+
+// Records not acknowledged yet, including broken and overwritten ones
+inline uint16_t journalPending(const EventJournal& journal) {
+    return (uint16_t)(journal.nextSeq - 1 - journal.acked);
+}
+
+template <class Storage>
+bool journalReadSlot(Storage& storage, uint8_t slot, JournalRecord& record) {
+    uint8_t data[JOURNAL_RECORD_SIZE];
+    int address = JOURNAL_RECORDS_START + slot * JOURNAL_RECORD_SIZE;
+    for (uint8_t i = 0; i < JOURNAL_RECORD_SIZE; i++) {
+        data[i] = storage.read(address + i);
+    }
+    uint16_t crc = crc16(data, JOURNAL_RECORD_DATA, JOURNAL_CRC_INIT);
+    if (data[JOURNAL_RECORD_DATA] != (crc & 0xFF) || data[JOURNAL_RECORD_DATA + 1] != (crc >> 8)) {
+        return false;
+    }
+    journalDecode(data, record);
+    return true;
+}
+
+template <class Storage>
+bool journalReadAck(Storage& storage, uint8_t slot, uint16_t& seq) {
+    int address = JOURNAL_EEPROM_START + slot * JOURNAL_ACK_SIZE;
+    uint8_t data[JOURNAL_ACK_SIZE];
+    for (uint8_t i = 0; i < JOURNAL_ACK_SIZE; i++) {
+        data[i] = storage.read(address + i);
+    }
+    uint16_t crc = crc16(data, 2, JOURNAL_CRC_INIT);
+    if (data[2] != (crc & 0xFF) || data[3] != (crc >> 8)) {
+        return false;
+    }
+    seq = data[0] | (data[1] << 8);
+    return true;
+}
+
+// Finds the write position and the acknowledgement after a reset
+template <class Storage>
+void journalBegin(EventJournal& journal, Storage& storage) {
+    JournalRecord record;
+    bool found = false;
+    uint16_t newest = 0;
+    uint8_t newestSlot = 0;
+    uint8_t boot = 0;
+    for (uint8_t slot = 0; slot < JOURNAL_RECORDS; slot++) {
+        if (journalReadSlot(storage, slot, record) && (!found || journalIsNewer(record.seq, newest))) {
+            found = true;
+            newest = record.seq;
+            newestSlot = slot;
+            boot = record.boot;
+        }
+    }
+    // The oldest record of the ring, older ones are left over from before a wrap
+    uint16_t oldest = newest;
+    for (uint8_t slot = 0; found && slot < JOURNAL_RECORDS; slot++) {
+        if (journalReadSlot(storage, slot, record) && (uint16_t)(newest - record.seq) < JOURNAL_RECORDS &&
+            journalIsNewer(oldest, record.seq)) {
+            oldest = record.seq;
+        }
+    }
+    journal.nextSeq = found ? newest + 1 : 1;
+    journal.nextSlot = found ? (newestSlot + 1) % JOURNAL_RECORDS : 0;
+    journal.boot = found ? boot + 1 : 0;
+    journal.overwritten = 0;
+
+    // Nothing acknowledged, unless an acknowledgement of one of the records is found
+    journal.acked = found ? oldest - 1 : 0;
+    journal.persistedAck = journal.acked;
+    journal.nextAckSlot = 0;
+    bool foundAck = false;
+    uint16_t ack = 0;
+    for (uint8_t slot = 0; slot < JOURNAL_ACK_SLOTS; slot++) {
+        uint16_t seq;
+        if (journalReadAck(storage, slot, seq) && (!foundAck || journalIsNewer(seq, ack))) {
+            foundAck = true;
+            ack = seq;
+            journal.nextAckSlot = (slot + 1) % JOURNAL_ACK_SLOTS;
+        }
+    }
+    if (foundAck && !journalIsNewer(journal.acked, ack) && !journalIsNewer(ack, journal.nextSeq - 1)) {
+        journal.acked = ack;
+        journal.persistedAck = ack;
+    }
+}
+
+template <class Storage>
+void journalAppend(EventJournal& journal, Storage& storage, JournalRecord& record) {
+    // Full: the oldest record goes, counted if it wasn't acknowledged
+    if (journalPending(journal) >= JOURNAL_RECORDS) {
+        journal.acked++;
+        journal.overwritten++;
+    }
+    record.seq = journal.nextSeq;
+    record.boot = journal.boot;
+    uint8_t data[JOURNAL_RECORD_SIZE];
+    journalEncode(record, data);
+    uint16_t crc = crc16(data, JOURNAL_RECORD_DATA, JOURNAL_CRC_INIT);
+    data[JOURNAL_RECORD_DATA] = crc & 0xFF;
+    data[JOURNAL_RECORD_DATA + 1] = crc >> 8;
+    int address = JOURNAL_RECORDS_START + journal.nextSlot * JOURNAL_RECORD_SIZE;
+    for (uint8_t i = 0; i < JOURNAL_RECORD_SIZE; i++) {
+        storage.update(address + i, data[i]);
+    }
+    journal.nextSeq++;
+    journal.nextSlot = (journal.nextSlot + 1) % JOURNAL_RECORDS;
+}
+
+// The record with sequence number seq, which must be pending. False if a power cut broke it
+template <class Storage>
+bool journalRead(const EventJournal& journal, Storage& storage, uint16_t seq, JournalRecord& record) {
+    uint16_t back = journal.nextSeq - seq;
+    uint8_t slot = (journal.nextSlot + JOURNAL_RECORDS - back) % JOURNAL_RECORDS;
+    return journalReadSlot(storage, slot, record) && record.seq == seq;
+}
+
+// The gateway has every record up to seq. Returns false if seq isn't a pending record
+template <class Storage>
+bool journalAck(EventJournal& journal, Storage& storage, uint16_t seq) {
+    if (!journalIsNewer(seq, journal.acked) || journalIsNewer(seq, journal.nextSeq - 1)) {
+        return false;
+    }
+    journal.acked = seq;
+    if ((uint16_t)(journal.acked - journal.persistedAck) < JOURNAL_ACK_PERSIST) {
+        return true;
+    }
+    uint8_t data[JOURNAL_ACK_SIZE] = {(uint8_t)(seq & 0xFF), (uint8_t)(seq >> 8)};
+    uint16_t crc = crc16(data, 2, JOURNAL_CRC_INIT);
+    data[2] = crc & 0xFF;
+    data[3] = crc >> 8;
+    int address = JOURNAL_EEPROM_START + journal.nextAckSlot * JOURNAL_ACK_SIZE;
+    for (uint8_t i = 0; i < JOURNAL_ACK_SIZE; i++) {
+        storage.update(address + i, data[i]);
+    }
+    journal.persistedAck = seq;
+    journal.nextAckSlot = (journal.nextAckSlot + 1) % JOURNAL_ACK_SLOTS;
+    return true;
+}
+
+// Gateway side: what to do with a record uploaded with prev (see DOCK_EVENT_JOURNAL),
+// when every record of the dock up to acked is handled (known: since the gateway started)
+enum JournalUpload {
+    JOURNAL_UPLOAD_NEXT,        // Handle it, it's acknowledged now
+    JOURNAL_UPLOAD_DUPLICATE,   // Handled before, acknowledge again
+    JOURNAL_UPLOAD_HELD_BACK    // A record before it was lost on the way, wait for the resend
+};
+
+inline JournalUpload journalUpload(bool known, uint16_t acked, uint16_t seq, uint16_t prev) {
+    if (!known) {
+        return JOURNAL_UPLOAD_NEXT;
+    }
+    // Far older ones are a dock with a new journal
+    if ((uint16_t)(acked - seq) < JOURNAL_RECORDS) {
+        return JOURNAL_UPLOAD_DUPLICATE;
+    }
+    // A resend starts with the first record the dock has that isn't acknowledged
+    if (prev == seq || !journalIsNewer(prev, acked)) {
+        return JOURNAL_UPLOAD_NEXT;
+    }
+    return JOURNAL_UPLOAD_HELD_BACK;
+}
+
+#endif
@@ -0,0 +1,142 @@
+/**
+ * Dock event queue
+ *
+ * The NFC session and the stations don't call the station's callbacks (onOrbConnected()
+ * and the rest) where things happen any more: they post an event to a fixed ring of
+ * EVENT_QUEUE_SIZE events, and OrbDock::loop() hands the queued events to every
+ * subscriber at the end of the pass, after the NFC polling. The station is always the
+ * first subscriber; others (a logger, a display, a link to another board) subscribe
+ * with a function and a context pointer, up to EVENT_SUBSCRIBERS in all. Nothing is
+ * allocated.
+ *
+ * Every handler call is timed, so the `s` command can show which subscriber holds up
+ * loop(). A full queue drops the new event and counts it.
+ *
+ * No Arduino dependencies, so the host tools in tools/ can use it too.
+ */
+
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include <stdint.h>
+#include "OrbRegistry.h"     // PROGMEM and registryName()
+
+#ifndef EVENT_QUEUE_SIZE
+#define EVENT_QUEUE_SIZE 8
+#endif
+#ifndef EVENT_SUBSCRIBERS
+#define EVENT_SUBSCRIBERS 3
+#endif
+
+enum EventType {
+    EVENT_ORB_CONNECTED,
+    EVENT_ORB_DISCONNECTED,
+    EVENT_UNFORMATTED_NFC,
+    EVENT_ENERGY_CHANGED,       // value: the new energy
+    EVENT_ERROR,                // message
+    EVENT_BUTTON,               // value: the button pressed, from 1
+    EVENT_TYPES
+};
+
+const char EVENT_NAME_ORB_CONNECTED[] PROGMEM = "orb connected";
+const char EVENT_NAME_ORB_DISCONNECTED[] PROGMEM = "orb disconnected";
+const char EVENT_NAME_UNFORMATTED_NFC[] PROGMEM = "unformatted NFC";
+const char EVENT_NAME_ENERGY_CHANGED[] PROGMEM = "energy changed";
+const char EVENT_NAME_ERROR[] PROGMEM = "error";
+const char EVENT_NAME_BUTTON[] PROGMEM = "button";
+const char* const EVENT_NAMES[] PROGMEM = {
+    EVENT_NAME_ORB_CONNECTED, EVENT_NAME_ORB_DISCONNECTED, EVENT_NAME_UNFORMATTED_NFC,
+    EVENT_NAME_ENERGY_CHANGED, EVENT_NAME_ERROR, EVENT_NAME_BUTTON
+};
+
+// Subscription masks
+#define EVENT_MASK(type) (1 << (type))
+#define EVENT_ALL 0xFF
+
+struct OrbDockEvent {
+    uint8_t type;
+    uint8_t value;
+    const char* message;        // Error message, a string that outlives the queue (a literal)
+};
+
+typedef void (*EventHandler)(void* context, const OrbDockEvent& event);
+
+struct EventSubscriber {
+    EventHandler handler;
+    void* context;
+    const char* name;
+    uint8_t mask;               // EVENT_MASK of the event types it gets
+    uint16_t calls;
+    uint32_t totalMicros;
+    uint32_t maxMicros;
+};
+
+struct EventQueue {
+    OrbDockEvent events[EVENT_QUEUE_SIZE];
+    uint8_t head;               // Oldest event
+    uint8_t count;
+    uint16_t posted;
+    uint16_t dropped;
+    EventSubscriber subscribers[EVENT_SUBSCRIBERS];
+    uint8_t subscriberCount;
+};
+
+inline void eventQueueInit(EventQueue& queue) {
+    queue.head = 0;
+    queue.count = 0;
+    queue.posted = 0;
+    queue.dropped = 0;
+    queue.subscriberCount = 0;
+}
+
+// Returns false if all EVENT_SUBSCRIBERS are taken
+inline bool eventQueueSubscribe(EventQueue& queue, EventHandler handler, void* context, uint8_t mask, const char* name) {
+    if (queue.subscriberCount >= EVENT_SUBSCRIBERS) {
+        return false;
+    }
+    EventSubscriber& subscriber = queue.subscribers[queue.subscriberCount++];
+    subscriber.handler = handler;
+    subscriber.context = context;
+    subscriber.name = name;
+    subscriber.mask = mask;
+    subscriber.calls = 0;
+    subscriber.totalMicros = 0;
+    subscriber.maxMicros = 0;
+    return true;
+}
+
+// Returns false, and counts the event as dropped, if the queue is full
+inline bool eventQueuePost(EventQueue& queue, uint8_t type, uint8_t value, const char* message) {
+    if (queue.count >= EVENT_QUEUE_SIZE) {
+        queue.dropped++;
+        return false;
+    }
+    OrbDockEvent& event = queue.events[(queue.head + queue.count) % EVENT_QUEUE_SIZE];
+    event.type = type;
+    event.value = value;
+    event.message = message;
+    queue.count++;
+    queue.posted++;
+    return true;
+}
+
+// Takes the oldest event off the queue, false if it's empty
+inline bool eventQueuePop(EventQueue& queue, OrbDockEvent& event) {
+    if (queue.count == 0) {
+        return false;
+    }
+    event = queue.events[queue.head];
+    queue.head = (queue.head + 1) % EVENT_QUEUE_SIZE;
+    queue.count--;
+    return true;
+}
+
+inline void eventSubscriberTimed(EventSubscriber& subscriber, uint32_t micros) {
+    subscriber.calls++;
+    subscriber.totalMicros += micros;
+    if (micros > subscriber.maxMicros) {
+        subscriber.maxMicros = micros;
+    }
+}
+
+#endif
@@ -0,0 +1,100 @@
+/**
+ * Low-power idle mode of battery docks
+ *
+ * A dock built with IDLE_AFTER_MS goes idle once it has been empty and quiet for that
+ * long: no tag in the field, no event posted, no serial byte and no pin change on a
+ * wake pin (the buttons). While idle
+ *
+ *  - the ring crossfades from the rainbow to a dim breathing pattern (LED_PATTERN_IDLE)
+ *    that steps every IDLE_LED_INTERVAL instead of every 15 ms
+ *  - the NFC poll runs every IDLE_NFC_CHECK_INTERVAL instead of NFC_CHECK_INTERVAL, and
+ *    the PN532 is in PowerDown between polls, its RF field off. The PN532 has no
+ *    low-power card detection, so the poll itself stays as it is
+ *  - between loop() passes the AVR sleeps in idle sleep mode until the next poll or LED
+ *    step, at most IDLE_SLEEP_MAX_MS. Timer 0 keeps millis() going and its tick wakes the
+ *    CPU, and a serial byte or a pin change on a wake pin ends the sleep early
+ *
+ * Any activity, a tag turning up at a poll above all, brings the dock straight back to
+ * full speed. The dock adds up the time it slept, and the 's' command prints the share
+ * of time it was awake, which is what the battery life goes with (tools/idle-power
+ * turns that into currents).
+ *
+ * No Arduino dependencies, so the host tools in tools/ can use it too.
+ */
+
+#ifndef IDLE_POWER_H
+#define IDLE_POWER_H
+
+#include <stdint.h>
+
+#ifndef IDLE_AFTER_MS
+#define IDLE_AFTER_MS 0                 // Quiet time before going idle, 0 leaves idle mode out (mains docks)
+#endif
+#define IDLE_NFC_CHECK_INTERVAL 750     // ms between NFC polls while idle, the longest a tag waits to be seen
+#define IDLE_LED_INTERVAL 40            // ms per step of the breathing pattern
+#define IDLE_SLEEP_MAX_MS 50            // Longest sleep, so I2C commands and the Comms timers don't wait longer
+
+struct IdlePower {
+    uint32_t after;             // Quiet time before going idle in ms, 0 for never
+    bool idle;
+    uint32_t lastActivity;      // millis()
+    uint32_t idleSince;
+    uint32_t idleMillis;        // Time idle before idleSince
+    uint32_t sleptMillis;       // Time asleep since boot
+    uint16_t sleptMicros;       // Below a millisecond, carried into sleptMillis
+    uint16_t wakes;             // Times woken from idle
+};
+
+inline void idlePowerInit(IdlePower& power, uint32_t after) {
+    power.after = after;
+    power.idle = false;
+    power.lastActivity = 0;
+    power.idleSince = 0;
+    power.idleMillis = 0;
+    power.sleptMillis = 0;
+    power.sleptMicros = 0;
+    power.wakes = 0;
+}
+
+// Something happened. Returns true if it woke the dock from idle
+inline bool idlePowerActivity(IdlePower& power, uint32_t now) {
+    power.lastActivity = now;
+    if (!power.idle) {
+        return false;
+    }
+    power.idle = false;
+    power.idleMillis += now - power.idleSince;
+    power.wakes++;
+    return true;
+}
+
+// Returns true when the dock has just gone idle
+inline bool idlePowerCheck(IdlePower& power, uint32_t now) {
+    if (power.idle || power.after == 0 || now - power.lastActivity < power.after) {
+        return false;
+    }
+    power.idle = true;
+    power.idleSince = now;
+    return true;
+}
+
+inline void idlePowerSlept(IdlePower& power, uint32_t micros) {
+    uint32_t total = power.sleptMicros + micros;
+    power.sleptMillis += total / 1000;
+    power.sleptMicros = total % 1000;
+}
+
+// Time idle since boot, in ms
+inline uint32_t idlePowerIdleMillis(const IdlePower& power, uint32_t now) {
+    return power.idleMillis + (power.idle ? now - power.idleSince : 0);
+}
+
+// part out of total in thousandths, without overflowing 32 bits after 71 minutes
+inline uint16_t idlePowerPermille(uint32_t part, uint32_t total) {
+    if (total == 0) {
+        return 0;
+    }
+    return total < 4294967UL ? part * 1000 / total : part / (total / 1000);
+}
+
+#endif
@@ -0,0 +1,99 @@
+/**
+ * Append-only journey log
+ *
+ * Every orb visit appends one page to a ring of log pages after the energy ring,
+ * so a visit costs one page write no matter how long the log is.
+ *
+ * Each page holds one entry:
+ *  byte 0: bit 7 set for a valid entry, bit 6 lap bit, bits 0-5 station id
+ *  byte 1: orb energy when it arrived at the station
+ *  byte 2-3: arrival tick (seconds since the dock booted, little endian)
+ *
+ * The lap bit flips every time the log wraps around, so the head (next page to
+ * write) is the first entry that is blank or from the previous lap. The energy
+ * change of a visit is the difference to the next entry's arrival energy.
+ *
+ * No Arduino dependencies, so the host tools in tools/ can use it too.
+ */
+
+#ifndef JOURNEY_LOG_H
+#define JOURNEY_LOG_H
+
+#include <stdint.h>
+
+#define JOURNEY_ENTRY_VALID 0x80
+#define JOURNEY_ENTRY_LAP 0x40
+#define JOURNEY_ENTRY_STATION 0x3F
+#define JOURNEY_TICK_MS 1000
+
+// Fills a 4 byte page with a journey entry
+inline void journeyLogEncode(uint8_t* page, uint8_t stationId, uint8_t energy, uint16_t tick, uint8_t lap) {
+    page[0] = JOURNEY_ENTRY_VALID | (lap ? JOURNEY_ENTRY_LAP : 0) | (stationId & JOURNEY_ENTRY_STATION);
+    page[1] = energy;
+    page[2] = tick & 0xFF;
+    page[3] = tick >> 8;
+}
+
+inline bool journeyLogIsValid(const uint8_t* page) {
+    return page[0] & JOURNEY_ENTRY_VALID;
+}
+
+inline uint8_t journeyLogLap(const uint8_t* page) {
+    return (page[0] & JOURNEY_ENTRY_LAP) ? 1 : 0;
+}
+
+inline uint8_t journeyLogStation(const uint8_t* page) {
+    return page[0] & JOURNEY_ENTRY_STATION;
+}
+
+inline uint16_t journeyLogTick(const uint8_t* page) {
+    return page[2] | (page[3] << 8);
+}
+
+// Incremental head search, so the log can be scanned one bulk read at a time
+struct JourneyHeadScan {
+    uint8_t index;      // Entries scanned so far
+    uint8_t firstLap;   // Lap bit of the first entry
+    bool found;         // Head found, the rest of the log doesn't need to be read
+    bool wrapped;       // The entry at the head is from the previous lap
+};
+
+inline void journeyScanBegin(JourneyHeadScan& scan) {
+    scan.index = 0;
+    scan.firstLap = 0;
+    scan.found = false;
+    scan.wrapped = false;
+}
+
+inline void journeyScanPage(JourneyHeadScan& scan, const uint8_t* page) {
+    if (scan.found) return;
+    if (!journeyLogIsValid(page)) {
+        scan.found = true;
+        return;
+    }
+    if (scan.index == 0) {
+        scan.firstLap = journeyLogLap(page);
+    } else if (journeyLogLap(page) != scan.firstLap) {
+        scan.found = true;
+        scan.wrapped = true;
+        return;
+    }
+    scan.index++;
+}
+
+// Index of the next entry to write
+inline uint8_t journeyScanHead(const JourneyHeadScan& scan, uint8_t numEntries) {
+    return scan.index % numEntries;
+}
+
+// Lap bit of the next entry to write - flips when a full lap was scanned
+inline uint8_t journeyScanLap(const JourneyHeadScan& scan, uint8_t numEntries) {
+    return (scan.index == numEntries) ? !scan.firstLap : scan.firstLap;
+}
+
+// Index of the oldest entry, for reading the log in order
+inline uint8_t journeyScanOldest(const JourneyHeadScan& scan, uint8_t numEntries) {
+    return (scan.wrapped || scan.index == numEntries) ? journeyScanHead(scan, numEntries) : 0;
+}
+
+#endif
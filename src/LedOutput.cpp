@@ -0,0 +1,77 @@
+#include "LedOutput.h"
+
+#if LED_DRIVER == LED_DRIVER_FASTLED
+// FastLED keeps a pointer to pixels and sends them as they are - its own brightness stays at 255
+LedOutput::LedOutput(uint16_t count) : count(count) {
+#else
+// The strip's buffer holds the rendered frame, in the strip's GRB order
+LedOutput::LedOutput(uint16_t count) : count(count), strip(count, LED_PIN, NEO_GRB + NEO_KHZ800) {
+#endif
+    frame = count > 0 ? (uint8_t*)calloc(count, 3) : NULL;
+    if (frame == NULL) this->count = 0;
+    ledRenderInit(render);
+}
+
+LedOutput::~LedOutput() {
+    free(frame);
+}
+
+void LedOutput::begin() {
+    if (count == 0) return;
+#if LED_DRIVER == LED_DRIVER_FASTLED
+    FastLED.addLeds<WS2812B, LED_PIN, GRB>(pixels, count);
+#else
+    strip.begin();
+#endif
+}
+
+void LedOutput::show() {
+    if (count == 0) return;
+    ledRenderNextFrame(render);
+#if LED_DRIVER == LED_DRIVER_FASTLED
+    for (uint16_t i = 0; i < count; i++) {
+        const uint8_t* rgb = frame + i * 3;
+        pixels[i] = CRGB(ledRenderChannel(render, rgb[0]), ledRenderChannel(render, rgb[1]), ledRenderChannel(render, rgb[2]));
+    }
+    FastLED.show();
+#else
+    uint8_t* grb = strip.getPixels();
+    for (uint16_t i = 0; i < count; i++, grb += 3) {
+        const uint8_t* rgb = frame + i * 3;
+        grb[0] = ledRenderChannel(render, rgb[1]);
+        grb[1] = ledRenderChannel(render, rgb[0]);
+        grb[2] = ledRenderChannel(render, rgb[2]);
+    }
+    strip.show();
+#endif
+}
+
+void LedOutput::setBrightness(uint8_t brightness, uint8_t ramp) {
+    ledRenderSetBrightness(render, brightness, ramp);
+}
+
+uint8_t LedOutput::getBrightness() const {
+    return render.level;
+}
+
+void LedOutput::setPixelColor(uint16_t pixel, uint32_t color) {
+    setPixelColor(pixel, (uint8_t)(color >> 16), (uint8_t)(color >> 8), (uint8_t)color);
+}
+
+void LedOutput::setPixelColor(uint16_t pixel, uint8_t r, uint8_t g, uint8_t b) {
+    if (pixel >= count) return;
+    uint8_t* rgb = frame + pixel * 3;
+    rgb[0] = r;
+    rgb[1] = g;
+    rgb[2] = b;
+}
+
+void LedOutput::fill(uint32_t color) {
+    for (uint16_t i = 0; i < count; i++) {
+        setPixelColor(i, color);
+    }
+}
+
+uint16_t LedOutput::numPixels() const {
+    return count;
+}
@@ -0,0 +1,77 @@
+/**
+ * The dock's LEDs: the frame everything draws into and the driver that shows it,
+ * chosen at compile time with build flags:
+ *
+ *   LED_DRIVER  LED_DRIVER_NEOPIXEL (Adafruit NeoPixel, the default) or LED_DRIVER_FASTLED
+ *   LED_COUNT   Pixels on the ring or strip (default 24, the NeoPixel ring)
+ *   LED_PIN     Data pin (default 6)
+ *
+ * The dock owns the only LedOutput, and the LED patterns and the stations both draw
+ * into it (OrbDockCore::leds), so there is one driver on the pin. Drawing goes into the
+ * frame, at full brightness; show() applies brightness and gamma while copying it to the
+ * driver's buffer (see LedRender.h), so the frame is never rescaled and brightness
+ * changes fade. That costs a second LED_COUNT * 3 bytes, as the drivers only send their
+ * own buffer.
+ * LED_COUNT must be the same in every translation unit - set it in platformio.ini, not
+ * in a source file.
+ */
+
+#ifndef LED_OUTPUT_H
+#define LED_OUTPUT_H
+
+#include <Arduino.h>
+#include "LedRender.h"
+
+#define LED_DRIVER_NEOPIXEL 0
+#define LED_DRIVER_FASTLED  1
+
+#ifndef LED_DRIVER
+#define LED_DRIVER LED_DRIVER_NEOPIXEL
+#endif
+#ifndef LED_COUNT
+#define LED_COUNT 24
+#endif
+#ifndef LED_PIN
+#define LED_PIN 6
+#endif
+
+#if LED_DRIVER == LED_DRIVER_FASTLED
+#include <FastLED.h>
+#else
+#include <Adafruit_NeoPixel.h>
+#endif
+
+class LedOutput {
+public:
+    // count is LED_COUNT, or 0 for a dock without LEDs (nothing is allocated or driven)
+    LedOutput(uint16_t count);
+    ~LedOutput();
+
+    void begin();
+    // Renders the frame to the LEDs, one brightness ramp step further
+    void show();
+    // Brightness the following frames ramp to by ramp steps per frame, 0 to jump straight to it
+    void setBrightness(uint8_t brightness, uint8_t ramp = 0);
+    // Brightness of the last frame shown
+    uint8_t getBrightness() const;
+    void setPixelColor(uint16_t pixel, uint32_t color);
+    void setPixelColor(uint16_t pixel, uint8_t r, uint8_t g, uint8_t b);
+    void fill(uint32_t color);
+    uint16_t numPixels() const;
+
+    static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) {
+        return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+    }
+
+private:
+    uint8_t* frame;             // RGB, count * 3 bytes
+    uint16_t count;
+    LedRender render;
+#if LED_DRIVER == LED_DRIVER_FASTLED
+    CRGB pixels[LED_COUNT];
+#else
+    Adafruit_NeoPixel strip;
+#endif
+};
+
+#endif
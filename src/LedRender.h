@@ -0,0 +1,110 @@
+/**
+ * Render pass of LedOutput: brightness and gamma applied when a frame is shown
+ *
+ * The stations and the LED patterns draw full brightness colours into LedOutput's frame,
+ * which is never rescaled. Every show() sends each channel through
+ *
+ *   out = (gamma(value) * scale + dither) >> 8
+ *
+ * where gamma is value^2 (one 8x8 multiply), scale is the brightness out of 256 and
+ * dither is a rounding offset that changes every frame (temporal dithering), so the
+ * low bits lost in the shift average out over LED_DITHER_FRAMES frames instead of
+ * banding. The brightness ramps towards its target by a fixed step per frame, so a
+ * brightness change fades instead of jumping.
+ *
+ * Also the integer colour helpers the dock's LED layers are drawn and blended with.
+ *
+ * No Arduino dependencies, so the host tools in tools/ can use it too.
+ */
+
+#ifndef LED_RENDER_H
+#define LED_RENDER_H
+
+#include <stdint.h>
+
+#ifndef LED_DITHER
+#define LED_DITHER 1            // 0 rounds every frame the same way
+#endif
+#define LED_DITHER_FRAMES 8
+
+struct LedRender {
+    uint8_t level;              // Brightness of the frame being rendered
+    uint8_t target;
+    uint8_t ramp;               // Brightness steps per frame towards target, 0 to jump
+    uint16_t scale;             // level as a multiplier out of 256
+    uint8_t dither;             // Rounding offset of the frame being rendered
+    uint8_t frame;
+};
+
+// Full brightness until told otherwise
+inline void ledRenderInit(LedRender& render) {
+    render.level = 255;
+    render.target = 255;
+    render.ramp = 0;
+    render.scale = 256;
+    render.dither = 128;
+    render.frame = 0;
+}
+
+inline void ledRenderSetBrightness(LedRender& render, uint8_t brightness, uint8_t ramp) {
+    render.target = brightness;
+    render.ramp = ramp;
+}
+
+// Starts the next frame: steps the brightness and picks the frame's rounding offset
+inline void ledRenderNextFrame(LedRender& render) {
+    if (render.ramp == 0 || render.level == render.target) {
+        render.level = render.target;
+    } else if (render.level < render.target) {
+        render.level = render.target - render.level > render.ramp ? render.level + render.ramp : render.target;
+    } else {
+        render.level = render.level - render.target > render.ramp ? render.level - render.ramp : render.target;
+    }
+    render.scale = render.level == 0 ? 0 : render.level + 1;
+#if LED_DITHER
+    // Bit reversed frame count, so consecutive frames round far apart: 16, 144, 80, 208, ...
+    uint8_t step = render.frame++ % LED_DITHER_FRAMES;
+    render.dither = (((step & 1) << 2 | (step & 2) | (step & 4) >> 2) << 5) + 16;
+#endif
+}
+
+inline uint8_t ledGamma(uint8_t value) {
+    return ((uint16_t)value * value + value) >> 8;
+}
+
+inline uint8_t ledRenderChannel(const LedRender& render, uint8_t value) {
+    return (ledGamma(value) * render.scale + render.dither) >> 8;
+}
+
+// Blends colour over rgb with opacity alpha (255 covers it)
+inline void ledBlend(uint8_t* rgb, const uint8_t* colour, uint8_t alpha) {
+    uint16_t a = alpha + (alpha >> 7);  // 0-256
+    for (uint8_t c = 0; c < 3; c++) {
+        rgb[c] = (colour[c] * a + rgb[c] * (256 - a)) >> 8;
+    }
+}
+
+// sin(degrees) * 127, from a parabola per half wave (within 6% of the sine, and no floats)
+inline int8_t ledSine(uint16_t degrees) {
+    degrees %= 360;
+    uint16_t x = degrees < 180 ? degrees : degrees - 180;
+    int8_t value = ((uint32_t)x * (180 - x) * 1028) >> 16;  // 4x(180-x)/180^2 * 127
+    return degrees < 180 ? value : -value;
+}
+
+// Full saturation and value colour for a hue from 0 to 65535 (0 red, 21845 green, 43690 blue)
+inline void ledHue(uint16_t hue, uint8_t* rgb) {
+    uint16_t h = ((uint32_t)hue * 1530 + 32768) >> 16;   // 6 ramps of 255 steps
+    uint8_t ramp = h % 255;
+    switch (h / 255) {
+        case 0:  rgb[0] = 255;        rgb[1] = ramp;       rgb[2] = 0;          break;
+        case 1:  rgb[0] = 255 - ramp; rgb[1] = 255;        rgb[2] = 0;          break;
+        case 2:  rgb[0] = 0;          rgb[1] = 255;        rgb[2] = ramp;       break;
+        case 3:  rgb[0] = 0;          rgb[1] = 255 - ramp; rgb[2] = 255;        break;
+        case 4:  rgb[0] = ramp;       rgb[1] = 0;          rgb[2] = 255;        break;
+        case 5:  rgb[0] = 255;        rgb[1] = 0;          rgb[2] = 255 - ramp; break;
+        default: rgb[0] = 255;        rgb[1] = 0;          rgb[2] = 0;          break;
+    }
+}
+
+#endif
@@ -0,0 +1,113 @@
+/**
+ * PN532 health monitor
+ *
+ * The dock probes the PN532 (GetFirmwareVersion) every NFC_HEALTH_INTERVAL, and right
+ * away after a tag exchange timed out. After NFC_HEALTH_FAILURES failed probes in a row
+ * it counts as wedged, and every NFC check after that runs one recovery stage and
+ * probes again, moving on to the next stage while the PN532 still doesn't answer:
+ *  1. SAMConfig again
+ *  2. begin() and SAMConfig again
+ *  3. probe every PN532 pin layout, as at boot
+ *  4. reset the AVR with the watchdog - only if the PN532 has worked since boot,
+ *     otherwise (no reader at boot) the pin probe is repeated instead
+ * One stage per NFC check, so the LEDs and serial keep running while it recovers.
+ *
+ * No Arduino dependencies, so the host tools in tools/ can use it too.
+ */
+
+#ifndef NFC_HEALTH_H
+#define NFC_HEALTH_H
+
+#include <stdint.h>
+#include "OrbRegistry.h"     // PROGMEM and registryName()
+
+#define NFC_HEALTH_INTERVAL 5000    // ms between probes of a PN532 that is working
+#define NFC_HEALTH_FAILURES 2       // Failed probes in a row before recovery starts
+
+enum NFCHealthStage {
+    NFC_HEALTHY,
+    NFC_RECOVER_SAMCONFIG,
+    NFC_RECOVER_BEGIN,
+    NFC_RECOVER_PINS,
+    NFC_RECOVER_RESET,
+    NFC_HEALTH_STAGES
+};
+
+const char NFC_HEALTH_STAGE_NAME_HEALTHY[] PROGMEM = "healthy";
+const char NFC_HEALTH_STAGE_NAME_SAMCONFIG[] PROGMEM = "SAMConfig";
+const char NFC_HEALTH_STAGE_NAME_BEGIN[] PROGMEM = "begin";
+const char NFC_HEALTH_STAGE_NAME_PINS[] PROGMEM = "pin probe";
+const char NFC_HEALTH_STAGE_NAME_RESET[] PROGMEM = "reset";
+const char* const NFC_HEALTH_STAGE_NAMES[] PROGMEM = {
+    NFC_HEALTH_STAGE_NAME_HEALTHY, NFC_HEALTH_STAGE_NAME_SAMCONFIG, NFC_HEALTH_STAGE_NAME_BEGIN,
+    NFC_HEALTH_STAGE_NAME_PINS, NFC_HEALTH_STAGE_NAME_RESET
+};
+
+struct NFCHealth {
+    uint8_t stage;              // NFC_HEALTHY, or the recovery stage to run next
+    uint8_t failures;           // Failed probes in a row
+    bool suspect;               // Probe at the next NFC check rather than after NFC_HEALTH_INTERVAL
+    bool everHealthy;           // The PN532 has answered since boot
+    uint32_t wedgedAt;          // ms
+    uint16_t wedges;            // Times recovery started
+    uint16_t recoveries;        // Times it succeeded
+    uint32_t recoveryMillis;    // Total time the recoveries took
+    uint8_t recoveredBy;        // Stage the last recovery succeeded at
+};
+
+inline void nfcHealthInit(NFCHealth& health) {
+    health.stage = NFC_HEALTHY;
+    health.failures = 0;
+    health.suspect = false;
+    health.everHealthy = false;
+    health.wedgedAt = 0;
+    health.wedges = 0;
+    health.recoveries = 0;
+    health.recoveryMillis = 0;
+    health.recoveredBy = NFC_HEALTHY;
+}
+
+// Starts recovery at a stage, straight away - for a PN532 that isn't found at boot
+inline void nfcHealthWedged(NFCHealth& health, uint8_t stage, uint32_t now) {
+    health.stage = stage;
+    health.wedgedAt = now;
+    health.wedges++;
+}
+
+// A tag exchange got no answer at all: the tag may be gone, or the PN532 wedged
+inline void nfcHealthTimedOut(NFCHealth& health) {
+    health.suspect = true;
+}
+
+// Result of a probe, after the recovery stage if one ran
+inline void nfcHealthProbed(NFCHealth& health, bool answered, uint32_t now) {
+    health.suspect = false;
+    if (answered) {
+        if (health.stage != NFC_HEALTHY) {
+            health.recoveries++;
+            health.recoveryMillis += now - health.wedgedAt;
+            health.recoveredBy = health.stage;
+            health.stage = NFC_HEALTHY;
+        }
+        health.failures = 0;
+        health.everHealthy = true;
+        return;
+    }
+    if (health.stage == NFC_HEALTHY) {
+        health.suspect = true;
+        if (++health.failures >= NFC_HEALTH_FAILURES) {
+            nfcHealthWedged(health, NFC_RECOVER_SAMCONFIG, now);
+        }
+    } else if (health.stage == NFC_RECOVER_PINS && !health.everHealthy) {
+        // Never found since boot - a reset would only find nothing again
+    } else if (health.stage < NFC_RECOVER_RESET) {
+        health.stage++;
+    }
+}
+
+// Mean time from a recovery starting to the PN532 answering again, in ms
+inline uint32_t nfcHealthMeanRecovery(const NFCHealth& health) {
+    return health.recoveries ? health.recoveryMillis / health.recoveries : 0;
+}
+
+#endif
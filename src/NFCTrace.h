@@ -0,0 +1,67 @@
+/**
+ * PN532 transaction trace
+ *
+ * The dock keeps the last NFC_TRACE_SIZE tag exchanges and (re-)selects in a ring
+ * buffer in SRAM and sends them over serial when it receives NFC_TRACE_COMMAND.
+ *
+ * Frame: "ORBT", record count, records oldest first, CRC-16 of count and records
+ * (low byte first). Each record is NFC_TRACE_RECORD_SIZE bytes, little endian:
+ *  0-3: start time (micros)
+ *  4-5: duration in NFC_TRACE_TICK_US units, saturating
+ *  6:   NTAG command, or NFC_TRACE_SELECT for an InListPassiveTarget
+ *  7:   page (0 if the command has none)
+ *  8:   result: NFC_TRACE_OK or the NFCFailure class
+ *  9:   attempt, 0 for the first try
+ *
+ * No Arduino dependencies, so tools/nfc-trace can decode and replay traces.
+ */
+
+#ifndef NFC_TRACE_H
+#define NFC_TRACE_H
+
+#include <stdint.h>
+
+#define NFC_TRACE_COMMAND 't'
+#define NFC_TRACE_MAGIC "ORBT"
+#define NFC_TRACE_RECORD_SIZE 10
+#define NFC_TRACE_TICK_US 16
+#define NFC_TRACE_SELECT 0x4A  // PN532 InListPassiveTarget
+#define NFC_TRACE_OK 0xFF
+
+struct NFCTraceRecord {
+    uint32_t startMicros;
+    uint16_t duration;
+    uint8_t command;
+    uint8_t page;
+    uint8_t result;
+    uint8_t attempt;
+};
+
+inline uint16_t nfcTraceDuration(uint32_t micros) {
+    uint32_t ticks = micros / NFC_TRACE_TICK_US;
+    return ticks > 0xFFFF ? 0xFFFF : ticks;
+}
+
+inline void nfcTraceEncode(const NFCTraceRecord& record, uint8_t* out) {
+    out[0] = record.startMicros;
+    out[1] = record.startMicros >> 8;
+    out[2] = record.startMicros >> 16;
+    out[3] = record.startMicros >> 24;
+    out[4] = record.duration;
+    out[5] = record.duration >> 8;
+    out[6] = record.command;
+    out[7] = record.page;
+    out[8] = record.result;
+    out[9] = record.attempt;
+}
+
+inline void nfcTraceDecode(const uint8_t* in, NFCTraceRecord& record) {
+    record.startMicros = (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+    record.duration = in[4] | (in[5] << 8);
+    record.command = in[6];
+    record.page = in[7];
+    record.result = in[8];
+    record.attempt = in[9];
+}
+
+#endif
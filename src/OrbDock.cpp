@@ -1,138 +1,305 @@
 #include "OrbDock.h"
+#include "Crc16.h"
+#ifdef __AVR__
+#include <avr/wdt.h>
+#if IDLE_AFTER_MS > 0
+#include <avr/sleep.h>
+#endif
+#endif
 
 
 // Constructor
-OrbDock::OrbDock(StationId id) :
-    strip(NEOPIXEL_COUNT, NEOPIXEL_PIN, NEO_GRB + NEO_KHZ800),
+OrbDockCore::OrbDockCore(StationId id, uint16_t ledCount) :
+    leds(ledCount),
     nfc(PN532_SCK, PN532_MISO, PN532_MOSI, PN532_SS) {
     // Initialize member variables
     stationId = id;
     isNFCConnected = false;
     isOrbConnected = false;
     isUnformattedNFC = false;
+    firstVisit = false;
+    memset(&departedOrb, 0, sizeof(departedOrb));
+    departedOrb.trait = TraitId::NONE;
+    nfcPollingPaused = false;
     currentMillis = 0;
+    lastNFCCheckTime = 0;
+    nfcCheckInterval = NFC_CHECK_INTERVAL;
+#if IDLE_AFTER_MS > 0
+    idlePowerInit(idlePower, IDLE_AFTER_MS);
+#endif
+    nfcPinLayout = 0;
+    nfcPoweredDown = false;
+    nfcHealthInit(nfcHealth);
+    nfcHealthCheckTime = 0;
+    eventQueueInit(events);
+    energySlot = -1;
+    energySeq = 0;
+    journeyHead = 0;
+    journeyLap = 0;
+    tagType = TAG_NTAG213;
+    for (int i = 0; i < TAG_CACHE_SIZE; i++) {
+        tagCache[i].type = 0xFF;
+    }
+    tagCacheNext = 0;
+    nfcTagGone = false;
+    nfcQuiet = false;
+    nfcSilent = false;
+    nfcRestored = false;
+    for (int i = 0; i < NFC_FAILURE_CLASSES; i++) {
+        nfcFailureCounts[i] = 0;
+    }
+    retryPolicyInit(nfcRetryPolicy);
+    nfcTagGoneCount = 0;
+#if NFC_TRACE_SIZE > 0
+    nfcTraceNext = 0;
+    nfcTraceCount = 0;
+#endif
+    ledPreviousMillis = 0;
+    rainbowHue = 0;
+    chasePixel = 0;
+    chaseIntensity = 0;
+    chaseDirection = 1;
+    memset(chaseLevels, 0, sizeof(chaseLevels));
+    ledTraitColor = traitColor(TraitId::NONE);
+    flashHueOffset = 0;
+    errorRed = 0;
+    errorBlue = 255;
+    errorToRed = true;
+    breathAngle = 0;
+    for (uint8_t id = 0; id < LED_PATTERN_COUNT; id++) {
+        ledLayers[id].alpha = 0;
+        ledLayers[id].target = 0;
+        ledLayers[id].previousMillis = 0;
+    }
     setLEDPattern(LED_PATTERN_NO_ORB);
 }
 
 // Destructor
-OrbDock::~OrbDock() {
+OrbDockCore::~OrbDockCore() {
     // Cleanup code if needed
 }
 
-void OrbDock::begin() {
-    // Initialize NeoPixel strip
-    strip.begin();
-    strip.setBrightness(0);
-    strip.show();
+void OrbDockCore::begin() {
+    // Initialize the LEDs - blank, then the rainbow fades in
+    leds.begin();
+    leds.show();
 
-    // Try to initialize NFC with default pins
-    Serial.println(F("Initializing PN532 NFC reader with latest dock pins..."));
-    nfc.begin();
-    uint32_t versiondata = nfc.getFirmwareVersion();
-    
-    // If default pins don't work, try later dock design pins
-    if (!versiondata) {
-        Serial.println(F("Latest dock pins failed, trying V2 dock pins..."));
-        nfc = Adafruit_PN532(PN532_SCK2, PN532_MISO2, PN532_MOSI2, PN532_SS2); // Later dock design pins
+    if (probeNFC()) {
+        nfcHealthProbed(nfcHealth, true, millis());
+    } else {
+        // Keeps looking for it while the LEDs run, see checkNFCHealth()
+        Serial.println(F("Didn't find PN53x board with any pin configuration"));
+        nfcHealthWedged(nfcHealth, NFC_RECOVER_PINS, millis());
+        setLEDPattern(LED_PATTERN_ERROR);
+    }
+
+    Serial.print(F("Station: "));
+    Serial.println(flashName(STATION_NAMES, stationId));
+    Serial.println(F("Put your orbs in me!"));
+}
+
+bool OrbDockCore::probeNFC() {
+    for (uint8_t layout = 0; layout < PN532_PIN_LAYOUTS; layout++) {
+        Serial.print(F("Initializing PN532 NFC reader with "));
+        Serial.print(flashName(PN532_PIN_LAYOUT_NAMES, layout));
+        Serial.println(F(" dock pins..."));
+        if (layout != nfcPinLayout) {
+            nfc = Adafruit_PN532(PN532_PINS[layout][0], PN532_PINS[layout][1], PN532_PINS[layout][2], PN532_PINS[layout][3]);
+            nfcPinLayout = layout;
+        }
         nfc.begin();
-        versiondata = nfc.getFirmwareVersion();
-        
-        // If that fails too, try newest pins
-        if (!versiondata) {
-            Serial.println(F("V2 dock pins failed, trying v1 dock pins..."));
-            nfc = Adafruit_PN532(PN532_SCK1, PN532_MISO1, PN532_MOSI1, PN532_SS1);
-            nfc.begin();
-            versiondata = nfc.getFirmwareVersion();
-            
-            // If all pin configurations fail
-            if (!versiondata) {
-                Serial.println(F("Didn't find PN53x board with any pin configuration"));
-                // Flash red LED to indicate error
-                while (1) {
-                    strip.setPixelColor(0, 255, 0, 0); // Red
-                    strip.show();
-                    delay(1000);
-                    strip.setPixelColor(0, 0, 0, 0); // Off
-                    strip.show(); 
-                    delay(1000);
-                }
-            }
+        if (nfc.getFirmwareVersion()) {
+            configureNFC();
+            return true;
         }
     }
+    return false;
+}
 
+void OrbDockCore::configureNFC() {
     nfc.SAMConfig();                        // Configure the PN532 to read RFID tags
     nfc.setPassiveActivationRetries(0x11);  // Set the max number of retry attempts to read from a card
-
-    Serial.print(F("Station: "));
-    Serial.println(STATION_NAMES[stationId]);
-    Serial.println(F("Put your orbs in me!"));
 }
 
-void OrbDock::loop() {
-    currentMillis = millis();
+// Called every NFC check. A working PN532 is probed every NFC_HEALTH_INTERVAL, or at the
+// next check after an exchange timed out; one that stopped answering gets the next
+// recovery stage and a probe every check until it answers again (see NFCHealth.h)
+bool OrbDockCore::checkNFCHealth() {
+#if IDLE_AFTER_MS > 0
+    wakeNFC();
+#endif
+    uint8_t stage = nfcHealth.stage;
+    if (stage == NFC_HEALTHY && !nfcHealth.suspect &&
+        currentMillis - nfcHealthCheckTime < NFC_HEALTH_INTERVAL) {
+        return true;
+    }
+    nfcHealthCheckTime = currentMillis;
 
-    // Run LED patterns
-    runLEDPatterns();
+    switch (stage) {
+        case NFC_RECOVER_SAMCONFIG:
+            configureNFC();
+            break;
+        case NFC_RECOVER_BEGIN:
+            nfc.begin();
+            configureNFC();
+            break;
+        case NFC_RECOVER_RESET:
+            Serial.println(F("PN532 not answering, resetting"));
+#ifdef __AVR__
+            wdt_enable(WDTO_15MS);
+            while (1) {}
+#endif
+            break;
+    }
+    // The pin probe probes as it goes
+    bool answered = stage == NFC_RECOVER_PINS ? probeNFC() : nfc.getFirmwareVersion() != 0;
+    nfcHealthProbed(nfcHealth, answered, millis());
+
+    if (nfcHealth.stage == NFC_HEALTHY) {
+        if (stage != NFC_HEALTHY) {
+            Serial.print(F("PN532 recovered by "));
+            Serial.print(flashName(NFC_HEALTH_STAGE_NAMES, stage));
+            Serial.print(F(" in "));
+            Serial.print(millis() - nfcHealth.wedgedAt);
+            Serial.println(F(" ms"));
+        }
+        return true;
+    }
+    if (stage == NFC_HEALTHY) {
+        Serial.println(F("PN532 not answering, recovering"));
+    }
+    // Pulses for as long as it takes
+    setLEDPattern(LED_PATTERN_ERROR);
+    return false;
+}
 
-    // Check for NFC / Orb presence periodically
-    static unsigned long lastNFCCheckTime = 0;
-    if (currentMillis - lastNFCCheckTime < NFC_CHECK_INTERVAL) {
-        return;
+bool OrbDockCore::subscribe(EventHandler handler, void* context, uint8_t mask, const char* name) {
+    return eventQueueSubscribe(events, handler, context, mask, name);
+}
+
+void OrbDockCore::postEvent(EventType type, uint8_t value, const char* message) {
+#if IDLE_AFTER_MS > 0
+    idleActivity();
+#endif
+    if (!eventQueuePost(events, type, value, message)) {
+        Serial.print(F("Event queue full, dropped "));
+        Serial.println(flashName(EVENT_NAMES, type));
     }
-    lastNFCCheckTime = currentMillis;
+}
 
-    // While orb is connected, check if it's still connected
-    if (isNFCConnected && isOrbConnected) {
-        if (!isNFCActive()) {
-            // Orb has disconnected
-            endOrbSession();
+void OrbDockCore::dispatchEvents() {
+    // Events the handlers post wait for the next pass, so this always ends
+    OrbDockEvent event;
+    for (uint8_t pending = events.count; pending > 0 && eventQueuePop(events, event); pending--) {
+        for (uint8_t i = 0; i < events.subscriberCount; i++) {
+            EventSubscriber& subscriber = events.subscribers[i];
+            if (!(subscriber.mask & EVENT_MASK(event.type))) {
+                continue;
+            }
+            unsigned long startMicros = micros();
+            subscriber.handler(subscriber.context, event);
+            eventSubscriberTimed(subscriber, micros() - startMicros);
         }
-        return;
     }
+}
 
-    // Check for NFC presence
-    if(isNFCPresent()) {
-        isNFCConnected = true;
-        // NFC is present! Check if it's an orb
-        int orbStatus = isOrb();
-        switch (orbStatus) {
-            case STATUS_FAILED:
-                handleError("Failed to check orb header");
-                return;
-            case STATUS_FALSE:
-                if (!isUnformattedNFC) {
-                    Serial.println(F("Unformatted NFC connected"));
-                    isUnformattedNFC = true;
-                    onUnformattedNFC();
-                }
-                break;
-            case STATUS_TRUE:
-                isOrbConnected = true;
-                setLEDPattern(LED_PATTERN_ORB_CONNECTED);
-                readOrbInfo();
-                setVisited(true);
-                onOrbConnected();
-                break;
-        }
+void OrbDockCore::printEventStats() {
+    Serial.print(F("Events - posted: "));
+    Serial.print(events.posted);
+    Serial.print(F(" dropped: "));
+    Serial.println(events.dropped);
+    for (uint8_t i = 0; i < events.subscriberCount; i++) {
+        const EventSubscriber& subscriber = events.subscribers[i];
+        Serial.print(subscriber.name);
+        Serial.print(F(" - calls: "));
+        Serial.print(subscriber.calls);
+        Serial.print(F(" mean us: "));
+        Serial.print(subscriber.calls ? subscriber.totalMicros / subscriber.calls : 0);
+        Serial.print(F(" max us: "));
+        Serial.println(subscriber.maxMicros);
     }
 }
 
-bool OrbDock::isNFCPresent() {
-    uint8_t uid[7];  // Buffer to store the returned UID
-    uint8_t uidLength;
-    if (!nfc.readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &uidLength, 30)) {
+const NFCHealth& OrbDockCore::getNFCHealth() {
+    return nfcHealth;
+}
+
+bool OrbDockCore::isNFCPresent() {
+    // inListPassiveTarget (unlike readPassiveTargetID) registers the tag with the PN532 library,
+    // which inDataExchange needs for the bulk reads
+    if (!selectTag(0)) {
         return false;
     }
-    if (uidLength != 7) {
+    // Pages 0 and 1 hold the 7 byte UID, with the check byte for the first 3 UID bytes in page 0
+    uint8_t command[2] = {NTAG_CMD_READ, 0};
+    uint8_t response[16];
+    uint8_t responseLength = sizeof(response);
+    unsigned long startMicros = micros();
+    bool answered = nfc.inDataExchange(command, sizeof(command), response, &responseLength);
+    traceNFC(NTAG_CMD_READ, 0, answered && responseLength == 16 ? NFC_TRACE_OK : retryPolicyClassify(answered), 0, startMicros);
+    if (!answered) {
+        nfcHealthTimedOut(nfcHealth);
+    }
+    if (!answered || responseLength != 16 ||
+        response[3] != (0x88 ^ response[0] ^ response[1] ^ response[2])) {
         Serial.println(F("Detected non-NTAG203 tag (UUID length != 7 bytes)!"));
         return false;
     }
+    memcpy(nfcUid, response, 3);
+    memcpy(nfcUid + 3, response + 4, 4);
+    nfcTagGone = false;
+    if (detectTagType() == STATUS_FAILED) {
+        return false;
+    }
     Serial.println(F("NFC tag read successfully"));
     return true;
 }
 
+// Sets tagType from the UID cache, or asks the tag with GET_VERSION
+int OrbDockCore::detectTagType() {
+    for (int i = 0; i < TAG_CACHE_SIZE; i++) {
+        if (tagCache[i].type != 0xFF && memcmp(tagCache[i].uid, nfcUid, 7) == 0) {
+            tagType = static_cast<TagType>(tagCache[i].type);
+            return STATUS_SUCCEEDED;
+        }
+    }
+
+    uint8_t command[1] = {NTAG_CMD_GET_VERSION};
+    uint8_t version[8];
+    uint8_t versionLength = sizeof(version);
+    unsigned long startMicros = micros();
+    bool answered = nfc.inDataExchange(command, sizeof(command), version, &versionLength);
+    traceNFC(NTAG_CMD_GET_VERSION, 0, answered && versionLength == 8 ? NFC_TRACE_OK : retryPolicyClassify(answered), 0, startMicros);
+    if (!answered || versionLength != 8) {
+        // No GET_VERSION, so it's an older NTAG203-like tag. The NAK put it back to idle, so select it again
+        tagType = TAG_NTAG203;
+        if (!selectTag(1)) {
+            return STATUS_FAILED;
+        }
+    } else if (version[2] == 0x04 && version[6] == 0x0F) {
+        tagType = TAG_NTAG213;
+    } else if (version[2] == 0x04 && version[6] == 0x11) {
+        tagType = TAG_NTAG215;
+    } else if (version[2] == 0x04 && version[6] == 0x13) {
+        tagType = TAG_NTAG216;
+    } else if (version[2] == 0x03 && version[6] == 0x0E) {
+        tagType = TAG_ULTRALIGHT_EV1;
+    } else {
+        // E.g. the 20 page Ultralight EV1 MF0UL11, which can't hold the stations, energy ring and journey log
+        Serial.println(F("Unsupported tag type"));
+        return STATUS_FAILED;
+    }
+    Serial.print(F("Tag type: "));
+    Serial.println(flashName(TAG_TYPE_NAMES, tagType));
+
+    memcpy(tagCache[tagCacheNext].uid, nfcUid, 7);
+    tagCache[tagCacheNext].type = tagType;
+    tagCacheNext = (tagCacheNext + 1) % TAG_CACHE_SIZE;
+    return STATUS_SUCCEEDED;
+}
+
 // Check if an Orb NFC is connected by reading the orb page
-bool OrbDock::isNFCActive() {
+bool OrbDockCore::isNFCActive() {
   // See if we can read the orb page
   int checkStatus = isOrb();
   if (checkStatus == STATUS_FAILED) {
@@ -142,7 +309,7 @@ bool OrbDock::isNFCActive() {
 }
 
 // Whether the connected NFC is formatted as an orb
-int OrbDock::isOrb() {
+int OrbDockCore::isOrb() {
     if (readPage(ORBS_PAGE) == STATUS_FAILED) {
         Serial.println(F("Failed to read data from NFC"));
         return STATUS_FAILED;
@@ -155,7 +322,7 @@ int OrbDock::isOrb() {
 }
 
 // Print station information
-void OrbDock::printOrbInfo() {
+void OrbDockCore::printOrbInfo() {
     Serial.println(F("\n*************************************************"));
     Serial.print(F("Trait: "));
     Serial.print(getTraitName());
@@ -163,7 +330,7 @@ void OrbDock::printOrbInfo() {
     Serial.println(orbInfo.energy);
     
     for (int i = 0; i < NUM_STATIONS; i++) {
-        Serial.print(STATION_NAMES[i]);
+        Serial.print(flashName(STATION_NAMES, i));
         Serial.print(F(": Visited:"));
         Serial.print(orbInfo.stations[i].visited ? "Yes" : "No");
         Serial.print(F(" | "));
@@ -174,22 +341,32 @@ void OrbDock::printOrbInfo() {
     Serial.println();
 }
 
-void OrbDock::endOrbSession() {
+void OrbDockCore::endOrbSession() {
+    if (isOrbConnected) {
+        departedOrb = orbInfo;
+    }
     setLEDPattern(LED_PATTERN_NO_ORB);
     isOrbConnected = false;
     isNFCConnected = false;
     isUnformattedNFC = false;
+    nfcRestored = false;
     reInitializeStations();
     orbInfo.trait = TraitId::NONE;
-    onOrbDisconnected();
+    orbInfo.energy = 0;
+    energySlot = -1;
 }
 
-int OrbDock::writeStation(int stationId) {
+// Fills a 4 byte page with a station's data
+void OrbDockCore::encodeStation(int stationId, uint8_t* page) {
+    page[0] = orbInfo.stations[stationId].visited ? 1 : 0;
+    page[1] = orbInfo.stations[stationId].custom;
+    page[2] = 0;
+    page[3] = 0;
+}
+
+int OrbDockCore::writeStation(int stationId) {
     // Prepare the page buffer with station data
-    page_buffer[0] = orbInfo.stations[stationId].visited ? 1 : 0;
-    page_buffer[1] = orbInfo.stations[stationId].custom;
-    page_buffer[2] = 0;
-    page_buffer[3] = 0;
+    encodeStation(stationId, page_buffer);
 
     // Write the buffer to the NFC
     int writeDataStatus = writePage(STATIONS_PAGE_OFFSET + stationId, page_buffer);
@@ -200,166 +377,644 @@ int OrbDock::writeStation(int stationId) {
     return STATUS_SUCCEEDED;
 }
 
-int OrbDock::writePage(int page, uint8_t* data) {
-    int retryCount = 0;
-    while (retryCount < MAX_RETRIES) {
-        Serial.print(F("Writing to page "));
-        Serial.println(page);
-        
-        if (nfc.ntag2xx_WritePage(page, data)) {
-            Serial.println(F("Write succeeded"));
+// Sends a command to the tag and checks the answer is responseLength bytes long, retrying by failure class:
+// wrong length answers are retried straight away, errors (timeouts, CRC, NACKs, see RetryPolicy.h)
+// re-select the tag first. If the re-select fails the tag is gone, so give up without using the rest
+// of the retries.
+int OrbDockCore::nfcExchange(uint8_t* command, uint8_t commandLength, uint8_t* response, uint8_t responseLength) {
+    if (nfcTagGone) {
+        return STATUS_FAILED;
+    }
+    // Writes expect an empty answer, so give them a byte of room to see one that isn't (a
+    // NACK comes back as an error status, see RetryPolicy.h)
+    uint8_t scratch[1];
+    uint8_t* buffer = responseLength > 0 ? response : scratch;
+    uint8_t bufferLength = responseLength > 0 ? responseLength : sizeof(scratch);
+    uint8_t page = commandLength > 1 ? command[1] : 0;
+    for (int attempt = 0; attempt < MAX_RETRIES; attempt++) {
+        uint8_t length = bufferLength;
+        unsigned long startMicros = micros();
+        bool answered = nfc.inDataExchange(command, commandLength, buffer, &length);
+        if (answered && length == responseLength) {
+            traceNFC(command[0], page, NFC_TRACE_OK, attempt, startMicros);
+            retryPolicySucceeded(nfcRetryPolicy);
             return STATUS_SUCCEEDED;
         }
-        
-        retryCount++;
-        if (retryCount < MAX_RETRIES) {
-            Serial.println(F("Retrying write"));
-            //delay(RETRY_DELAY);
-            nfc.inListPassiveTarget();
+
+        NFCFailure failure = retryPolicyClassify(answered);
+        traceNFC(command[0], page, failure, attempt, startMicros);
+        nfcFailureCounts[failure]++;
+        if (failure == NFC_FAILURE_ERROR) {
+            nfcHealthTimedOut(nfcHealth);
+        }
+        if (!nfcSilent) {
+            Serial.print(F("NFC "));
+            Serial.print(flashName(NFC_FAILURE_NAMES, failure));
+            Serial.println(F(", retrying"));
+        }
+
+        uint8_t backoff = retryPolicyFailed(nfcRetryPolicy, failure);
+        if (backoff > 0) {
+            delay(backoff);
+        }
+
+        if (retryPolicyReselects(failure) && !selectTag(attempt + 1)) {
+            if (!nfcSilent) {
+                Serial.println(F("NFC tag gone"));
+            }
+            nfcTagGone = true;
+            nfcTagGoneCount++;
+            return STATUS_FAILED;
         }
     }
 
-    Serial.println(F("Write failed after retries"));
+    if (!nfcSilent) {
+        Serial.println(F("NFC failed after retries"));
+    }
     return STATUS_FAILED;
 }
 
-int OrbDock::readPage(int page) {
-    int retryCount = 0;
-    while (retryCount < MAX_RETRIES) {
-        if (nfc.ntag2xx_ReadPage(page, page_buffer)) {
-            return STATUS_SUCCEEDED;
+// (Re-)selects the tag in the field, which also registers it with the library for inDataExchange
+bool OrbDockCore::selectTag(uint8_t attempt) {
+    unsigned long startMicros = micros();
+    bool selected = nfc.inListPassiveTarget();
+    traceNFC(NFC_TRACE_SELECT, 0, selected ? NFC_TRACE_OK : NFC_FAILURE_ERROR, attempt, startMicros);
+    return selected;
+}
+
+// Records a PN532 transaction in the trace ring buffer
+void OrbDockCore::traceNFC(uint8_t command, uint8_t page, uint8_t result, uint8_t attempt, unsigned long startMicros) {
+#if NFC_TRACE_SIZE > 0
+    NFCTraceRecord& record = nfcTrace[nfcTraceNext];
+    record.startMicros = startMicros;
+    record.duration = nfcTraceDuration(micros() - startMicros);
+    record.command = command;
+    record.page = page;
+    record.result = result;
+    record.attempt = attempt;
+    nfcTraceNext = (nfcTraceNext + 1) % NFC_TRACE_SIZE;
+    if (nfcTraceCount < NFC_TRACE_SIZE) {
+        nfcTraceCount++;
+    }
+#endif
+}
+
+void OrbDockCore::dumpNFCTrace() {
+#if NFC_TRACE_SIZE > 0
+    uint8_t encoded[NFC_TRACE_RECORD_SIZE];
+    uint16_t crc = crc16Update(CRC16_INIT, nfcTraceCount);
+    Serial.write((const uint8_t*)NFC_TRACE_MAGIC, 4);
+    Serial.write(nfcTraceCount);
+    for (uint8_t i = 0; i < nfcTraceCount; i++) {
+        uint8_t index = (nfcTraceNext + NFC_TRACE_SIZE - nfcTraceCount + i) % NFC_TRACE_SIZE;
+        nfcTraceEncode(nfcTrace[index], encoded);
+        crc = crc16(encoded, sizeof(encoded), crc);
+        Serial.write(encoded, sizeof(encoded));
+    }
+    Serial.write(crc & 0xFF);
+    Serial.write(crc >> 8);
+#endif
+}
+
+int OrbDockCore::writePage(int page, uint8_t* data) {
+    if (!nfcQuiet) {
+        Serial.print(F("Writing to page "));
+        Serial.println(page);
+    }
+    uint8_t command[6] = {NTAG_CMD_WRITE, (uint8_t)page, data[0], data[1], data[2], data[3]};
+    if (nfcExchange(command, sizeof(command), nullptr, 0) == STATUS_FAILED) {
+        Serial.println(F("Write failed"));
+        return STATUS_FAILED;
+    }
+    return STATUS_SUCCEEDED;
+}
+
+// Writes a group of pages, then checks them with bulk reads and rewrites only the pages that don't match.
+// Pages are written last to first, so a header in the first page only lands once the rest is written.
+int OrbDockCore::writePages(uint8_t startPage, uint8_t numPages, uint8_t* data) {
+    for (int i = numPages - 1; i >= 0; i--) {
+        if (writePage(startPage + i, data + i * 4) == STATUS_FAILED) {
+            return STATUS_FAILED;
         }
-        
-        retryCount++;
-        if (retryCount < MAX_RETRIES) {
-            Serial.println(F("Retrying read"));
-            delay(RETRY_DELAY);
-            nfc.inListPassiveTarget();
+    }
+    return verifyPages(startPage, numPages, data);
+}
+
+// Reads back pages one burst at a time and rewrites any that don't match data
+int OrbDockCore::verifyPages(uint8_t startPage, uint8_t numPages, uint8_t* data) {
+    uint8_t burst[NFC_MAX_BURST_PAGES * 4];
+    for (uint8_t offset = 0; offset < numPages; offset += NFC_MAX_BURST_PAGES) {
+        uint8_t count = min(numPages - offset, NFC_MAX_BURST_PAGES);
+        for (int round = 0; ; round++) {
+            if (readPages(startPage + offset, count, burst) == STATUS_FAILED) {
+                return STATUS_FAILED;
+            }
+            bool mismatch = false;
+            for (uint8_t i = 0; i < count; i++) {
+                uint8_t* expected = data + (offset + i) * 4;
+                if (memcmp(burst + i * 4, expected, 4) == 0) {
+                    continue;
+                }
+                mismatch = true;
+                Serial.print(F("Verify failed for page "));
+                Serial.println(startPage + offset + i);
+                if (round >= VERIFY_ROUNDS || writePage(startPage + offset + i, expected) == STATUS_FAILED) {
+                    return STATUS_FAILED;
+                }
+            }
+            if (!mismatch) {
+                break;
+            }
         }
     }
+    return STATUS_SUCCEEDED;
+}
 
-    Serial.println(F("Read failed after retries"));
-    return STATUS_FAILED;
+int OrbDockCore::readPage(int page) {
+    return readPages(page, 1, page_buffer);
+}
+
+// Reads consecutive pages into buffer with as few FAST_READ (or READ, on older tags) commands as possible
+int OrbDockCore::readPages(uint8_t startPage, uint8_t numPages, uint8_t* buffer) {
+    bool fastRead = TAG_LAYOUTS[tagType].fastRead;
+    while (numPages > 0) {
+        uint8_t burst = min(numPages, fastRead ? NFC_MAX_BURST_PAGES : 4);
+        uint8_t command[3] = {NTAG_CMD_FAST_READ, startPage, (uint8_t)(startPage + burst - 1)};
+        if (!fastRead) {
+            command[0] = NTAG_CMD_READ;
+        }
+        if (fastRead) {
+            if (nfcExchange(command, 3, buffer, burst * 4) == STATUS_FAILED) {
+                return STATUS_FAILED;
+            }
+        } else {
+            // READ always returns 4 pages, so it goes through a 16 byte buffer and copies what was asked for
+            uint8_t response[16];
+            if (nfcExchange(command, 2, response, sizeof(response)) == STATUS_FAILED) {
+                return STATUS_FAILED;
+            }
+            memcpy(buffer, response, burst * 4);
+        }
+        startPage += burst;
+        numPages -= burst;
+        buffer += burst * 4;
+    }
+    return STATUS_SUCCEEDED;
 }
 
 // Read and print the entire NFC storage
-void OrbDock::printNFCStorage() {
+void OrbDockCore::printNFCStorage() {
+    uint8_t burst[NFC_MAX_BURST_PAGES * 4];
+    uint8_t totalPages = TAG_LAYOUTS[tagType].totalPages;
+    Serial.print(F("Tag type: "));
+    Serial.println(flashName(TAG_TYPE_NAMES, tagType));
     // Read the entire NFC storage
-    for (int i = 0; i < 45; i++) {
-        if (readPage(i) == STATUS_FAILED) {
+    for (uint8_t page = 0; page < totalPages; page += NFC_MAX_BURST_PAGES) {
+        uint8_t numPages = min(totalPages - page, NFC_MAX_BURST_PAGES);
+        if (readPages(page, numPages, burst) == STATUS_FAILED) {
             Serial.println(F("Failed to read page"));
             return;
         }
-        Serial.print(F("Page "));
-        Serial.print(i);
-        Serial.print(F(": "));
-        for (int j = 0; j < 4; j++) {
-            Serial.print(page_buffer[j]);
-            Serial.print(F(" "));
+        for (uint8_t i = 0; i < numPages; i++) {
+            Serial.print(F("Page "));
+            Serial.print(page + i);
+            Serial.print(F(": "));
+            for (int j = 0; j < 4; j++) {
+                Serial.print(burst[i * 4 + j]);
+                Serial.print(F(" "));
+            }
+            Serial.println();
+        }
+    }
+}
+
+// Streams the tag one burst at a time, so the image never has to fit in RAM
+void OrbDockCore::dumpTagImage() {
+    uint8_t result = TAG_IMAGE_OK;
+    if (nfcHealth.stage != NFC_HEALTHY || (!isNFCConnected && !isNFCPresent())) {
+        result = TAG_IMAGE_NO_TAG;
+    }
+    uint8_t header[TAG_IMAGE_HEADER_SIZE];
+    header[0] = tagType;
+    header[1] = result == TAG_IMAGE_OK ? TAG_LAYOUTS[tagType].totalPages : 0;
+    memcpy(header + 2, nfcUid, TAG_IMAGE_UID_LENGTH);
+    uint16_t crc = crc16(header, sizeof(header));
+    Serial.write((const uint8_t*)TAG_IMAGE_MAGIC, 4);
+    Serial.write(header, sizeof(header));
+
+    // Nothing but the frame from here on
+    nfcSilent = true;
+    uint8_t burst[NFC_MAX_BURST_PAGES * 4];
+    for (uint8_t page = 0; page < header[1]; page += NFC_MAX_BURST_PAGES) {
+        uint8_t numPages = min(header[1] - page, NFC_MAX_BURST_PAGES);
+        if (result != TAG_IMAGE_OK || readPages(page, numPages, burst) == STATUS_FAILED) {
+            // The rest is sent as zeros, so the frame keeps its length
+            result = TAG_IMAGE_READ_FAILED;
+            memset(burst, 0, sizeof(burst));
+        }
+        crc = crc16(burst, numPages * 4, crc);
+        Serial.write(burst, numPages * 4);
+    }
+    nfcSilent = false;
+    crc = crc16Update(crc, result);
+    Serial.write(result);
+    Serial.write(crc & 0xFF);
+    Serial.write(crc >> 8);
+}
+
+void OrbDockCore::restoreTagImage() {
+    uint8_t request[TAG_IMAGE_REQUEST_SIZE];
+    uint8_t result;
+    Serial.setTimeout(TAG_IMAGE_TIMEOUT_MS);
+    if (Serial.readBytes(request, sizeof(request)) != sizeof(request)) {
+        result = TAG_IMAGE_TIMEOUT;
+    } else if (!tagImageRequestValid(request)) {
+        result = TAG_IMAGE_BAD_REQUEST;
+    } else if (nfcHealth.stage != NFC_HEALTHY || !isNFCPresent()) {
+        result = TAG_IMAGE_NO_TAG;
+    } else if (request[0] != tagType) {
+        result = TAG_IMAGE_WRONG_TYPE;
+    } else {
+        isNFCConnected = true;
+        int orbStatus = isOrb();
+        if (orbStatus == STATUS_FAILED) {
+            result = TAG_IMAGE_READ_FAILED;
+        } else if (orbStatus == STATUS_TRUE && memcmp(nfcUid, request + 1, TAG_IMAGE_UID_LENGTH) != 0) {
+            result = TAG_IMAGE_OTHER_ORB;
+        } else {
+            nfcQuiet = true;
+            result = restoreTagImagePages();
+            nfcQuiet = false;
+        }
+    }
+    Serial.setTimeout(1000);    // Stream's default
+    sendTagImageReply(result, 0);
+    Serial.print(F("Tag image restore: "));
+    Serial.println(flashName(TAG_IMAGE_RESULT_NAMES, result));
+    if (result == TAG_IMAGE_OK) {
+        nfcRestored = true;
+    }
+}
+
+// Asks for user memory a chunk at a time, last chunk first, and writes the pages that differ
+uint8_t OrbDockCore::restoreTagImagePages() {
+    uint8_t chunk[TAG_IMAGE_CHUNK_SIZE];
+    uint8_t current[TAG_IMAGE_CHUNK_PAGES * 4];
+    uint8_t page = TAG_LAYOUTS[tagType].userPageEnd;
+    uint8_t reply = TAG_IMAGE_OK;
+    uint8_t badChunks = 0;
+    while (page > TAG_IMAGE_USER_PAGE) {
+        uint8_t count = tagImageChunkPages(page);
+        uint8_t first = page - count;
+        sendTagImageReply(reply, page);
+        if (Serial.readBytes(chunk, 2) != 2) {
+            return TAG_IMAGE_TIMEOUT;
+        }
+        bool valid = chunk[0] == first && chunk[1] == count;
+        if (chunk[1] > TAG_IMAGE_CHUNK_PAGES) {
+            // No telling where it ends, so skip everything up to a pause
+            valid = false;
+            while (Serial.readBytes(chunk, sizeof(chunk)) > 0) {
+            }
+        } else if (Serial.readBytes(chunk + 2, chunk[1] * 4 + 2) != (size_t)(chunk[1] * 4 + 2)) {
+            return TAG_IMAGE_TIMEOUT;
+        } else {
+            valid = valid && tagImageChunkValid(chunk);
         }
-        Serial.println();
+        if (!valid) {
+            if (++badChunks > TAG_IMAGE_CHUNK_RETRIES) {
+                return TAG_IMAGE_BAD_CHUNK;
+            }
+            reply = TAG_IMAGE_BAD_CHUNK;
+            continue;
+        }
+        reply = TAG_IMAGE_OK;
+
+        uint8_t* data = chunk + 2;
+        if (readPages(first, count, current) == STATUS_FAILED) {
+            return TAG_IMAGE_READ_FAILED;
+        }
+        bool written = false;
+        for (int i = count - 1; i >= 0; i--) {
+            if (memcmp(current + i * 4, data + i * 4, 4) == 0) {
+                continue;
+            }
+            if (writePage(first + i, data + i * 4) == STATUS_FAILED) {
+                return TAG_IMAGE_WRITE_FAILED;
+            }
+            written = true;
+        }
+        if (written && verifyPages(first, count, data) == STATUS_FAILED) {
+            return TAG_IMAGE_WRITE_FAILED;
+        }
+        page = first;
+    }
+    return TAG_IMAGE_OK;
+}
+
+void OrbDockCore::sendTagImageReply(uint8_t result, uint8_t page) {
+    uint8_t reply[TAG_IMAGE_REPLY_SIZE];
+    tagImageEncodeReply(reply, result, page);
+    Serial.write(reply, sizeof(reply));
+}
+
+uint16_t OrbDockCore::getNFCFailureCount(NFCFailure failure) {
+    return nfcFailureCounts[failure];
+}
+
+uint16_t OrbDockCore::getNFCTagGoneCount() {
+    return nfcTagGoneCount;
+}
+
+void OrbDockCore::printNFCStats() {
+    Serial.print(F("NFC failures -"));
+    for (int i = 0; i < NFC_FAILURE_CLASSES; i++) {
+        Serial.print(F(" "));
+        Serial.print(flashName(NFC_FAILURE_NAMES, i));
+        Serial.print(F(": "));
+        Serial.print(nfcFailureCounts[i]);
     }
+    Serial.print(F(" | tag gone: "));
+    Serial.println(nfcTagGoneCount);
+    Serial.print(F("PN532 - "));
+    Serial.print(flashName(NFC_HEALTH_STAGE_NAMES, nfcHealth.stage));
+    Serial.print(F(", "));
+    Serial.print(flashName(PN532_PIN_LAYOUT_NAMES, nfcPinLayout));
+    Serial.print(F(" pins | wedged: "));
+    Serial.print(nfcHealth.wedges);
+    Serial.print(F(" recovered: "));
+    Serial.print(nfcHealth.recoveries);
+    Serial.print(F(" mean ms: "));
+    Serial.println(nfcHealthMeanRecovery(nfcHealth));
 }
 
 // Returns the trait name
-const char* OrbDock::getTraitName() {
-    return TRAIT_NAMES[static_cast<int>(orbInfo.trait)];
+const __FlashStringHelper* OrbDockCore::getTraitName() {
+    return flashName(TRAIT_NAMES, orbInfo.trait < NUM_TRAITS ? orbInfo.trait : TraitId::NONE);
+}
+
+const uint8_t* OrbDockCore::getNFCUid() {
+    return nfcUid;
 }
 
 // Writes the trait to the orb
-int OrbDock::setTrait(TraitId newTrait) {
+int OrbDockCore::setTrait(TraitId newTrait) {
     Serial.print(F("Setting trait to "));
-    Serial.println(TRAIT_NAMES[static_cast<int>(newTrait)]);
+    Serial.println(flashName(TRAIT_NAMES, newTrait));
     orbInfo.trait = newTrait;
     uint8_t traitBytes[4] = {static_cast<uint8_t>(newTrait), 0, 0, 0};  // Convert trait to bytes
     memcpy(page_buffer, traitBytes, 4);
     return writePage(TRAIT_PAGE, page_buffer);
 }
 
-int OrbDock::setVisited(bool visited) {
+int OrbDockCore::setVisited(bool visited) {
     Serial.print(F("Setting visited to "));
     Serial.print(visited ? "true" : "false");
     Serial.print(F(" for station "));
-    Serial.println(STATION_NAMES[stationId]);
+    Serial.println(flashName(STATION_NAMES, stationId));
     orbInfo.stations[stationId].visited = visited;
     return writeStation(stationId);
 }
 
-int OrbDock::setEnergy(byte energy) {
+int OrbDockCore::setEnergy(byte energy) {
     Serial.print(F("Setting energy to "));
     Serial.println(energy);
-    orbInfo.energy = energy;
-    byte energyBytes[4] = {energy, 0, 0, 0};  // Convert energy to bytes
-    memcpy(page_buffer, energyBytes, 4);
-    int result = writePage(ENERGY_PAGE, page_buffer);
+    int result = writeEnergy(energy, false);
     if (result == STATUS_SUCCEEDED) {
         setLEDPattern(LED_PATTERN_FLASH);
     }
     return result;
 }
 
-int OrbDock::addEnergy(byte amount) {
-    byte newEnergy = orbInfo.energy + amount;
-    if (newEnergy > 250) newEnergy = 250;
-    Serial.print(F("Adding "));
-    Serial.print(amount);
-    Serial.println(F(" energy"));
-    return setEnergy(newEnergy);
+// Writes the energy as the next record in the energy ring, so no single page wears out
+int OrbDockCore::writeEnergy(byte energy, bool verify) {
+    orbInfo.energy = energy;
+    uint8_t slot = energyRingNextSlot(energySlot, TAG_LAYOUTS[tagType].energySlots);
+    uint8_t seq = energySlot < 0 ? 0 : energySeq + 1;
+    energyRingEncode(page_buffer, energy, seq);
+    int result = verify
+        ? writePages(ENERGY_RING_PAGE + slot, 1, page_buffer)
+        : writePage(ENERGY_RING_PAGE + slot, page_buffer);
+    if (result == STATUS_SUCCEEDED) {
+        energySlot = slot;
+        energySeq = seq;
+    }
+    return result;
 }
 
-int OrbDock::removeEnergy(byte amount) {
-    byte newEnergy = orbInfo.energy - amount;
-    if (newEnergy < 0) newEnergy = 0;
-    Serial.print(F("Removing "));
-    Serial.print(amount);
-    Serial.println(F(" energy"));
-    return setEnergy(newEnergy);
+// Finds the newest energy record with a bulk read of the energy ring (one burst on an NTAG213)
+int OrbDockCore::readEnergy() {
+    uint8_t burst[NFC_MAX_BURST_PAGES * 4];
+    uint8_t slots = TAG_LAYOUTS[tagType].energySlots;
+    energySlot = -1;
+    for (uint8_t slot = 0; slot < slots; slot += NFC_MAX_BURST_PAGES) {
+        uint8_t numPages = min(slots - slot, NFC_MAX_BURST_PAGES);
+        if (readPages(ENERGY_RING_PAGE + slot, numPages, burst) == STATUS_FAILED) {
+            return STATUS_FAILED;
+        }
+        for (uint8_t i = 0; i < numPages; i++) {
+            uint8_t* record = burst + i * 4;
+            if (energyRingIsValid(record) && (energySlot < 0 || energyRingIsNewer(record[1], energySeq))) {
+                energySlot = slot + i;
+                energySeq = record[1];
+                orbInfo.energy = record[0];
+            }
+        }
+    }
+    if (energySlot >= 0) {
+        return STATUS_SUCCEEDED;
+    }
+    // Orbs formatted before the energy ring keep their energy in the legacy energy page
+    if (readPage(ENERGY_PAGE) == STATUS_FAILED) {
+        return STATUS_FAILED;
+    }
+    orbInfo.energy = page_buffer[0];
+    return STATUS_SUCCEEDED;
 }
 
-int OrbDock::setCustom(byte value) {
+// Finds the next free journey log entry, reading the log one burst at a time until the head is found
+int OrbDockCore::readJourneyHead() {
+    uint8_t burst[NFC_MAX_BURST_PAGES * 4];
+    JourneyHeadScan scan;
+    journeyScanBegin(scan);
+    uint8_t numEntries = journeyLogEntries();
+    for (uint8_t entry = 0; entry < numEntries && !scan.found; entry += NFC_MAX_BURST_PAGES) {
+        uint8_t numPages = min(numEntries - entry, NFC_MAX_BURST_PAGES);
+        if (readPages(journeyLogPage() + entry, numPages, burst) == STATUS_FAILED) {
+            return STATUS_FAILED;
+        }
+        for (uint8_t i = 0; i < numPages; i++) {
+            journeyScanPage(scan, burst + i * 4);
+        }
+    }
+    journeyHead = journeyScanHead(scan, numEntries);
+    journeyLap = journeyScanLap(scan, numEntries);
+    return STATUS_SUCCEEDED;
+}
+
+// The journey log fills the user memory after the energy ring
+uint8_t OrbDockCore::journeyLogPage() {
+    return ENERGY_RING_PAGE + TAG_LAYOUTS[tagType].energySlots;
+}
+
+uint8_t OrbDockCore::journeyLogEntries() {
+    return TAG_LAYOUTS[tagType].userPageEnd - journeyLogPage();
+}
+
+// Appends this station and the orb's arrival energy to the journey log
+int OrbDockCore::logVisit() {
+    uint16_t tick = currentMillis / JOURNEY_TICK_MS;
+    journeyLogEncode(page_buffer, stationId, orbInfo.energy, tick, journeyLap);
+    if (writePage(journeyLogPage() + journeyHead, page_buffer) == STATUS_FAILED) {
+        Serial.println(F("Failed to log visit"));
+        return STATUS_FAILED;
+    }
+    journeyHead++;
+    if (journeyHead >= journeyLogEntries()) {
+        journeyHead = 0;
+        journeyLap = !journeyLap;
+    }
+    return STATUS_SUCCEEDED;
+}
+
+int OrbDockCore::setCustom(byte value) {
     Serial.print(F("Setting custom to "));
     Serial.println(value);
     Serial.print(F(" for station "));
-    Serial.println(STATION_NAMES[stationId]);
+    Serial.println(flashName(STATION_NAMES, stationId));
     orbInfo.stations[stationId].custom = value;
     int result = writeStation(stationId);
     return result;
 }
 
-Station OrbDock::getCurrentStationInfo() {
+Station OrbDockCore::getCurrentStationInfo() {
     return orbInfo.stations[stationId];
 }
 
-void OrbDock::handleError(const char* message) {
-    Serial.println(message);
-    onError(message);
-}
-
 // Formats the NFC with "ORBS" header, default station information and given trait
-int OrbDock::formatNFC(TraitId trait) {
+int OrbDockCore::formatNFC(TraitId trait) {
     Serial.println(F("Formatting NFC with ORBS header, default station information and given trait..."));
-    // Write header
-    memcpy(page_buffer, ORBS_HEADER, 4);
-    if (writePage(ORBS_PAGE, page_buffer) == STATUS_FAILED) {
+    // Find the newest energy record, so the new one goes after it and wins
+    if (readEnergy() == STATUS_FAILED) {
         return STATUS_FAILED;
     }
-    // Write default stations
-    if (resetOrb() == STATUS_FAILED) {
+    if (writeEnergy(INIT_ENERGY, true) == STATUS_FAILED) {
         return STATUS_FAILED;
     }
-    // Write trait
-    if (setTrait(trait) == STATUS_FAILED) {
-        return STATUS_FAILED;
+
+    // Blanks the journey log, so the entries an earlier orb left aren't read as this one's
+    // visits. Read a burst at a time, and only the pages that aren't zero are written
+    uint8_t blank[NFC_MAX_BURST_PAGES * 4];
+    memset(blank, 0, sizeof(blank));
+    uint8_t endPage = TAG_LAYOUTS[tagType].userPageEnd;
+    for (uint8_t page = journeyLogPage(); page < endPage; page += NFC_MAX_BURST_PAGES) {
+        if (verifyPages(page, min(endPage - page, NFC_MAX_BURST_PAGES), blank) == STATUS_FAILED) {
+            return STATUS_FAILED;
+        }
+    }
+    journeyHead = 0;
+    journeyLap = 0;
+
+    // Header, trait, legacy energy page and default stations as one verified group.
+    // The header is written last, so a half formatted tag doesn't look like an orb
+    orbInfo.trait = trait;
+    reInitializeStations();
+    uint8_t image[(STATIONS_PAGE_OFFSET + NUM_STATIONS - ORBS_PAGE) * 4];
+    memset(image, 0, sizeof(image));
+    memcpy(image, ORBS_HEADER, 4);
+    image[(TRAIT_PAGE - ORBS_PAGE) * 4] = static_cast<uint8_t>(trait);
+    image[(ENERGY_PAGE - ORBS_PAGE) * 4] = INIT_ENERGY;
+    for (int i = 0; i < NUM_STATIONS; i++) {
+        encodeStation(i, image + (STATIONS_PAGE_OFFSET - ORBS_PAGE + i) * 4);
+    }
+    return writePages(ORBS_PAGE, sizeof(image) / 4, image);
+}
+
+// Pages startPage on of a newly formatted orb: header, trait, default stations and
+// INIT_ENERGY in the legacy page and the first energy ring record, zeros elsewhere
+void OrbDockCore::encodeOrbImage(TraitId trait, uint8_t startPage, uint8_t numPages, uint8_t* data) {
+    memset(data, 0, numPages * 4);
+    for (uint8_t i = 0; i < numPages; i++) {
+        uint8_t* page = data + i * 4;
+        switch (startPage + i) {
+            case ORBS_PAGE:
+                memcpy(page, ORBS_HEADER, 4);
+                break;
+            case TRAIT_PAGE:
+                page[0] = static_cast<uint8_t>(trait);
+                break;
+            case ENERGY_PAGE:
+                page[0] = INIT_ENERGY;
+                break;
+            case ENERGY_RING_PAGE:
+                energyRingEncode(page, INIT_ENERGY, 0);
+                break;
+        }
+    }
+}
+
+// Writes the orb image over the whole user memory, journey log included, so a reused tag
+// keeps nothing of the orb it was. A fresh tag is all zeros, so only the pages that aren't
+// get written, then one bulk read per NFC_MAX_BURST_PAGES verifies the lot, rewriting what
+// doesn't match (the stale pages of a reused tag). The header goes last, once everything
+// else has verified, so a tag lifted half way is never taken for an orb. A fresh orb is 4
+// writes and 4 reads on an NTAG213, where formatNFC() does 18 writes and 5 reads
+int OrbDockCore::provisionOrb(TraitId trait) {
+    if (nfcHealth.stage != NFC_HEALTHY) {
+        return STATUS_FALSE;
+    }
+    if (isNFCConnected) {
+        // Provisioned already - waiting for it to be lifted, then straight back to looking
+        if (readPage(ORBS_PAGE) == STATUS_FAILED) {
+            endOrbSession();
+        }
+        return STATUS_FALSE;
+    }
+    if (!isNFCPresent()) {
+        return STATUS_FALSE;
     }
-    // Write energy
-    if (setEnergy(INIT_ENERGY) == STATUS_FAILED) {
+    isNFCConnected = true;
+    // Orbs, and tags that didn't answer, are left alone
+    if (isOrb() != STATUS_FALSE) {
+        return STATUS_FALSE;
+    }
+
+    nfcQuiet = true;
+    uint8_t image[NFC_MAX_BURST_PAGES * 4];
+    uint8_t endPage = TAG_LAYOUTS[tagType].userPageEnd;
+    int result = STATUS_SUCCEEDED;
+    for (int page = endPage - 1; page > ORBS_PAGE && result == STATUS_SUCCEEDED; page--) {
+        encodeOrbImage(trait, page, 1, image);
+        if (memcmp(image, "\0\0\0\0", 4) != 0) {
+            result = writePage(page, image);
+        }
+    }
+    for (uint8_t page = ORBS_PAGE + 1; page < endPage && result == STATUS_SUCCEEDED; page += NFC_MAX_BURST_PAGES) {
+        uint8_t numPages = min(endPage - page, NFC_MAX_BURST_PAGES);
+        encodeOrbImage(trait, page, numPages, image);
+        result = verifyPages(page, numPages, image);
+    }
+    if (result == STATUS_SUCCEEDED) {
+        encodeOrbImage(trait, ORBS_PAGE, 1, image);
+        result = writePages(ORBS_PAGE, 1, image);
+    }
+    nfcQuiet = false;
+
+    if (result == STATUS_FAILED) {
+        Serial.println(F("Provisioning failed"));
         return STATUS_FAILED;
     }
-    return STATUS_SUCCEEDED;
+    orbInfo.trait = trait;
+    orbInfo.energy = INIT_ENERGY;
+    energySlot = 0;
+    energySeq = 0;
+    journeyHead = 0;
+    journeyLap = 0;
+    return STATUS_TRUE;
 }
 
 // Set the orb to default station information - zero energy, not visited
-int OrbDock::resetOrb() {
+int OrbDockCore::resetOrb() {
     Serial.println("Initializing orb with default station information...");
     reInitializeStations();
     int status = writeStations();
@@ -367,16 +1022,11 @@ int OrbDock::resetOrb() {
         Serial.println("Failed to reset orb");
         return STATUS_FAILED;
     }
-    status = readOrbInfo();
-    if (status == STATUS_FAILED) {
-        Serial.println("Failed to reset orb");
-        return STATUS_FAILED;
-    }
     return STATUS_SUCCEEDED;
 }
 
 // Initialize stations information to default values
-void OrbDock::reInitializeStations() {
+void OrbDockCore::reInitializeStations() {
     Serial.println(F("Initializing stations information to default values..."));
     for (int i = 0; i < NUM_STATIONS; i++) {
         orbInfo.stations[i] = {false, 0};
@@ -384,266 +1034,434 @@ void OrbDock::reInitializeStations() {
 }
 
 // Read station information and trait from orb
-int OrbDock::readOrbInfo() {
+int OrbDockCore::readOrbInfo() {
     Serial.println("Reading trait and station information from orb...");
-    
-    // Read stations
+
+    // Trait, the legacy energy page and the stations are consecutive, so one readPages()
+    // gets them in bursts (two FAST_READs on an NTAG213) rather than a read per page
+    const uint8_t numPages = STATIONS_PAGE_OFFSET + NUM_STATIONS - TRAIT_PAGE;
+    uint8_t pages[numPages * 4];
+    if (readPages(TRAIT_PAGE, numPages, pages) == STATUS_FAILED) {
+        Serial.println(F("Failed to read trait and station information"));
+        return STATUS_FAILED;
+    }
+    orbInfo.trait = static_cast<TraitId>(pages[0]);
     for (int i = 0; i < NUM_STATIONS; i++) {
-        if (readPage(STATIONS_PAGE_OFFSET + i) == STATUS_FAILED) {
-            Serial.println(F("Failed to read station information"));
-            return STATUS_FAILED;
-        }
-        orbInfo.stations[i].visited = page_buffer[0] == 1;
-        orbInfo.stations[i].custom = page_buffer[1];
-        
+        const uint8_t* page = pages + (STATIONS_PAGE_OFFSET - TRAIT_PAGE + i) * 4;
+        orbInfo.stations[i].visited = page[0] == 1;
+        orbInfo.stations[i].custom = page[1];
+    }
+
+    // The energy ring, in bursts too
+    if (readEnergy() == STATUS_FAILED) {
+        Serial.println(F("Failed to read energy"));
+        return STATUS_FAILED;
     }
 
-    // Read trait
-    if (readPage(TRAIT_PAGE) == STATUS_FAILED) {
-        Serial.println(F("Failed to read trait"));
+    // Find where the next visit goes in the journey log
+    if (readJourneyHead() == STATUS_FAILED) {
+        Serial.println(F("Failed to read journey log"));
         return STATUS_FAILED;
     }
-    orbInfo.trait = static_cast<TraitId>(page_buffer[0]);
 
     printOrbInfo();
     return STATUS_SUCCEEDED;
 }
 
 // Write station information and trait to orb
-int OrbDock::writeOrbInfo() {
+int OrbDockCore::writeOrbInfo() {
     Serial.println("Writing stations to orb...");
-    writeStations();
-    setTrait(orbInfo.trait);
-    setEnergy(orbInfo.energy);
-
-    return STATUS_SUCCEEDED;
+    if (writeStations() == STATUS_FAILED) {
+        return STATUS_FAILED;
+    }
+    uint8_t traitPage[4] = {static_cast<uint8_t>(orbInfo.trait), 0, 0, 0};
+    if (writePages(TRAIT_PAGE, 1, traitPage) == STATUS_FAILED) {
+        return STATUS_FAILED;
+    }
+    return writeEnergy(orbInfo.energy, true);
 }
 
-// Write station data
-int OrbDock::writeStations() {
+// Write station data as one verified group
+int OrbDockCore::writeStations() {
+    uint8_t stations[NUM_STATIONS * 4];
     for (int i = 0; i < NUM_STATIONS; i++) {
-        if (writeStation(i) == STATUS_FAILED) {
-            return STATUS_FAILED;
-        }
+        encodeStation(i, stations + i * 4);
     }
-    return STATUS_SUCCEEDED;
+    return writePages(STATIONS_PAGE_OFFSET, NUM_STATIONS, stations);
 }
 
 /********************** LED FUNCTIONS *****************************/
 
-void OrbDock::setLEDPattern(LEDPatternId patternId) {
-    ledPatternConfig = LED_PATTERNS[patternId];
+void OrbDockCore::setLEDPattern(LEDPatternId patternId) {
+    const LEDPatternConfig& pattern = LED_PATTERNS[patternId];
+    if (pattern.overlay) {
+        // Cuts in and fades straight back out - showing it again while it plays doesn't restart it
+        LEDLayer& layer = ledLayers[patternId];
+        if (layer.alpha == 0) {
+            layer.alpha = pattern.brightness;
+            layer.previousMillis = currentMillis - pattern.interval;
+        }
+        layer.target = 0;
+        return;
+    }
+    for (uint8_t id = 0; id < LED_PATTERN_COUNT; id++) {
+        if (!LED_PATTERNS[id].overlay) {
+            ledLayers[id].target = id == patternId ? pattern.brightness : 0;
+        }
+    }
 }
 
-void OrbDock::runLEDPatterns() {
-    static unsigned long ledPreviousMillis;
-    static uint8_t ledBrightness;
-    //static unsigned long ledBrightnessPreviousMillis;
-    static unsigned int ledPatternInterval;
-
-    // If the LED pattern is orb_connected, set the LED speed based on energy level
-    if (ledPatternConfig.id == LED_PATTERN_ORB_CONNECTED) {
-        ledPatternInterval = map(MAX_ENERGY - orbInfo.energy, 0, MAX_ENERGY, 20, 100);
+void OrbDockCore::runLEDPatterns() {
+    if (currentMillis - ledPreviousMillis < LED_FRAME_INTERVAL) {
+        return;
     }
-    else {
-        ledPatternInterval = ledPatternConfig.interval;
+    ledPreviousMillis = currentMillis;
+
+    // Fade the layers and step the animations of the visible ones
+    bool changed = false;
+    for (uint8_t id = 0; id < LED_PATTERN_COUNT; id++) {
+        LEDLayer& layer = ledLayers[id];
+        uint8_t ramp = LED_PATTERNS[id].brightnessRamp;
+        if (layer.alpha < layer.target) {
+            layer.alpha = layer.target - layer.alpha > ramp ? layer.alpha + ramp : layer.target;
+            changed = true;
+        } else if (layer.alpha > layer.target) {
+            layer.alpha = layer.alpha - layer.target > ramp ? layer.alpha - ramp : layer.target;
+            changed = true;
+        }
+        if (layer.alpha == 0) {
+            continue;
+        }
+
+        // The chase speeds up with the orb's energy
+        unsigned int interval = id == LED_PATTERN_ORB_CONNECTED ?
+            map(MAX_ENERGY - orbInfo.energy, 0, MAX_ENERGY, 20, 100) : LED_PATTERNS[id].interval;
+        if (currentMillis - layer.previousMillis >= interval) {
+            layer.previousMillis = currentMillis;
+            switch (id) {
+                case LED_PATTERN_NO_ORB:
+                    led_rainbow();
+                    break;
+                case LED_PATTERN_ORB_CONNECTED:
+                    led_trait_chase();
+                    break;
+                case LED_PATTERN_IDLE:
+                    led_breathe();
+                    break;
+                case LED_PATTERN_FLASH:
+                    led_flash();
+                    break;
+                case LED_PATTERN_ERROR:
+                    led_error();
+                    break;
+            }
+            changed = true;
+        }
     }
 
-    if (currentMillis - ledPreviousMillis >= ledPatternInterval) {
-        ledPreviousMillis = currentMillis;
+    if (changed) {
+        composeLEDs();
+        // Gamma is applied by the render pass (see LedRender.h)
+        leds.show();
+    }
+}
 
-        switch (ledPatternConfig.id) {
-            case LED_PATTERN_NO_ORB: {
-                led_rainbow();
-                break;
-            }
-            case LED_PATTERN_ORB_CONNECTED: {
-                led_trait_chase();
-                break;
-            }
-            case LED_PATTERN_FLASH: {
-                led_flash();
-                break;
+// Blends the visible layers, bottom to top, into the frame in one pass over the pixels
+void OrbDockCore::composeLEDs() {
+    // Kept after the orb has gone, while the chase fades out. A trait byte off the end of
+    // the table (a damaged tag) keeps the last colour.
+    if (isOrbConnected && orbInfo.trait < NUM_TRAITS) {
+        ledTraitColor = traitColor(orbInfo.trait);
+    }
+    for (uint16_t i = 0; i < LED_COUNT; i++) {
+        uint8_t rgb[3] = {0, 0, 0};
+        for (uint8_t id = 0; id < LED_PATTERN_COUNT; id++) {
+            if (ledLayers[id].alpha > 0) {
+                uint8_t layerRgb[3];
+                ledLayerPixel(id, i, layerRgb);
+                ledBlend(rgb, layerRgb, ledLayers[id].alpha);
             }
-            default:
-                break;
         }
+        leds.setPixelColor(i, rgb[0], rgb[1], rgb[2]);
+    }
+}
 
-        // Set brightness
-        if (ledBrightness != ledPatternConfig.brightness) {
-            ledBrightness = ledPatternConfig.brightness;
-            strip.setBrightness(ledBrightness);
-        }
-        // Smooth brightness transitions
-        // TODO: This causes a bunch of flickering jank. Figure out why.
-        // if (ledBrightness != ledPatternConfig.brightness && currentMillis - ledBrightnessPreviousMillis >= ledPatternConfig.brightnessInterval) {
-        //     ledBrightnessPreviousMillis = currentMillis;
-        //     ledBrightness = lerp(ledBrightness, ledPatternConfig.brightness, ledPatternConfig.brightnessInterval);
-        //     strip.setBrightness(ledBrightness);
-        // }
+static void unpackColor(uint32_t color, uint8_t* rgb) {
+    rgb[0] = (uint8_t)(color >> 16);
+    rgb[1] = (uint8_t)(color >> 8);
+    rgb[2] = (uint8_t)color;
+}
 
-        strip.show();
+// One pixel of a layer, at full opacity
+void OrbDockCore::ledLayerPixel(uint8_t layer, uint16_t pixel, uint8_t* rgb) {
+    switch (layer) {
+        case LED_PATTERN_NO_ORB: {
+            // One rainbow around the ring
+            ledHue((uint16_t)rainbowHue + pixel * (65536 / LED_COUNT), rgb);
+            break;
+        }
+        case LED_PATTERN_ORB_CONNECTED: {
+            // Two dots opposite each other, brightness by distance to the nearer one
+            uint16_t distance = (pixel + LED_COUNT - chasePixel) % LED_COUNT;
+            if (distance > LED_COUNT / 2) distance = LED_COUNT - distance;
+            unpackColor(dimColor(ledTraitColor, chaseLevels[distance]), rgb);
+            break;
+        }
+        case LED_PATTERN_IDLE: {
+            // The whole ring in one colour, breathing between 1/8 and 1/3 (before gamma)
+            uint8_t level = 32 + ((ledSine(breathAngle) + 127) * 48 >> 8);
+            unpackColor(dimColor(LED_IDLE_COLOR, level), rgb);
+            break;
+        }
+        case LED_PATTERN_FLASH: {
+            // Trait colour, brighter and darker in waves around the ring
+            int8_t shift = ledSine(flashHueOffset + 360 * pixel / LED_COUNT);
+            unpackColor(ledTraitColor, rgb);
+            for (uint8_t c = 0; c < 3; c++) {
+                // Up to +/- 30/360 of the channel
+                int16_t value = rgb[c] + (((int32_t)rgb[c] * shift * 43) >> 16);
+                rgb[c] = constrain(value, 0, 255);
+            }
+            break;
+        }
+        case LED_PATTERN_ERROR: {
+            rgb[0] = errorRed;
+            rgb[1] = 0;
+            rgb[2] = errorBlue;
+            break;
+        }
     }
-
 }
 
-// Rainbow cycle along whole strip. Pass delay time (in ms) between frames.
-void OrbDock::led_rainbow() {
-    static long firstPixelHue = 0;
-    if (firstPixelHue < 5*65536) {
-      strip.rainbow(firstPixelHue, 1, 255, 255, true);
-      firstPixelHue += 256;
+// Rainbow cycle along whole strip
+void OrbDockCore::led_rainbow() {
+    if (rainbowHue < 5*65536) {
+      rainbowHue += 256;
     } else {
-      firstPixelHue = 0; // Reset for next cycle
+      rainbowHue = 0; // Reset for next cycle
     }
 }
 
 // Rotates a weakening dot around the NeoPixel ring using the trait color
-void OrbDock::led_trait_chase() {
-    static uint16_t currentPixel = 0;
-    static uint8_t intensity = 255;
-    static uint8_t globalIntensity = 0;
-    static int8_t globalDirection = 1;
+void OrbDockCore::led_trait_chase() {
+    const uint8_t intensity = 255;
     
     // Update global intensity
-    globalIntensity += globalDirection * 9;  // Adjust 2 to change global fade speed
-    if (globalIntensity >= 255 || globalIntensity <= 30) {
-        globalDirection *= -1;
-        globalIntensity = constrain(globalIntensity, 30, 255);
+    chaseIntensity += chaseDirection * 9;  // Adjust 2 to change global fade speed
+    if (chaseIntensity >= 255 || chaseIntensity <= 30) {
+        chaseDirection *= -1;
+        chaseIntensity = constrain(chaseIntensity, 30, 255);
     }
 
-    // Find the trait color
-    uint32_t traitColor = TRAIT_COLORS[static_cast<int>(orbInfo.trait)];
-
-    // Calculate opposite pixel position
-    uint16_t oppositePixel = (currentPixel + (NEOPIXEL_COUNT / 2)) % NEOPIXEL_COUNT;
-    
-    // Set both bright dots
-    uint8_t adjustedIntensity = (uint16_t)intensity * globalIntensity / 255;
-    strip.setPixelColor(currentPixel, dimColor(traitColor, adjustedIntensity));
-    strip.setPixelColor(oppositePixel, dimColor(traitColor, adjustedIntensity));
-    
-    // Set pixels between the dots with decreasing intensity
-    for (int i = 1; i < NEOPIXEL_COUNT/2; i++) {
-        // Calculate pixels on both sides
-        uint16_t pixel1 = (currentPixel + i) % NEOPIXEL_COUNT;
-        uint16_t pixel2 = (currentPixel - i + NEOPIXEL_COUNT) % NEOPIXEL_COUNT;
-        
+    // Both bright dots, and the pixels between them with decreasing intensity
+    chaseLevels[0] = (uint16_t)intensity * chaseIntensity / 255;
+    chaseLevels[LED_COUNT / 2] = chaseLevels[0];
+    for (int i = 1; i < LED_COUNT/2; i++) {
         // Calculate fade based on distance to nearest bright dot
-        float fadeRatio = pow(float(NEOPIXEL_COUNT/4 - abs(i - NEOPIXEL_COUNT/4)) / (NEOPIXEL_COUNT/4), 2);
+        float fadeRatio = pow(float(LED_COUNT/4 - abs(i - LED_COUNT/4)) / (LED_COUNT/4), 2);
         uint8_t fadeIntensity = round(intensity * fadeRatio);
-        adjustedIntensity = (uint16_t)fadeIntensity * globalIntensity / 255;
-        
-        if (adjustedIntensity > 0) {
-            strip.setPixelColor(pixel1, dimColor(traitColor, adjustedIntensity));
-            strip.setPixelColor(pixel2, dimColor(traitColor, adjustedIntensity));
-        }
+        chaseLevels[i] = (uint16_t)fadeIntensity * chaseIntensity / 255;
     }
     
     // Move to next pixel
-    currentPixel = (currentPixel + 1) % NEOPIXEL_COUNT;
-}
-
-void OrbDock::led_flash() {
-    static uint8_t intensity = 255;
-    static int8_t intensityDirection = -1;
-    static uint16_t hueOffset = 0;
-    static bool cycleComplete = false;
-
-    // If cycle is complete, switch to appropriate pattern
-    if (cycleComplete) {
-        intensity = 255;
-        intensityDirection = -1;
-        hueOffset = 0;
-        cycleComplete = false;
-        if (isOrbConnected) {
-            setLEDPattern(LED_PATTERN_ORB_CONNECTED);
-        } else {
-            setLEDPattern(LED_PATTERN_NO_ORB);
+    chasePixel = (chasePixel + 1) % LED_COUNT;
+}
+
+// Rotates the flash's waves the opposite way to the chase
+void OrbDockCore::led_flash() {
+    flashHueOffset = (flashHueOffset - 8 + 360) % 360;
+}
+
+// One breath every 360 / 5 steps of IDLE_LED_INTERVAL, about 3 s
+void OrbDockCore::led_breathe() {
+    breathAngle = (breathAngle + 5) % 360;
+}
+
+// Red to blue and back
+void OrbDockCore::led_error() {
+    if (errorToRed) {
+        errorRed = min(255, errorRed + 15);
+        errorBlue = max(0, errorBlue - 15);
+        if (errorRed >= 255 && errorBlue <= 0) {
+            errorToRed = false;
+        }
+    } else {
+        errorRed = max(0, errorRed - 15); 
+        errorBlue = min(255, errorBlue + 15);
+        if (errorRed <= 0 && errorBlue >= 255) {
+            errorToRed = true;
         }
-        return;
     }
+}
+
+uint32_t OrbDockCore::dimColor(uint32_t color, uint8_t intensity) {
+  uint8_t r = (uint8_t)(color >> 16);
+  uint8_t g = (uint8_t)(color >> 8);
+  uint8_t b = (uint8_t)color;
+  
+  r = (r * intensity) >> 8;
+  g = (g * intensity) >> 8;
+  b = (b * intensity) >> 8;
+  
+  return LedOutput::Color(r, g, b);
+}
+
+/********************** IDLE FUNCTIONS *****************************/
+
+#if IDLE_AFTER_MS > 0
 
-    // Get base trait color and extract hue
-    uint32_t traitColor = TRAIT_COLORS[static_cast<int>(orbInfo.trait)];
-    uint8_t r = (uint8_t)(traitColor >> 16);
-    uint8_t g = (uint8_t)(traitColor >> 8); 
-    uint8_t b = (uint8_t)traitColor;
+// Set by a pin change on a wake pin
+static volatile bool idlePinWoken = false;
 
-    // Fast fade intensity
-    intensity += intensityDirection * 12;
-    if (intensity <= 30 || intensity >= 255) {
-        intensityDirection *= -1;
-        intensity = constrain(intensity, 30, 255);
-        if (intensity <= 30) {
-            cycleComplete = true;
+#ifdef __AVR__
+// Only wake the CPU and note it, the station reads its pins as usual
+ISR(PCINT0_vect) {
+    idlePinWoken = true;
+}
+ISR(PCINT1_vect, ISR_ALIASOF(PCINT0_vect));
+ISR(PCINT2_vect, ISR_ALIASOF(PCINT0_vect));
+#endif
+
+void OrbDockCore::wakeOnPin(uint8_t pin) {
+#ifdef __AVR__
+    volatile uint8_t* pcicr = digitalPinToPCICR(pin);
+    if (pcicr) {
+        *digitalPinToPCMSK(pin) |= 1 << digitalPinToPCMSKbit(pin);
+        *pcicr |= 1 << digitalPinToPCICRbit(pin);
+    }
+#endif
+}
+
+// Called at the end of every loop() pass, see IdlePower.h
+void OrbDockCore::runIdle(bool ledPatterns) {
+    // An orb on the dock, a station running the NFC itself or a button keep it awake
+    if (isOrbConnected || nfcPollingPaused || idlePinWoken) {
+        idlePinWoken = false;
+        idleActivity();
+        return;
+    }
+    if (idlePowerCheck(idlePower, millis())) {
+        Serial.println(F("Idle"));
+        nfcCheckInterval = IDLE_NFC_CHECK_INTERVAL;
+        if (ledPatterns) {
+            setLEDPattern(LED_PATTERN_IDLE);
         }
     }
+    if (!idlePower.idle) {
+        return;
+    }
 
-    // Rotate hue offset in opposite direction
-    hueOffset = (hueOffset - 8 + 360) % 360;
+    // Until the next poll, unless the PN532 is being recovered
+    if (!nfcPoweredDown && nfcHealth.stage == NFC_HEALTHY && !nfcHealth.suspect) {
+        powerDownNFC();
+    }
 
-    // Fill strip with hue-shifted colors
-    for (int i = 0; i < NEOPIXEL_COUNT; i++) {
-        // Calculate hue offset for this pixel
-        uint16_t pixelHue = (hueOffset + (360 * i / NEOPIXEL_COUNT)) % 360;
-        
-        // Create color with similar hue to trait color but varying
-        float hueShift = sin(pixelHue * PI / 180.0) * 30; // +/- 30 degree hue shift
-        uint32_t shiftedColor = strip.Color(
-            r + (r * hueShift/360),
-            g + (g * hueShift/360),
-            b + (b * hueShift/360)
-        );
+    unsigned long elapsed = millis() - lastNFCCheckTime;
+    unsigned long wait = elapsed < nfcCheckInterval ? nfcCheckInterval - elapsed : 0;
+    if (ledPatterns) {
+        wait = min(wait, ledIdleWait());
+    }
+    if (wait > IDLE_SLEEP_MAX_MS) {
+        wait = IDLE_SLEEP_MAX_MS;
+    }
+    if (wait > 0) {
+        idleSleep(wait);
+    }
+}
 
-        strip.setPixelColor(i, dimColor(shiftedColor, intensity));
+// Back to full speed. The orb's own pattern is already set when it was an orb that woke it
+void OrbDockCore::idleActivity() {
+    if (!idlePowerActivity(idlePower, millis())) {
+        return;
+    }
+    Serial.println(F("Awake"));
+    nfcCheckInterval = NFC_CHECK_INTERVAL;
+    wakeNFC();
+    if (!isOrbConnected) {
+        setLEDPattern(LED_PATTERN_NO_ORB);
     }
 }
 
-void OrbDock::led_error() {
-    static uint8_t r = 0;
-    static uint8_t b = 255;
-    static bool toRed = true;
+void OrbDockCore::idleSleep(unsigned long ms) {
+    unsigned long startMicros = micros();
+#ifdef __AVR__
+    // Idle sleep keeps timer 0, the UART and the pin change interrupts running: millis()
+    // goes on, and its tick wakes the CPU every 1.024 ms to check the time
+    unsigned long start = millis();
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    while (millis() - start < ms && !Serial.available() && !idlePinWoken) {
+        sleep_mode();
+    }
+#else
+    // Host builds (tools/) - virtual time, the serial port and the tag are looked at after
+    delay(ms);
+#endif
+    idlePowerSlept(idlePower, micros() - startMicros);
+}
 
-    if (toRed) {
-        r = min(255, r + 1);
-        b = max(0, b - 1);
-        if (r >= 255 && b <= 0) {
-            toRed = false;
+// Milliseconds until runLEDPatterns has a frame to render
+unsigned long OrbDockCore::ledIdleWait() {
+    unsigned long now = millis();
+    unsigned long wait = IDLE_SLEEP_MAX_MS;
+    for (uint8_t id = 0; id < LED_PATTERN_COUNT; id++) {
+        const LEDLayer& layer = ledLayers[id];
+        unsigned long since;
+        unsigned long interval;
+        if (layer.alpha != layer.target) {
+            // Fading, a frame every LED_FRAME_INTERVAL
+            since = ledPreviousMillis;
+            interval = LED_FRAME_INTERVAL;
+        } else if (layer.alpha > 0) {
+            since = layer.previousMillis;
+            interval = LED_PATTERNS[id].interval;
+        } else {
+            continue;
         }
-    } else {
-        r = max(0, r - 1); 
-        b = min(255, b + 1);
-        if (r <= 0 && b >= 255) {
-            toRed = true;
+        unsigned long elapsed = now - since;
+        if (elapsed >= interval) {
+            return 0;
         }
+        wait = min(wait, interval - elapsed);
     }
+    return wait;
+}
 
-    for(int i = 0; i < NEOPIXEL_COUNT; i++) {
-        strip.setPixelColor(i, r, 0, b);
-    }
+// PowerDown (UM0701 7.2.11), woken by its SPI select going low. Its RF field goes off.
+// The library keeps reading a response to itself, so the ACK is all there is to go by; a
+// PN532 that stayed up anyway answers the wake-up probe as usual (see wakeNFC())
+void OrbDockCore::powerDownNFC() {
+    uint8_t command[2] = {PN532_COMMAND_POWERDOWN, 0x20};  // WakeUpEnable: SPI
+    nfcPoweredDown = nfc.sendCommandCheckAck(command, sizeof(command));
 }
 
-// Helper function to dim a 32-bit color value by a certain intensity (0-255)
-uint32_t OrbDock::dimColor(uint32_t color, uint8_t intensity) {
-  uint8_t r = (uint8_t)(color >> 16);
-  uint8_t g = (uint8_t)(color >> 8);
-  uint8_t b = (uint8_t)color;
-  
-  r = (r * intensity) >> 8;
-  g = (g * intensity) >> 8;
-  b = (b * intensity) >> 8;
-  
-  return strip.Color(r, g, b);
+// The first command after PowerDown wakes the PN532 and is answered once it's up, so it
+// doubles as a probe: a PN532 that doesn't answer it gets the health check's probe
+void OrbDockCore::wakeNFC() {
+    if (!nfcPoweredDown) {
+        return;
+    }
+    nfcPoweredDown = false;
+    if (!nfc.getFirmwareVersion()) {
+        nfcHealthTimedOut(nfcHealth);
+    }
 }
 
-float OrbDock::lerp(float start, float end, float t) {
-    return start + t * (end - start);
+void OrbDockCore::printIdleStats() {
+    unsigned long now = millis();
+    uint16_t awake = idlePowerPermille(now - idlePower.sleptMillis, now);
+    uint16_t idle = idlePowerPermille(idlePowerIdleMillis(idlePower, now), now);
+    Serial.print(F("Idle - awake: "));
+    Serial.print(awake / 10);
+    Serial.print('.');
+    Serial.print(awake % 10);
+    Serial.print(F("% idle: "));
+    Serial.print(idle / 10);
+    Serial.print('.');
+    Serial.print(idle % 10);
+    Serial.print(F("% wakes: "));
+    Serial.println(idlePower.wakes);
 }
 
-// Provide empty implementations for pure virtual functions to satisfy the linker
-void OrbDock::onOrbConnected() {}
-void OrbDock::onOrbDisconnected() {}
-void OrbDock::onError(const char* errorMessage) {}
-void OrbDock::onUnformattedNFC() {}
+#endif
+
 /********************** MISC FUNCTIONS *****************************/
@@ -4,10 +4,16 @@
 #include <Wire.h>
 #include <SPI.h>
 #include <Adafruit_PN532.h>
-#include <Adafruit_NeoPixel.h>
-
-// NeoPixel pin 
-#define NEOPIXEL_PIN (6)
+#include "LedOutput.h"
+#include "EnergyRing.h"
+#include "JourneyLog.h"
+#include "RetryPolicy.h"
+#include "NFCTrace.h"
+#include "NFCHealth.h"
+#include "EventQueue.h"
+#include "OrbRegistry.h"
+#include "IdlePower.h"
+#include "TagImage.h"
 
 // PN532 pins - latest design
 #define PN532_SCK   (5)
@@ -27,6 +33,20 @@
 #define PN532_MOSI1 (3)
 #define PN532_SS1   (4)
 
+// The pin layouts begin() tries in turn (SCK, MISO, MOSI, SS), and the recovery's pin probe
+#define PN532_PIN_LAYOUTS 3
+const uint8_t PN532_PINS[PN532_PIN_LAYOUTS][4] = {
+    {PN532_SCK, PN532_MISO, PN532_MOSI, PN532_SS},
+    {PN532_SCK2, PN532_MISO2, PN532_MOSI2, PN532_SS2},
+    {PN532_SCK1, PN532_MISO1, PN532_MOSI1, PN532_SS1}
+};
+const char PN532_PIN_LAYOUT_NAME_LATEST[] PROGMEM = "latest";
+const char PN532_PIN_LAYOUT_NAME_V2[] PROGMEM = "V2";
+const char PN532_PIN_LAYOUT_NAME_V1[] PROGMEM = "V1";
+const char* const PN532_PIN_LAYOUT_NAMES[] PROGMEM = {
+    PN532_PIN_LAYOUT_NAME_LATEST, PN532_PIN_LAYOUT_NAME_V2, PN532_PIN_LAYOUT_NAME_V1
+};
+
 // Status constants
 #define STATUS_FAILED    0
 #define STATUS_SUCCEEDED 1
@@ -34,71 +54,42 @@
 #define STATUS_TRUE      3
 
 // Communication constants
-#define MAX_RETRIES      4
-#define RETRY_DELAY      10
+#define VERIFY_ROUNDS    2      // Times mismatched pages are rewritten after a verify read before giving up
 #define NFC_TIMEOUT      1000
 #define DELAY_AFTER_CARD_PRESENT 50
 #define NFC_CHECK_INTERVAL 300
+#ifndef NFC_TRACE_SIZE
+#define NFC_TRACE_SIZE   16     // PN532 transactions kept for NFC_TRACE_COMMAND, 0 to leave the trace out
+#endif
 
-// NFC constants
-#define PAGE_OFFSET 4
-#define ORBS_PAGE (PAGE_OFFSET + 0)
-#define TRAIT_PAGE (PAGE_OFFSET + 1) 
-#define ENERGY_PAGE (PAGE_OFFSET + 2)
-#define STATIONS_PAGE_OFFSET (PAGE_OFFSET + 3)
-#define ORBS_HEADER "ORBS"
-
-// LED constants
-#define NEOPIXEL_COUNT  24
+// NTAG commands sent through the PN532 with inDataExchange
+#define NTAG_CMD_GET_VERSION 0x60  // Returns vendor, product type and storage size
+#define NTAG_CMD_READ      0x30    // Returns 4 pages starting at the given page
+#define NTAG_CMD_WRITE     0xA2    // Writes 1 page, answered with an ACK
+#define NTAG_CMD_FAST_READ 0x3A    // Returns all pages between start and end page
+#define NFC_MAX_BURST_PAGES 12     // Pages per FAST_READ that fit in the PN532 library's 64 byte frame buffer
+#define TAG_CACHE_SIZE 4           // Remembered tag types, so a re-seated orb skips GET_VERSION
 
-// Orb constants
-#define NUM_STATIONS 14
-#define NUM_TRAITS 6
+// Orb constants (stations, traits and the page layout are in OrbRegistry.h)
 #define MAX_ENERGY 250
 #define INIT_ENERGY 5
 #define ALCHEMIZATION_ENERGY 42
 
-enum TraitId {
-    NONE, RUMINATE, SHAME, DOUBT, DISCONTENT, HOPELESS
-};
-
-const char* const TRAIT_NAMES[] = {
-    "NONE",
-    "RUMINATE",
-    "SHAME",
-    "DOUBT",
-    "DISCONTENT",
-    "HOPELESS"
-};
-
-const uint32_t TRAIT_COLORS[] = {
-    0xFF0000,  // None
-    0xFF2800,  // Orange for RUMINATE (Rumination)
-    0xFF4600,  // Yellow for SHAME (Shame Spiral)
-    0x20FF00,  // Green for DOUBT (Self Doubt)
-    0xFF00D2,  // Pink/Magenta for DISCONTENT (Discontentment)
-    0x1400FF   // Blue for HOPELESS (Hopelessness)
-};
-
-const char* const TRAIT_COLOR_NAMES[] = {
-    "red",     // None
-    "orange",  // Rumination
-    "yellow",  // Shame Spiral
-    "green",   // Self Doubt
-    "pink",    // Discontentment
-    "blue"     // Hopelessness
-};
+// A name from one of the PROGMEM tables (see registryName()), for Serial.print()
+inline const __FlashStringHelper* flashName(const char* const* table, uint8_t index) {
+    return reinterpret_cast<const __FlashStringHelper*>(registryName(table, index));
+}
 
-enum StationId {
-    GENERIC, CONFIGURE, CONSOLE, DISTILLER, CASINO, FOREST,
-    ALCHEMY, PIPES, CHECKER, SLERP, RETOXIFY,
-    GENERATOR, STRING, CHILL, HUNT
+// NFC failure classes (see RetryPolicy.h)
+const char NFC_FAILURE_NAME_ERROR[] PROGMEM = "error";
+const char NFC_FAILURE_NAME_LENGTH[] PROGMEM = "wrong length";
+const char* const NFC_FAILURE_NAMES[] PROGMEM = {
+    NFC_FAILURE_NAME_ERROR, NFC_FAILURE_NAME_LENGTH
 };
 
-const char* const STATION_NAMES[] = {
-    "GENERIC", "CONFIGURE", "CONSOLE", "DISTILLER", "CASINO", "FOREST",
-    "ALCHEMY", "PIPES", "CHECKER", "SLERP", "RETOXIFY",
-    "GENERATOR", "STRING", "CHILL", "HUNT"
+struct TagCacheEntry {
+    uint8_t uid[7];
+    uint8_t type;
 };
 
 // Station struct
@@ -107,40 +98,74 @@ struct Station {
     byte custom;
 };
 
+// The dock's LED layers, bottom to top. Each frame blends the visible ones into the
+// frame in one pass over the pixels (see composeLEDs), so an overlay such as the flash
+// plays over the chase without stopping or restarting it.
 enum LEDPatternId {
-    LED_PATTERN_NO_ORB,
-    LED_PATTERN_ORB_CONNECTED,
-    LED_PATTERN_FLASH
+    LED_PATTERN_NO_ORB,         // Base: rainbow while the dock is empty
+    LED_PATTERN_ORB_CONNECTED,  // Base: chase in the orb's trait colour
+    LED_PATTERN_IDLE,           // Base: dim breathing while the dock is idle (see IdlePower.h)
+    LED_PATTERN_FLASH,          // Overlay: energy changed
+    LED_PATTERN_ERROR,          // Overlay: the station reported an error, or the PN532 isn't answering
+    LED_PATTERN_COUNT
 };
 
 struct LEDPatternConfig {
     int id;
-    uint8_t brightness;
-    uint16_t interval;
-    float brightnessInterval;
+    uint8_t brightness;         // Opacity of the layer when shown, out of 255 (applied before gamma)
+    uint16_t interval;          // Animation step, in ms
+    uint8_t brightnessRamp;     // Opacity steps per frame when fading in or out
+    bool overlay;               // Overlays cut in and fade out by themselves, base patterns replace each other
 };
 
+#define LED_FRAME_INTERVAL 10   // Shortest time between frames, in ms - frames are only rendered when something changed
+#define LED_IDLE_COLOR 0x4080FF // Of the breathing while idle
+
 const LEDPatternConfig LED_PATTERNS[] = {
     {
         .id = LED_PATTERN_NO_ORB,
-        .brightness = 200,
+        .brightness = 226,      // 226^2 - shows as brightness 200 did before gamma correction
         .interval = 15,
-        .brightnessInterval = 5.0f
+        .brightnessRamp = 4,
+        .overlay = false
     },
     {
         .id = LED_PATTERN_ORB_CONNECTED,
         .brightness = 255,
-        .interval = 80,
-        .brightnessInterval = 5.0f
+        .interval = 80,         // Replaced by 20-100 ms by energy
+        .brightnessRamp = 8,
+        .overlay = false
+    },
+    {
+        .id = LED_PATTERN_IDLE,
+        .brightness = 255,      // The breathing itself is dim, see ledLayerPixel
+        .interval = IDLE_LED_INTERVAL,
+        .brightnessRamp = 2,
+        .overlay = false
     },
     {
         .id = LED_PATTERN_FLASH,
         .brightness = 255,
         .interval = 10,
-        .brightnessInterval = 5.0f
+        .brightnessRamp = 12,
+        .overlay = true
+    },
+    {
+        .id = LED_PATTERN_ERROR,
+        .brightness = 255,
+        .interval = 10,
+        .brightnessRamp = 3,
+        .overlay = true
     }
 };
 
+// State of one LED layer
+struct LEDLayer {
+    uint8_t alpha;              // Opacity in the current frame
+    uint8_t target;             // Opacity it is fading to
+    unsigned long previousMillis;   // Last animation step
+};
+
 // Additional helper structs/enums
 struct OrbInfo {
     TraitId trait;
@@ -148,93 +173,481 @@ struct OrbInfo {
     Station stations[NUM_STATIONS];
 };
 
-class OrbDock {
+// Everything a dock does that doesn't call back into the station, see OrbDock below
+class OrbDockCore {
+    // Runs the NFC session and calls the station back
+    template <class Station> friend class OrbDock;
+#ifdef ORB_BENCHMARK
+    // Times the private NFC and LED methods, see Benchmark.cpp
+    friend class OrbDockBenchmark;
+#endif
 public:
-    OrbDock(StationId id);
-    virtual ~OrbDock();
+    // ledCount is 0 for stations without LEDs, so no pixel buffer is allocated
+    OrbDockCore(StationId id, uint16_t ledCount);
+    ~OrbDockCore();
     
-    virtual void begin();
-    virtual void loop();
+    void begin();
+    // Gets the events of the kinds in mask (EVENT_MASK) from the next loop() on, see
+    // EventQueue.h. Returns false if there are EVENT_SUBSCRIBERS already
+    bool subscribe(EventHandler handler, void* context, uint8_t mask, const char* name);
 
 protected:
     // State variables
     StationId stationId;
     OrbInfo orbInfo;
+    // The orb as it was when its session ended: onOrbDisconnected() runs after
+    // endOrbSession() has cleared orbInfo, so what was lifted is only here
+    OrbInfo departedOrb;
     bool isNFCConnected;
     bool isOrbConnected;
     bool isUnformattedNFC;
+    // The orb on the dock hadn't visited this station before, set before its visit is
+    // written (getCurrentStationInfo().visited is already true in onOrbConnected())
+    bool firstVisit;
+    // Set by a station that runs the NFC itself (mass provisioning): loop() then only keeps
+    // the PN532 health check
+    bool nfcPollingPaused;
     
+    // The LEDs, drawn by the LED patterns or by the station itself (FEATURE_LEDS)
+    LedOutput leds;
+
     // Timing variables
     unsigned long currentMillis;
-
-    // Virtual methods for child classes to implement
-    virtual void onOrbConnected() = 0;
-    virtual void onOrbDisconnected() = 0;
-    virtual void onError(const char* errorMessage) = 0;
-    virtual void onUnformattedNFC() = 0;
-    virtual void onEnergyLevelChanged(byte newEnergy) {};
+    unsigned long lastNFCCheckTime;
+    uint16_t nfcCheckInterval;  // NFC_CHECK_INTERVAL, or IDLE_NFC_CHECK_INTERVAL while idle
+#if IDLE_AFTER_MS > 0
+    IdlePower idlePower;
+#endif
 
     // Helper methods that child classes can use
     Station getCurrentStationInfo();
     // Returns the trait name
-    const char* getTraitName();
-    // Resets the station information, but keeps the trait
-    int resetOrb();
-    // Resets the orb with a new trait
-    int formatNFC(TraitId newTrait);
-    // Writes the trait to the orb
-    int setTrait(TraitId newTrait);
-    // Adds energy to the orb
-    int addEnergy(byte amount);
-    // Removes energy from the orb
-    int removeEnergy(byte amount);
-    // Sets the energy of the orb
-    int setEnergy(byte amount);
+    const __FlashStringHelper* getTraitName();
+    // Returns the 7 byte UID of the current (or last) orb
+    const uint8_t* getNFCUid();
     // Sets the visited status of the current station
     int setVisited(bool visited);
     // Sets the custom value of the current station
     int setCustom(byte value);
-    // Sets the LED pattern
+    // Shows an LED pattern: a base pattern crossfades from the other one, an overlay plays once on top
     void setLEDPattern(LEDPatternId patternId);
     // Reads and prints the entire NFC storage
     void printNFCStorage();
+    // A pin change on pin wakes the dock from idle (battery docks, see IdlePower.h)
+#if IDLE_AFTER_MS > 0
+    void wakeOnPin(uint8_t pin);
+#else
+    void wakeOnPin(uint8_t pin) {}
+#endif
+    // Number of NFC failures of a class since boot
+    uint16_t getNFCFailureCount(NFCFailure failure);
+    // Number of times a failed re-select ended an NFC operation early because the tag was gone
+    uint16_t getNFCTagGoneCount();
+    // Prints the NFC failure counters
+    void printNFCStats();
+    // Sends the PN532 transaction trace as a binary frame (see NFCTrace.h)
+    void dumpNFCTrace();
+    // Sends the tag in the field as a binary image frame (see TagImage.h)
+    void dumpTagImage();
+    // Writes a tag image sent over the serial port onto the tag in the field (see TagImage.h).
+    // Blocks until it's done, well under a second for an NTAG213
+    void restoreTagImage();
+    // Whether the PN532 answers, and how its recoveries went (see NFCHealth.h)
+    const NFCHealth& getNFCHealth();
+    // Queues an event for the subscribers, handed out at the end of this loop() pass
+    void postEvent(EventType type, uint8_t value = 0, const char* message = NULL);
+    // Prints the events posted and dropped, and the time each subscriber took
+    void printEventStats();
 
 private:
+    // Wrapped by OrbDock, which checks the station declared the feature and calls it back
+    int resetOrb();
+    int formatNFC(TraitId newTrait);
+    int provisionOrb(TraitId trait);
+    int setTrait(TraitId newTrait);
+    int setEnergy(byte amount);
+
     // NFC helper methods
     int writeStation(int stationID);
     int writeStations();
+    void encodeStation(int stationId, uint8_t* page);
+    void encodeOrbImage(TraitId trait, uint8_t startPage, uint8_t numPages, uint8_t* data);
+    int writeEnergy(byte energy, bool verify);
+    int nfcExchange(uint8_t* command, uint8_t commandLength, uint8_t* response, uint8_t responseLength);
+    bool selectTag(uint8_t attempt);
+    void traceNFC(uint8_t command, uint8_t page, uint8_t result, uint8_t attempt, unsigned long startMicros);
     int writePage(int page, uint8_t* data);
+    int writePages(uint8_t startPage, uint8_t numPages, uint8_t* data);
+    int verifyPages(uint8_t startPage, uint8_t numPages, uint8_t* data);
     int readPage(int page);
+    int readPages(uint8_t startPage, uint8_t numPages, uint8_t* buffer);
+    int readEnergy();
+    int readJourneyHead();
+    int detectTagType();
+    uint8_t journeyLogPage();
+    uint8_t journeyLogEntries();
+    int logVisit();
+    // The chunks of a restore, returns a TagImageResult
+    uint8_t restoreTagImagePages();
+    void sendTagImageReply(uint8_t result, uint8_t page);
     int readOrbInfo();
     int writeOrbInfo();
     void reInitializeStations();
     bool isNFCPresent();
     bool isNFCActive();
+    // Finds the PN532 on one of PN532_PINS and configures it, false if it's on none
+    bool probeNFC();
+    void configureNFC();
+    // Probes the PN532 now and then and runs its recovery, false while it doesn't answer
+    bool checkNFCHealth();
+    // Hands the events queued before it to the subscribers
+    void dispatchEvents();
+    // Goes idle after the quiet time, and sleeps until the next poll or LED step while idle
+#if IDLE_AFTER_MS > 0
+    void runIdle(bool ledPatterns);
+    void idleActivity();
+    void idleSleep(unsigned long ms);
+    unsigned long ledIdleWait();
+    void powerDownNFC();
+    void wakeNFC();
+    void printIdleStats();
+#else
+    void runIdle(bool ledPatterns) {}
+#endif
     int isOrb();
     void printOrbInfo();
     void endOrbSession();
 
     // LED pattern methods
     void runLEDPatterns();
+    void composeLEDs();
+    void ledLayerPixel(uint8_t layer, uint16_t pixel, uint8_t* rgb);
+    // Animation steps of the layers
     void led_rainbow();
     void led_trait_chase();
     void led_flash();
     void led_error();
+    void led_breathe();
     uint32_t dimColor(uint32_t color, uint8_t intensity);
-    float lerp(float start, float end, float t);
 
-    // Additional helper methods
-    void handleError(const char* message);
-    
+    EventQueue events;
+
     // Hardware objects
-    Adafruit_NeoPixel strip;
     Adafruit_PN532 nfc;
+    uint8_t nfcPinLayout;       // Index into PN532_PINS
+    bool nfcPoweredDown;        // In PowerDown until the next command, see wakeNFC()
+    NFCHealth nfcHealth;
+    unsigned long nfcHealthCheckTime;
     
-    // LED variables
-    LEDPatternConfig ledPatternConfig;
+    // LED variables - per dock rather than static, so several docks can run in one process (tools/fleet-sim)
+    LEDLayer ledLayers[LED_PATTERN_COUNT];
+    unsigned long ledPreviousMillis;
+    long rainbowHue;
+    uint16_t chasePixel;
+    uint8_t chaseIntensity;
+    int8_t chaseDirection;
+    uint8_t chaseLevels[LED_COUNT / 2 + 1];    // Chase brightness by distance from the dot, for the current frame
+    uint32_t ledTraitColor;             // Of the orb on the dock, or the last one
+    uint16_t flashHueOffset;
+    uint8_t errorRed;
+    uint8_t errorBlue;
+    bool errorToRed;
+    uint16_t breathAngle;
     
     // NFC
     byte page_buffer[4];
+    uint8_t nfcUid[7];
+    TagType tagType;
+    TagCacheEntry tagCache[TAG_CACHE_SIZE];
+    uint8_t tagCacheNext;
+    // Set when a re-select failed, so the rest of the session's NFC operations fail straight away
+    bool nfcTagGone;
+    bool nfcQuiet;              // Leaves out the per page serial logging (mass provisioning)
+    bool nfcSilent;             // Leaves out the retry logging too, inside a binary frame
+    bool nfcRestored;           // The tag in the field has had an image restored, left alone until it's lifted
+    uint16_t nfcFailureCounts[NFC_FAILURE_CLASSES];
+    RetryPolicy nfcRetryPolicy;
+    uint16_t nfcTagGoneCount;
+#if NFC_TRACE_SIZE > 0
+    NFCTraceRecord nfcTrace[NFC_TRACE_SIZE];
+    uint8_t nfcTraceNext;
+    uint8_t nfcTraceCount;
+#endif
+    // Newest record in the energy ring, -1 if the ring is empty
+    int8_t energySlot;
+    uint8_t energySeq;
+    // Next journey log entry to write, and its lap bit
+    uint8_t journeyHead;
+    uint8_t journeyLap;
+};
+
+
+// Station features, declared by each station in its FEATURES constant. What a station
+// doesn't declare is never called, so the linker can drop it (--gc-sections), and using
+// it is a compile error
+#define FEATURE_LED_PATTERNS (1 << 0)  // The dock's LED patterns
+#define FEATURE_ENERGY       (1 << 1)  // setEnergy(), addEnergy(), removeEnergy()
+#define FEATURE_FORMAT       (1 << 2)  // formatNFC(), resetOrb(), setTrait()
+#define FEATURE_LEDS         (1 << 3)  // LEDs the station draws itself, through leds
+
+/**
+ * Base class of the stations, templated on the station itself (CRTP):
+ *
+ *   class OrbDockBasic : public OrbDock<OrbDockBasic> {
+ *   public:
+ *       static const uint8_t FEATURES = FEATURE_LED_PATTERNS | FEATURE_ENERGY;
+ *       ...
+ *   protected:
+ *       friend class OrbDock<OrbDockBasic>;
+ *       void onOrbConnected() { ... }
+ *
+ * The callbacks below are defaults the station hides with its own. They are called from
+ * the event queue at the end of loop() (see EventQueue.h), through one function that
+ * calls them without virtual dispatch, so the compiler can inline them and drops what a
+ * station never uses.
+ */
+template <class Station>
+class OrbDock : public OrbDockCore {
+public:
+    OrbDock(StationId id) : OrbDockCore(id, hasFeature(FEATURE_LED_PATTERNS | FEATURE_LEDS) ? LED_COUNT : 0) {
+        subscribe(stationEvent, this, EVENT_ALL, "station");
+    }
+
+    void loop() {
+        currentMillis = millis();
+
+        if (hasFeature(FEATURE_LED_PATTERNS)) {
+            runLEDPatterns();
+        }
+
+        handleSerialCommands();
+        pollNFC();
+        // The callbacks, after the NFC work of this pass rather than in the middle of it
+        dispatchEvents();
+        // Battery docks sleep here while idle, see IdlePower.h
+        runIdle(hasFeature(FEATURE_LED_PATTERNS));
+    }
+
+protected:
+    // Callbacks, hidden by the station's own
+    void onOrbConnected() {}
+    void onOrbDisconnected() {}
+    void onError(const char* errorMessage) {}
+    void onUnformattedNFC() {}
+    void onEnergyLevelChanged(byte newEnergy) {}
+    // A EVENT_BUTTON the station posted, button from 1
+    void onButton(uint8_t button) {}
+    // Gets every byte received on the serial port first, returns true if it was used
+    bool onSerialByte(uint8_t byte) { return false; }
+
+    static constexpr bool hasFeature(uint8_t feature) {
+        return (Station::FEATURES & feature) != 0;
+    }
+
+    // Resets the station information, but keeps the trait
+    int resetOrb() {
+        static_assert(hasFeature(FEATURE_FORMAT), "resetOrb() needs FEATURE_FORMAT in the station's FEATURES");
+        return OrbDockCore::resetOrb();
+    }
+
+    // Resets the orb with a new trait
+    int formatNFC(TraitId newTrait) {
+        static_assert(hasFeature(FEATURE_FORMAT), "formatNFC() needs FEATURE_FORMAT in the station's FEATURES");
+        return OrbDockCore::formatNFC(newTrait);
+    }
+
+    // Mass provisioning: makes the fresh tag in the field an orb with trait, once per tag.
+    // Returns STATUS_TRUE when it provisioned a tag, STATUS_FALSE when there was none to do
+    int provisionOrb(TraitId trait) {
+        static_assert(hasFeature(FEATURE_FORMAT), "provisionOrb() needs FEATURE_FORMAT in the station's FEATURES");
+        return OrbDockCore::provisionOrb(trait);
+    }
+
+    // Ends the session with the tag on the reader as if it had been lifted, for a station
+    // taking the NFC over (mass provisioning). An orb's session ends with onOrbDisconnected()
+    void releaseTag() {
+        bool wasOrb = isOrbConnected;
+        endOrbSession();
+        if (wasOrb) {
+            postEvent(EVENT_ORB_DISCONNECTED);
+        }
+    }
+
+    // Writes the trait to the orb
+    int setTrait(TraitId newTrait) {
+        static_assert(hasFeature(FEATURE_FORMAT), "setTrait() needs FEATURE_FORMAT in the station's FEATURES");
+        return OrbDockCore::setTrait(newTrait);
+    }
+
+    // Sets the energy of the orb
+    int setEnergy(byte amount) {
+        static_assert(hasFeature(FEATURE_ENERGY), "setEnergy() needs FEATURE_ENERGY in the station's FEATURES");
+        int result = OrbDockCore::setEnergy(amount);
+        if (result == STATUS_SUCCEEDED) {
+            postEvent(EVENT_ENERGY_CHANGED, amount);
+        }
+        return result;
+    }
+
+    // Adds energy to the orb
+    int addEnergy(byte amount) {
+        // Clamped before adding, as the byte would wrap
+        byte newEnergy = amount >= MAX_ENERGY - orbInfo.energy ? MAX_ENERGY : orbInfo.energy + amount;
+        Serial.print(F("Adding "));
+        Serial.print(amount);
+        Serial.println(F(" energy"));
+        return setEnergy(newEnergy);
+    }
+
+    // Removes energy from the orb
+    int removeEnergy(byte amount) {
+        byte newEnergy = amount >= orbInfo.energy ? 0 : orbInfo.energy - amount;
+        Serial.print(F("Removing "));
+        Serial.print(amount);
+        Serial.println(F(" energy"));
+        return setEnergy(newEnergy);
+    }
+
+private:
+    Station& station() {
+        return *static_cast<Station*>(this);
+    }
+
+    void handleError(const char* message) {
+        Serial.println(message);
+        if (hasFeature(FEATURE_LED_PATTERNS)) {
+            setLEDPattern(LED_PATTERN_ERROR);
+        }
+        postEvent(EVENT_ERROR, 0, message);
+    }
+
+    // Checks for NFC / Orb presence periodically
+    void pollNFC() {
+        if (currentMillis - lastNFCCheckTime < nfcCheckInterval) {
+            return;
+        }
+        lastNFCCheckTime = currentMillis;
+
+        // Nothing to poll while the PN532 doesn't answer
+        if (!checkNFCHealth() || nfcPollingPaused) {
+            return;
+        }
+
+        // A restored tag isn't a visit, wait for it to be lifted
+        if (nfcRestored) {
+            if (readPage(ORBS_PAGE) == STATUS_FAILED) {
+                endOrbSession();
+            }
+            return;
+        }
+
+        // While orb is connected, check if it's still connected
+        if (isNFCConnected && isOrbConnected) {
+            if (!isNFCActive()) {
+                // Orb has disconnected
+                endOrbSession();
+                postEvent(EVENT_ORB_DISCONNECTED);
+            }
+            return;
+        }
+
+        // Check for NFC presence
+        if(isNFCPresent()) {
+            isNFCConnected = true;
+            // NFC is present! Check if it's an orb
+            int orbStatus = isOrb();
+            switch (orbStatus) {
+                case STATUS_FAILED:
+                    handleError("Failed to check orb header");
+                    return;
+                case STATUS_FALSE:
+                    if (!isUnformattedNFC) {
+                        Serial.println(F("Unformatted NFC connected"));
+                        isUnformattedNFC = true;
+                        postEvent(EVENT_UNFORMATTED_NFC);
+                    }
+                    break;
+                case STATUS_TRUE:
+                    // A half-read orb would get the visit written over what wasn't read, so
+                    // the session ends instead and the next poll starts it again
+                    if (readOrbInfo() == STATUS_FAILED) {
+                        endOrbSession();
+                        handleError("Failed to read orb");
+                        return;
+                    }
+                    isOrbConnected = true;
+                    setLEDPattern(LED_PATTERN_ORB_CONNECTED);
+                    firstVisit = !orbInfo.stations[stationId].visited;
+                    logVisit();
+                    setVisited(true);
+                    postEvent(EVENT_ORB_CONNECTED);
+                    break;
+            }
+        }
+    }
+
+    // Hands the events to the station's callbacks
+    static void stationEvent(void* dock, const OrbDockEvent& event) {
+        Station& station = *static_cast<Station*>(static_cast<OrbDock*>(dock));
+        switch (event.type) {
+            case EVENT_ORB_CONNECTED:
+                station.onOrbConnected();
+                break;
+            case EVENT_ORB_DISCONNECTED:
+                station.onOrbDisconnected();
+                break;
+            case EVENT_UNFORMATTED_NFC:
+                station.onUnformattedNFC();
+                break;
+            case EVENT_ENERGY_CHANGED:
+                station.onEnergyLevelChanged(event.value);
+                break;
+            case EVENT_ERROR:
+                station.onError(event.message);
+                break;
+            case EVENT_BUTTON:
+                station.onButton(event.value);
+                break;
+        }
+    }
+
+    // Single character commands from the serial port
+    void handleSerialCommands() {
+        while (Serial.available() > 0) {
+            uint8_t byte = Serial.read();
+#if IDLE_AFTER_MS > 0
+            idleActivity();
+#endif
+            if (station().onSerialByte(byte)) {
+                continue;
+            }
+            switch (byte) {
+                case NFC_TRACE_COMMAND:
+                    dumpNFCTrace();
+                    break;
+                case TAG_IMAGE_DUMP_COMMAND:
+                    dumpTagImage();
+                    break;
+                case TAG_IMAGE_RESTORE_COMMAND:
+                    // The orb on the dock is about to be rewritten, so its session ends here
+                    if (isOrbConnected) {
+                        endOrbSession();
+                        postEvent(EVENT_ORB_DISCONNECTED);
+                    }
+                    restoreTagImage();
+                    break;
+                case 's':
+                    printNFCStats();
+                    printEventStats();
+#if IDLE_AFTER_MS > 0
+                    printIdleStats();
+#endif
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
 };
 
 #endif
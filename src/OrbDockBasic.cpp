@@ -6,6 +6,7 @@
  * - trait (byte, one of TraitId enum)
  * - energy (byte, 0-250)
  * - stations[] (array of StationInfo structs, one for each station)
+ * firstVisit is true if the orb hadn't visited this station before
  * 
  * Available methods from base class:
  * - onOrbConnected() (override)
@@ -22,29 +23,33 @@
 
 #include "OrbDock.h"
 
-class OrbDockBasic : public OrbDock {
+class OrbDockBasic : public OrbDock<OrbDockBasic> {
 public:
+    static const uint8_t FEATURES = FEATURE_LED_PATTERNS | FEATURE_ENERGY;
+
     OrbDockBasic() : OrbDock(StationId::GENERIC) {
     }
 
 protected:
-    void onOrbConnected() override {
+    friend class OrbDock<OrbDockBasic>;
+
+    void onOrbConnected() {
         Serial.println(F("Orb connected"));
-        if (!getCurrentStationInfo().visited) {
+        if (firstVisit) {
             addEnergy(1);
         }
     }
 
-    void onOrbDisconnected() override {
+    void onOrbDisconnected() {
         Serial.println(F("Orb disconnected")); 
     }
 
-    void onError(const char* errorMessage) override {
+    void onError(const char* errorMessage) {
         Serial.print(F("Error: "));
         Serial.println(errorMessage);
     }
 
-    void onUnformattedNFC() override {
+    void onUnformattedNFC() {
         Serial.println(F("Unformatted NFC detected"));
     }
 };
\ No newline at end of file
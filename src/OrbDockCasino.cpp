@@ -21,6 +21,7 @@
  * - onOrbDisconnected() (override)
  * - onError(const char* errorMessage) (override)
  * - onUnformattedNFC() (override)
+ * - onButton(uint8_t button) (override)
  * 
  * - addEnergy(byte amount)
  * - setEnergy(byte amount)
@@ -32,10 +33,18 @@
 #include "OrbDock.h"
 #include "ButtonDisplay.h"
 
-class OrbDockCasino : public OrbDock {
+class OrbDockCasino : public OrbDock<OrbDockCasino> {
 private:
     const uint8_t* font = u8g_font_fub49n;
     ButtonDisplay display{font};
+    bool showingError;
+    unsigned long errorMillis;
+
+    void showError(const char* message) {
+        display.showError(message);
+        showingError = true;
+        errorMillis = millis();
+    }
 
     void updateDisplay() {
         display.clearDisplay();
@@ -52,60 +61,84 @@ private:
     }
 
 public:
-    OrbDockCasino() : OrbDock(StationId::CASINO) {
+    static const uint8_t FEATURES = FEATURE_LED_PATTERNS | FEATURE_ENERGY;
+
+    OrbDockCasino() : OrbDock(StationId::CASINO), showingError(false), errorMillis(0) {
     }
 
     void begin() {
         OrbDock::begin();
         display.begin();
+        for (uint8_t button = 1; button <= 4; button++) {
+            wakeOnPin(display.getButtonPin(button));
+        }
         updateDisplay();
     }
 
-    void loop() override {
+    void loop() {
         OrbDock::loop();
+        display.refresh();
 
-        if (!isOrbConnected) return;
-
-        // Handle button inputs
-        if (display.isButton1Pressed()) {
-            addEnergy(1);
-            updateDisplay();
-        }
-        
-        if (display.isButton2Pressed()) {
-            addEnergy(5);
+        if (showingError && millis() - errorMillis >= ERROR_DISPLAY_MS) {
+            showingError = false;
             updateDisplay();
         }
 
-        if (display.isButton3Pressed()) {
-            removeEnergy(5);
-            updateDisplay();
-        }
-
-        if (display.isButton4Pressed()) {
-            removeEnergy(1);
-            updateDisplay();
+        // Presses go through the event queue, to onButton()
+        uint8_t presses = display.readPresses();
+        for (uint8_t button = 1; button <= 4; button++) {
+            if (presses & (1 << (button - 1))) {
+                postEvent(EVENT_BUTTON, button);
+            }
         }
     }
 
 protected:
-    void onOrbConnected() override {
+    friend class OrbDock<OrbDockCasino>;
+
+    void onOrbConnected() {
         updateDisplay();
     }
 
-    void onOrbDisconnected() override {
+    void onOrbDisconnected() {
         updateDisplay();
     }
 
-    void onError(const char* errorMessage) override {
-        display.showError(errorMessage);
-        delay(2000);
-        updateDisplay();
+    void onError(const char* errorMessage) {
+        showError(errorMessage);
     }
 
-    void onUnformattedNFC() override {
-        display.showError(":::::");
-        delay(2000);
+    void onUnformattedNFC() {
+        showError(":::::");
+    }
+
+    bool onSerialByte(uint8_t byte) {
+        if (byte == 's') {
+            // Before the dock's own stats, which follow
+            Serial.print(F("Display frame: "));
+            Serial.print(display.getFrameMillis());
+            Serial.println(F(" ms"));
+        }
+        return false;
+    }
+
+    void onButton(uint8_t button) {
+        if (!isOrbConnected) return;
+
+        switch (button) {
+            case 1:
+                addEnergy(1);
+                break;
+            case 2:
+                addEnergy(5);
+                break;
+            case 3:
+                removeEnergy(5);
+                break;
+            case 4:
+                removeEnergy(1);
+                break;
+        }
         updateDisplay();
     }
 };
@@ -1,12 +1,35 @@
 #include "OrbDockComms.h"
 #include <Arduino.h>
+#include <EEPROM.h>
+#if COMMS_I2C_ADDRESS
+#include <Wire.h>
+
+OrbDockComms* OrbDockComms::i2cDock = NULL;
+#endif
+
+static_assert(DOCK_JOURNAL_PAYLOAD == JOURNAL_RECORD_DATA + 5, "A JOURNAL frame is a record, prev, the boot and the seconds");
+static_assert(DOCK_JOURNAL_PAYLOAD <= DOCK_MAX_PAYLOAD, "A JOURNAL frame doesn't fit DOCK_MAX_PAYLOAD");
+static_assert(DOCK_UID_LENGTH + 3 <= JOURNAL_DETAIL, "The UID, trait and visited mask don't fit a journal record");
 
 OrbDockComms::OrbDockComms(uint8_t orbPresentPin, uint8_t energyLevelPin, uint8_t toxicTraitPin)
     : OrbDock(StationId::GENERIC),
     _orbPresentPin(orbPresentPin),
     _energyLevelPin(energyLevelPin),
-    _toxicTraitPin(toxicTraitPin)
+    _toxicTraitPin(toxicTraitPin),
+    _eventSeq(0),
+    _journalSent(0),
+    _journalPrev(0),
+    _journalChained(false),
+    _journalSentMillis(0),
+    _linkMillis(0),
+    _linkSeen(false),
+    _lastErrorMillis(0)
 {
+    _lastError[0] = '\0';
+    dockParserInit(_commandParser, DOCK_COMMAND_MAGIC);
+#if COMMS_I2C_ADDRESS
+    dockRegistersInit(_registers, stationId);
+#endif
 
     // Single F() string with one print
     // Serial.print(F("OrbDockComms initialized - Present Pin: "));
@@ -19,6 +42,15 @@ OrbDockComms::OrbDockComms(uint8_t orbPresentPin, uint8_t energyLevelPin, uint8_
 
 void OrbDockComms::begin() {
     OrbDock::begin();
+#if COMMS_I2C_ADDRESS
+    // Released until there is something to read
+    digitalWrite(COMMS_DATA_READY_PIN, LOW);
+    pinMode(COMMS_DATA_READY_PIN, INPUT);
+    i2cDock = this;
+    Wire.begin(COMMS_I2C_ADDRESS);
+    Wire.onReceive(onI2CReceive);
+    Wire.onRequest(onI2CRequest);
+#else
     pinMode(_orbPresentPin, OUTPUT);
     pinMode(_energyLevelPin, OUTPUT);
     pinMode(_toxicTraitPin, OUTPUT);
@@ -26,19 +58,28 @@ void OrbDockComms::begin() {
     digitalWrite(_orbPresentPin, LOW);
     analogWrite(_energyLevelPin, 0);
     analogWrite(_toxicTraitPin, 0);
-    
+#endif
+
+    journalBegin(_journal, EEPROM);
+    _journalSent = _journal.acked;
+
+    uint8_t station = stationId;
+    sendEvent(DOCK_EVENT_HELLO, _eventSeq++, &station, 1);
     // Serial.println(F("OrbDockComms initialized"));
 }
 
 void OrbDockComms::loop() {
     OrbDock::loop();
+    uploadJournal();
+#if COMMS_I2C_ADDRESS
+    updateRegisters();
+#endif
 }
 
 void OrbDockComms::onOrbConnected() {
     OrbDock::onOrbConnected();
-    digitalWrite(_orbPresentPin, HIGH);
-    analogWrite(_energyLevelPin, orbInfo.energy);
-    analogWrite(_toxicTraitPin, static_cast<int>(orbInfo.trait));
+    publishOrb(true, 0);
+    journalOrbEvent(EVENT_ORB_CONNECTED, orbInfo, orbInfo.energy);
     // analogWrite(_energyLevelPin, 90);
     // analogWrite(_toxicTraitPin, 4);
     // Serial.print(F("Orb Comms sending: Orb Present = HIGH, Energy = "));
@@ -49,22 +90,234 @@ void OrbDockComms::onOrbConnected() {
 
 void OrbDockComms::onOrbDisconnected() {
     OrbDock::onOrbDisconnected();
-    digitalWrite(_orbPresentPin, LOW);
-    analogWrite(_energyLevelPin, 0);
-    analogWrite(_toxicTraitPin, 0);
+    publishOrb(false, 0);
+    // The session is over by now, so the orb as it was lifted
+    journalOrbEvent(EVENT_ORB_DISCONNECTED, departedOrb, departedOrb.energy);
     // Serial.println(F("Orb Comms sending: Orb Present = LOW, Energy = 0, Trait = 0"));
 }
 
 void OrbDockComms::onEnergyLevelChanged(byte newEnergy) {
-    analogWrite(_energyLevelPin, newEnergy);
+    publishOrb(true, DOCK_CHANGED_ENERGY);
+    journalOrbEvent(EVENT_ENERGY_CHANGED, orbInfo, newEnergy);
     // Serial.print(F("Orb Comms sending: Energy = "));
     // Serial.println(newEnergy);
 }
 
 void OrbDockComms::onError(const char* errorMessage) {
     OrbDock::onError(errorMessage);
+    // A tag the dock keeps failing on would fill the journal with the same error
+    // Compared as journaled, so the same text from another caller counts as a repeat
+    if (strncmp(errorMessage, _lastError, sizeof(_lastError) - 1) == 0 &&
+        millis() - _lastErrorMillis < JOURNAL_ERROR_REPEAT_MS) {
+        return;
+    }
+    strncpy(_lastError, errorMessage, sizeof(_lastError) - 1);
+    _lastError[sizeof(_lastError) - 1] = '\0';
+    _lastErrorMillis = millis();
+    JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.type = EVENT_ERROR;
+    memcpy(record.detail, _lastError, sizeof(record.detail));
+    journalEvent(record);
 }
 
 void OrbDockComms::onUnformattedNFC() {
     OrbDock::onUnformattedNFC();
 }
+
+bool OrbDockComms::onSerialByte(uint8_t byte) {
+    DockParseResult result = dockParserFeed(_commandParser, byte);
+    if (result == DOCK_PARSE_FRAME) {
+        _linkMillis = millis();
+        _linkSeen = true;
+        handleCommand();
+    }
+    return result != DOCK_PARSE_IDLE;
+}
+
+void OrbDockComms::handleCommand() {
+    uint8_t status;
+    switch (_commandParser.type) {
+        case DOCK_COMMAND_PING:
+            sendEvent(DOCK_EVENT_PONG, _commandParser.seq, NULL, 0);
+            break;
+        case DOCK_COMMAND_SET_ENERGY:
+        case DOCK_COMMAND_SET_TRAIT:
+            status = _commandParser.length == 1 ? runCommand(_commandParser.type, _commandParser.payload[0]) : STATUS_FAILED;
+            sendEvent(DOCK_EVENT_RESULT, _commandParser.seq, &status, 1);
+            break;
+        case DOCK_COMMAND_JOURNAL_ACK:
+            if (_commandParser.length == 2 &&
+                journalAck(_journal, EEPROM, _commandParser.payload[0] | (_commandParser.payload[1] << 8)) &&
+                journalIsNewer(_journal.acked, _journalSent)) {
+                // The gateway had more than this boot sent
+                _journalSent = _journal.acked;
+                _journalChained = false;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+uint8_t OrbDockComms::runCommand(uint8_t command, uint8_t argument) {
+    if (!isOrbConnected) {
+        return STATUS_FAILED;
+    }
+    switch (command) {
+        case DOCK_COMMAND_SET_ENERGY:
+            return setEnergy(argument);
+        case DOCK_COMMAND_SET_TRAIT:
+            if (argument >= NUM_TRAITS || setTrait(static_cast<TraitId>(argument)) != STATUS_SUCCEEDED) {
+                return STATUS_FAILED;
+            }
+            publishOrb(true, DOCK_CHANGED_TRAIT);
+            return STATUS_SUCCEEDED;
+        default:
+            return STATUS_FAILED;
+    }
+}
+
+uint16_t OrbDockComms::visitedMask(const OrbInfo& orb) {
+    uint16_t visited = 0;
+    for (int i = 0; i < NUM_STATIONS; i++) {
+        if (orb.stations[i].visited) visited |= 1 << i;
+    }
+    return visited;
+}
+
+// change is the DOCK_CHANGED_* to raise, 0 for an orb placed or lifted
+void OrbDockComms::publishOrb(bool present, uint8_t change) {
+#if COMMS_I2C_ADDRESS
+    noInterrupts();
+    if (change == 0) {
+        dockRegistersSetOrb(_registers, present, getNFCUid(), orbInfo.trait, orbInfo.energy, visitedMask(orbInfo));
+    } else {
+        dockRegistersSet(_registers, DOCK_REG_TRAIT, orbInfo.trait, DOCK_CHANGED_TRAIT);
+        dockRegistersSet(_registers, DOCK_REG_ENERGY, orbInfo.energy, DOCK_CHANGED_ENERGY);
+    }
+    updateDataReady();
+    interrupts();
+#else
+    digitalWrite(_orbPresentPin, present ? HIGH : LOW);
+    analogWrite(_energyLevelPin, present ? orbInfo.energy : 0);
+    analogWrite(_toxicTraitPin, present ? static_cast<int>(orbInfo.trait) : 0);
+#endif
+}
+
+#if COMMS_I2C_ADDRESS
+// Status, counters and the controller's command, once per loop()
+void OrbDockComms::updateRegisters() {
+    uint8_t status = (isOrbConnected ? DOCK_STATUS_ORB : 0) |
+        (isUnformattedNFC ? DOCK_STATUS_UNFORMATTED : 0) |
+        (getNFCHealth().stage != NFC_HEALTHY ? DOCK_STATUS_READER_FAULT : 0);
+    uint8_t command;
+    uint8_t argument;
+    noInterrupts();
+    // The orb bit changes with DOCK_CHANGED_ORB, in publishOrb()
+    status = (status & ~DOCK_STATUS_ORB) | (_registers.bytes[DOCK_REG_STATUS] & DOCK_STATUS_ORB);
+    dockRegistersSet(_registers, DOCK_REG_STATUS, status, DOCK_CHANGED_STATUS);
+    dockRegistersPut16(_registers, DOCK_REG_NFC_ERRORS, getNFCFailureCount(NFC_FAILURE_ERROR));
+    dockRegistersPut16(_registers, DOCK_REG_NFC_WRONG_LENGTHS, getNFCFailureCount(NFC_FAILURE_LENGTH));
+    _registers.bytes[DOCK_REG_NFC_WEDGES] = getNFCHealth().wedges;
+    bool pending = dockRegistersTakeCommand(_registers, command, argument);
+    updateDataReady();
+    interrupts();
+
+    if (pending) {
+        uint8_t result = runCommand(command, argument);
+        noInterrupts();
+        dockRegistersCommandDone(_registers, result);
+        updateDataReady();
+        interrupts();
+    }
+}
+
+// Pulls the line low while there are changes, lets the controller's pull-up have it otherwise
+void OrbDockComms::updateDataReady() {
+    pinMode(COMMS_DATA_READY_PIN, dockRegistersDataReady(_registers) ? OUTPUT : INPUT);
+}
+
+void OrbDockComms::onI2CReceive(int count) {
+    uint8_t data[DOCK_I2C_BUFFER];
+    uint8_t length = 0;
+    while (Wire.available() && length < sizeof(data)) {
+        data[length++] = Wire.read();
+    }
+    dockRegistersReceive(i2cDock->_registers, data, length);
+}
+
+void OrbDockComms::onI2CRequest() {
+    uint8_t data[DOCK_I2C_BUFFER];
+    uint8_t length = dockRegistersRequest(i2cDock->_registers, data);
+    Wire.write(data, length);
+    i2cDock->updateDataReady();
+}
+#endif
+
+void OrbDockComms::sendEvent(uint8_t type, uint8_t seq, const uint8_t* payload, uint8_t length) {
+    uint8_t frame[DOCK_MAX_FRAME];
+    Serial.write(frame, dockFrameEncode(DOCK_EVENT_MAGIC, type, seq, payload, length, frame));
+}
+
+void OrbDockComms::journalOrbEvent(uint8_t type, const OrbInfo& orb, uint8_t energy) {
+    JournalRecord record;
+    uint16_t visited = visitedMask(orb);
+    record.type = type;
+    record.value = energy;
+    memcpy(record.detail, getNFCUid(), DOCK_UID_LENGTH);
+    record.detail[DOCK_UID_LENGTH] = orb.trait;
+    record.detail[DOCK_UID_LENGTH + 1] = visited & 0xFF;
+    record.detail[DOCK_UID_LENGTH + 2] = visited >> 8;
+    journalEvent(record);
+}
+
+// Only writes the EEPROM, the record is sent from loop() by uploadJournal()
+void OrbDockComms::journalEvent(JournalRecord& record) {
+    record.seconds = millis() / 1000;
+    journalAppend(_journal, EEPROM, record);
+}
+
+// Sends the records the gateway hasn't acknowledged. No more than fit in the serial
+// transmit buffer, so it never waits for the port, and the rest go on the next pass
+void OrbDockComms::uploadJournal() {
+    uint32_t now = millis();
+    // Overwritten while the gateway was away
+    if (journalIsNewer(_journal.acked, _journalSent)) {
+        _journalSent = _journal.acked;
+        _journalChained = false;
+    }
+    if (_journalSent != _journal.acked && now - _journalSentMillis >= JOURNAL_ACK_TIMEOUT_MS) {
+        // Lost on the way, or the gateway is gone: again from the first it doesn't have
+        _journalSent = _journal.acked;
+        _journalChained = false;
+    }
+    bool linkUp = _linkSeen && now - _linkMillis < JOURNAL_LINK_TIMEOUT_MS;
+    if (!linkUp && (_journalSent != _journal.acked || now - _journalSentMillis < JOURNAL_PROBE_MS)) {
+        return;
+    }
+    uint16_t batch = linkUp ? JOURNAL_BATCH : 1;
+    uint16_t newest = _journal.nextSeq - 1;
+    while (_journalSent != newest && (uint16_t)(_journalSent - _journal.acked) < batch &&
+           Serial.availableForWrite() >= DOCK_FRAME_OVERHEAD + DOCK_JOURNAL_PAYLOAD) {
+        _journalSent++;
+        _journalSentMillis = now;
+        JournalRecord record;
+        // A record a power cut broke is left out, the gateway sees the gap
+        if (!journalRead(_journal, EEPROM, _journalSent, record)) {
+            continue;
+        }
+        uint16_t prev = _journalChained ? _journalPrev : record.seq;
+        uint16_t seconds = now / 1000;
+        uint8_t payload[DOCK_JOURNAL_PAYLOAD];
+        journalEncode(record, payload);
+        payload[JOURNAL_RECORD_DATA] = prev & 0xFF;
+        payload[JOURNAL_RECORD_DATA + 1] = prev >> 8;
+        payload[JOURNAL_RECORD_DATA + 2] = _journal.boot;
+        payload[JOURNAL_RECORD_DATA + 3] = seconds & 0xFF;
+        payload[JOURNAL_RECORD_DATA + 4] = seconds >> 8;
+        sendEvent(DOCK_EVENT_JOURNAL, _eventSeq++, payload, sizeof(payload));
+        _journalPrev = record.seq;
+        _journalChained = true;
+    }
+}
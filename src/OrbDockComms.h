@@ -2,24 +2,84 @@
 #define ORBDOCKCOMMS_H
 
 #include "OrbDock.h"
+#include "DockProtocol.h"
+#include "DockRegisters.h"
+#include "EventJournal.h"
 
-class OrbDockComms : public OrbDock {
+// I2C target mode (see DockRegisters.h): the dock answers on the I2C bus at this address
+// instead of driving its PWM pins. 0 keeps the PWM pins
+#ifndef COMMS_I2C_ADDRESS
+#define COMMS_I2C_ADDRESS 0
+#endif
+// Open drain, pulled low while DOCK_REG_CHANGES isn't 0. The orb present pin of the PWM mode
+#ifndef COMMS_DATA_READY_PIN
+#define COMMS_DATA_READY_PIN 10
+#endif
+
+// Journal upload (see EventJournal.h)
+#define JOURNAL_BATCH 8                 // Records sent before waiting for an acknowledgement
+#define JOURNAL_ACK_TIMEOUT_MS 1000     // Then they are sent again
+#define JOURNAL_LINK_TIMEOUT_MS 10000   // Without a frame from the gateway the link is down...
+#define JOURNAL_PROBE_MS 5000           // ...and one record goes out this often, to find it again
+#define JOURNAL_ERROR_REPEAT_MS 60000   // The same error isn't journaled again for this long
+
+class OrbDockComms : public OrbDock<OrbDockComms> {
 public:
+    static const uint8_t FEATURES = FEATURE_LED_PATTERNS | FEATURE_ENERGY | FEATURE_FORMAT;
+
     OrbDockComms(uint8_t orbPresentPin = 10, uint8_t energyLevelPin = 11, uint8_t toxicTraitPin = 12);
-    void begin() override;
-    void loop() override;
+    void begin();
+    void loop();
 
 protected:
-    void onOrbConnected() override;
-    void onOrbDisconnected() override;
-    void onEnergyLevelChanged(byte newEnergy) override;
-    void onError(const char* errorMessage) override;
-    void onUnformattedNFC() override;
+    friend class OrbDock<OrbDockComms>;
+
+    void onOrbConnected();
+    void onOrbDisconnected();
+    void onEnergyLevelChanged(byte newEnergy);
+    void onError(const char* errorMessage);
+    void onUnformattedNFC();
+    bool onSerialByte(uint8_t byte);
 
 private:
+    // Gateway frames (see DockProtocol.h)
+    void sendEvent(uint8_t type, uint8_t seq, const uint8_t* payload, uint8_t length);
+    void handleCommand();
+    // Journal records: an orb event with the orb's UID, trait and visited stations
+    void journalOrbEvent(uint8_t type, const OrbInfo& orb, uint8_t energy);
+    void journalEvent(JournalRecord& record);
+    void uploadJournal();
+    // Runs a DockCommand from the gateway or the I2C controller, returns its STATUS_*
+    uint8_t runCommand(uint8_t command, uint8_t argument);
+    // The orb on the PWM pins or in the registers
+    void publishOrb(bool present, uint8_t change);
+    uint16_t visitedMask(const OrbInfo& orb);
+
     uint8_t _orbPresentPin;
     uint8_t _energyLevelPin;
     uint8_t _toxicTraitPin;
+    DockFrameParser _commandParser;
+    uint8_t _eventSeq;
+    EventJournal _journal;
+    uint16_t _journalSent;          // Newest record sent, the ones after _journal.acked are waiting for an acknowledgement
+    uint16_t _journalPrev;          // The last one that went out, if _journalChained
+    bool _journalChained;           // False when the next record starts a resend
+    uint32_t _journalSentMillis;
+    uint32_t _linkMillis;           // Last frame from the gateway
+    bool _linkSeen;
+    char _lastError[JOURNAL_DETAIL];    // As journaled, see onError()
+    uint32_t _lastErrorMillis;
+
+#if COMMS_I2C_ADDRESS
+    // The Wire callbacks, in the TWI interrupt
+    static void onI2CReceive(int count);
+    static void onI2CRequest();
+    void updateDataReady();
+    void updateRegisters();
+
+    static OrbDockComms* i2cDock;
+    DockRegisterMap _registers;
+#endif
 };
 
 #endif // ORBDOCKCOMMS_H
\ No newline at end of file
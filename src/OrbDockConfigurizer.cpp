@@ -10,6 +10,14 @@
  *  S2: D9     // Add 5 energy  
  *  S3: D10    // Remove 1 energy
  *  S4: D11    // Remove 5 energy
+ *  S3 + S4 held together, or 'p' on the serial port: mass provisioning on/off. S3 and
+ *  S4 act when they are released, and not at all after the chord, so entering
+ *  provisioning never resets or formats the orb on the reader
+ *
+ * Mass provisioning makes every fresh tag placed on the dock an orb with the selected
+ * trait as fast as the tag allows (see OrbDockCore::provisionOrb): no orb session, no
+ * per page logging, and the dock looks for the next tag as soon as one is lifted. The
+ * display shows the trait, the tags done and the orbs per minute.
  * 
  *  * orbInfo contains information on connected orb:
  * - trait (byte, one of TraitId enum)
@@ -22,6 +30,7 @@
  * - onEnergyLevelChanged(byte newEnergy) (override)
  * - onError(const char* errorMessage) (override)
  * - onUnformattedNFC() (override)
+ * - onButton(uint8_t button) (override)
  * 
  * - addEnergy(byte amount)
  * - setEnergy(byte amount)
@@ -33,7 +42,7 @@
 #include "OrbDock.h"
 #include "ButtonDisplay.h"
 
-class OrbDockConfigurizer : public OrbDock {
+class OrbDockConfigurizer : public OrbDock<OrbDockConfigurizer> {
 private:
 
     // See https://github.com/olikraus/u8glib/wiki/fontsize
@@ -41,93 +50,206 @@ private:
     const uint8_t* font =  u8g_font_fub17; // u8g_font_osb21;
     ButtonDisplay display{font};
     TraitId selectedTrait;
+    bool showingError;
+    unsigned long errorMillis;
+    bool provisioning;
+    uint16_t provisioned;
+    unsigned long firstProvisionMillis;
+    unsigned long lastProvisionMillis;
+    uint8_t releasePresses;     // S3 / S4 presses, posted once both are released
+    bool chordUsed;             // S3 + S4 were held together since both were last up
+
+    void provisionNext() {
+        int result = provisionOrb(selectedTrait);
+        if (result == STATUS_TRUE) {
+            lastProvisionMillis = millis();
+            if (provisioned++ == 0) {
+                firstProvisionMillis = lastProvisionMillis;
+            }
+            Serial.print(F("Provisioned "));
+            Serial.println(provisioned);
+            setLEDPattern(LED_PATTERN_FLASH);
+            updateDisplay();
+        } else if (result == STATUS_FAILED) {
+            onError("Failed");
+        }
+    }
 
     void updateDisplay() {
         display.clearDisplay();
         
-        if (isOrbConnected) {
+        if (provisioning) {
             char shortName[9];
-            strncpy(shortName, TRAIT_NAMES[selectedTrait], 8);
-            shortName[8] = '\0';
-            display.println(shortName);
-            display.println(TRAIT_COLOR_NAMES[selectedTrait]);
+            display.println(registryCopyName(shortName, sizeof(shortName), TRAIT_NAMES, selectedTrait));
+            char line[16];
+            itoa(provisioned, line, 10);
+            strcat(line, " orbs");
+            display.println(line);
+            if (provisioned >= 2) {
+                // Over the tags since the first, so the wait for the first doesn't count
+                unsigned long perMinute = (provisioned - 1) * 60000UL / (lastProvisionMillis - firstProvisionMillis + 1);
+                itoa(perMinute, line, 10);
+                strcat(line, "/min");
+                display.println(line);
+            } else {
+                display.println("-/min");
+            }
+        } else if (isOrbConnected) {
+            char name[9];
+            display.println(registryCopyName(name, sizeof(name), TRAIT_NAMES, selectedTrait));
+            display.println(registryCopyName(name, sizeof(name), TRAIT_COLOR_NAMES, selectedTrait));
         } else {
-            char shortName[9];
-            strncpy(shortName, TRAIT_NAMES[selectedTrait], 8);
-            shortName[8] = '\0';
-            display.println(shortName);
-            display.println(TRAIT_COLOR_NAMES[selectedTrait]);
+            char name[9];
+            display.println(registryCopyName(name, sizeof(name), TRAIT_NAMES, selectedTrait));
+            display.println(registryCopyName(name, sizeof(name), TRAIT_COLOR_NAMES, selectedTrait));
         }
         
         display.updateDisplay();
     }
 
 public:
+    static const uint8_t FEATURES = FEATURE_LED_PATTERNS | FEATURE_FORMAT;
+
     OrbDockConfigurizer() : OrbDock(StationId::CONFIGURE) {
         selectedTrait = TraitId::RUMINATE;
+        showingError = false;
+        errorMillis = 0;
+        provisioning = false;
+        provisioned = 0;
+        firstProvisionMillis = 0;
+        lastProvisionMillis = 0;
+        releasePresses = 0;
+        chordUsed = false;
     }
 
     void begin() {
         OrbDock::begin();
         display.begin();
+        for (uint8_t button = 1; button <= 4; button++) {
+            wakeOnPin(display.getButtonPin(button));
+        }
         updateDisplay();
     }
 
-    void loop() override {
-        OrbDock::loop();
-
-        // Handle button inputs
-        if (display.isButton1Pressed()) {
-            int trait = static_cast<int>(selectedTrait) + 1;
-            if (trait >= NUM_TRAITS) trait = 0;
-            selectedTrait = static_cast<TraitId>(trait);
-            Serial.print(F("Next trait: "));
-            Serial.println(TRAIT_NAMES[selectedTrait]);
-            delay(200); // Simple debounce
-            updateDisplay();
+    // Mass provisioning on or off, restarting the count
+    void setProvisioning(bool on) {
+        // The orb session, or the tag provisioning was waiting on, ends here
+        if (isNFCConnected) {
+            releaseTag();
         }
-        
-        if (display.isButton2Pressed()) {
-            int trait = static_cast<int>(selectedTrait) - 1;
-            if (trait < 0) trait = NUM_TRAITS - 1;
-            selectedTrait = static_cast<TraitId>(trait);
-            Serial.print(F("Previous trait: "));
-            Serial.println(TRAIT_NAMES[selectedTrait]);
-            delay(200); // Simple debounce
-            updateDisplay();
+        provisioning = on;
+        nfcPollingPaused = on;
+        provisioned = 0;
+        Serial.println(on ? F("Mass provisioning on") : F("Mass provisioning off"));
+        updateDisplay();
+    }
+
+    // Tags provisioned since mass provisioning was turned on
+    uint16_t getProvisionedCount() {
+        return provisioned;
+    }
+
+    void loop() {
+        OrbDock::loop();
+        if (provisioning) {
+            provisionNext();
         }
+        display.refresh();
 
-        if (display.isButton3Pressed() && isOrbConnected) {
-            Serial.println(F("Reset orb"));
-            resetOrb();
-            delay(200);
+        if (showingError && millis() - errorMillis >= ERROR_DISPLAY_MS) {
+            showingError = false;
             updateDisplay();
         }
 
-        if (display.isButton4Pressed() && isNFCConnected) {
-            Serial.println(F("Format orb"));
-            formatNFC(selectedTrait);
-            delay(200);
-            updateDisplay();
+        // Presses go through the event queue, to onButton()
+        uint8_t presses = display.readPresses();
+        uint8_t held = display.getHeldButtons();
+        for (uint8_t button = 1; button <= 2; button++) {
+            if (presses & (1 << (button - 1))) {
+                postEvent(EVENT_BUTTON, button);
+            }
+        }
+        // S3 and S4 wait for the release, as they may become the provisioning chord
+        releasePresses |= presses & 0x0C;
+        if ((held & 0x0C) == 0x0C && !chordUsed) {
+            chordUsed = true;
+            setProvisioning(!provisioning);
+        }
+        if ((held & 0x0C) == 0) {
+            for (uint8_t button = 3; button <= 4 && !chordUsed; button++) {
+                if (releasePresses & (1 << (button - 1))) {
+                    postEvent(EVENT_BUTTON, button);
+                }
+            }
+            releasePresses = 0;
+            chordUsed = false;
         }
     }
 
 protected:
-    void onOrbConnected() override {
+    friend class OrbDock<OrbDockConfigurizer>;
+
+    void onOrbConnected() {
         updateDisplay();
     }
 
-    void onOrbDisconnected() override {
+    void onOrbDisconnected() {
         updateDisplay();
     }
 
-    void onError(const char* errorMessage) override {
+    void onError(const char* errorMessage) {
         display.showError(errorMessage);
-        delay(2000);
+        showingError = true;
+        errorMillis = millis();
+    }
+
+    void onButton(uint8_t button) {
+        int trait = static_cast<int>(selectedTrait);
+        switch (button) {
+            case 1:
+                trait++;
+                if (trait >= NUM_TRAITS) trait = 0;
+                selectedTrait = static_cast<TraitId>(trait);
+                Serial.print(F("Next trait: "));
+                Serial.println(flashName(TRAIT_NAMES, selectedTrait));
+                break;
+            case 2:
+                trait--;
+                if (trait < 0) trait = NUM_TRAITS - 1;
+                selectedTrait = static_cast<TraitId>(trait);
+                Serial.print(F("Previous trait: "));
+                Serial.println(flashName(TRAIT_NAMES, selectedTrait));
+                break;
+            case 3:
+                if (!isOrbConnected || provisioning) return;
+                Serial.println(F("Reset orb"));
+                resetOrb();
+                break;
+            case 4:
+                if (!isNFCConnected || provisioning) return;
+                Serial.println(F("Format orb"));
+                formatNFC(selectedTrait);
+                break;
+        }
         updateDisplay();
     }
 
-    void onUnformattedNFC() override {
+    void onUnformattedNFC() {
         formatNFC(selectedTrait);
     }
+
+    bool onSerialByte(uint8_t byte) {
+        if (byte == 's') {
+            // Before the dock's own stats, which follow
+            Serial.print(F("Display frame: "));
+            Serial.print(display.getFrameMillis());
+            Serial.println(F(" ms"));
+            return false;
+        }
+        if (byte != 'p') {
+            return false;
+        }
+        setProvisioning(!provisioning);
+        return true;
+    }
 };
@@ -22,90 +22,46 @@
  */
 
 #include "OrbDock.h"
-#include <FastLED.h>
 
-#define NUM_LEDS 16
-#define LED_STRIP_PIN 6
-
-class OrbDockLedStrip : public OrbDock {
-private:
-    CRGB leds[NUM_LEDS];
-    uint16_t hue = 0;
+// Build with -DLED_DRIVER=LED_DRIVER_FASTLED -DLED_COUNT=16 for the 16 LED WS2812B strip,
+// see the ledstrip environments in platformio.ini
+#define LED_STRIP_BRIGHTNESS 50
 
+class OrbDockLedStrip : public OrbDock<OrbDockLedStrip> {
 public:
+    // Draws the strip itself instead of running the LED patterns
+    static const uint8_t FEATURES = FEATURE_LEDS;
+
     OrbDockLedStrip() : OrbDock(StationId::GENERIC) {
-        FastLED.addLeds<WS2812B, LED_STRIP_PIN, GRB>(leds, NUM_LEDS);
-        FastLED.setBrightness(50);
-        FastLED.show();
+    }
+
+    void begin() {
+        OrbDock::begin();
+        leds.setBrightness(LED_STRIP_BRIGHTNESS);
+        leds.show();
     }
 
 protected:
-    void onOrbConnected() override {
-        
-        // Set all LEDs to the trait color
-        const char* traitName = getTraitName();
-        CRGB color;
-        
-        // Match trait to color
-        if (strcmp(traitName, "RUMINATE") == 0) {
-            color = CRGB::Orange;
-        } else if (strcmp(traitName, "SHAME") == 0) {
-            color = CRGB::Yellow;
-        } else if (strcmp(traitName, "DOUBT") == 0) {
-            color = CRGB::Green;
-        } else if (strcmp(traitName, "DISCONTENT") == 0) {
-            color = CRGB::Pink;
-        } else if (strcmp(traitName, "HOPELESS") == 0) {
-            color = CRGB::Blue;
-        } else {
-            color = CRGB::Red;
-        }
+    friend class OrbDock<OrbDockLedStrip>;
 
-        fill_solid(leds, NUM_LEDS, color);
-        FastLED.show();
+    void onOrbConnected() {
+        // Set all LEDs to the trait color
+        leds.fill(traitColor(orbInfo.trait));
+        leds.show();
     }
 
-    void onOrbDisconnected() override {
+    void onOrbDisconnected() {
         Serial.println(F("Orb disconnected"));
-        
-        // Return to rainbow pattern
-        for(int i = 0; i < NUM_LEDS; i++) {
-            leds[i] = CRGB::Black;
-        }
-        FastLED.show();
+        leds.fill(0);
+        leds.show();
     }
 
-    void onError(const char* errorMessage) override {
+    void onError(const char* errorMessage) {
         Serial.print(F("Error: "));
         Serial.println(errorMessage);
-        
-        // // Flash red on error
-        // for(int i = 0; i < 3; i++) {
-        //     fill_solid(leds, NUM_LEDS, CRGB::Red);
-        //     FastLED.show();
-        //     delay(200);
-        //     fill_solid(leds, NUM_LEDS, CRGB::Black);
-        //     FastLED.show();
-        //     delay(200);
-        // }
     }
 
-    void onUnformattedNFC() override {
+    void onUnformattedNFC() {
         Serial.println(F("Unformatted NFC detected"));
-        
-        // // Pulse white for unformatted NFC
-        // for(int brightness = 0; brightness < 255; brightness++) {
-        //     fill_solid(leds, NUM_LEDS, CRGB::White);
-        //     FastLED.setBrightness(brightness);
-        //     FastLED.show();
-        //     delay(5);
-        // }
-        // for(int brightness = 255; brightness >= 0; brightness--) {
-        //     fill_solid(leds, NUM_LEDS, CRGB::White);
-        //     FastLED.setBrightness(brightness);
-        //     FastLED.show();
-        //     delay(5);
-        // }
-        // FastLED.setBrightness(50);
     }
 };
@@ -0,0 +1,260 @@
+/**
+ * Rules Dock: a station whose behaviour is a rule table (see StationRules.h) rather than
+ * code, so a new station is a table and not another subclass
+ *
+ * Build flags:
+ *   RULES_STATION     the StationId it writes visits as (default GENERIC)
+ *   RULES_PRESET      the table in flash it runs until one is uploaded (default
+ *                     RULES_BASIC, also RULES_TRIGGER and RULES_CASINO)
+ *   RULES_PULSE_PINS  bit mask of the pins rules may pulse (default pin 12, the Trigger's)
+ *   RULES_BUTTONS     the Casino's button screen: presses run the button rules, and it
+ *                     shows the orb's energy
+ *   RULES_FEATURES    FEATURE_ENERGY alone for a dock without the LED ring, like the
+ *                     Trigger (default FEATURE_LED_PATTERNS | FEATURE_ENERGY)
+ *
+ * A table uploaded with tools/station-rules is kept in the EEPROM and runs instead of
+ * the preset from then on, over reboots, until it's reset.
+ */
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "OrbDock.h"
+#include "StationRules.h"
+#ifdef RULES_BUTTONS
+#include "ButtonDisplay.h"
+#endif
+
+#ifndef RULES_STATION
+#define RULES_STATION GENERIC
+#endif
+#ifndef RULES_PRESET
+#define RULES_PRESET RULES_BASIC
+#endif
+#ifndef RULES_FEATURES
+#define RULES_FEATURES (FEATURE_LED_PATTERNS | FEATURE_ENERGY)
+#endif
+#ifndef RULES_PULSE_PINS
+#define RULES_PULSE_PINS (1UL << 12)
+#endif
+
+class OrbDockRules : public OrbDock<OrbDockRules> {
+private:
+    bool rulesStored;           // The EEPROM holds a table, which runs instead of RULES_PRESET
+    uint8_t pulsePin;           // The pin a rule set high, RULE_NO_PIN for none
+    unsigned long pulseStart;
+    unsigned long pulseMs;
+#ifdef RULES_BUTTONS
+    ButtonDisplay display{u8g_font_fub49n};
+
+    void updateDisplay() {
+        display.clearDisplay();
+        if (isOrbConnected) {
+            char energyStr[8];
+            itoa(orbInfo.energy, energyStr, 10);
+            display.println(energyStr);
+        } else {
+            display.println("::");
+        }
+        display.updateDisplay();
+    }
+#endif
+
+    RulesInFlash preset() {
+        RulesInFlash table = {RULES_PRESET, sizeof(RULES_PRESET) / sizeof(RULES_PRESET[0])};
+        return table;
+    }
+
+    RulesInStorage<EEPROMClass> stored() {
+        RulesInStorage<EEPROMClass> table = {EEPROM};
+        return table;
+    }
+
+    void runRules(uint8_t trigger) {
+        // The orb lifted, not the cleared orbInfo, for the rules on its way out
+        const OrbInfo& info = trigger == RULE_ON_DISCONNECT ? departedOrb : orbInfo;
+        RuleOrb orb = {(uint8_t)info.trait, info.energy, !firstVisit};
+        RuleActions actions;
+        if (rulesStored) {
+            stationRulesRun(stored(), trigger, orb, actions);
+        } else {
+            stationRulesRun(preset(), trigger, orb, actions);
+        }
+        if (actions.matched == 0) {
+            return;
+        }
+
+        if (actions.energy != 0) {
+            int energy = orbInfo.energy + actions.energy;
+            energy = constrain(energy, 0, MAX_ENERGY);
+            if (energy != orbInfo.energy) {
+                setEnergy(energy);
+            }
+        }
+        if (actions.setCustom && actions.custom != getCurrentStationInfo().custom) {
+            setCustom(actions.custom);
+        }
+        if (actions.pulsePin != RULE_NO_PIN) {
+            if (pulsePin != RULE_NO_PIN && pulsePin != actions.pulsePin) {
+                digitalWrite(pulsePin, LOW);
+            }
+            digitalWrite(actions.pulsePin, actions.pulseSeconds > 0 ? HIGH : LOW);
+            pulsePin = actions.pulseSeconds > 0 ? actions.pulsePin : RULE_NO_PIN;
+            pulseStart = millis();
+            pulseMs = actions.pulseSeconds * 1000UL;
+        }
+        if (actions.led == RULE_LED_FLASH) {
+            setLEDPattern(LED_PATTERN_FLASH);
+        } else if (actions.led == RULE_LED_ERROR) {
+            setLEDPattern(LED_PATTERN_ERROR);
+        }
+    }
+
+    template <class Rules>
+    void sendRulesFrame(const Rules& table, uint8_t source) {
+        uint8_t count = table.count();
+        uint16_t crc = crc16Update(crc16Update(CRC16_INIT, source), count);
+        Serial.write((const uint8_t*)RULES_MAGIC, 4);
+        Serial.write(source);
+        Serial.write(count);
+        for (uint8_t i = 0; i < count; i++) {
+            StationRule rule;
+            table.read(i, rule);
+            crc = crc16(reinterpret_cast<const uint8_t*>(&rule), RULE_SIZE, crc);
+            Serial.write(reinterpret_cast<const uint8_t*>(&rule), RULE_SIZE);
+        }
+        Serial.write(crc & 0xFF);
+        Serial.write(crc >> 8);
+    }
+
+    void sendRules() {
+        if (rulesStored) {
+            sendRulesFrame(stored(), RULES_FROM_EEPROM);
+        } else {
+            sendRulesFrame(preset(), RULES_FROM_FLASH);
+        }
+    }
+
+    // Blocks for the table that follows RULES_UPLOAD_COMMAND, well under a second
+    void uploadRules() {
+        // The host sends the table once it has this, so it never waits in the serial buffer
+        sendRules();
+        uint8_t table[RULES_TABLE_SIZE(RULES_MAX)];
+        Serial.setTimeout(RULES_TIMEOUT_MS);
+        bool valid = Serial.readBytes(table, 1) == 1;
+        if (valid && table[0] > RULES_MAX) {
+            // No telling where it ends, so skip everything up to a pause
+            valid = false;
+            while (Serial.readBytes(table, sizeof(table)) > 0) {
+            }
+        } else if (valid) {
+            size_t length = RULES_TABLE_SIZE(table[0]) - 1;
+            valid = Serial.readBytes(table + 1, length) == length && stationRulesTableValid(table, RULES_PULSE_PINS);
+        }
+        Serial.setTimeout(1000);    // Stream's default
+
+        if (!valid) {
+            Serial.println(F("Rules upload refused"));
+        } else if (table[0] == 0) {
+            // Fails stationRulesStored() from now on
+            EEPROM.update(RULES_EEPROM_START, 0xFF);
+            rulesStored = false;
+            Serial.println(F("Rules reset to the preset"));
+        } else {
+            for (uint16_t i = 0; i < RULES_TABLE_SIZE(table[0]); i++) {
+                EEPROM.update(RULES_EEPROM_START + i, table[i]);
+            }
+            rulesStored = stationRulesStored(EEPROM);
+            Serial.println(rulesStored ? F("Rules stored") : F("Rules not stored, EEPROM write failed"));
+        }
+        sendRules();
+    }
+
+public:
+    static const uint8_t FEATURES = RULES_FEATURES;
+
+    OrbDockRules()
+        : OrbDock(StationId::RULES_STATION),
+        rulesStored(false),
+        pulsePin(RULE_NO_PIN),
+        pulseStart(0),
+        pulseMs(0)
+    {
+    }
+
+    void begin() {
+        OrbDock::begin();
+        rulesStored = stationRulesStored(EEPROM);
+        for (uint8_t pin = 0; pin < 32; pin++) {
+            if (RULES_PULSE_PINS & (1UL << pin)) {
+                pinMode(pin, OUTPUT);
+                digitalWrite(pin, LOW);
+            }
+        }
+#ifdef RULES_BUTTONS
+        display.begin();
+        for (uint8_t button = 1; button <= 4; button++) {
+            wakeOnPin(display.getButtonPin(button));
+        }
+        updateDisplay();
+#endif
+    }
+
+    void loop() {
+        OrbDock::loop();
+
+        if (pulsePin != RULE_NO_PIN && millis() - pulseStart >= pulseMs) {
+            digitalWrite(pulsePin, LOW);
+            pulsePin = RULE_NO_PIN;
+        }
+
+#ifdef RULES_BUTTONS
+        display.refresh();
+        // Presses go through the event queue, to onButton()
+        uint8_t presses = display.readPresses();
+        for (uint8_t button = 1; button <= 4; button++) {
+            if (presses & (1 << (button - 1))) {
+                postEvent(EVENT_BUTTON, button);
+            }
+        }
+#endif
+    }
+
+protected:
+    friend class OrbDock<OrbDockRules>;
+
+    void onOrbConnected() {
+        runRules(RULE_ON_CONNECT);
+#ifdef RULES_BUTTONS
+        updateDisplay();
+#endif
+    }
+
+    void onOrbDisconnected() {
+        runRules(RULE_ON_DISCONNECT);
+#ifdef RULES_BUTTONS
+        updateDisplay();
+#endif
+    }
+
+    void onButton(uint8_t button) {
+        if (!isOrbConnected || button < 1 || button > 4) return;
+
+        runRules(RULE_ON_BUTTON1 + button - 1);
+#ifdef RULES_BUTTONS
+        updateDisplay();
+#endif
+    }
+
+    bool onSerialByte(uint8_t byte) {
+        switch (byte) {
+            case RULES_DUMP_COMMAND:
+                sendRules();
+                return true;
+            case RULES_UPLOAD_COMMAND:
+                uploadRules();
+                return true;
+            default:
+                return false;
+        }
+    }
+};
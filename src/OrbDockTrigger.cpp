@@ -1,12 +1,15 @@
 #include <Arduino.h>
 #include "OrbDock.h"
 
-class OrbDockTrigger : public OrbDock {
+class OrbDockTrigger : public OrbDock<OrbDockTrigger> {
 private:
     uint8_t _triggerPin;
     unsigned long _triggerStartTime;
 
 public:
+    // Presence only - no LED ring, orb writes besides the visit
+    static const uint8_t FEATURES = 0;
+
     OrbDockTrigger(uint8_t triggerPin) 
         : OrbDock(StationId::PIPES),
         _triggerPin(triggerPin),
@@ -14,13 +17,13 @@ public:
     {
     }
 
-    void begin() override {
+    void begin() {
         OrbDock::begin();
         pinMode(_triggerPin, OUTPUT);
         digitalWrite(_triggerPin, LOW);
     }
 
-    void loop() override {
+    void loop() {
         OrbDock::loop();
         
         // Check if trigger should turn off after 20 seconds
@@ -30,22 +33,22 @@ public:
         }
     }
 
-    void onOrbConnected() override {
+    void onOrbConnected() {
         Serial.println("BALLS CONNECT OK");
         digitalWrite(_triggerPin, HIGH);
         _triggerStartTime = millis();
     }
 
-    void onOrbDisconnected() override {
+    void onOrbDisconnected() {
         digitalWrite(_triggerPin, LOW);
         _triggerStartTime = 0;
     }
 
-    void onError(const char* errorMessage) override {
+    void onError(const char* errorMessage) {
         // Do nothing
     }
 
-    void onUnformattedNFC() override {
+    void onUnformattedNFC() {
         // Do nothing
     }
 };
@@ -0,0 +1,179 @@
+/**
+ * Station, trait and tag layout registry
+ *
+ * The one list of stations and traits. The StationId and TraitId enums, NUM_STATIONS,
+ * NUM_TRAITS, the name and colour tables and the orb's page layout are all generated
+ * from ORB_STATIONS and ORB_TRAITS at compile time, so adding a station is one line
+ * here and costs no RAM: the names live in flash (PROGMEM, read with pgm_read_ptr()
+ * or registryName()/registryCopyName()) and the page offsets are constants.
+ *
+ * The static_asserts at the bottom fail the build if the layout stops fitting one of
+ * the tags in TAG_LAYOUTS, or outgrows the 16 bit visited mask of DockProtocol.h or the
+ * station bits of a journey entry.
+ *
+ * No Arduino dependencies, so the host tools in tools/ can use it too.
+ */
+
+#ifndef ORB_REGISTRY_H
+#define ORB_REGISTRY_H
+
+#include <stdint.h>
+#include <string.h>
+#include "JourneyLog.h"
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+// Host builds keep the tables in RAM
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+#ifndef pgm_read_ptr
+#define pgm_read_ptr(address) (*(const void* const*)(address))
+#endif
+#ifndef pgm_read_byte
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#endif
+#ifndef pgm_read_dword
+#define pgm_read_dword(address) (*(const uint32_t*)(address))
+#endif
+#ifndef memcpy_P
+#define memcpy_P memcpy
+#endif
+#ifndef strncpy_P
+#define strncpy_P strncpy
+#endif
+#endif
+
+// X(id) - in the order of the ids written to the tags, append only
+#define ORB_STATIONS(X) \
+    X(GENERIC) X(CONFIGURE) X(CONSOLE) X(DISTILLER) X(CASINO) X(FOREST) \
+    X(ALCHEMY) X(PIPES) X(CHECKER) X(SLERP) X(RETOXIFY) \
+    X(GENERATOR) X(STRING) X(CHILL) X(HUNT)
+
+// X(id, LED colour, colour name) - in the order of the ids written to the tags, append only
+#define ORB_TRAITS(X) \
+    X(NONE,       0xFF0000, red)      /* None */ \
+    X(RUMINATE,   0xFF2800, orange)   /* Rumination */ \
+    X(SHAME,      0xFF4600, yellow)   /* Shame Spiral */ \
+    X(DOUBT,      0x20FF00, green)    /* Self Doubt */ \
+    X(DISCONTENT, 0xFF00D2, pink)     /* Discontentment */ \
+    X(HOPELESS,   0x1400FF, blue)     /* Hopelessness */
+
+#define ORB_REGISTRY_STATION_ID(id) id,
+#define ORB_REGISTRY_TRAIT_ID(id, color, colorName) id,
+#define ORB_REGISTRY_STATION_NAME(id) const char STATION_NAME_##id[] PROGMEM = #id;
+#define ORB_REGISTRY_STATION_NAME_POINTER(id) STATION_NAME_##id,
+#define ORB_REGISTRY_TRAIT_NAME(id, color, colorName) \
+    const char TRAIT_NAME_##id[] PROGMEM = #id; \
+    const char TRAIT_COLOR_NAME_##id[] PROGMEM = #colorName;
+#define ORB_REGISTRY_TRAIT_NAME_POINTER(id, color, colorName) TRAIT_NAME_##id,
+#define ORB_REGISTRY_TRAIT_COLOR(id, color, colorName) color,
+#define ORB_REGISTRY_TRAIT_COLOR_NAME_POINTER(id, color, colorName) TRAIT_COLOR_NAME_##id,
+
+enum StationId {
+    ORB_STATIONS(ORB_REGISTRY_STATION_ID)
+    NUM_STATIONS
+};
+
+enum TraitId {
+    ORB_TRAITS(ORB_REGISTRY_TRAIT_ID)
+    NUM_TRAITS
+};
+
+ORB_STATIONS(ORB_REGISTRY_STATION_NAME)
+const char* const STATION_NAMES[] PROGMEM = {
+    ORB_STATIONS(ORB_REGISTRY_STATION_NAME_POINTER)
+};
+
+ORB_TRAITS(ORB_REGISTRY_TRAIT_NAME)
+const char* const TRAIT_NAMES[] PROGMEM = {
+    ORB_TRAITS(ORB_REGISTRY_TRAIT_NAME_POINTER)
+};
+const uint32_t TRAIT_COLORS[] PROGMEM = {
+    ORB_TRAITS(ORB_REGISTRY_TRAIT_COLOR)
+};
+const char* const TRAIT_COLOR_NAMES[] PROGMEM = {
+    ORB_TRAITS(ORB_REGISTRY_TRAIT_COLOR_NAME_POINTER)
+};
+
+// Page layout of an orb, after the tag's UID and capability container
+constexpr uint8_t PAGE_OFFSET = 4;
+constexpr uint8_t ORBS_PAGE = PAGE_OFFSET + 0;
+constexpr uint8_t TRAIT_PAGE = PAGE_OFFSET + 1;
+constexpr uint8_t ENERGY_PAGE = PAGE_OFFSET + 2;    // Legacy single energy page, only read if the energy ring is empty
+constexpr uint8_t STATIONS_PAGE_OFFSET = PAGE_OFFSET + 3;
+constexpr uint8_t ENERGY_RING_PAGE = STATIONS_PAGE_OFFSET + NUM_STATIONS;
+// The energy ring size and the journey log after it depend on the tag's capacity, see TAG_LAYOUTS
+#define ORBS_HEADER "ORBS"
+
+// Tag types, detected with GET_VERSION
+enum TagType {
+    TAG_NTAG203, TAG_NTAG213, TAG_NTAG215, TAG_NTAG216, TAG_ULTRALIGHT_EV1,
+    TAG_TYPES
+};
+
+const char TAG_TYPE_NAME_NTAG203[] PROGMEM = "NTAG203";
+const char TAG_TYPE_NAME_NTAG213[] PROGMEM = "NTAG213";
+const char TAG_TYPE_NAME_NTAG215[] PROGMEM = "NTAG215";
+const char TAG_TYPE_NAME_NTAG216[] PROGMEM = "NTAG216";
+const char TAG_TYPE_NAME_ULTRALIGHT_EV1[] PROGMEM = "ULTRALIGHT EV1";
+const char* const TAG_TYPE_NAMES[] PROGMEM = {
+    TAG_TYPE_NAME_NTAG203, TAG_TYPE_NAME_NTAG213, TAG_TYPE_NAME_NTAG215,
+    TAG_TYPE_NAME_NTAG216, TAG_TYPE_NAME_ULTRALIGHT_EV1
+};
+
+struct TagLayout {
+    uint8_t totalPages;
+    uint8_t userPageEnd;   // First page after user memory
+    uint8_t energySlots;   // Pages in the energy ring, the rest of user memory is the journey log
+    bool fastRead;         // Supports FAST_READ, otherwise bulk reads use 4 page READs
+};
+
+constexpr TagLayout TAG_LAYOUTS[] = {
+    {42, 40, 8, false},    // NTAG203, and any tag that doesn't answer GET_VERSION
+    {45, 40, 8, true},     // NTAG213 - 10 journey entries
+    {135, 130, 16, true},  // NTAG215 - 92 journey entries
+    {231, 226, 32, true},  // NTAG216 - 172 journey entries
+    {41, 36, 8, true}      // Ultralight EV1 MF0UL21 - 6 journey entries
+};
+
+#define MIN_JOURNEY_ENTRIES 4  // Journey log pages every tag must have left after the energy ring
+
+constexpr uint8_t tagJourneyLogPage(const TagLayout& layout) {
+    return ENERGY_RING_PAGE + layout.energySlots;
+}
+
+constexpr bool tagLayoutFits(const TagLayout& layout) {
+    return layout.userPageEnd <= layout.totalPages && layout.energySlots >= 2 &&
+        tagJourneyLogPage(layout) + MIN_JOURNEY_ENTRIES <= layout.userPageEnd;
+}
+
+constexpr bool tagLayoutsFit(uint8_t type = 0) {
+    return type >= TAG_TYPES || (tagLayoutFits(TAG_LAYOUTS[type]) && tagLayoutsFit(type + 1));
+}
+
+static_assert(sizeof(TAG_LAYOUTS) / sizeof(TAG_LAYOUTS[0]) == TAG_TYPES, "TAG_LAYOUTS needs a layout per TagType");
+static_assert(sizeof(TAG_TYPE_NAMES) / sizeof(TAG_TYPE_NAMES[0]) == TAG_TYPES, "TAG_TYPE_NAMES needs a name per TagType");
+static_assert(tagLayoutsFit(), "Stations, energy ring and MIN_JOURNEY_ENTRIES don't fit in one of the TAG_LAYOUTS");
+static_assert(NUM_STATIONS <= 16, "Stations are sent as a 16 bit visited mask (DOCK_EVENT_ORB_CONNECTED)");
+static_assert(NUM_STATIONS - 1 <= JOURNEY_ENTRY_STATION, "Station ids don't fit in a journey entry");
+
+// A name from STATION_NAMES, TRAIT_NAMES, TRAIT_COLOR_NAMES, TAG_TYPE_NAMES or another
+// PROGMEM table of PROGMEM strings, still in flash
+inline const char* registryName(const char* const* table, uint8_t index) {
+    return static_cast<const char*>(pgm_read_ptr(table + index));
+}
+
+// The same copied to RAM, cut to size - 1 characters
+inline char* registryCopyName(char* buffer, size_t size, const char* const* table, uint8_t index) {
+    strncpy_P(buffer, registryName(table, index), size - 1);
+    buffer[size - 1] = '\0';
+    return buffer;
+}
+
+inline uint32_t traitColor(uint8_t trait) {
+    return pgm_read_dword(&TRAIT_COLORS[trait < NUM_TRAITS ? trait : (uint8_t)NONE]);
+}
+
+#endif
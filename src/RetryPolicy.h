@@ -0,0 +1,69 @@
+/**
+ * NFC retry policy
+ *
+ * Failed tag exchanges are classified from what came back, and each class is
+ * retried its own way with its own backoff:
+ *  - error: inDataExchange() failed - no answer, or any error status the PN532
+ *    reported (timeout, CRC, parity, a NACK from the tag). The library doesn't pass
+ *    the status on, so these can't be told apart. The tag may be gone or back in
+ *    idle - re-select once, give up if that fails
+ *  - wrong length: the PN532 reported success with fewer bytes than asked for, or
+ *    any on a write, and the tag is still selected - just retry
+ * An answer longer than the buffer can't be seen: the library cuts it short.
+ *
+ * Backoff doubles on each failure of a class in a row and halves on each success.
+ *
+ * No Arduino dependencies, so tools/nfc-trace can replay captured traces through it.
+ */
+
+#ifndef RETRY_POLICY_H
+#define RETRY_POLICY_H
+
+#include <stdint.h>
+
+#define MAX_RETRIES      4
+#define RETRY_BACKOFF_MIN 1     // ms after the first failure of a class
+#define RETRY_BACKOFF_MAX 16
+
+enum NFCFailure {
+    NFC_FAILURE_ERROR,
+    NFC_FAILURE_LENGTH,
+    NFC_FAILURE_CLASSES
+};
+
+struct RetryPolicy {
+    uint8_t backoff[NFC_FAILURE_CLASSES];
+};
+
+inline void retryPolicyInit(RetryPolicy& policy) {
+    for (uint8_t i = 0; i < NFC_FAILURE_CLASSES; i++) {
+        policy.backoff[i] = 0;
+    }
+}
+
+// answered is what inDataExchange() returned, for an exchange that didn't get the
+// length it asked for
+inline NFCFailure retryPolicyClassify(bool answered) {
+    return answered ? NFC_FAILURE_LENGTH : NFC_FAILURE_ERROR;
+}
+
+inline void retryPolicySucceeded(RetryPolicy& policy) {
+    for (uint8_t i = 0; i < NFC_FAILURE_CLASSES; i++) {
+        policy.backoff[i] /= 2;
+    }
+}
+
+// Returns the ms to wait before the next attempt
+inline uint8_t retryPolicyFailed(RetryPolicy& policy, NFCFailure failure) {
+    uint8_t wait = policy.backoff[failure];
+    uint8_t next = wait * 2;
+    policy.backoff[failure] = next < RETRY_BACKOFF_MIN ? RETRY_BACKOFF_MIN : (next > RETRY_BACKOFF_MAX ? RETRY_BACKOFF_MAX : next);
+    return wait;
+}
+
+// Whether the tag must be re-selected before the next attempt. If that fails, the tag is gone
+inline bool retryPolicyReselects(NFCFailure failure) {
+    return failure == NFC_FAILURE_ERROR;
+}
+
+#endif
@@ -0,0 +1,327 @@
+/**
+ * Station behaviour as a rule table
+ *
+ * A rule is 8 bytes: when it runs (an orb connecting or leaving, or a button pressed
+ * with an orb on the dock), the conditions on the orb (trait, energy range, whether it
+ * had visited this station before) and one action (an energy change, the station's
+ * custom value, a pin pulse or an LED effect). stationRulesRun() goes through a table
+ * once, without allocating, and adds up what the matching rules do into RuleActions:
+ * energy changes add up, for the other actions the last matching rule wins, and a rule
+ * with RULE_FINAL ends the run. The station then applies it with one write per kind.
+ *
+ * Tables live in flash (the station's preset, PROGMEM) or in the EEPROM, where
+ * RULES_UPLOAD_COMMAND puts a table sent over the serial port. The host sends the
+ * command, waits for the dock's table frame
+ *
+ *   "ORBU", source (RULES_FROM_FLASH or RULES_FROM_EEPROM), count, count x 8 bytes, CRC-16
+ *
+ * whose CRC covers everything after the magic, then sends the new table as count,
+ * count x 8 bytes, CRC-16 (RULES_CRC_INIT), which is also how it's kept in the EEPROM.
+ * The dock answers with the frame of the table it now runs, the old one if it refused
+ * the upload. A count of 0 erases the EEPROM copy, back to the preset.
+ * RULES_DUMP_COMMAND only sends the frame. tools/station-rules writes tables as text and
+ * uploads them.
+ *
+ * The Comms station's event journal (EventJournal.h) uses the whole EEPROM, so tables
+ * are for the stations without one.
+ *
+ * No Arduino dependencies, so the host tools in tools/ can use it too.
+ */
+
+#ifndef STATION_RULES_H
+#define STATION_RULES_H
+
+#include <stdint.h>
+#include <string.h>
+#include "Crc16.h"
+#include "OrbRegistry.h"
+
+#define RULES_UPLOAD_COMMAND 'R'
+#define RULES_DUMP_COMMAND 'r'
+#define RULES_MAGIC "ORBU"
+#define RULES_MAX 16
+#define RULE_SIZE 8
+#define RULES_TABLE_SIZE(count) (1 + (count) * RULE_SIZE + 2)      // Count, rules, CRC
+#define RULES_FRAME_SIZE(count) (4 + 1 + RULES_TABLE_SIZE(count))   // Magic and source first
+#define RULES_CRC_INIT 0x5255       // Not CRC16_INIT, so nothing else in the EEPROM passes for a table
+#define RULES_TIMEOUT_MS 500        // Dock waiting for the table after RULES_UPLOAD_COMMAND
+#ifndef RULES_EEPROM_START
+#define RULES_EEPROM_START 0
+#endif
+
+enum RuleTrigger {
+    RULE_ON_CONNECT,
+    RULE_ON_DISCONNECT,         // The orb is gone: no energy or custom actions, it reads as when it was lifted
+    RULE_ON_BUTTON1,            // Buttons 1-4, pressed with an orb on the dock
+    RULE_ON_BUTTON2,
+    RULE_ON_BUTTON3,
+    RULE_ON_BUTTON4,
+    RULE_TRIGGERS
+};
+
+enum RuleVisited {
+    RULE_VISITED_ANY,
+    RULE_NOT_VISITED,           // First visit to this station
+    RULE_VISITED
+};
+
+enum RuleAction {
+    RULE_ENERGY,                // value: energy change, -128 to 127, kept within 0 and MAX_ENERGY
+    RULE_SET_CUSTOM,            // value: the station's custom byte on the orb
+    RULE_PULSE_PIN,             // value: pin, arg: seconds high, 0 to set it low
+    RULE_LED,                   // value: RuleLedEffect
+    RULE_ACTIONS
+};
+
+enum RuleLedEffect {
+    RULE_LED_FLASH,
+    RULE_LED_ERROR,
+    RULE_LED_EFFECTS
+};
+
+#define RULE_ANY_TRAIT 0xFF
+#define RULE_FINAL 0x80             // In action: no rules after this one when it matches
+#define RULE_NO_PIN 0xFF
+#define RULE_NO_LED 0xFF
+
+enum RuleSource {
+    RULES_FROM_FLASH,
+    RULES_FROM_EEPROM
+};
+
+// Names for tools/station-rules, read with registryName()
+const char RULE_TRIGGER_NAME_CONNECT[] PROGMEM = "connect";
+const char RULE_TRIGGER_NAME_DISCONNECT[] PROGMEM = "disconnect";
+const char RULE_TRIGGER_NAME_BUTTON1[] PROGMEM = "button1";
+const char RULE_TRIGGER_NAME_BUTTON2[] PROGMEM = "button2";
+const char RULE_TRIGGER_NAME_BUTTON3[] PROGMEM = "button3";
+const char RULE_TRIGGER_NAME_BUTTON4[] PROGMEM = "button4";
+const char* const RULE_TRIGGER_NAMES[] PROGMEM = {
+    RULE_TRIGGER_NAME_CONNECT, RULE_TRIGGER_NAME_DISCONNECT, RULE_TRIGGER_NAME_BUTTON1,
+    RULE_TRIGGER_NAME_BUTTON2, RULE_TRIGGER_NAME_BUTTON3, RULE_TRIGGER_NAME_BUTTON4
+};
+const char RULE_ACTION_NAME_ENERGY[] PROGMEM = "energy";
+const char RULE_ACTION_NAME_CUSTOM[] PROGMEM = "custom";
+const char RULE_ACTION_NAME_PIN[] PROGMEM = "pin";
+const char RULE_ACTION_NAME_LED[] PROGMEM = "led";
+const char* const RULE_ACTION_NAMES[] PROGMEM = {
+    RULE_ACTION_NAME_ENERGY, RULE_ACTION_NAME_CUSTOM, RULE_ACTION_NAME_PIN, RULE_ACTION_NAME_LED
+};
+const char RULE_LED_EFFECT_NAME_FLASH[] PROGMEM = "flash";
+const char RULE_LED_EFFECT_NAME_ERROR[] PROGMEM = "error";
+const char* const RULE_LED_EFFECT_NAMES[] PROGMEM = {RULE_LED_EFFECT_NAME_FLASH, RULE_LED_EFFECT_NAME_ERROR};
+
+// In this order on the wire and in the EEPROM
+struct StationRule {
+    uint8_t trigger;            // RuleTrigger
+    uint8_t trait;              // TraitId, or RULE_ANY_TRAIT
+    uint8_t energyMin;          // Energy range, inclusive
+    uint8_t energyMax;
+    uint8_t visited;            // RuleVisited
+    uint8_t action;             // RuleAction, with RULE_FINAL
+    uint8_t value;
+    uint8_t arg;
+};
+
+static_assert(sizeof(StationRule) == RULE_SIZE, "StationRule is sent and stored as RULE_SIZE bytes");
+
+// What the conditions look at
+struct RuleOrb {
+    uint8_t trait;
+    uint8_t energy;
+    bool visited;               // This station, before this visit
+};
+
+// What the matching rules of a run add up to
+struct RuleActions {
+    int16_t energy;
+    bool setCustom;
+    uint8_t custom;
+    uint8_t pulsePin;           // RULE_NO_PIN for none
+    uint8_t pulseSeconds;
+    uint8_t led;                // RuleLedEffect, or RULE_NO_LED
+    uint8_t matched;            // Rules that matched
+};
+
+// The stations that used to be subclasses, as tables
+const StationRule RULES_BASIC[] PROGMEM = {
+    {RULE_ON_CONNECT, RULE_ANY_TRAIT, 0, 255, RULE_NOT_VISITED, RULE_ENERGY, 1, 0},
+};
+const StationRule RULES_TRIGGER[] PROGMEM = {
+    {RULE_ON_CONNECT, RULE_ANY_TRAIT, 0, 255, RULE_VISITED_ANY, RULE_PULSE_PIN, 12, 20},
+    {RULE_ON_DISCONNECT, RULE_ANY_TRAIT, 0, 255, RULE_VISITED_ANY, RULE_PULSE_PIN, 12, 0},
+};
+const StationRule RULES_CASINO[] PROGMEM = {
+    {RULE_ON_BUTTON1, RULE_ANY_TRAIT, 0, 255, RULE_VISITED_ANY, RULE_ENERGY, 1, 0},
+    {RULE_ON_BUTTON2, RULE_ANY_TRAIT, 0, 255, RULE_VISITED_ANY, RULE_ENERGY, 5, 0},
+    {RULE_ON_BUTTON3, RULE_ANY_TRAIT, 0, 255, RULE_VISITED_ANY, RULE_ENERGY, (uint8_t)-5, 0},
+    {RULE_ON_BUTTON4, RULE_ANY_TRAIT, 0, 255, RULE_VISITED_ANY, RULE_ENERGY, (uint8_t)-1, 0},
+};
+
+// A table in flash
+struct RulesInFlash {
+    const StationRule* rules;
+    uint8_t size;
+
+    uint8_t count() const { return size; }
+    uint8_t trigger(uint8_t index) const { return pgm_read_byte(&rules[index].trigger); }
+    void read(uint8_t index, StationRule& rule) const { memcpy_P(&rule, &rules[index], RULE_SIZE); }
+};
+
+// A table in RAM (host tools)
+struct RulesInRam {
+    const StationRule* rules;
+    uint8_t size;
+
+    uint8_t count() const { return size; }
+    uint8_t trigger(uint8_t index) const { return rules[index].trigger; }
+    void read(uint8_t index, StationRule& rule) const { rule = rules[index]; }
+};
+
+// The table in the EEPROM, checked with stationRulesStored(): anything with
+// read(address), such as Arduino's EEPROM or the fakes of the host tools
+template <class Storage>
+struct RulesInStorage {
+    Storage& storage;
+
+    uint8_t count() const { return storage.read(RULES_EEPROM_START); }
+    uint8_t trigger(uint8_t index) const { return storage.read(RULES_EEPROM_START + 1 + index * RULE_SIZE); }
+    void read(uint8_t index, StationRule& rule) const {
+        uint8_t* bytes = reinterpret_cast<uint8_t*>(&rule);
+        for (uint8_t i = 0; i < RULE_SIZE; i++) {
+            bytes[i] = storage.read(RULES_EEPROM_START + 1 + index * RULE_SIZE + i);
+        }
+    }
+};
+
+inline bool stationRuleMatches(const StationRule& rule, const RuleOrb& orb) {
+    return (rule.trait == RULE_ANY_TRAIT || rule.trait == orb.trait) &&
+        orb.energy >= rule.energyMin && orb.energy <= rule.energyMax &&
+        (rule.visited == RULE_VISITED_ANY || (rule.visited == RULE_VISITED) == orb.visited);
+}
+
+// Runs the rules of table for trigger. Only the first byte of the other triggers' rules is read
+template <class Rules>
+void stationRulesRun(const Rules& table, uint8_t trigger, const RuleOrb& orb, RuleActions& actions) {
+    actions.energy = 0;
+    actions.setCustom = false;
+    actions.custom = 0;
+    actions.pulsePin = RULE_NO_PIN;
+    actions.pulseSeconds = 0;
+    actions.led = RULE_NO_LED;
+    actions.matched = 0;
+    uint8_t count = table.count();
+    for (uint8_t i = 0; i < count; i++) {
+        if (table.trigger(i) != trigger) {
+            continue;
+        }
+        StationRule rule;
+        table.read(i, rule);
+        if (!stationRuleMatches(rule, orb)) {
+            continue;
+        }
+        actions.matched++;
+        switch (rule.action & ~RULE_FINAL) {
+            case RULE_ENERGY:
+                actions.energy += (int8_t)rule.value;
+                break;
+            case RULE_SET_CUSTOM:
+                actions.setCustom = true;
+                actions.custom = rule.value;
+                break;
+            case RULE_PULSE_PIN:
+                actions.pulsePin = rule.value;
+                actions.pulseSeconds = rule.arg;
+                break;
+            case RULE_LED:
+                actions.led = rule.value;
+                break;
+        }
+        if (rule.action & RULE_FINAL) {
+            break;
+        }
+    }
+}
+
+// Whether the dock can run rule. pulsePins has a bit for each pin the station lets rules pulse
+inline bool stationRuleValid(const StationRule& rule, uint32_t pulsePins) {
+    uint8_t action = rule.action & ~RULE_FINAL;
+    if (rule.trigger >= RULE_TRIGGERS || rule.visited > RULE_VISITED || rule.energyMin > rule.energyMax ||
+        (rule.trait != RULE_ANY_TRAIT && rule.trait >= NUM_TRAITS) || action >= RULE_ACTIONS) {
+        return false;
+    }
+    switch (action) {
+        case RULE_ENERGY:
+        case RULE_SET_CUSTOM:
+            // Nothing to write to once the orb is gone
+            return rule.trigger != RULE_ON_DISCONNECT;
+        case RULE_PULSE_PIN:
+            return rule.value < 32 && (pulsePins & (1UL << rule.value));
+        default:
+            return rule.value < RULE_LED_EFFECTS;
+    }
+}
+
+// Host side: count, rules and CRC into out, returns the length (RULES_TABLE_SIZE)
+inline uint16_t stationRulesEncode(uint8_t* out, const StationRule* rules, uint8_t count) {
+    out[0] = count;
+    memcpy(out + 1, rules, count * RULE_SIZE);
+    uint16_t crc = crc16(out, 1 + count * RULE_SIZE, RULES_CRC_INIT);
+    out[1 + count * RULE_SIZE] = crc & 0xFF;
+    out[2 + count * RULE_SIZE] = crc >> 8;
+    return RULES_TABLE_SIZE(count);
+}
+
+// A table as uploaded or stored, RULES_TABLE_SIZE(table[0]) bytes
+inline bool stationRulesTableValid(const uint8_t* table, uint32_t pulsePins) {
+    uint8_t count = table[0];
+    if (count > RULES_MAX) {
+        return false;
+    }
+    uint16_t crc = crc16(table, 1 + count * RULE_SIZE, RULES_CRC_INIT);
+    if (table[1 + count * RULE_SIZE] != (crc & 0xFF) || table[2 + count * RULE_SIZE] != (crc >> 8)) {
+        return false;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        StationRule rule;
+        memcpy(&rule, table + 1 + i * RULE_SIZE, RULE_SIZE);
+        if (!stationRuleValid(rule, pulsePins)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether the EEPROM holds a table, which then runs instead of the preset
+template <class Storage>
+bool stationRulesStored(Storage& storage) {
+    uint8_t count = storage.read(RULES_EEPROM_START);
+    if (count > RULES_MAX) {
+        return false;
+    }
+    uint16_t crc = RULES_CRC_INIT;
+    for (uint16_t i = 0; i < 1 + count * RULE_SIZE; i++) {
+        crc = crc16Update(crc, storage.read(RULES_EEPROM_START + i));
+    }
+    return storage.read(RULES_EEPROM_START + 1 + count * RULE_SIZE) == (crc & 0xFF) &&
+        storage.read(RULES_EEPROM_START + 2 + count * RULE_SIZE) == (crc >> 8);
+}
+
+// Host side: a table frame, false if it's damaged. rules points into frame
+inline bool stationRulesDecodeFrame(const uint8_t* frame, uint16_t length, uint8_t& source, const uint8_t*& rules,
+    uint8_t& count) {
+    if (length < RULES_FRAME_SIZE(0) || memcmp(frame, RULES_MAGIC, 4) != 0 || frame[5] > RULES_MAX ||
+        length != RULES_FRAME_SIZE(frame[5])) {
+        return false;
+    }
+    uint16_t crc = crc16(frame + 4, length - 6);
+    if (frame[length - 2] != (crc & 0xFF) || frame[length - 1] != (crc >> 8)) {
+        return false;
+    }
+    source = frame[4];
+    count = frame[5];
+    rules = frame + 6;
+    return true;
+}
+
+#endif
@@ -0,0 +1,37 @@
+/**
+ * The station built into the firmware, chosen with a build flag - see the per-station
+ * environments in platformio.ini:
+ *   -DORB_STATION_BASIC, _CONFIGURIZER, _CASINO, _LEDSTRIP, _COMMS, _RULES or _TRIGGER
+ *
+ * Defines ORB_STATION_DOCK, the declaration of the global orbDock. Firmware builds
+ * without a flag get the Trigger station; benchmark builds without one get no station
+ * (Benchmark.cpp then runs its own suite).
+ */
+
+#ifndef STATION_SELECT_H
+#define STATION_SELECT_H
+
+#if defined(ORB_STATION_BASIC)
+#include "OrbDockBasic.cpp"
+#define ORB_STATION_DOCK OrbDockBasic orbDock{}
+#elif defined(ORB_STATION_CONFIGURIZER)
+#include "OrbDockConfigurizer.cpp"
+#define ORB_STATION_DOCK OrbDockConfigurizer orbDock{}
+#elif defined(ORB_STATION_CASINO)
+#include "OrbDockCasino.cpp"
+#define ORB_STATION_DOCK OrbDockCasino orbDock{}
+#elif defined(ORB_STATION_LEDSTRIP)
+#include "OrbDockLedStrip.cpp"
+#define ORB_STATION_DOCK OrbDockLedStrip orbDock{}
+#elif defined(ORB_STATION_COMMS)
+#include "OrbDockComms.h"
+#define ORB_STATION_DOCK OrbDockComms orbDock(10, 11, 12)
+#elif defined(ORB_STATION_RULES)
+#include "OrbDockRules.cpp"
+#define ORB_STATION_DOCK OrbDockRules orbDock{}
+#elif defined(ORB_STATION_TRIGGER) || !defined(ORB_BENCHMARK)
+#include "OrbDockTrigger.cpp"
+#define ORB_STATION_DOCK OrbDockTrigger orbDock(12)
+#endif
+
+#endif
@@ -0,0 +1,178 @@
+/**
+ * Tag image backup and restore over serial
+ *
+ * TAG_IMAGE_DUMP_COMMAND makes the dock read the whole tag in its field with bulk reads
+ * and send it as one frame:
+ *
+ *   "ORBI", tag type, pages, UID (7), pages x 4 bytes, result, CRC-16 (low byte first)
+ *
+ * The CRC covers everything after the magic. The result is TAG_IMAGE_OK, or why the
+ * image is incomplete (pages it couldn't read are sent as zeros, no tag means no pages).
+ * tools/tag-image keeps these frames as they are, as image files.
+ *
+ * TAG_IMAGE_RESTORE_COMMAND writes the user memory of an image back to a tag. The host
+ * sends the command followed by
+ *
+ *   tag type, UID (7) of the image, CRC-16
+ *
+ * and the dock answers each step with a reply, "ORBR", result, page, CRC-16 of result
+ * and page. page is the end (exclusive) of the next chunk the dock wants, 0 when it's
+ * done or has given up. The host then sends that chunk:
+ *
+ *   first page, page count (up to TAG_IMAGE_CHUNK_PAGES), count x 4 bytes, CRC-16
+ *
+ * Chunks go from the end of user memory down to TAG_IMAGE_USER_PAGE, so the orb header
+ * is written last and a tag lifted half way isn't taken for an orb. A chunk with a bad
+ * CRC or in the wrong place is answered with TAG_IMAGE_BAD_CHUNK and the same page, to
+ * be sent again. The dock reads each chunk's pages from the tag in one bulk read, writes
+ * only the ones that differ (last first) and checks them with a bulk read.
+ *
+ * A restore goes onto a tag of the image's type that isn't an orb (a blank tag), or onto
+ * the orb the image was taken from, never over another orb. Afterwards the dock leaves
+ * the tag alone until it is lifted, so it doesn't log a visit on the copy.
+ *
+ * No Arduino dependencies, so the host tools in tools/ can use it too.
+ */
+
+#ifndef TAG_IMAGE_H
+#define TAG_IMAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "Crc16.h"
+#include "OrbRegistry.h"
+
+#define TAG_IMAGE_DUMP_COMMAND 'i'
+#define TAG_IMAGE_RESTORE_COMMAND 'I'
+#define TAG_IMAGE_MAGIC "ORBI"
+#define TAG_IMAGE_REPLY_MAGIC "ORBR"
+#define TAG_IMAGE_UID_LENGTH 7
+#define TAG_IMAGE_HEADER_SIZE (2 + TAG_IMAGE_UID_LENGTH)            // Tag type, pages, UID
+#define TAG_IMAGE_FRAME_OVERHEAD (4 + TAG_IMAGE_HEADER_SIZE + 1 + 2)
+#define TAG_IMAGE_REQUEST_SIZE (1 + TAG_IMAGE_UID_LENGTH + 2)       // Restore: tag type, UID, CRC
+#define TAG_IMAGE_REPLY_SIZE (4 + 2 + 2)
+#define TAG_IMAGE_CHUNK_PAGES 12        // NFC_MAX_BURST_PAGES, and 52 byte chunks fit the AVR's 64 byte serial buffer
+#define TAG_IMAGE_CHUNK_SIZE (2 + TAG_IMAGE_CHUNK_PAGES * 4 + 2)
+#define TAG_IMAGE_USER_PAGE PAGE_OFFSET // First page restored, pages 0-3 are UID, lock bits and capability container
+#define TAG_IMAGE_TIMEOUT_MS 500        // Dock waiting for the restore request or a chunk
+#define TAG_IMAGE_CHUNK_RETRIES 3       // Bad chunks a restore gets over before giving up
+
+enum TagImageResult {
+    TAG_IMAGE_OK,
+    TAG_IMAGE_NO_TAG,           // Nothing in the field, or it didn't answer
+    TAG_IMAGE_READ_FAILED,
+    TAG_IMAGE_WRONG_TYPE,       // Restore onto a tag of another type
+    TAG_IMAGE_OTHER_ORB,        // Restore over an orb that isn't the image's
+    TAG_IMAGE_BAD_REQUEST,
+    TAG_IMAGE_BAD_CHUNK,        // Send the chunk again
+    TAG_IMAGE_WRITE_FAILED,
+    TAG_IMAGE_TIMEOUT,
+    TAG_IMAGE_RESULTS
+};
+
+const char TAG_IMAGE_RESULT_NAME_OK[] PROGMEM = "ok";
+const char TAG_IMAGE_RESULT_NAME_NO_TAG[] PROGMEM = "no tag";
+const char TAG_IMAGE_RESULT_NAME_READ_FAILED[] PROGMEM = "read failed";
+const char TAG_IMAGE_RESULT_NAME_WRONG_TYPE[] PROGMEM = "wrong tag type";
+const char TAG_IMAGE_RESULT_NAME_OTHER_ORB[] PROGMEM = "another orb";
+const char TAG_IMAGE_RESULT_NAME_BAD_REQUEST[] PROGMEM = "bad request";
+const char TAG_IMAGE_RESULT_NAME_BAD_CHUNK[] PROGMEM = "bad chunk";
+const char TAG_IMAGE_RESULT_NAME_WRITE_FAILED[] PROGMEM = "write failed";
+const char TAG_IMAGE_RESULT_NAME_TIMEOUT[] PROGMEM = "timeout";
+const char* const TAG_IMAGE_RESULT_NAMES[] PROGMEM = {
+    TAG_IMAGE_RESULT_NAME_OK, TAG_IMAGE_RESULT_NAME_NO_TAG, TAG_IMAGE_RESULT_NAME_READ_FAILED,
+    TAG_IMAGE_RESULT_NAME_WRONG_TYPE, TAG_IMAGE_RESULT_NAME_OTHER_ORB, TAG_IMAGE_RESULT_NAME_BAD_REQUEST,
+    TAG_IMAGE_RESULT_NAME_BAD_CHUNK, TAG_IMAGE_RESULT_NAME_WRITE_FAILED, TAG_IMAGE_RESULT_NAME_TIMEOUT
+};
+
+inline size_t tagImageFrameSize(uint8_t pages) {
+    return TAG_IMAGE_FRAME_OVERHEAD + (size_t)pages * 4;
+}
+
+// Pages in the restore chunk that ends at page (exclusive)
+inline uint8_t tagImageChunkPages(uint8_t page) {
+    uint8_t pages = page - TAG_IMAGE_USER_PAGE;
+    return pages < TAG_IMAGE_CHUNK_PAGES ? pages : TAG_IMAGE_CHUNK_PAGES;
+}
+
+// A dump frame, checked, pointing into the frame
+struct TagImage {
+    uint8_t type;
+    uint8_t pages;
+    const uint8_t* uid;
+    const uint8_t* data;        // pages x 4 bytes
+    uint8_t result;
+};
+
+// Host side: false if frame isn't a whole, undamaged dump frame
+inline bool tagImageDecode(const uint8_t* frame, size_t length, TagImage& image) {
+    if (length < TAG_IMAGE_FRAME_OVERHEAD || memcmp(frame, TAG_IMAGE_MAGIC, 4) != 0 ||
+        length != tagImageFrameSize(frame[5])) {
+        return false;
+    }
+    uint16_t crc = crc16(frame + 4, length - 6);
+    if (frame[length - 2] != (crc & 0xFF) || frame[length - 1] != (crc >> 8)) {
+        return false;
+    }
+    image.type = frame[4];
+    image.pages = frame[5];
+    image.uid = frame + 6;
+    image.data = frame + 4 + TAG_IMAGE_HEADER_SIZE;
+    image.result = frame[length - 3];
+    return true;
+}
+
+// Host side: the restore request that follows TAG_IMAGE_RESTORE_COMMAND
+inline void tagImageEncodeRequest(uint8_t* out, uint8_t type, const uint8_t* uid) {
+    out[0] = type;
+    memcpy(out + 1, uid, TAG_IMAGE_UID_LENGTH);
+    uint16_t crc = crc16(out, 1 + TAG_IMAGE_UID_LENGTH);
+    out[1 + TAG_IMAGE_UID_LENGTH] = crc & 0xFF;
+    out[2 + TAG_IMAGE_UID_LENGTH] = crc >> 8;
+}
+
+inline bool tagImageRequestValid(const uint8_t* request) {
+    uint16_t crc = crc16(request, 1 + TAG_IMAGE_UID_LENGTH);
+    return request[1 + TAG_IMAGE_UID_LENGTH] == (crc & 0xFF) && request[2 + TAG_IMAGE_UID_LENGTH] == (crc >> 8);
+}
+
+// Host side: a chunk of count pages from first, returns its length
+inline uint8_t tagImageEncodeChunk(uint8_t* out, uint8_t first, uint8_t count, const uint8_t* data) {
+    out[0] = first;
+    out[1] = count;
+    memcpy(out + 2, data, count * 4);
+    uint16_t crc = crc16(out, 2 + count * 4);
+    out[2 + count * 4] = crc & 0xFF;
+    out[3 + count * 4] = crc >> 8;
+    return 4 + count * 4;
+}
+
+// Dock side, a chunk whose first two bytes say it has count pages
+inline bool tagImageChunkValid(const uint8_t* chunk) {
+    uint8_t count = chunk[1];
+    uint16_t crc = crc16(chunk, 2 + count * 4);
+    return chunk[2 + count * 4] == (crc & 0xFF) && chunk[3 + count * 4] == (crc >> 8);
+}
+
+inline void tagImageEncodeReply(uint8_t* out, uint8_t result, uint8_t page) {
+    memcpy(out, TAG_IMAGE_REPLY_MAGIC, 4);
+    out[4] = result;
+    out[5] = page;
+    uint16_t crc = crc16(out + 4, 2);
+    out[6] = crc & 0xFF;
+    out[7] = crc >> 8;
+}
+
+// Host side: reply is TAG_IMAGE_REPLY_SIZE bytes starting with the magic
+inline bool tagImageDecodeReply(const uint8_t* reply, uint8_t& result, uint8_t& page) {
+    uint16_t crc = crc16(reply + 4, 2);
+    if (memcmp(reply, TAG_IMAGE_REPLY_MAGIC, 4) != 0 || reply[6] != (crc & 0xFF) || reply[7] != (crc >> 8)) {
+        return false;
+    }
+    result = reply[4];
+    page = reply[5];
+    return true;
+}
+
+#endif
@@ -1,17 +1,9 @@
+#ifndef ORB_BENCHMARK  // The bench environment has its own setup() and loop() in Benchmark.cpp
 #include <Arduino.h>
-#include "OrbDockConfigurizer.cpp"
-#include "OrbDockBasic.cpp"
-#include "OrbDockCasino.cpp"
-#include "OrbDockLedStrip.cpp"
-#include "OrbDockComms.h"
-#include "OrbDockTrigger.cpp"
+#include "StationSelect.h"
 
-//OrbDockBasic orbDock{};
-//OrbDockConfigurizer orbDock{};
-//OrbDockCasino orbDock{};
-//OrbDockLedStrip orbDock{};
-//OrbDockComms orbDock(10, 11, 12);
-OrbDockTrigger orbDock(12);
+// The station comes from the build environment, see StationSelect.h and platformio.ini
+ORB_STATION_DOCK;
 
 void setup() {
     Serial.begin(115200);
@@ -22,3 +14,5 @@ void setup() {
 void loop() {
     orbDock.loop();
 }
+
+#endif
@@ -0,0 +1,112 @@
+/**
+ * Host simulator for the wear-leveled energy ring (src/EnergyRing.h)
+ *
+ * Models an NTAG213 where every page dies after a number of write cycles, replays
+ * Casino-style button presses (random add/remove energy) and reports how many
+ * writes the orb survives with the legacy single ENERGY_PAGE vs the energy ring.
+ * Also cuts power in the middle of some writes to check the newest record is
+ * always a value that was actually written.
+ *
+ * Build and run on the host:
+ *   g++ -std=c++11 -O2 -I../../src -o energy-wear-sim energy-wear-sim.cpp
+ *   ./energy-wear-sim [page endurance] [writes per night]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include "EnergyRing.h"
+#include "OrbRegistry.h"
+
+#define NTAG213_PAGES 45
+
+struct SimTag {
+    uint8_t pages[NTAG213_PAGES][4];
+    uint32_t writes[NTAG213_PAGES];
+    uint32_t endurance;
+
+    explicit SimTag(uint32_t pageEndurance) : endurance(pageEndurance) {
+        memset(pages, 0, sizeof(pages));
+        memset(writes, 0, sizeof(writes));
+    }
+
+    // Returns false once the page is worn out; a torn write stores garbage
+    bool write(int page, const uint8_t* data, bool torn, std::mt19937& rng) {
+        if (writes[page] >= endurance) return false;
+        writes[page]++;
+        memcpy(pages[page], data, 4);
+        if (torn) pages[page][rng() % 4] ^= 1 + rng() % 255;
+        return true;
+    }
+};
+
+// Writes until the energy page dies, returns the number of successful writes
+static uint32_t runLegacy(uint32_t endurance, std::mt19937& rng) {
+    SimTag tag(endurance);
+    uint32_t count = 0;
+    uint8_t energy = 5;
+    uint8_t page[4] = {0, 0, 0, 0};
+    while (true) {
+        energy = (energy + 1 + rng() % 5) % 250;
+        page[0] = energy;
+        if (!tag.write(ENERGY_PAGE, page, false, rng)) return count;
+        count++;
+    }
+}
+
+// Writes until any ring page dies, checking recovery after torn writes
+static uint32_t runRing(uint32_t endurance, uint32_t& tornWrites, uint32_t& badRecoveries, std::mt19937& rng) {
+    SimTag tag(endurance);
+    uint32_t count = 0;
+    uint8_t energy = 5;
+    uint8_t lastGood = 0;
+    int8_t newest = -1;
+    uint8_t seq = 0;
+    uint8_t page[4];
+    while (true) {
+        energy = (energy + 1 + rng() % 5) % 250;
+        uint8_t slot = energyRingNextSlot(newest, ENERGY_RING_SLOTS);
+        uint8_t nextSeq = newest < 0 ? 0 : seq + 1;
+        energyRingEncode(page, energy, nextSeq);
+        bool torn = rng() % 1000 == 0;
+        if (!tag.write(ENERGY_RING_PAGE + slot, page, torn, rng)) return count;
+        count++;
+
+        // Re-read the ring the way readEnergy() does after the orb is re-seated
+        int8_t found = energyRingFindNewest(&tag.pages[ENERGY_RING_PAGE][0], ENERGY_RING_SLOTS);
+        if (torn) {
+            tornWrites++;
+            // A torn write must fall back to the last committed value
+            if (found >= 0 && tag.pages[ENERGY_RING_PAGE + found][0] != lastGood) {
+                badRecoveries++;
+            }
+        } else {
+            lastGood = energy;
+            if (found < 0 || tag.pages[ENERGY_RING_PAGE + found][0] != energy) badRecoveries++;
+        }
+        newest = found;
+        if (found >= 0) seq = tag.pages[ENERGY_RING_PAGE + found][1];
+    }
+}
+
+int main(int argc, char** argv) {
+    uint32_t endurance = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+    uint32_t writesPerNight = argc > 2 ? strtoul(argv[2], nullptr, 10) : 3000;
+    std::mt19937 rng(1234);
+
+    uint32_t legacyWrites = runLegacy(endurance, rng);
+    uint32_t tornWrites = 0;
+    uint32_t badRecoveries = 0;
+    uint32_t ringWrites = runRing(endurance, tornWrites, badRecoveries, rng);
+
+    printf("Page endurance:        %u writes\n", endurance);
+    printf("Ring slots:            %d pages (from page %d)\n", ENERGY_RING_SLOTS, ENERGY_RING_PAGE);
+    printf("Legacy ENERGY_PAGE:    %u energy writes (%.1f nights at %u writes/night)\n",
+        legacyWrites, (double)legacyWrites / writesPerNight, writesPerNight);
+    printf("Energy ring:           %u energy writes (%.1f nights at %u writes/night)\n",
+        ringWrites, (double)ringWrites / writesPerNight, writesPerNight);
+    printf("Lifetime improvement:  %.2fx\n", (double)ringWrites / legacyWrites);
+    printf("Torn writes simulated: %u, bad recoveries: %u\n", tornWrites, badRecoveries);
+    return badRecoveries == 0 ? 0 : 1;
+}
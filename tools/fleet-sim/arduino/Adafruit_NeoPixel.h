@@ -0,0 +1,47 @@
+#ifndef NATIVE_NEOPIXEL_H
+#define NATIVE_NEOPIXEL_H
+
+#include <Arduino.h>
+
+#define NEO_GRB 0x52
+#define NEO_KHZ800 0x0000
+#define NEOPIXEL_SHOW_US_PER_PIXEL 30   // 24 bits at 800 kHz, with interrupts off
+
+typedef uint16_t neoPixelType;
+
+class Adafruit_NeoPixel;
+
+// Called with every frame shown, for tools/led-frames - NULL in the fleet simulator
+extern void (*neoPixelShowHook)(const Adafruit_NeoPixel& strip);
+
+// Keeps the pixels (GRB, unscaled - LedOutput does its own brightness), and show() takes as long as on the dock
+class Adafruit_NeoPixel {
+public:
+    Adafruit_NeoPixel(uint16_t n, int16_t pin, neoPixelType type) : numLEDs(n), pixels((uint8_t*)calloc(n ? n : 1, 3)) {}
+    ~Adafruit_NeoPixel() { free(pixels); }
+    void begin() {}
+    void show() {
+        if (neoPixelShowHook) neoPixelShowHook(*this);
+        delayMicroseconds(numLEDs * NEOPIXEL_SHOW_US_PER_PIXEL);
+    }
+    void setBrightness(uint8_t brightness) {}
+    void setPixelColor(uint16_t n, uint32_t color) { setPixelColor(n, color >> 16, color >> 8, color); }
+    void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b) {
+        if (n >= numLEDs) return;
+        pixels[n * 3] = g;
+        pixels[n * 3 + 1] = r;
+        pixels[n * 3 + 2] = b;
+    }
+    void fill(uint32_t color = 0, uint16_t first = 0, uint16_t count = 0) {
+        for (uint16_t i = first; i < (count ? first + count : numLEDs); i++) setPixelColor(i, color);
+    }
+    uint8_t* getPixels() const { return pixels; }
+    uint16_t numPixels() const { return numLEDs; }
+    static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) { return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b; }
+
+private:
+    uint16_t numLEDs;
+    uint8_t* pixels;
+};
+
+#endif
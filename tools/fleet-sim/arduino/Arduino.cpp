@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <Arduino.h>
+#include <Wire.h>
+#include <U8glib.h>
+#include <Adafruit_NeoPixel.h>
+#include <EEPROM.h>
+
+thread_local ArduinoClock* arduinoClock;
+thread_local ArduinoEEPROM* arduinoEEPROM;
+thread_local ArduinoSerialPort* arduinoSerial;
+EEPROMClass EEPROM;
+HardwareSerial Serial;
+TwoWire Wire;
+void (*neoPixelShowHook)(const Adafruit_NeoPixel& strip);
+const uint8_t u8g_font_fub49n[] = {0};
+const uint8_t u8g_font_fub17[] = {0};
+
+char* itoa(int value, char* buffer, int radix) {
+    snprintf(buffer, 12, radix == 16 ? "%x" : "%d", value);
+    return buffer;
+}
+
+size_t HardwareSerial::write(uint8_t data) {
+    if (arduinoSerial) {
+        arduinoSerial->output.push_back(data);
+        arduinoClock->micros += NATIVE_SERIAL_BYTE_US;
+    }
+    return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        write(data[i]);
+    }
+    return length;
+}
+
+int HardwareSerial::available() {
+    if (!arduinoSerial) {
+        return 0;
+    }
+    ArduinoSerialPort& port = *arduinoSerial;
+    if (port.inputRead == port.input.size() && port.refill) {
+        port.refill(port);
+    }
+    return port.input.size() - port.inputRead;
+}
+
+int HardwareSerial::read() {
+    if (available() == 0) {
+        return -1;
+    }
+    arduinoClock->micros += NATIVE_SERIAL_BYTE_US;
+    return arduinoSerial->input[arduinoSerial->inputRead++];
+}
+
+// Like Stream's: gives up once nothing has come for the timeout
+size_t HardwareSerial::readBytes(uint8_t* buffer, size_t length) {
+    size_t count = 0;
+    while (count < length) {
+        int data = read();
+        if (data < 0) {
+            arduinoClock->micros += (uint64_t)(arduinoSerial ? arduinoSerial->timeout : 1000) * 1000;
+            break;
+        }
+        buffer[count++] = data;
+    }
+    return count;
+}
+
+void HardwareSerial::setTimeout(unsigned long ms) {
+    if (arduinoSerial) {
+        arduinoSerial->timeout = ms;
+    }
+}
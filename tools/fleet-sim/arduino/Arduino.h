@@ -0,0 +1,109 @@
+/**
+ * Host stand-in for the Arduino core, for running docks in tools/fleet-sim
+ *
+ * Time is virtual: every thread points arduinoClock at the clock of the dock it is
+ * running, millis()/micros() read it and delay() advances it. EEPROM.h works the same
+ * way, each dock has its own. Serial text output is dropped, and so is binary output
+ * (Serial.write()) unless the thread points arduinoSerial at a port. Pins are no-ops
+ * and digitalRead() returns HIGH (buttons released).
+ */
+
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+#define PROGMEM
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define DEC 10
+#define HEX 16
+#define PI 3.1415926535897932384626433832795
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// Virtual time of the dock the current thread is running
+struct ArduinoClock {
+    uint64_t micros;
+};
+
+extern thread_local ArduinoClock* arduinoClock;
+
+inline unsigned long millis() { return arduinoClock->micros / 1000; }
+inline unsigned long micros() { return arduinoClock->micros; }
+inline void delay(unsigned long ms) { arduinoClock->micros += (uint64_t)ms * 1000; }
+inline void delayMicroseconds(unsigned int us) { arduinoClock->micros += us; }
+
+inline void pinMode(uint8_t pin, uint8_t mode) {}
+inline void digitalWrite(uint8_t pin, uint8_t value) {}
+inline int digitalRead(uint8_t pin) { return HIGH; }
+inline void analogWrite(uint8_t pin, int value) {}
+inline long map(long x, long inMin, long inMax, long outMin, long outMax) {
+    return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+char* itoa(int value, char* buffer, int radix);
+
+class Print {
+public:
+    size_t write(uint8_t data) { return 1; }
+    size_t write(const uint8_t* data, size_t length) { return length; }
+    template <typename T> size_t print(T value, int format = DEC) { return 0; }
+    template <typename T> size_t println(T value, int format = DEC) { return 0; }
+    size_t println() { return 0; }
+};
+
+class Stream : public Print {
+public:
+    int available() { return 0; }
+    int read() { return -1; }
+};
+
+#define NATIVE_SERIAL_BYTE_US 87     // A byte at 115200 baud
+
+// The other end of the dock's serial port, for a host tool talking to the dock in virtual
+// time: every byte the dock reads or writes takes NATIVE_SERIAL_BYTE_US
+struct ArduinoSerialPort {
+    std::vector<uint8_t> input;
+    size_t inputRead;
+    std::vector<uint8_t> output;
+    unsigned long timeout;      // Stream::setTimeout()
+    // Called when the dock waits for a byte and input has run out, to queue the tool's answer
+    void (*refill)(ArduinoSerialPort& port);
+
+    ArduinoSerialPort() : inputRead(0), timeout(1000), refill(NULL) {}
+};
+
+extern thread_local ArduinoSerialPort* arduinoSerial;
+
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long baud) {}
+    void flush() {}
+    int availableForWrite() { return 63; }     // Output is dropped or kept whole, so the buffer is always empty
+    operator bool() { return true; }
+    size_t write(uint8_t data);
+    size_t write(const uint8_t* data, size_t length);
+    int available();
+    int read();
+    size_t readBytes(uint8_t* buffer, size_t length);
+    void setTimeout(unsigned long ms);
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef NATIVE_EEPROM_H
+#define NATIVE_EEPROM_H
+
+#include <Arduino.h>
+
+#define NATIVE_EEPROM_SIZE 1024
+
+// EEPROM of the dock the current thread is running, erased to 0xFF
+struct ArduinoEEPROM {
+    uint8_t bytes[NATIVE_EEPROM_SIZE];
+};
+
+extern thread_local ArduinoEEPROM* arduinoEEPROM;
+
+class EEPROMClass {
+public:
+    uint8_t read(int address) { return arduinoEEPROM->bytes[address]; }
+    void write(int address, uint8_t value) { arduinoEEPROM->bytes[address] = value; }
+    void update(int address, uint8_t value) { arduinoEEPROM->bytes[address] = value; }
+    uint16_t length() { return NATIVE_EEPROM_SIZE; }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
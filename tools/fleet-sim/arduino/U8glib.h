@@ -0,0 +1,36 @@
+#ifndef NATIVE_U8GLIB_H
+#define NATIVE_U8GLIB_H
+
+#include <Arduino.h>
+
+#define U8G_I2C_OPT_NONE 0
+#define U8G_PAGES 8
+#define U8G_PAGE_US 11500   // 128 bytes of a page at 100 kHz I2C
+
+extern const uint8_t u8g_font_fub49n[];
+extern const uint8_t u8g_font_fub17[];
+
+// Draws nothing, but the picture loop has as many pages, and takes as long, as on the dock
+class U8GLIB_SSD1306_128X64 {
+public:
+    U8GLIB_SSD1306_128X64(uint8_t options) : page(0) {}
+    void begin() {}
+    void setFont(const uint8_t* font) {}
+    void setFontRefHeightExtendedText() {}
+    void setDefaultForegroundColor() {}
+    void setFontPosTop() {}
+    int8_t getFontAscent() { return 12; }
+    int8_t getFontDescent() { return -3; }
+    uint8_t getStrWidth(const char* text) { return strlen(text) * 10; }
+    uint8_t drawStr(uint8_t x, uint8_t y, const char* text) { return getStrWidth(text); }
+    void firstPage() { page = 0; }
+    uint8_t nextPage() {
+        delayMicroseconds(U8G_PAGE_US);
+        return ++page < U8G_PAGES;
+    }
+
+private:
+    uint8_t page;
+};
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef NATIVE_WIRE_H
+#define NATIVE_WIRE_H
+
+#include <Arduino.h>
+
+// Every I2C device answers
+class TwoWire : public Stream {
+public:
+    void begin() {}
+    void beginTransmission(uint8_t address) {}
+    uint8_t endTransmission(bool stop = true) { return 0; }
+};
+
+extern TwoWire Wire;
+
+#endif
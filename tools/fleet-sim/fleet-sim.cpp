@@ -0,0 +1,413 @@
+/**
+ * Dock fleet simulator
+ *
+ * Runs the real station classes (Basic, Casino, Configurizer, Comms, Trigger) on
+ * the host, against the in-memory tags of lib/FakePN532 with modelled reader
+ * timing and the virtual-time Arduino core in arduino/. A population of orbs walks
+ * between the docks, dwells at each one and is sometimes lifted and put back
+ * (re-seated) during a visit; every orb keeps its own tag, so what one dock writes
+ * the next one reads.
+ *
+ * Docks are split over worker threads. Virtual time advances in SIM_EPOCH_US
+ * epochs: the main thread moves orbs in and out of docks, then every worker runs
+ * its docks' loop() up to the end of the epoch.
+ *
+ * Reports per station type:
+ *  - insert-to-callback latency: orb placed -> onOrbConnected() returned, orb lifted ->
+ *    onOrbDisconnected() returned (the end of the loop() that called it - the stations'
+ *    callbacks are resolved at compile time, so the simulator can't wrap them)
+ *  - NFC transactions (selects and exchanges) until the callback, and per visit
+ *  - throughput ceiling: orbs/hour if visitors swapped orbs with no dwell at all, from
+ *    the connect plus the disconnect latency
+ *  - the longest single loop(), which is how long the LEDs and NFC polling can stall
+ *
+ * Build and run on the host:
+ *   g++ -std=gnu++11 -O2 -pthread -DFAKE_PN532_THREAD_LOCAL=thread_local -Iarduino -I../../lib/FakePN532/src -I../../src \
+ *       -o fleet-sim fleet-sim.cpp arduino/Arduino.cpp ../../lib/FakePN532/src/FakePN532.cpp \
+ *       ../../src/OrbDock.cpp ../../src/LedOutput.cpp \
+ *       ../../src/OrbDockComms.cpp ../../src/ButtonDisplay.cpp
+ *   ./fleet-sim [--docks 1000] [--orbs-per-dock 3] [--minutes 10] [--threads N] [--reseat 15]
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "OrbDock.h"
+#include "OrbDockBasic.cpp"
+#include "OrbDockCasino.cpp"
+#include "OrbDockConfigurizer.cpp"
+#include "OrbDockComms.h"
+#include "OrbDockTrigger.cpp"
+
+// Arduino's min/max macros, which would break std::min/std::max below
+#undef min
+#undef max
+
+#define SIM_EPOCH_US 10000      // Orbs move between epochs
+#define SIM_LOOP_US 1000        // Virtual time of one loop() besides the delays it makes
+#define DWELL_MIN_S 5
+#define DWELL_MAX_S 60
+#define WALK_MIN_S 10
+#define WALK_MAX_S 90
+#define RESEAT_MIN_MS 300       // Time a re-seated orb is out of the field
+#define RESEAT_MAX_MS 1500
+#define START_ENERGY 20
+
+enum StationType {
+    SIM_BASIC, SIM_CASINO, SIM_CONFIGURIZER, SIM_COMMS, SIM_TRIGGER, SIM_STATION_TYPES
+};
+
+static const char* const STATION_TYPE_NAMES[] = {
+    "Basic", "Casino", "Configurizer", "Comms", "Trigger"
+};
+
+struct DockStats {
+    std::vector<uint32_t> connectLatency;       // us
+    std::vector<uint32_t> disconnectLatency;    // us
+    uint64_t transactionsToConnect;
+    uint64_t transactionsPerVisit;
+    uint32_t visits;
+    uint32_t reseats;
+    uint32_t missed;                            // Orb left before the dock saw it
+    uint32_t loopMax;                           // Longest loop(), us
+};
+
+// What the simulator needs from a dock, independent of its station class
+class SimDock {
+public:
+    SimDock(StationType stationType) : type(stationType), orbTag(NULL), placedAt(0), liftedAt(0), placedTransactions(0), connected(false) {
+        clock.micros = 0;
+        memset(eeprom.bytes, 0xFF, sizeof(eeprom.bytes));
+        emptyField.present = false;
+        emptyField.timed = true;
+        stats.transactionsToConnect = stats.transactionsPerVisit = 0;
+        stats.visits = stats.reseats = stats.missed = 0;
+        stats.loopMax = 0;
+    }
+    virtual ~SimDock() {}
+
+    void enter() {
+        arduinoClock = &clock;
+        arduinoEEPROM = &eeprom;
+        fakeField = orbTag ? orbTag : &emptyField;
+    }
+
+    virtual void start() = 0;
+    virtual void step() = 0;
+
+    // Called by the main thread between epochs
+    void place(FakeNTAG* tag, uint64_t now) {
+        orbTag = tag;
+        placedAt = now;
+        placedTransactions = tag->selects + tag->exchanges;
+    }
+
+    void lift(uint64_t now) {
+        if (!connected) stats.missed++;
+        orbTag = NULL;
+        liftedAt = now;
+    }
+
+    StationType type;
+    ArduinoClock clock;
+    ArduinoEEPROM eeprom;
+    DockStats stats;
+
+protected:
+    void orbConnected() {
+        connected = true;
+        stats.connectLatency.push_back(clock.micros - placedAt);
+        stats.transactionsToConnect += orbTag ? orbTag->selects + orbTag->exchanges - placedTransactions : 0;
+    }
+
+    void orbDisconnected() {
+        connected = false;
+        stats.disconnectLatency.push_back(clock.micros - liftedAt);
+    }
+
+public:
+    FakeNTAG* orbTag;
+    FakeNTAG emptyField;
+    uint64_t placedAt;
+    uint64_t liftedAt;
+    uint32_t placedTransactions;
+    bool connected;
+};
+
+// A station class, watched for orbs connecting and disconnecting after each loop()
+template <class Station>
+class SimStation : public Station, public SimDock {
+public:
+    template <typename... Args>
+    SimStation(StationType type, Args... args) : Station(args...), SimDock(type) {
+    }
+
+    void start() override {
+        enter();
+        Station::begin();
+    }
+
+    void step() override {
+        enter();
+        bool wasConnected = this->isOrbConnected;
+        uint64_t loopStart = clock.micros;
+        Station::loop();
+        stats.loopMax = std::max(stats.loopMax, (uint32_t)(clock.micros - loopStart));
+        if (this->isOrbConnected && !wasConnected) {
+            orbConnected();
+        } else if (!this->isOrbConnected && wasConnected) {
+            orbDisconnected();
+        }
+        clock.micros += SIM_LOOP_US;
+    }
+};
+
+enum OrbState {
+    ORB_WALKING, ORB_SEATED, ORB_RESEATING
+};
+
+struct SimOrb {
+    FakeNTAG tag;
+    OrbState state;
+    int dock;
+    uint64_t nextAt;        // Virtual time of the orb's next move
+    uint64_t reseatAt;      // During a visit: when it's lifted to be re-seated, 0 if it isn't
+    uint32_t transactionsAtPlace;
+};
+
+// Reusable barrier for the epoch handoff between the main thread and the workers
+class Barrier {
+public:
+    explicit Barrier(int count) : count(count), waiting(0), generation(0) {
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        int arrived = generation;
+        if (++waiting == count) {
+            waiting = 0;
+            generation++;
+            condition.notify_all();
+        } else {
+            condition.wait(lock, [&] { return generation != arrived; });
+        }
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable condition;
+    int count;
+    int waiting;
+    int generation;
+};
+
+static SimDock* makeDock(StationType type) {
+    switch (type) {
+        case SIM_BASIC: return new SimStation<OrbDockBasic>(type);
+        case SIM_CASINO: return new SimStation<OrbDockCasino>(type);
+        case SIM_CONFIGURIZER: return new SimStation<OrbDockConfigurizer>(type);
+        case SIM_COMMS: return new SimStation<OrbDockComms>(type, 10, 11, 12);
+        default: return new SimStation<OrbDockTrigger>(type, 12);
+    }
+}
+
+// A formatted orb with its own 7 byte UID
+static void makeOrb(SimOrb& orb, uint32_t serial, std::mt19937& rng) {
+    uint8_t uid[7] = {0x04, (uint8_t)serial, (uint8_t)(serial >> 8), (uint8_t)(serial >> 16), (uint8_t)(serial >> 24), 0x5C, 0x80};
+    memcpy(orb.tag.pages[0], uid, 3);
+    orb.tag.pages[0][3] = 0x88 ^ uid[0] ^ uid[1] ^ uid[2];
+    memcpy(orb.tag.pages[1], uid + 3, 4);
+    orb.tag.pages[2][0] = uid[3] ^ uid[4] ^ uid[5] ^ uid[6];
+    orb.tag.formatOrb(1 + rng() % (NUM_TRAITS - 1), START_ENERGY, ENERGY_RING_PAGE);
+    orb.tag.timed = true;
+    orb.state = ORB_WALKING;
+    orb.dock = -1;
+    orb.nextAt = (uint64_t)(rng() % (WALK_MAX_S * 1000)) * 1000;
+    orb.reseatAt = 0;
+}
+
+static uint64_t randomMicros(std::mt19937& rng, uint32_t minMs, uint32_t maxMs) {
+    return (uint64_t)(minMs + rng() % (maxMs - minMs + 1)) * 1000;
+}
+
+// Moves the orbs whose next move is due
+static void moveOrbs(std::vector<SimOrb>& orbs, std::vector<SimDock*>& docks, std::vector<int>& occupant,
+                     uint64_t now, int reseatPercent, std::mt19937& rng) {
+    for (size_t i = 0; i < orbs.size(); i++) {
+        SimOrb& orb = orbs[i];
+        if (orb.state == ORB_SEATED && orb.reseatAt != 0 && now >= orb.reseatAt) {
+            docks[orb.dock]->lift(now);
+            docks[orb.dock]->stats.reseats++;
+            orb.state = ORB_RESEATING;
+            orb.reseatAt = now + randomMicros(rng, RESEAT_MIN_MS, RESEAT_MAX_MS);
+            continue;
+        }
+        if (orb.state == ORB_RESEATING && now >= orb.reseatAt) {
+            docks[orb.dock]->place(&orb.tag, now);
+            orb.state = ORB_SEATED;
+            orb.reseatAt = 0;
+            continue;
+        }
+        if (now < orb.nextAt) continue;
+
+        if (orb.state == ORB_WALKING) {
+            // Try a random dock, or keep walking for a bit if it's taken
+            int dock = rng() % docks.size();
+            if (occupant[dock] >= 0) {
+                orb.nextAt = now + randomMicros(rng, 1000, 5000);
+                continue;
+            }
+            occupant[dock] = i;
+            orb.dock = dock;
+            orb.state = ORB_SEATED;
+            orb.transactionsAtPlace = orb.tag.selects + orb.tag.exchanges;
+            docks[dock]->place(&orb.tag, now);
+            uint64_t dwell = randomMicros(rng, DWELL_MIN_S * 1000, DWELL_MAX_S * 1000);
+            orb.nextAt = now + dwell;
+            orb.reseatAt = (int)(rng() % 100) < reseatPercent ? now + dwell / 2 : 0;
+        } else {
+            // Done - lifted for good (an orb out for a re-seat is just not put back)
+            SimDock* dock = docks[orb.dock];
+            if (orb.state == ORB_SEATED) dock->lift(now);
+            dock->stats.visits++;
+            dock->stats.transactionsPerVisit += orb.tag.selects + orb.tag.exchanges - orb.transactionsAtPlace;
+            occupant[orb.dock] = -1;
+            orb.dock = -1;
+            orb.state = ORB_WALKING;
+            orb.reseatAt = 0;
+            orb.nextAt = now + randomMicros(rng, WALK_MIN_S * 1000, WALK_MAX_S * 1000);
+        }
+    }
+}
+
+static uint32_t percentile(std::vector<uint32_t>& values, int percent) {
+    if (values.empty()) return 0;
+    return values[(values.size() - 1) * percent / 100];
+}
+
+static double mean(const std::vector<uint32_t>& values) {
+    if (values.empty()) return 0;
+    double sum = 0;
+    for (uint32_t value : values) sum += value;
+    return sum / values.size();
+}
+
+static void report(std::vector<SimDock*>& docks) {
+    printf("%-13s %6s %7s | %-28s | %-28s | %7s %7s | %8s %8s\n", "station", "docks", "visits",
+        "connect ms p50/p90/p99/max", "disconnect ms p50/p99/max", "nfc/con", "nfc/vis", "orbs/h", "loop ms");
+    for (int type = 0; type < SIM_STATION_TYPES; type++) {
+        DockStats total;
+        total.transactionsToConnect = total.transactionsPerVisit = 0;
+        total.visits = total.reseats = total.missed = 0;
+        total.loopMax = 0;
+        int count = 0;
+        for (SimDock* dock : docks) {
+            if (dock->type != type) continue;
+            count++;
+            DockStats& stats = dock->stats;
+            total.connectLatency.insert(total.connectLatency.end(), stats.connectLatency.begin(), stats.connectLatency.end());
+            total.disconnectLatency.insert(total.disconnectLatency.end(), stats.disconnectLatency.begin(), stats.disconnectLatency.end());
+            total.transactionsToConnect += stats.transactionsToConnect;
+            total.transactionsPerVisit += stats.transactionsPerVisit;
+            total.visits += stats.visits;
+            total.reseats += stats.reseats;
+            total.missed += stats.missed;
+            total.loopMax = std::max(total.loopMax, stats.loopMax);
+        }
+        if (count == 0) continue;
+        std::sort(total.connectLatency.begin(), total.connectLatency.end());
+        std::sort(total.disconnectLatency.begin(), total.disconnectLatency.end());
+        std::vector<uint32_t>& connect = total.connectLatency;
+        std::vector<uint32_t>& disconnect = total.disconnectLatency;
+        double service = mean(connect) + mean(disconnect);
+        printf("%-13s %6d %7u | %6.0f %6.0f %6.0f %6.0f | %8.0f %8.0f %8.0f | %7.1f %7.1f | %8.0f %8.1f\n",
+            STATION_TYPE_NAMES[type], count, total.visits,
+            percentile(connect, 50) / 1000.0, percentile(connect, 90) / 1000.0, percentile(connect, 99) / 1000.0,
+            connect.empty() ? 0 : connect.back() / 1000.0,
+            percentile(disconnect, 50) / 1000.0, percentile(disconnect, 99) / 1000.0,
+            disconnect.empty() ? 0 : disconnect.back() / 1000.0,
+            connect.empty() ? 0 : (double)total.transactionsToConnect / connect.size(),
+            total.visits ? (double)total.transactionsPerVisit / total.visits : 0,
+            service > 0 ? 3600e6 / service : 0, total.loopMax / 1000.0);
+        if (total.missed > 0 || total.reseats > 0) {
+            printf("%-13s %6s %7s   %u re-seats, %u placements lifted before the dock saw them\n", "", "", "",
+                total.reseats, total.missed);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    int numDocks = 1000;
+    int orbsPerDock = 3;
+    int minutes = 10;
+    int reseatPercent = 15;
+    int numThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--docks") == 0) numDocks = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--orbs-per-dock") == 0) orbsPerDock = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--minutes") == 0) minutes = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--threads") == 0) numThreads = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--reseat") == 0) reseatPercent = atoi(argv[i + 1]);
+    }
+
+    std::mt19937 rng(1);
+    std::vector<SimDock*> docks;
+    for (int i = 0; i < numDocks; i++) {
+        docks.push_back(makeDock((StationType)(i % SIM_STATION_TYPES)));
+        docks.back()->start();
+    }
+    std::vector<int> occupant(numDocks, -1);
+    std::vector<SimOrb> orbs(numDocks * orbsPerDock);
+    for (size_t i = 0; i < orbs.size(); i++) {
+        makeOrb(orbs[i], i, rng);
+    }
+
+    // Docks' clocks start wherever begin() left them, line them up
+    uint64_t now = 0;
+    for (SimDock* dock : docks) now = std::max(now, dock->clock.micros);
+    for (SimDock* dock : docks) dock->clock.micros = now;
+    uint64_t end = now + (uint64_t)minutes * 60 * 1000000;
+
+    printf("%d docks, %zu orbs, %d virtual minutes on %d threads\n", numDocks, orbs.size(), minutes, numThreads);
+    Barrier epochStart(numThreads + 1);
+    Barrier epochEnd(numThreads + 1);
+    uint64_t epochEndAt = 0;
+    bool running = true;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < numThreads; t++) {
+        workers.emplace_back([&, t] {
+            while (true) {
+                epochStart.wait();
+                if (!running) return;
+                for (size_t i = t; i < docks.size(); i += numThreads) {
+                    while (docks[i]->clock.micros < epochEndAt) {
+                        docks[i]->step();
+                    }
+                }
+                epochEnd.wait();
+            }
+        });
+    }
+
+    for (; now < end; now += SIM_EPOCH_US) {
+        moveOrbs(orbs, docks, occupant, now, reseatPercent, rng);
+        epochEndAt = now + SIM_EPOCH_US;
+        epochStart.wait();
+        epochEnd.wait();
+    }
+    running = false;
+    epochStart.wait();
+    for (std::thread& worker : workers) worker.join();
+
+    report(docks);
+    for (SimDock* dock : docks) delete dock;
+    return 0;
+}
@@ -0,0 +1,334 @@
+/**
+ * How many I2C docks one bus can serve
+ *
+ * Simulates a show controller on one I2C bus with docks in I2C target mode (the real
+ * register map of src/DockRegisters.h on each simulated dock). Orbs are placed, change
+ * energy and are lifted at random at --rate changes per dock per second, and the
+ * controller sends a SET_ENERGY to a random dock every so often (--commands per dock per
+ * second), which the dock runs NFC_WRITE_MS later.
+ *
+ * The controller reads DOCK_READ_EVENT bytes from DOCK_REG_CHANGES in one write and
+ * repeated start read, in one of three ways:
+ *   polling      every dock in turn, as fast as the bus goes - no data-ready lines
+ *   shared line  the docks' data-ready lines wired together: docks in turn while it's low
+ *   line/dock    a data-ready line per dock: only the docks whose line is low
+ *
+ * For each bus clock and way, finds the most docks (up to the 112 7-bit addresses) for
+ * which 99% of changes reach the controller within --deadline ms, the update rate the
+ * show needs. Bus time counts the bits, the target's clock stretching and the
+ * controller's gap between transactions; the bus capacitance limit isn't modelled.
+ *
+ * Fails if the controller's copy of a dock differs from the dock's registers at the end
+ * (a change lost between the dock and the controller) or a command goes unanswered.
+ *
+ * Build and run on the host:
+ *   g++ -std=c++11 -O2 -I../../src -o i2c-bus i2c-bus.cpp
+ *   ./i2c-bus [--rate 2] [--deadline 50] [--commands 0.1] [--seconds 30]
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "DockRegisters.h"
+#include "OrbRegistry.h"
+
+#define MAX_DOCKS 112           // 7-bit addresses that aren't reserved
+#define TARGET_STRETCH_US 40    // Dock's TWI interrupt holding the clock, per transaction
+#define CONTROLLER_GAP_US 20    // Controller's time between transactions
+#define NFC_WRITE_MS 25         // Dock running a command
+#define DRAIN_MS 2000           // After the changes stop, for the controller to catch up
+#define STATUS_FAILED 0         // STATUS_* in OrbDock.h
+#define STATUS_SUCCEEDED 1
+
+enum Mode { MODE_POLLING, MODE_SHARED_LINE, MODE_LINE_PER_DOCK, MODES };
+static const char* const MODE_NAMES[] = {"polling", "shared line", "line/dock"};
+
+struct Options {
+    double rate;
+    double deadline;
+    double commands;
+    double seconds;
+};
+
+struct SimDock {
+    DockRegisterMap registers;
+    uint8_t uid[DOCK_UID_LENGTH];
+    bool orb;
+    double nextChange;          // us
+    double commandDone;         // us, 0 while no command is running
+    double changedSince;        // Oldest change the controller hasn't read, -1 for none
+    double commandSent;         // us, 0 while the controller isn't waiting for a result
+    uint8_t seen[DOCK_REGISTERS];   // Controller's copy
+};
+
+struct Result {
+    double p99;                 // ms
+    double max;
+    double busy;                // Fraction of the time the bus was in use
+    int lost;                   // Docks whose copy differs at the end
+    int unanswered;             // Commands without a result
+    double commandP99;          // ms, command write to result read
+};
+
+static double percentile(std::vector<double>& values, double fraction) {
+    if (values.empty()) return 0;
+    size_t index = (size_t)(fraction * (values.size() - 1));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+// START, address, register, repeated START, address, bytes, STOP - in bit times
+static double readMicros(int bytes, double bitMicros) {
+    return (1 + 9 + 9 + 1 + 9 + 9 * bytes + 1) * bitMicros + TARGET_STRETCH_US + CONTROLLER_GAP_US;
+}
+
+static double writeMicros(int bytes, double bitMicros) {
+    return (1 + 9 + 9 * bytes + 1) * bitMicros + TARGET_STRETCH_US + CONTROLLER_GAP_US;
+}
+
+class Bus {
+public:
+    Bus(int numDocks, Mode mode, double clock, const Options& options)
+        : docks(numDocks), mode(mode), bitMicros(1e6 / clock), options(options), rng(12345), next(0) {
+        for (int i = 0; i < numDocks; i++) {
+            SimDock& dock = docks[i];
+            dockRegistersInit(dock.registers, 1 + i % (NUM_STATIONS - 1));
+            memcpy(dock.seen, dock.registers.bytes, DOCK_REGISTERS);
+            dock.orb = false;
+            dock.commandDone = 0;
+            dock.changedSince = -1;
+            dock.commandSent = 0;
+            dock.nextChange = interval(options.rate);
+        }
+        nextCommand = interval(options.commands * numDocks);
+    }
+
+    Result run() {
+        double end = options.seconds * 1e6;
+        double now = 0;
+        double busy = 0;
+        commandsSent = 0;
+        commandsAnswered = 0;
+        while (now < end + DRAIN_MS * 1000.0) {
+            bool changing = now < end;
+            runDocks(now, changing);
+            double took = 0;
+            if (changing && now >= nextCommand) {
+                took = sendCommand(now);
+                nextCommand += interval(options.commands * docks.size());
+            }
+            if (took == 0) {
+                int dock = pickDock();
+                if (dock >= 0) took = readEvent(dock, now);
+            }
+            if (took > 0) {
+                busy += took;
+                now += took;
+            } else {
+                now = nextWake(now, changing);
+            }
+        }
+
+        Result result;
+        result.busy = busy / now;
+        result.p99 = percentile(latencies, 0.99) / 1000;
+        result.max = latencies.empty() ? 0 : *std::max_element(latencies.begin(), latencies.end()) / 1000;
+        result.commandP99 = percentile(commandLatencies, 0.99) / 1000;
+        result.lost = 0;
+        for (const SimDock& dock : docks) {
+            // The registers an event read covers
+            if (memcmp(dock.seen + DOCK_REG_STATUS, dock.registers.bytes + DOCK_REG_STATUS,
+                    DOCK_REG_NFC_ERRORS - DOCK_REG_STATUS) != 0 || dockRegistersDataReady(dock.registers)) {
+                result.lost++;
+            }
+        }
+        result.unanswered = commandsSent - commandsAnswered;
+        return result;
+    }
+
+private:
+    std::vector<SimDock> docks;
+    Mode mode;
+    double bitMicros;
+    Options options;
+    std::mt19937 rng;
+    int next;                   // Round robin
+    double nextCommand;
+    int commandsSent;
+    int commandsAnswered;
+    std::vector<double> latencies;
+    std::vector<double> commandLatencies;
+
+    double interval(double perSecond) {
+        std::exponential_distribution<double> distribution(perSecond / 1e6);
+        return distribution(rng);
+    }
+
+    void changed(SimDock& dock, double now) {
+        if (dock.changedSince < 0 && dockRegistersDataReady(dock.registers)) {
+            dock.changedSince = now;
+        }
+    }
+
+    // What happened on the docks up to now
+    void runDocks(double now, bool changing) {
+        for (SimDock& dock : docks) {
+            while (changing && dock.nextChange <= now) {
+                double at = dock.nextChange;
+                if (!dock.orb || rng() % 10 < 3) {
+                    dock.orb = !dock.orb;
+                    if (dock.orb) {
+                        for (uint8_t& byte : dock.uid) byte = rng();
+                    }
+                    dockRegistersSetOrb(dock.registers, dock.orb, dock.uid, 1 + rng() % 5, rng() % 250, rng() & 0x7FFF);
+                } else {
+                    dockRegistersSet(dock.registers, DOCK_REG_ENERGY, rng() % 250, DOCK_CHANGED_ENERGY);
+                }
+                changed(dock, at);
+                dock.nextChange += interval(options.rate);
+            }
+            if (dock.commandDone > 0 && dock.commandDone <= now) {
+                uint8_t command;
+                uint8_t argument;
+                if (dockRegistersTakeCommand(dock.registers, command, argument)) {
+                    if (dock.orb) {
+                        dockRegistersSet(dock.registers, DOCK_REG_ENERGY, argument, DOCK_CHANGED_ENERGY);
+                    }
+                    dockRegistersCommandDone(dock.registers, dock.orb ? STATUS_SUCCEEDED : STATUS_FAILED);
+                    changed(dock, dock.commandDone);
+                }
+                dock.commandDone = 0;
+            }
+        }
+    }
+
+    double nextWake(double now, bool changing) {
+        double wake = changing ? nextCommand : now + DRAIN_MS * 1000.0;
+        for (const SimDock& dock : docks) {
+            if (changing) wake = std::min(wake, dock.nextChange);
+            if (dock.commandDone > 0) wake = std::min(wake, dock.commandDone);
+        }
+        return std::max(wake, now + 1);
+    }
+
+    // The dock to read next, -1 for none
+    int pickDock() {
+        int count = docks.size();
+        if (mode == MODE_POLLING) {
+            return next++ % count;
+        }
+        bool anyReady = false;
+        for (int i = 0; i < count; i++) {
+            int dock = (next + i) % count;
+            if (dockRegistersDataReady(docks[dock].registers)) {
+                if (mode == MODE_LINE_PER_DOCK) {
+                    next = dock + 1;
+                    return dock;
+                }
+                anyReady = true;
+            }
+        }
+        // Shared line: the controller can't tell which dock pulled it, so it reads them in turn
+        return anyReady ? next++ % count : -1;
+    }
+
+    double readEvent(int index, double now) {
+        SimDock& dock = docks[index];
+        uint8_t pointer = DOCK_REG_CHANGES;
+        dockRegistersReceive(dock.registers, &pointer, 1);
+        uint8_t data[DOCK_I2C_BUFFER];
+        dockRegistersRequest(dock.registers, data);
+        double took = readMicros(DOCK_READ_EVENT, bitMicros);
+        uint8_t changes = data[0];
+        if (changes != 0) {
+            latencies.push_back(now + took - dock.changedSince);
+            dock.changedSince = -1;
+            memcpy(dock.seen + DOCK_REG_CHANGES, data, DOCK_READ_EVENT);
+            if (changes & DOCK_CHANGED_RESULT) {
+                commandsAnswered++;
+                commandLatencies.push_back(now + took - dock.commandSent);
+                dock.commandSent = 0;
+                // The result itself, one more read
+                pointer = DOCK_REG_RESULT;
+                dockRegistersReceive(dock.registers, &pointer, 1);
+                dockRegistersRequest(dock.registers, data);
+                took += readMicros(1, bitMicros);
+            }
+        }
+        return took;
+    }
+
+    double sendCommand(double now) {
+        SimDock& dock = docks[rng() % docks.size()];
+        // One command per dock at a time, the controller waits for its result
+        if (dock.commandSent > 0) {
+            return 0;
+        }
+        uint8_t data[3] = {DOCK_REG_COMMAND, DOCK_COMMAND_SET_ENERGY, (uint8_t)(rng() % 250)};
+        commandsSent++;
+        dockRegistersReceive(dock.registers, data, sizeof(data));
+        dock.commandSent = now;
+        dock.commandDone = now + NFC_WRITE_MS * 1000.0;
+        return writeMicros(sizeof(data), bitMicros);
+    }
+};
+
+static bool meets(const Result& result, const Options& options) {
+    return result.p99 <= options.deadline && result.lost == 0 && result.unanswered == 0;
+}
+
+int main(int argc, char** argv) {
+    Options options = {2, 50, 0.1, 30};
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--rate") == 0) options.rate = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--deadline") == 0) options.deadline = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--commands") == 0) options.commands = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--seconds") == 0) options.seconds = atof(argv[i + 1]);
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    printf("%.1f changes/s and %.2f commands/s per dock, 99%% of changes within %.0f ms\n\n",
+        options.rate, options.commands, options.deadline);
+    printf("%-8s %-12s %6s %8s %8s %9s %11s\n", "bus", "controller", "docks", "p99 ms", "max ms", "bus busy", "command p99");
+    const double CLOCKS[] = {100000, 400000};
+    bool ok = true;
+    for (double clock : CLOCKS) {
+        for (int mode = 0; mode < MODES; mode++) {
+            // Most docks that meet the deadline, by bisection
+            int low = 0;
+            int high = MAX_DOCKS;
+            Result best = {0, 0, 0, 0, 0, 0};
+            while (low < high) {
+                int docks = (low + high + 1) / 2;
+                Result result = Bus(docks, (Mode)mode, clock, options).run();
+                if (result.lost || result.unanswered) {
+                    printf("%3.0f kHz %-12s %6d: %d docks out of sync, %d commands unanswered - FAILED\n",
+                        clock / 1000, MODE_NAMES[mode], docks, result.lost, result.unanswered);
+                    ok = false;
+                }
+                if (meets(result, options)) {
+                    low = docks;
+                    best = result;
+                } else {
+                    high = docks - 1;
+                }
+            }
+            if (low == 0) {
+                printf("%3.0f kHz  %-12s %6s\n", clock / 1000, MODE_NAMES[mode], "none");
+                continue;
+            }
+            printf("%3.0f kHz  %-12s %5d%s %8.1f %8.1f %8.0f%% %11.1f\n", clock / 1000, MODE_NAMES[mode], low,
+                low == MAX_DOCKS ? "+" : " ", best.p99, best.max, best.busy * 100, best.commandP99);
+        }
+    }
+    if (!ok) {
+        printf("\nFAILED\n");
+    }
+    return ok ? 0 : 1;
+}
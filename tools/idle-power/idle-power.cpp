@@ -0,0 +1,224 @@
+/**
+ * Idle mode battery check
+ *
+ * Runs a battery dock on the host (the virtual-time Arduino core and NeoPixel stand-in
+ * of tools/fleet-sim, and the timed in-memory tag of lib/FakePN532) through a day at a
+ * quiet outdoor station: a group of players every VISIT_EVERY minutes, each of them
+ * putting an orb on the dock for a while, and nobody in between. It runs the day twice,
+ * with idle mode off and on (see src/IdlePower.h), and reports the time the AVR was
+ * awake, the mean current of the AVR, the PN532, the ring and the rest of the board,
+ * and how long BATTERY_MAH lasts.
+ *
+ * The currents are rough figures from the parts' datasheets, not measurements of a
+ * dock: what comes out is the ratio between the two runs more than the hours. The AVR
+ * current goes by the awake fraction the dock counts itself (the 's' command), the
+ * PN532 by the time the fake reader spent with its field on and in PowerDown, and the
+ * ring by the channel values of every frame sent to it.
+ *
+ * Fails if an orb isn't seen, if one waits longer than IDLE_NFC_CHECK_INTERVAL and the
+ * read to be seen, if the dock never went idle, or if idle mode doesn't save current.
+ *
+ * Build and run on the host:
+ *   g++ -std=gnu++11 -O2 -DIDLE_AFTER_MS=60000 -I../fleet-sim/arduino -I../../lib/FakePN532/src -I../../src \
+ *       -o idle-power idle-power.cpp ../fleet-sim/arduino/Arduino.cpp ../../lib/FakePN532/src/FakePN532.cpp \
+ *       ../../src/OrbDock.cpp ../../src/LedOutput.cpp
+ *   ./idle-power [--hours 2]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <Arduino.h>
+#include <Adafruit_NeoPixel.h>
+#include "OrbDock.h"
+
+#undef min
+#undef max
+
+static_assert(IDLE_AFTER_MS > 0, "build with -DIDLE_AFTER_MS=60000, as the battery docks are");
+
+// The day
+#define VISIT_EVERY 20          // Minutes between groups, the first one after 5
+#define GROUP_SIZE 4            // Orbs per group, one after the other
+#define ORB_ON_MS 20000
+#define ORB_GAP_MS 10000
+#define LOOP_PASS_US 200        // A loop() pass with nothing to do, on the AVR
+#define MAX_DETECT_MS (IDLE_NFC_CHECK_INTERVAL + 250)
+
+// Currents in mA, at 5 V
+#define AVR_ACTIVE_MA 12.0      // ATmega328P at 16 MHz
+#define AVR_SLEEP_MA 4.0        // In idle sleep mode, timer 0 and the UART running
+#define BOARD_MA 6.0            // Regulator, power LED, pull-ups
+#define PN532_FIELD_MA 110.0    // Running a command, RF field on
+#define PN532_STANDBY_MA 40.0   // Between commands
+#define PN532_DOWN_MA 0.01      // PowerDown
+#define PIXEL_MA 0.6            // WS2812 with its LEDs off
+#define CHANNEL_MA 20.0         // One colour of one pixel at 255
+#define BATTERY_MAH 10000.0
+
+class BatteryDock : public OrbDock<BatteryDock> {
+public:
+    static const uint8_t FEATURES = FEATURE_LED_PATTERNS | FEATURE_ENERGY;
+
+    BatteryDock(bool idle) : OrbDock(StationId::GENERIC) {
+        if (!idle) {
+            idlePower.after = 0;
+        }
+    }
+
+    const IdlePower& power() {
+        return idlePower;
+    }
+
+    std::vector<uint32_t> connects;     // millis() of each orb seen
+
+protected:
+    friend class OrbDock<BatteryDock>;
+
+    void onOrbConnected() {
+        connects.push_back(millis());
+        addEnergy(1);
+    }
+};
+
+struct Result {
+    double awake;               // Fractions of the day
+    double idle;
+    double avrMa;
+    double pn532Ma;
+    double ledMa;
+    uint32_t placed;
+    uint32_t seen;
+    uint32_t maxDetectMs;
+    uint16_t wakes;
+};
+
+static ArduinoClock hostClock;
+static uint64_t ledCharge;      // Channel sum x microseconds
+static uint32_t ledSum;         // Of the frame on the ring
+static uint64_t ledSince;
+
+static void recordFrame(const Adafruit_NeoPixel& strip) {
+    ledCharge += (uint64_t)ledSum * (micros() - ledSince);
+    ledSince = micros();
+    const uint8_t* pixels = strip.getPixels();
+    ledSum = 0;
+    for (int i = 0; i < strip.numPixels() * 3; i++) {
+        ledSum += pixels[i];
+    }
+}
+
+static Result runDay(bool idle, uint32_t hours) {
+    hostClock.micros = 0;
+    ledCharge = 0;
+    ledSum = 0;
+    ledSince = 0;
+    memset(&fakePN532Power, 0, sizeof(fakePN532Power));
+    FakeNTAG field;
+    field.timed = true;
+    field.present = false;
+    field.formatOrb(TraitId::DOUBT, 100, ENERGY_RING_PAGE);
+    fakeField = &field;
+
+    BatteryDock dock(idle);
+    dock.begin();
+
+    Result result = {};
+    std::vector<uint32_t> placedAt;
+    uint64_t endMicros = (uint64_t)hours * 3600 * 1000000;
+    while (micros() < endMicros) {
+        // Where the day is: in a group's visit, which orb and whether it's on the dock
+        uint32_t now = millis();
+        uint32_t minute = now / 60000;
+        bool present = false;
+        if (minute >= 5) {
+            uint32_t intoVisit = now - ((minute - 5) / VISIT_EVERY * VISIT_EVERY + 5) * 60000;
+            uint32_t orb = intoVisit / (ORB_ON_MS + ORB_GAP_MS);
+            present = orb < GROUP_SIZE && intoVisit % (ORB_ON_MS + ORB_GAP_MS) < ORB_ON_MS;
+        }
+        if (present && !field.present) {
+            placedAt.push_back(now);
+        }
+        field.present = present;
+
+        dock.loop();
+        delayMicroseconds(LOOP_PASS_US);
+    }
+    uint64_t total = micros();
+    ledCharge += (uint64_t)ledSum * (total - ledSince);
+
+    const IdlePower& power = dock.power();
+    uint64_t slept = (uint64_t)power.sleptMillis * 1000 + power.sleptMicros;
+    result.awake = 1.0 - (double)slept / total;
+    result.idle = idlePowerIdleMillis(power, millis()) * 1000.0 / total;
+    result.wakes = power.wakes;
+    result.avrMa = AVR_ACTIVE_MA * result.awake + AVR_SLEEP_MA * (1.0 - result.awake);
+
+    uint64_t down = fakePN532Power.downMicros + (fakePN532Power.down ? total - fakePN532Power.downSince : 0);
+    double fieldShare = (double)fakePN532Power.fieldMicros / total;
+    double downShare = (double)down / total;
+    result.pn532Ma = PN532_FIELD_MA * fieldShare + PN532_DOWN_MA * downShare +
+        PN532_STANDBY_MA * (1.0 - fieldShare - downShare);
+    result.ledMa = PIXEL_MA * LED_COUNT + CHANNEL_MA * ((double)ledCharge / total) / 255;
+
+    result.placed = placedAt.size();
+    result.seen = dock.connects.size();
+    for (size_t i = 0; i < placedAt.size() && i < dock.connects.size(); i++) {
+        uint32_t detect = dock.connects[i] - placedAt[i];
+        if (detect > result.maxDetectMs) {
+            result.maxDetectMs = detect;
+        }
+    }
+    return result;
+}
+
+static double totalMa(const Result& result) {
+    return result.avrMa + result.pn532Ma + result.ledMa + BOARD_MA;
+}
+
+int main(int argc, char** argv) {
+    uint32_t hours = 2;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--hours") && i + 1 < argc) {
+            hours = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--hours N]\n", argv[0]);
+            return 2;
+        }
+    }
+    arduinoClock = &hostClock;
+    neoPixelShowHook = recordFrame;
+
+    printf("%u h, a group of %d every %d min, idle after %d s\n\n", (unsigned)hours, GROUP_SIZE, VISIT_EVERY, IDLE_AFTER_MS / 1000);
+    printf("%-9s %7s %7s %6s %8s %8s %8s %8s %9s %10s %6s\n", "idle", "awake", "idle", "wakes",
+        "AVR mA", "PN532 mA", "LEDs mA", "total mA", "battery h", "orbs seen", "max ms");
+    Result results[2];
+    bool ok = true;
+    for (int idle = 0; idle < 2; idle++) {
+        const Result& result = results[idle] = runDay(idle, hours);
+        double total = totalMa(result);
+        printf("%-9s %6.1f%% %6.1f%% %6u %8.2f %8.2f %8.2f %8.2f %9.0f %5u/%-4u %6u\n", idle ? "on" : "off",
+            result.awake * 100, result.idle * 100, result.wakes, result.avrMa, result.pn532Ma, result.ledMa,
+            total, BATTERY_MAH / total, (unsigned)result.seen, (unsigned)result.placed, (unsigned)result.maxDetectMs);
+        if (result.seen != result.placed || result.placed == 0) {
+            printf("  FAILED: orbs missed\n");
+            ok = false;
+        }
+        if (result.maxDetectMs > MAX_DETECT_MS) {
+            printf("  FAILED: an orb waited longer than %d ms to be seen\n", MAX_DETECT_MS);
+            ok = false;
+        }
+    }
+    if (results[1].wakes == 0) {
+        printf("  FAILED: the dock never went idle\n");
+        ok = false;
+    }
+    double gain = totalMa(results[0]) / totalMa(results[1]);
+    printf("\nBattery life with idle mode: x%.2f\n", gain);
+    if (gain <= 1.0) {
+        printf("FAILED: idle mode saves nothing\n");
+        ok = false;
+    }
+    return ok ? 0 : 1;
+}
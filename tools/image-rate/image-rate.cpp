@@ -0,0 +1,275 @@
+/**
+ * Tag image dump and restore times
+ *
+ * Runs a dock on the host (the virtual-time Arduino core of tools/fleet-sim with a
+ * virtual serial port, and timed tags from lib/FakePN532) and talks to it the way
+ * tools/tag-image does (see src/TagImage.h): it dumps an orb the dock has just logged a
+ * visit on, restores the image onto a blank tag, restores it again onto the orb it came
+ * from, tries it over another orb, and restores onto a blank tag with the first chunk
+ * damaged on the way. Every serial byte takes its time at 115200 baud, and the host
+ * takes HOST_TURNAROUND_US to answer a reply (USB serial latency).
+ *
+ * Reports the time from the command to the end of the frame or the last reply, the
+ * NFC exchanges and the serial bytes of each, and fails if a dump or restore takes
+ * MAX_MS or more, if a restored tag's user memory differs from the image, if the orb
+ * the dock refused was touched, or if the dock logs a visit on a restored tag.
+ *
+ * Build and run on the host:
+ *   g++ -std=gnu++11 -O2 -I../fleet-sim/arduino -I../../lib/FakePN532/src -I../../src \
+ *       -o image-rate image-rate.cpp ../fleet-sim/arduino/Arduino.cpp ../../lib/FakePN532/src/FakePN532.cpp \
+ *       ../../src/OrbDock.cpp ../../src/LedOutput.cpp
+ *   ./image-rate
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <Arduino.h>
+#include "OrbDock.h"
+
+#undef min
+#undef max
+
+#define HOST_TURNAROUND_US 2000
+#define SETTLE_MS 1000          // Lets the dock see a tag placed or lifted
+#define MAX_MS 500              // "Well under a second"
+
+class ImageDock : public OrbDock<ImageDock> {
+public:
+    static const uint8_t FEATURES = FEATURE_LED_PATTERNS | FEATURE_ENERGY;
+
+    ImageDock() : OrbDock(StationId::GENERIC), connects(0) {}
+
+    uint32_t connects;
+
+protected:
+    friend class OrbDock<ImageDock>;
+
+    void onOrbConnected() {
+        connects++;
+        addEnergy(10);
+    }
+};
+
+// The host end of the serial port, answering the dock's restore replies with chunks
+struct Host {
+    ArduinoSerialPort port;
+    const uint8_t* image;       // Page 0 first
+    size_t scanned;             // Output bytes looked at
+    bool done;
+    uint8_t result;
+    int damage;                 // Chunks still to send with a flipped bit
+    int resent;
+};
+
+static ArduinoClock hostClock;
+static Host host;
+
+static void hostRefill(ArduinoSerialPort& port) {
+    while (!host.done && port.output.size() >= host.scanned + TAG_IMAGE_REPLY_SIZE) {
+        uint8_t result;
+        uint8_t page;
+        if (!tagImageDecodeReply(&port.output[host.scanned], result, page)) {
+            host.scanned++;     // The dock's text output
+            continue;
+        }
+        host.scanned += TAG_IMAGE_REPLY_SIZE;
+        if (page == 0) {
+            host.done = true;
+            host.result = result;
+            return;
+        }
+        if (result == TAG_IMAGE_BAD_CHUNK) {
+            host.resent++;
+        }
+        uint8_t count = tagImageChunkPages(page);
+        uint8_t first = page - count;
+        uint8_t chunk[TAG_IMAGE_CHUNK_SIZE];
+        uint8_t length = tagImageEncodeChunk(chunk, first, count, host.image + first * 4);
+        if (host.damage > 0) {
+            host.damage--;
+            chunk[2] ^= 0x01;
+        }
+        delayMicroseconds(HOST_TURNAROUND_US);
+        port.input.insert(port.input.end(), chunk, chunk + length);
+        return;
+    }
+}
+
+static void settle(ImageDock& dock, uint32_t ms) {
+    uint32_t start = millis();
+    while (millis() - start < ms) {
+        dock.loop();
+        delayMicroseconds(1000);
+    }
+}
+
+// Puts tag on the dock, or nothing for NULL
+static void place(ImageDock& dock, FakeNTAG* tag) {
+    static FakeNTAG empty;
+    empty.present = false;
+    fakeField = tag ? tag : &empty;
+    settle(dock, SETTLE_MS);
+}
+
+struct Run {
+    const char* name;
+    double ms;
+    uint32_t exchanges;
+    size_t bytes;
+    uint8_t result;
+    int resent;
+};
+
+static void printRun(const Run& run) {
+    printf("%-22s %8.1f %10u %8zu %6d  %s\n", run.name, run.ms, (unsigned)run.exchanges, run.bytes, run.resent,
+        registryName(TAG_IMAGE_RESULT_NAMES, run.result));
+}
+
+// Sends TAG_IMAGE_DUMP_COMMAND, keeps the frame in frame
+static Run dump(ImageDock& dock, FakeNTAG& tag, std::vector<uint8_t>& frame) {
+    host.port.input.assign(1, TAG_IMAGE_DUMP_COMMAND);
+    host.port.inputRead = 0;
+    host.port.output.clear();
+    uint32_t exchanges = tag.exchanges;
+    uint64_t start = micros();
+    dock.loop();
+    Run run = {"dump", (micros() - start) / 1000.0, tag.exchanges - exchanges, 0, TAG_IMAGE_NO_TAG, 0};
+
+    const std::vector<uint8_t>& output = host.port.output;
+    frame.clear();
+    for (size_t i = 0; i + TAG_IMAGE_FRAME_OVERHEAD <= output.size(); i++) {
+        if (memcmp(&output[i], TAG_IMAGE_MAGIC, 4) == 0 && i + tagImageFrameSize(output[i + 5]) <= output.size()) {
+            frame.assign(output.begin() + i, output.begin() + i + tagImageFrameSize(output[i + 5]));
+            break;
+        }
+    }
+    TagImage image;
+    if (tagImageDecode(frame.data(), frame.size(), image)) {
+        run.result = image.result;
+        run.bytes = frame.size();
+    }
+    return run;
+}
+
+// Sends TAG_IMAGE_RESTORE_COMMAND for image and answers the dock until it's done
+static Run restore(const char* name, ImageDock& dock, FakeNTAG& tag, const TagImage& image, int damage) {
+    uint8_t request[TAG_IMAGE_REQUEST_SIZE];
+    tagImageEncodeRequest(request, image.type, image.uid);
+    host.port.input.assign(1, TAG_IMAGE_RESTORE_COMMAND);
+    host.port.input.insert(host.port.input.end(), request, request + sizeof(request));
+    host.port.inputRead = 0;
+    host.port.output.clear();
+    host.image = image.data;
+    host.scanned = 0;
+    host.done = false;
+    host.result = TAG_IMAGE_TIMEOUT;
+    host.damage = damage;
+    host.resent = 0;
+
+    uint32_t exchanges = tag.exchanges;
+    uint64_t start = micros();
+    dock.loop();
+    hostRefill(host.port);      // The last reply, which wants no answer
+    Run run = {name, (micros() - start) / 1000.0, tag.exchanges - exchanges,
+        host.port.input.size() + host.port.output.size(), host.result, host.resent};
+    return run;
+}
+
+static bool sameUserMemory(const FakeNTAG& tag, const TagImage& image) {
+    for (uint8_t page = TAG_IMAGE_USER_PAGE; page < TAG_LAYOUTS[image.type].userPageEnd; page++) {
+        if (memcmp(tag.pages[page], image.data + page * 4, 4) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool check(bool ok, const char* failure) {
+    if (!ok) {
+        printf("FAILED: %s\n", failure);
+    }
+    return ok;
+}
+
+int main() {
+    arduinoClock = &hostClock;
+    host.port.refill = hostRefill;
+    arduinoSerial = &host.port;
+
+    ImageDock dock;
+    dock.begin();
+
+    FakeNTAG orb;
+    orb.timed = true;
+    orb.formatOrb(TraitId::DOUBT, 100, ENERGY_RING_PAGE);
+    FakeNTAG blank;
+    blank.timed = true;
+    FakeNTAG other;
+    other.timed = true;
+    other.formatOrb(TraitId::RUMINATE, 40, ENERGY_RING_PAGE);
+    other.pages[1][0] ^= 0x01;      // Another UID, and its check byte
+    other.pages[2][0] ^= 0x01;
+    FakeNTAG damaged;
+    damaged.timed = true;
+
+    printf("%-22s %8s %10s %8s %6s  %s\n", "", "ms", "exchanges", "bytes", "resent", "result");
+    bool ok = true;
+
+    // The dock logs a visit on the orb, then dumps it
+    place(dock, &orb);
+    std::vector<uint8_t> frame;
+    Run run = dump(dock, orb, frame);
+    printRun(run);
+    TagImage image;
+    ok &= check(tagImageDecode(frame.data(), frame.size(), image) && image.result == TAG_IMAGE_OK &&
+        image.pages == TAG_LAYOUTS[TAG_NTAG213].totalPages && memcmp(image.data, orb.pages, image.pages * 4) == 0,
+        "the dump isn't the orb");
+    ok &= check(run.ms < MAX_MS, "dump too slow");
+    uint8_t imagePages[FAKE_NTAG_PAGES * 4];
+    memcpy(imagePages, image.data, sizeof(imagePages));
+    image.data = imagePages;
+    place(dock, NULL);
+
+    // Onto a blank tag, which the dock then leaves alone until it's lifted
+    place(dock, &blank);
+    run = restore("restore onto blank", dock, blank, image, 0);
+    printRun(run);
+    ok &= check(run.result == TAG_IMAGE_OK && sameUserMemory(blank, image), "blank tag not restored");
+    ok &= check(run.ms < MAX_MS, "restore too slow");
+    uint32_t connects = dock.connects;
+    settle(dock, SETTLE_MS);
+    ok &= check(dock.connects == connects && sameUserMemory(blank, image), "visit logged on the restored tag");
+    place(dock, NULL);
+    place(dock, &blank);
+    ok &= check(dock.connects == connects + 1, "restored tag not an orb once put back");
+    place(dock, NULL);
+
+    // Onto the orb it came from, which needs no writes
+    place(dock, &orb);
+    memcpy(imagePages, orb.pages, sizeof(imagePages));
+    run = restore("restore onto same orb", dock, orb, image, 0);
+    printRun(run);
+    ok &= check(run.result == TAG_IMAGE_OK && sameUserMemory(orb, image), "same orb not restored");
+    place(dock, NULL);
+
+    // Never over another orb
+    place(dock, &other);
+    FakeNTAG before = other;
+    run = restore("restore over other orb", dock, other, image, 0);
+    printRun(run);
+    ok &= check(run.result == TAG_IMAGE_OTHER_ORB && memcmp(before.pages, other.pages, sizeof(before.pages)) == 0,
+        "other orb not refused, or touched");
+    place(dock, NULL);
+
+    // A chunk damaged on the way is sent again
+    place(dock, &damaged);
+    run = restore("restore, chunk damaged", dock, damaged, image, 1);
+    printRun(run);
+    ok &= check(run.result == TAG_IMAGE_OK && run.resent == 1 && sameUserMemory(damaged, image),
+        "damaged chunk not resent");
+    place(dock, NULL);
+
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,316 @@
+/**
+ * EEPROM journal under power cuts and a lossy link
+ *
+ * Runs src/EventJournal.h on a fake EEPROM that loses power after a random number of
+ * byte writes, leaving garbage in the byte it was writing half the time. The dock
+ * journals an event every EVENT_MIN_MS-EVENT_MAX_MS and uploads like
+ * OrbDockComms::uploadJournal(), over a serial link that drops frames and
+ * acknowledgements and is unplugged for a while now and then, to a gateway that takes
+ * records with journalUpload() like tools/orb-gateway. After a power cut the dock
+ * starts again from what journalBegin() finds.
+ *
+ * Fails if a record that was completely written never reaches the gateway (unless it
+ * was overwritten while the link was down), reaches it changed, or is handled twice.
+ * Reports the wear: writes of the most written EEPROM byte, and events until it
+ * reaches EEPROM_ENDURANCE.
+ *
+ * Build and run on the host:
+ *   g++ -std=c++11 -O2 -I../../src -o journal-sim journal-sim.cpp
+ *   ./journal-sim [--events 20000] [--cut-writes 4000] [--loss 5] [--seed 1]
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <random>
+#include <set>
+#include <vector>
+#include "DockProtocol.h"
+#include "EventJournal.h"
+#include "EventQueue.h"
+
+#define TICK_MS 1
+#define EVENT_MIN_MS 200
+#define EVENT_MAX_MS 2000
+#define SERIAL_BYTES_PER_MS 11      // 115200 baud
+#define SERIAL_TX_BUFFER 64
+#define OUTAGE_EVERY_MS 600000      // The gateway is unplugged about this often...
+#define OUTAGE_MIN_MS 10000         // ...for this long, up to long enough to overflow the journal
+#define OUTAGE_MAX_MS 120000
+#define DRAIN_MS 60000              // After the last event, for the rest to go up
+#define EEPROM_ENDURANCE 100000     // Writes per cell, ATmega328 datasheet
+
+// The uploader's timing, as in OrbDockComms.h
+#define JOURNAL_BATCH 8
+#define JOURNAL_ACK_TIMEOUT_MS 1000
+#define JOURNAL_LINK_TIMEOUT_MS 10000
+#define JOURNAL_PROBE_MS 5000
+
+struct PowerCut {
+};
+
+// EEPROM that counts the writes of each byte and can lose power in the middle of one
+struct FakeEEPROM {
+    uint8_t bytes[JOURNAL_EEPROM_SIZE];
+    uint32_t writes[JOURNAL_EEPROM_SIZE];
+    long budget;                // Byte writes until the power goes, negative for never
+    bool torn;                  // The byte being written when it does is garbage
+    std::mt19937* rng;
+
+    uint8_t read(int address) {
+        return bytes[address];
+    }
+
+    void update(int address, uint8_t value) {
+        if (bytes[address] == value) return;
+        if (budget == 0) {
+            if (torn) bytes[address] = (*rng)();
+            throw PowerCut();
+        }
+        if (budget > 0) budget--;
+        bytes[address] = value;
+        writes[address]++;
+    }
+};
+
+struct Frame {
+    uint8_t payload[DOCK_JOURNAL_PAYLOAD];
+};
+
+// RAM state of the dock, gone with the power
+struct Dock {
+    EventJournal journal;
+    uint16_t sent;
+    uint16_t prev;
+    bool chained;
+    uint64_t sentAt;
+    uint64_t linkAt;
+    bool linkSeen;
+    uint64_t bootAt;
+    long txBuffered;            // Bytes in the serial transmit buffer
+};
+
+struct Gateway {
+    bool known;
+    uint16_t acked;
+    std::map<uint16_t, int> handled;    // Times each record was handled
+    uint32_t corrupt;
+    uint32_t duplicates;
+};
+
+static FakeEEPROM eeprom;
+static Dock dock;
+static Gateway gateway;
+static std::deque<Frame> toGateway;
+static std::deque<uint16_t> toDock;
+static std::map<uint16_t, std::vector<uint8_t> > written;     // Records completely written, by seq
+static std::vector<uint8_t> writing;                            // The record being written
+static std::set<uint16_t> overwritten;
+
+static void boot(uint64_t now) {
+    journalBegin(dock.journal, eeprom);
+    dock.sent = dock.journal.acked;
+    dock.chained = false;
+    dock.sentAt = 0;
+    dock.linkAt = 0;
+    dock.linkSeen = false;
+    dock.bootAt = now;
+    dock.txBuffered = 0;
+}
+
+static void appendEvent(uint64_t now, uint32_t event) {
+    JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.type = event % 5 == 0 ? EVENT_ERROR : EVENT_ENERGY_CHANGED;
+    record.value = event;
+    record.seconds = (now - dock.bootAt) / 1000;
+    memcpy(record.detail, &event, sizeof(event));
+    record.seq = dock.journal.nextSeq;
+    record.boot = dock.journal.boot;
+    writing.resize(JOURNAL_RECORD_DATA);
+    journalEncode(record, &writing[0]);
+    if (journalPending(dock.journal) >= JOURNAL_RECORDS) {
+        overwritten.insert(dock.journal.acked + 1);
+    }
+    journalAppend(dock.journal, eeprom, record);
+    written[record.seq] = writing;
+}
+
+// OrbDockComms::uploadJournal()
+static void upload(uint64_t now) {
+    EventJournal& journal = dock.journal;
+    if (journalIsNewer(journal.acked, dock.sent)) {
+        dock.sent = journal.acked;
+        dock.chained = false;
+    }
+    if (dock.sent != journal.acked && now - dock.sentAt >= JOURNAL_ACK_TIMEOUT_MS) {
+        dock.sent = journal.acked;
+        dock.chained = false;
+    }
+    bool linkUp = dock.linkSeen && now - dock.linkAt < JOURNAL_LINK_TIMEOUT_MS;
+    if (!linkUp && (dock.sent != journal.acked || now - dock.sentAt < JOURNAL_PROBE_MS)) {
+        return;
+    }
+    uint16_t batch = linkUp ? JOURNAL_BATCH : 1;
+    uint16_t newest = journal.nextSeq - 1;
+    while (dock.sent != newest && (uint16_t)(dock.sent - journal.acked) < batch &&
+           SERIAL_TX_BUFFER - dock.txBuffered >= DOCK_FRAME_OVERHEAD + DOCK_JOURNAL_PAYLOAD) {
+        dock.sent++;
+        dock.sentAt = now;
+        JournalRecord record;
+        if (!journalRead(journal, eeprom, dock.sent, record)) {
+            continue;
+        }
+        Frame frame;
+        uint16_t prev = dock.chained ? dock.prev : record.seq;
+        journalEncode(record, frame.payload);
+        frame.payload[JOURNAL_RECORD_DATA] = prev & 0xFF;
+        frame.payload[JOURNAL_RECORD_DATA + 1] = prev >> 8;
+        toGateway.push_back(frame);
+        dock.txBuffered += DOCK_FRAME_OVERHEAD + DOCK_JOURNAL_PAYLOAD;
+        dock.prev = record.seq;
+        dock.chained = true;
+    }
+}
+
+// orb-gateway's handleJournal(), without the orb table
+static void receive(const Frame& frame) {
+    JournalRecord record;
+    journalDecode(frame.payload, record);
+    uint16_t prev = frame.payload[JOURNAL_RECORD_DATA] | (frame.payload[JOURNAL_RECORD_DATA + 1] << 8);
+    switch (journalUpload(gateway.known, gateway.acked, record.seq, prev)) {
+        case JOURNAL_UPLOAD_DUPLICATE:
+            gateway.duplicates++;
+            toDock.push_back(gateway.acked);
+            return;
+        case JOURNAL_UPLOAD_HELD_BACK:
+            return;
+        case JOURNAL_UPLOAD_NEXT:
+            break;
+    }
+    gateway.known = true;
+    gateway.acked = record.seq;
+    gateway.handled[record.seq]++;
+    auto original = written.find(record.seq);
+    if (original == written.end() || memcmp(&original->second[0], frame.payload, JOURNAL_RECORD_DATA) != 0) {
+        gateway.corrupt++;
+    }
+    toDock.push_back(gateway.acked);
+}
+
+int main(int argc, char** argv) {
+    uint32_t events = 20000;
+    long cutWrites = 4000;
+    int loss = 5;
+    unsigned seed = 1;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--events") == 0) events = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--cut-writes") == 0) cutWrites = atol(argv[i + 1]);
+        else if (strcmp(argv[i], "--loss") == 0) loss = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--seed") == 0) seed = atoi(argv[i + 1]);
+    }
+    // Sequence numbers aren't reused within a run, so they identify the records
+    if (events > 60000) events = 60000;
+
+    std::mt19937 rng(seed);
+    memset(eeprom.bytes, 0xFF, sizeof(eeprom.bytes));
+    memset(eeprom.writes, 0, sizeof(eeprom.writes));
+    eeprom.rng = &rng;
+    eeprom.budget = cutWrites > 0 ? rng() % (2 * cutWrites) : -1;
+    gateway.known = false;
+    gateway.corrupt = gateway.duplicates = 0;
+    boot(0);
+
+    uint32_t event = 0;
+    uint32_t cuts = 0;
+    uint32_t tornCuts = 0;
+    uint64_t nextEvent = EVENT_MIN_MS;
+    uint64_t outageAt = rng() % OUTAGE_EVERY_MS;
+    uint64_t outageEnd = 0;
+    uint64_t end = 0;
+    for (uint64_t now = 0; end == 0 || now < end; now += TICK_MS) {
+        if (now >= outageAt) {
+            outageEnd = now + OUTAGE_MIN_MS + rng() % (OUTAGE_MAX_MS - OUTAGE_MIN_MS);
+            outageAt = outageEnd + rng() % (2 * OUTAGE_EVERY_MS);
+        }
+        bool unplugged = now < outageEnd;
+        if (end != 0) {
+            // Draining: no more cuts, outages or losses
+            eeprom.budget = -1;
+            unplugged = false;
+            loss = 0;
+        }
+
+        // Last tick's frames arrive, or don't
+        while (!toGateway.empty()) {
+            if (!unplugged && (int)(rng() % 100) >= loss) receive(toGateway.front());
+            toGateway.pop_front();
+        }
+        try {
+            while (!toDock.empty()) {
+                uint16_t seq = toDock.front();
+                toDock.pop_front();
+                if (unplugged || (int)(rng() % 100) < loss) continue;
+                dock.linkAt = now;
+                dock.linkSeen = true;
+                if (journalAck(dock.journal, eeprom, seq) && journalIsNewer(dock.journal.acked, dock.sent)) {
+                    dock.sent = dock.journal.acked;
+                    dock.chained = false;
+                }
+            }
+            if (end == 0 && now >= nextEvent) {
+                appendEvent(now, event++);
+                nextEvent = now + EVENT_MIN_MS + rng() % (EVENT_MAX_MS - EVENT_MIN_MS);
+                if (event == events) end = now + DRAIN_MS;
+            }
+            upload(now);
+        } catch (const PowerCut&) {
+            cuts++;
+            tornCuts += eeprom.torn;
+            uint16_t seq = dock.journal.nextSeq;
+            boot(now);
+            // The record being written may have made it after all, when the bytes left
+            // were the same as before
+            if (dock.journal.nextSeq == (uint16_t)(seq + 1)) {
+                written[seq] = writing;
+            }
+            eeprom.torn = rng() % 2;
+            eeprom.budget = rng() % (2 * cutWrites);
+        }
+        dock.txBuffered = std::max(0L, dock.txBuffered - SERIAL_BYTES_PER_MS * TICK_MS);
+    }
+
+    uint32_t missing = 0;
+    uint32_t twice = 0;
+    uint32_t lost = 0;
+    for (const auto& record : written) {
+        auto handled = gateway.handled.find(record.first);
+        if (handled == gateway.handled.end()) {
+            if (overwritten.count(record.first)) lost++;
+            else missing++;
+        } else if (handled->second > 1) {
+            twice++;
+        }
+    }
+    uint32_t maxWrites = 0;
+    uint64_t recordWrites = 0;
+    for (int i = 0; i < JOURNAL_EEPROM_SIZE; i++) {
+        maxWrites = std::max(maxWrites, eeprom.writes[i]);
+        if (i >= JOURNAL_RECORDS_START) recordWrites += eeprom.writes[i];
+    }
+    uint32_t ackMax = *std::max_element(eeprom.writes, eeprom.writes + JOURNAL_RECORDS_START);
+
+    printf("%u events, %zu written completely, %u power cuts (%u torn)\n", events, written.size(), cuts, tornCuts);
+    printf("gateway: %zu handled, %u sent again, %zu overwritten while unplugged (%u of them lost)\n",
+        gateway.handled.size(), gateway.duplicates, overwritten.size(), lost);
+    printf("wear: hottest byte %u writes (%.3f per event), acknowledgements %u, records %.3f per byte per event\n",
+        maxWrites, (double)maxWrites / events, ackMax,
+        (double)recordWrites / (JOURNAL_EEPROM_SIZE - JOURNAL_RECORDS_START) / events);
+    printf("EEPROM worn out after %.1f million events\n", EEPROM_ENDURANCE * (double)events / maxWrites / 1e6);
+    bool ok = missing == 0 && twice == 0 && gateway.corrupt == 0;
+    printf("%u missing, %u handled twice, %u corrupt: %s\n", missing, twice, gateway.corrupt, ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
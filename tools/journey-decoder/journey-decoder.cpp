@@ -0,0 +1,121 @@
+/**
+ * Reconstructs orb journeys from tag dumps
+ *
+ * Takes the output of OrbDock::printNFCStorage() ("Page 12: 1 0 0 0" lines copied
+ * from the serial monitor) or tag images saved by tools/tag-image, one file per orb,
+ * and prints the visits in the journey log oldest first with each visit's energy change.
+ *
+ * Build and run on the host:
+ *   g++ -std=c++11 -O2 -I../../src -o journey-decoder journey-decoder.cpp
+ *   ./journey-decoder orb1.txt orb2.txt ...
+ */
+
+#include <cstdio>
+#include <cstring>
+#include "EnergyRing.h"
+#include "JourneyLog.h"
+#include "OrbRegistry.h"
+#include "TagImage.h"
+
+#define MAX_PAGES 256
+
+static const char* stationName(uint8_t id) {
+    return id < NUM_STATIONS ? STATION_NAMES[id] : "?";
+}
+
+// Reads a tag image, or "Page N: a b c d" lines. Returns the number of pages after the highest page seen
+static int readDump(const char* path, uint8_t pages[][4]) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return -1;
+    static uint8_t frame[TAG_IMAGE_FRAME_OVERHEAD + MAX_PAGES * 4];
+    size_t length = fread(frame, 1, sizeof(frame), file);
+    TagImage image;
+    if (tagImageDecode(frame, length, image)) {
+        fclose(file);
+        memcpy(pages, image.data, image.pages * 4);
+        return image.pages;
+    }
+    rewind(file);
+    char line[128];
+    int numPages = 0;
+    while (fgets(line, sizeof(line), file)) {
+        int page, b0, b1, b2, b3;
+        const char* start = strstr(line, "Page ");
+        if (!start || sscanf(start, "Page %d: %d %d %d %d", &page, &b0, &b1, &b2, &b3) != 5) continue;
+        if (page < 0 || page >= MAX_PAGES) continue;
+        pages[page][0] = b0;
+        pages[page][1] = b1;
+        pages[page][2] = b2;
+        pages[page][3] = b3;
+        if (page + 1 > numPages) numPages = page + 1;
+    }
+    fclose(file);
+    return numPages;
+}
+
+static void printJourney(const char* path, uint8_t pages[][4], uint8_t tagType) {
+    const TagLayout& layout = TAG_LAYOUTS[tagType];
+    const int logPage = tagJourneyLogPage(layout);
+    const int logEntries = layout.userPageEnd - logPage;
+    printf("%s (%s)\n", path, TAG_TYPE_NAMES[tagType]);
+    printf("  UID %02X%02X%02X%02X%02X%02X%02X", pages[0][0], pages[0][1], pages[0][2],
+        pages[1][0], pages[1][1], pages[1][2], pages[1][3]);
+    uint8_t trait = pages[TRAIT_PAGE][0];
+    printf("  trait %s", trait < NUM_TRAITS ? TRAIT_NAMES[trait] : "?");
+    int8_t energySlot = energyRingFindNewest(pages[ENERGY_RING_PAGE], layout.energySlots);
+    int currentEnergy = energySlot >= 0 ? pages[ENERGY_RING_PAGE + energySlot][0] : -1;
+    if (currentEnergy >= 0) printf("  energy %d", currentEnergy);
+    printf("\n");
+
+    JourneyHeadScan scan;
+    journeyScanBegin(scan);
+    for (int i = 0; i < logEntries; i++) {
+        journeyScanPage(scan, pages[logPage + i]);
+    }
+    uint8_t head = journeyScanHead(scan, logEntries);
+    uint8_t oldest = journeyScanOldest(scan, logEntries);
+    int count = (head - oldest + logEntries) % logEntries;
+    if (count == 0 && journeyLogIsValid(pages[logPage + oldest])) count = logEntries;
+    if (count == 0) {
+        printf("  No visits logged\n\n");
+        return;
+    }
+
+    printf("  %-4s %-9s %-10s %-8s %s\n", "#", "tick (s)", "station", "arrived", "change");
+    for (int n = 0; n < count; n++) {
+        const uint8_t* entry = pages[logPage + (oldest + n) % logEntries];
+        // The energy change of a visit is what the orb arrived with at the next station
+        int nextEnergy = n + 1 < count
+            ? pages[logPage + (oldest + n + 1) % logEntries][1]
+            : currentEnergy;
+        printf("  %-4d %-9u %-10s %-8u", n + 1, journeyLogTick(entry), stationName(journeyLogStation(entry)), entry[1]);
+        if (nextEnergy >= 0) printf(" %+d", nextEnergy - entry[1]);
+        printf("\n");
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s DUMP...\n", argv[0]);
+        return 2;
+    }
+    static uint8_t pages[MAX_PAGES][4];
+    int status = 0;
+    for (int i = 1; i < argc; i++) {
+        memset(pages, 0, sizeof(pages));
+        int numPages = readDump(argv[i], pages);
+        // Tag types are told apart by the number of pages in the dump
+        int tagType = -1;
+        for (uint8_t type = 0; type < TAG_TYPES; type++) {
+            if (TAG_LAYOUTS[type].totalPages == numPages) tagType = type;
+        }
+        if (tagType < 0) {
+            fprintf(stderr, "%s: incomplete dump or unknown tag type (%d pages)\n", argv[i], numPages);
+            status = 1;
+            continue;
+        }
+        printJourney(argv[i], pages, tagType);
+    }
+    return status;
+}
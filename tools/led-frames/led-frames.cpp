@@ -0,0 +1,143 @@
+/**
+ * LED frame-diff check
+ *
+ * Runs a dock on the host (the virtual-time Arduino core and NeoPixel stand-in of
+ * tools/fleet-sim, and the in-memory tag of lib/FakePN532) through boot, an orb
+ * arriving (the rainbow crossfading to the chase, with the flash on top), leaving, and
+ * arriving again, and records every frame it sends to the ring.
+ *
+ * Flicker is the ring's overall brightness stepping between two frames: the check
+ * fails if the mean channel value ever steps by more than the fastest brightness ramp
+ * in LED_PATTERNS (a fade steps it by no more than that), or if
+ * any frame is a one-frame spike (brighter or darker than both its neighbours by more
+ * than FLICKER_SPIKE). The one step allowed is the flash cutting in when energy is
+ * added, which is what a flash is for.
+ *
+ * Build and run on the host:
+ *   g++ -std=gnu++11 -O2 -I../fleet-sim/arduino -I../../lib/FakePN532/src -I../../src \
+ *       -o led-frames led-frames.cpp ../fleet-sim/arduino/Arduino.cpp ../../lib/FakePN532/src/FakePN532.cpp \
+ *       ../../src/OrbDock.cpp ../../src/LedOutput.cpp
+ *   ./led-frames [--dump frames.csv]
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <Arduino.h>
+#include <Adafruit_NeoPixel.h>
+#include "OrbDock.h"
+
+#undef min
+#undef max
+
+#define FLICKER_SPIKE 2.0       // Mean brightness, out of 255
+
+struct Frame {
+    uint32_t millis;
+    double mean;                // Mean channel value sent to the ring, 0-255
+};
+
+static std::vector<uint32_t> flashes;   // millis each flash was started at
+
+// Adds energy to every orb placed on it, so each arrival flashes
+class FrameDock : public OrbDock<FrameDock> {
+public:
+    static const uint8_t FEATURES = FEATURE_LED_PATTERNS | FEATURE_ENERGY;
+
+    FrameDock() : OrbDock(StationId::GENERIC) {
+    }
+
+protected:
+    friend class OrbDock<FrameDock>;
+
+    void onOrbConnected() {
+        flashes.push_back(millis());
+        addEnergy(1);
+    }
+};
+
+static ArduinoClock hostClock;
+static std::vector<Frame> frames;
+
+static void recordFrame(const Adafruit_NeoPixel& strip) {
+    const uint8_t* pixels = strip.getPixels();
+    uint32_t sum = 0;
+    for (int i = 0; i < strip.numPixels() * 3; i++) {
+        sum += pixels[i];
+    }
+    Frame frame = {(uint32_t)millis(), (double)sum / (strip.numPixels() * 3)};
+    frames.push_back(frame);
+}
+
+static void runUntil(FrameDock& dock, uint32_t ms) {
+    while (millis() < ms) {
+        dock.loop();
+        delayMicroseconds(1000);
+    }
+}
+
+static double step(size_t i) {
+    return i == 0 ? 0 : frames[i].mean - frames[i - 1].mean;
+}
+
+int main(int argc, char** argv) {
+    const char* dumpPath = argc > 2 && strcmp(argv[1], "--dump") == 0 ? argv[2] : NULL;
+    arduinoClock = &hostClock;
+    hostClock.micros = 0;
+    neoPixelShowHook = recordFrame;
+    FakeNTAG emptyField;
+    emptyField.present = false;
+    fakeTag.formatOrb(TraitId::DOUBT, 100, ENERGY_RING_PAGE);
+
+    // In ms: boot, orb placed, orb lifted, placed again, lifted
+    const uint32_t events[] = {0, 3000, 7000, 10000, 14000};
+    FrameDock dock;
+    fakeField = &emptyField;
+    dock.begin();
+    runUntil(dock, events[1]);
+    fakeField = &fakeTag;
+    runUntil(dock, events[2]);
+    fakeField = &emptyField;
+    runUntil(dock, events[3]);
+    fakeField = &fakeTag;
+    runUntil(dock, events[4]);
+    fakeField = &emptyField;
+    runUntil(dock, events[4] + 3000);
+
+    uint8_t limit = 0;
+    for (const LEDPatternConfig& pattern : LED_PATTERNS) {
+        if (pattern.brightnessRamp > limit) limit = pattern.brightnessRamp;
+    }
+
+    // Largest step, leaving out the first frame of each flash
+    double largest = 0;
+    uint32_t largestAt = 0;
+    int spikes = 0;
+    size_t nextFlash = 0;
+    for (size_t i = 1; i < frames.size(); i++) {
+        double size = step(i) < 0 ? -step(i) : step(i);
+        if (nextFlash < flashes.size() && frames[i].millis > flashes[nextFlash]) {
+            nextFlash++;
+        } else if (size > largest) {
+            largest = size;
+            largestAt = frames[i].millis;
+        }
+        if (i + 1 < frames.size() && step(i) * step(i + 1) < 0 &&
+            (size > FLICKER_SPIKE) && (step(i + 1) > FLICKER_SPIKE || step(i + 1) < -FLICKER_SPIKE)) {
+            printf("spike at %u ms: %+.1f then %+.1f\n", frames[i].millis, step(i), step(i + 1));
+            spikes++;
+        }
+    }
+
+    if (dumpPath) {
+        FILE* dump = fopen(dumpPath, "w");
+        fprintf(dump, "millis,mean\n");
+        for (const Frame& frame : frames) fprintf(dump, "%u,%.2f\n", frame.millis, frame.mean);
+        fclose(dump);
+    }
+
+    bool ok = largest <= limit && spikes == 0;
+    printf("%zu frames, %zu flashes: largest brightness step %.1f at %u ms (limit %u), %d spikes: %s\n",
+        frames.size(), flashes.size(), largest, largestAt, limit, spikes, ok ? "OK" : "FLICKER");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+/**
+ * PN532 recovery check
+ *
+ * Runs a dock on the host (the virtual-time Arduino core of tools/fleet-sim and the
+ * timed in-memory tag of lib/FakePN532) and wedges the fake PN532 in each of the ways
+ * it can wedge (see FakePN532Wedge), then reports how long the dock took to notice,
+ * how long the recovery took and which stage of it worked (see src/NFCHealth.h), and
+ * the longest gap between two LED frames meanwhile.
+ *
+ * Fails if a wedge the dock can clear isn't cleared, if an orb on the dock isn't back
+ * after the recovery, or if the LEDs stall for longer than MAX_LED_GAP.
+ *
+ * Build and run on the host:
+ *   g++ -std=gnu++11 -O2 -I../fleet-sim/arduino -I../../lib/FakePN532/src -I../../src \
+ *       -o nfc-health nfc-health.cpp ../fleet-sim/arduino/Arduino.cpp ../../lib/FakePN532/src/FakePN532.cpp \
+ *       ../../src/OrbDock.cpp ../../src/LedOutput.cpp
+ *   ./nfc-health
+ */
+
+#include <cstdio>
+#include <Arduino.h>
+#include <Adafruit_NeoPixel.h>
+#include "OrbDock.h"
+
+#define MAX_LED_GAP 500         // ms
+#define RUN_MS 20000            // Per scenario
+
+class HealthDock : public OrbDock<HealthDock> {
+public:
+    static const uint8_t FEATURES = FEATURE_LED_PATTERNS;
+
+    HealthDock() : OrbDock(StationId::GENERIC), connects(0) {
+    }
+
+    using OrbDockCore::getNFCHealth;
+    uint32_t connects;
+
+protected:
+    friend class OrbDock<HealthDock>;
+
+    void onOrbConnected() {
+        connects++;
+    }
+};
+
+struct Scenario {
+    const char* name;
+    uint8_t wedge;
+    uint32_t wedgeAt;           // ms, 0 for a PN532 wedged from boot
+    uint32_t unwedgeAt;         // ms the fault goes away by itself (plugged back in), 0 for never
+    bool orb;                   // An orb is on the dock throughout
+    uint8_t expectedStage;      // Stage the dock should end up at or recover by
+};
+
+static const Scenario SCENARIOS[] = {
+    {"SAMConfig lost, orb on dock", FAKE_PN532_WEDGED_SAMCONFIG, 3000, 0, true, NFC_RECOVER_SAMCONFIG},
+    {"SAMConfig lost, empty dock", FAKE_PN532_WEDGED_SAMCONFIG, 3000, 0, false, NFC_RECOVER_SAMCONFIG},
+    {"needs begin(), orb on dock", FAKE_PN532_WEDGED_BEGIN, 3000, 0, true, NFC_RECOVER_BEGIN},
+    {"unplugged at boot, plugged in", FAKE_PN532_WEDGED_DEAD, 0, 4000, false, NFC_RECOVER_PINS},
+    {"dies for good", FAKE_PN532_WEDGED_DEAD, 3000, 0, false, NFC_RECOVER_RESET}
+};
+
+static ArduinoClock hostClock;
+static uint32_t lastFrame;
+static uint32_t longestGap;
+
+static void recordFrame(const Adafruit_NeoPixel& strip) {
+    uint32_t now = millis();
+    if (now - lastFrame > longestGap) {
+        longestGap = now - lastFrame;
+    }
+    lastFrame = now;
+}
+
+int main() {
+    arduinoClock = &hostClock;
+    neoPixelShowHook = recordFrame;
+    bool ok = true;
+
+    printf("%-32s %10s %12s %-10s %8s %8s  %s\n",
+        "scenario", "notice ms", "recover ms", "stage", "orb back", "LED gap", "result");
+    for (const Scenario& scenario : SCENARIOS) {
+        hostClock.micros = 0;
+        lastFrame = 0;
+        longestGap = 0;
+        FakeNTAG field;
+        field.timed = true;
+        field.present = scenario.orb;
+        if (scenario.orb) field.formatOrb(TraitId::DOUBT, 100, ENERGY_RING_PAGE);
+        fakeField = &field;
+        fakePN532Wedge = scenario.wedgeAt == 0 ? scenario.wedge : FAKE_PN532_OK;
+
+        HealthDock dock;
+        dock.begin();
+        uint32_t connectsBefore = 0;
+        bool wedged = scenario.wedgeAt == 0;
+        while (millis() < RUN_MS) {
+            if (!wedged && millis() >= scenario.wedgeAt) {
+                wedged = true;
+                connectsBefore = dock.connects;
+                fakePN532Wedge = scenario.wedge;
+            }
+            if (scenario.unwedgeAt && millis() >= scenario.unwedgeAt && fakePN532Wedge != FAKE_PN532_OK) {
+                fakePN532Wedge = FAKE_PN532_OK;
+            }
+            dock.loop();
+            delayMicroseconds(1000);
+        }
+
+        const NFCHealth& health = dock.getNFCHealth();
+        bool recoverable = scenario.expectedStage != NFC_RECOVER_RESET;
+        bool orbBack = !scenario.orb || dock.connects > connectsBefore;
+        bool passed;
+        char notice[16] = "-";
+        char recover[16] = "-";
+        if (health.wedges > 0 && scenario.wedgeAt) {
+            snprintf(notice, sizeof(notice), "%u", (unsigned)(health.wedgedAt - scenario.wedgeAt));
+        }
+        if (recoverable) {
+            passed = health.recoveries == 1 && health.stage == NFC_HEALTHY &&
+                health.recoveredBy == scenario.expectedStage && orbBack;
+            snprintf(recover, sizeof(recover), "%u", (unsigned)nfcHealthMeanRecovery(health));
+        } else {
+            // The host has no watchdog, so the dock stays at the reset stage
+            passed = health.stage == NFC_RECOVER_RESET;
+        }
+        passed = passed && longestGap <= MAX_LED_GAP;
+        ok = ok && passed;
+        printf("%-32s %10s %12s %-10s %8s %8u  %s\n", scenario.name, notice, recover,
+            registryName(NFC_HEALTH_STAGE_NAMES, recoverable ? health.recoveredBy : health.stage),
+            scenario.orb ? (orbBack ? "yes" : "NO") : "-", (unsigned)longestGap, passed ? "OK" : "FAILED");
+    }
+    fakePN532Wedge = FAKE_PN532_OK;
+    return ok ? 0 : 1;
+}
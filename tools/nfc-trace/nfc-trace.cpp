@@ -0,0 +1,306 @@
+/**
+ * Captures, shows and replays PN532 transaction traces from a dock
+ *
+ * The dock keeps its last NFC_TRACE_SIZE tag exchanges in a ring buffer and sends
+ * them as a binary frame when it receives NFC_TRACE_COMMAND on the serial port
+ * (see src/NFCTrace.h).
+ *
+ * Build and run on the host:
+ *   g++ -std=c++11 -O2 -I../../src -o nfc-trace nfc-trace.cpp
+ *   ./nfc-trace capture /dev/ttyUSB0 casino.trace   Asks the dock for its trace and saves it
+ *   ./nfc-trace show casino.trace                   Timeline, latency per command and failures
+ *   ./nfc-trace replay casino.trace                 Replays the recorded outcomes through RetryPolicy.h
+ *
+ * replay compares the time the dock spent with what the current retry policy and the
+ * old one (4 blind retries, 10 ms apart, re-select after every failure) would have
+ * spent on the same tag answers, so retry changes can be tried against real field
+ * traces without a dock.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include "Crc16.h"
+#include "NFCTrace.h"
+#include "RetryPolicy.h"
+
+#define MAX_FRAME (4 + 1 + 255 * NFC_TRACE_RECORD_SIZE + 2)
+#define CAPTURE_TIMEOUT_MS 2000
+#define LEGACY_RETRY_DELAY_MS 10
+
+static const char* const FAILURE_NAMES[] = {"error", "wrong length"};
+
+static const char* commandName(uint8_t command) {
+    switch (command) {
+        case 0x30: return "READ";
+        case 0x3A: return "FAST_READ";
+        case 0xA2: return "WRITE";
+        case 0x60: return "GET_VERSION";
+        case NFC_TRACE_SELECT: return "SELECT";
+        default: return "?";
+    }
+}
+
+static const char* resultName(uint8_t result) {
+    if (result == NFC_TRACE_OK) return "ok";
+    return result < NFC_FAILURE_CLASSES ? FAILURE_NAMES[result] : "?";
+}
+
+static uint32_t durationMicros(const NFCTraceRecord& record) {
+    return (uint32_t)record.duration * NFC_TRACE_TICK_US;
+}
+
+// Checks a frame and decodes its records, returns false if it's damaged
+static bool decodeFrame(const uint8_t* frame, size_t length, std::vector<NFCTraceRecord>& records) {
+    if (length < 7 || memcmp(frame, NFC_TRACE_MAGIC, 4) != 0) return false;
+    uint8_t count = frame[4];
+    if (length != 4 + 1 + (size_t)count * NFC_TRACE_RECORD_SIZE + 2) return false;
+    uint16_t crc = crc16(frame + 4, 1 + count * NFC_TRACE_RECORD_SIZE);
+    if (frame[length - 2] != (crc & 0xFF) || frame[length - 1] != (crc >> 8)) return false;
+    records.resize(count);
+    for (uint8_t i = 0; i < count; i++) {
+        nfcTraceDecode(frame + 5 + i * NFC_TRACE_RECORD_SIZE, records[i]);
+    }
+    return true;
+}
+
+static bool loadTrace(const char* path, std::vector<NFCTraceRecord>& records) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "%s: can't open\n", path);
+        return false;
+    }
+    uint8_t frame[MAX_FRAME];
+    size_t length = fread(frame, 1, sizeof(frame), file);
+    fclose(file);
+    if (!decodeFrame(frame, length, records)) {
+        fprintf(stderr, "%s: not a valid trace\n", path);
+        return false;
+    }
+    return true;
+}
+
+// Reads one byte, returns false after CAPTURE_TIMEOUT_MS without data
+static bool readByte(int fd, uint8_t& byte) {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    timeval timeout = {CAPTURE_TIMEOUT_MS / 1000, (CAPTURE_TIMEOUT_MS % 1000) * 1000};
+    if (select(fd + 1, &fds, NULL, NULL, &timeout) <= 0) return false;
+    return read(fd, &byte, 1) == 1;
+}
+
+static int capture(const char* device, const char* path) {
+    int fd = open(device, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: can't open\n", device);
+        return 1;
+    }
+    termios tty;
+    tcgetattr(fd, &tty);
+    cfmakeraw(&tty);
+    cfsetispeed(&tty, B115200);
+    cfsetospeed(&tty, B115200);
+    tcsetattr(fd, TCSANOW, &tty);
+    tcflush(fd, TCIOFLUSH);
+
+    char command = NFC_TRACE_COMMAND;
+    if (write(fd, &command, 1) != 1) {
+        fprintf(stderr, "%s: write failed\n", device);
+        close(fd);
+        return 1;
+    }
+
+    // Skip the dock's text output up to the frame magic
+    uint8_t frame[MAX_FRAME];
+    size_t matched = 0;
+    uint8_t byte;
+    while (matched < 4) {
+        if (!readByte(fd, byte)) {
+            fprintf(stderr, "%s: no trace received, is NFC_TRACE_SIZE 0?\n", device);
+            close(fd);
+            return 1;
+        }
+        matched = (byte == (uint8_t)NFC_TRACE_MAGIC[matched]) ? matched + 1 : (byte == (uint8_t)NFC_TRACE_MAGIC[0] ? 1 : 0);
+    }
+    memcpy(frame, NFC_TRACE_MAGIC, 4);
+    size_t length = 4;
+    size_t expected = 5;
+    while (length < expected) {
+        if (!readByte(fd, frame[length])) break;
+        if (++length == 5) {
+            expected = 4 + 1 + frame[4] * NFC_TRACE_RECORD_SIZE + 2;
+        }
+    }
+    close(fd);
+
+    std::vector<NFCTraceRecord> records;
+    if (!decodeFrame(frame, length, records)) {
+        fprintf(stderr, "%s: damaged trace frame (%zu bytes)\n", device, length);
+        return 1;
+    }
+    FILE* file = fopen(path, "wb");
+    if (!file || fwrite(frame, 1, length, file) != length) {
+        fprintf(stderr, "%s: can't write\n", path);
+        return 1;
+    }
+    fclose(file);
+    printf("%zu records saved to %s\n", records.size(), path);
+    return 0;
+}
+
+static uint32_t percentile(std::vector<uint32_t> values, int percent) {
+    std::sort(values.begin(), values.end());
+    return values[(values.size() - 1) * percent / 100];
+}
+
+static int show(const char* path) {
+    std::vector<NFCTraceRecord> records;
+    if (!loadTrace(path, records)) return 1;
+    if (records.empty()) {
+        printf("Empty trace\n");
+        return 0;
+    }
+
+    printf("%10s %8s  %-12s %4s %3s  %s\n", "ms", "us", "command", "page", "try", "result");
+    uint32_t first = records[0].startMicros;
+    for (const NFCTraceRecord& record : records) {
+        printf("%10.1f %8u  %-12s %4u %3u  %s\n", (record.startMicros - first) / 1000.0, durationMicros(record),
+            commandName(record.command), record.page, record.attempt, resultName(record.result));
+    }
+
+    printf("\n%-12s %6s %8s %8s %8s", "command", "count", "p50 us", "p99 us", "max us");
+    for (int i = 0; i < NFC_FAILURE_CLASSES; i++) printf(" %11s", FAILURE_NAMES[i]);
+    printf("\n");
+    static const uint8_t COMMANDS[] = {NFC_TRACE_SELECT, 0x30, 0x3A, 0xA2, 0x60};
+    for (uint8_t command : COMMANDS) {
+        std::vector<uint32_t> durations;
+        int failures[NFC_FAILURE_CLASSES] = {0};
+        for (const NFCTraceRecord& record : records) {
+            if (record.command != command) continue;
+            durations.push_back(durationMicros(record));
+            if (record.result < NFC_FAILURE_CLASSES) failures[record.result]++;
+        }
+        if (durations.empty()) continue;
+        printf("%-12s %6zu %8u %8u %8u", commandName(command), durations.size(), percentile(durations, 50),
+            percentile(durations, 99), *std::max_element(durations.begin(), durations.end()));
+        for (int i = 0; i < NFC_FAILURE_CLASSES; i++) printf(" %11d", failures[i]);
+        printf("\n");
+    }
+    return 0;
+}
+
+// One NFC operation: a first attempt and the retries and re-selects that followed it
+struct Operation {
+    std::vector<NFCTraceRecord> records;
+};
+
+static std::vector<Operation> groupOperations(const std::vector<NFCTraceRecord>& records) {
+    std::vector<Operation> operations;
+    for (const NFCTraceRecord& record : records) {
+        bool starts = record.attempt == 0 || operations.empty();
+        if (starts) operations.push_back(Operation());
+        operations.back().records.push_back(record);
+    }
+    return operations;
+}
+
+// Time (us) an operation takes when its recorded tag answers are replayed through a retry model.
+// The tag is assumed to answer every attempt the way it did in the trace; attempts the dock
+// never made (it gave up earlier) are assumed to fail like its last one did
+struct ReplayResult {
+    uint64_t total;
+    uint32_t worst;
+};
+
+static uint32_t replayCurrent(const Operation& operation, RetryPolicy& policy) {
+    uint32_t time = 0;
+    for (const NFCTraceRecord& record : operation.records) {
+        time += durationMicros(record);
+        if (record.command == NFC_TRACE_SELECT) {
+            if (record.result != NFC_TRACE_OK) break;  // Tag gone, the operation ends
+            continue;
+        }
+        if (record.result == NFC_TRACE_OK) {
+            retryPolicySucceeded(policy);
+            break;
+        }
+        if (record.result < NFC_FAILURE_CLASSES) {
+            time += retryPolicyFailed(policy, (NFCFailure)record.result) * 1000;
+        }
+    }
+    return time;
+}
+
+static uint32_t replayLegacy(const Operation& operation, uint32_t selectMicros) {
+    uint32_t time = 0;
+    int attempts = 0;
+    const NFCTraceRecord* last = NULL;
+    for (const NFCTraceRecord& record : operation.records) {
+        if (record.command == NFC_TRACE_SELECT) continue;
+        last = &record;
+        attempts++;
+        time += durationMicros(record);
+        if (record.result == NFC_TRACE_OK) return time;
+        time += LEGACY_RETRY_DELAY_MS * 1000 + selectMicros;
+    }
+    // The old policy never gave up early, so it kept failing until it ran out of retries
+    for (; last && attempts < MAX_RETRIES; attempts++) {
+        time += durationMicros(*last) + LEGACY_RETRY_DELAY_MS * 1000 + selectMicros;
+    }
+    return time;
+}
+
+static void addResult(ReplayResult& result, uint32_t time) {
+    result.total += time;
+    result.worst = std::max(result.worst, time);
+}
+
+static int replay(const char* path) {
+    std::vector<NFCTraceRecord> records;
+    if (!loadTrace(path, records)) return 1;
+    std::vector<Operation> operations = groupOperations(records);
+
+    std::vector<uint32_t> selects;
+    for (const NFCTraceRecord& record : records) {
+        if (record.command == NFC_TRACE_SELECT && record.result == NFC_TRACE_OK) selects.push_back(durationMicros(record));
+    }
+    uint32_t selectMicros = selects.empty() ? 0 : percentile(selects, 50);
+
+    ReplayResult recorded = {0, 0};
+    ReplayResult current = {0, 0};
+    ReplayResult legacy = {0, 0};
+    RetryPolicy policy;
+    retryPolicyInit(policy);
+    int retried = 0;
+    for (const Operation& operation : operations) {
+        const NFCTraceRecord& first = operation.records.front();
+        const NFCTraceRecord& last = operation.records.back();
+        addResult(recorded, last.startMicros - first.startMicros + durationMicros(last));
+        addResult(current, replayCurrent(operation, policy));
+        addResult(legacy, replayLegacy(operation, selectMicros));
+        if (operation.records.size() > 1) retried++;
+    }
+
+    printf("%zu operations, %d with retries\n\n", operations.size(), retried);
+    printf("%-22s %10s %10s\n", "", "total ms", "worst ms");
+    printf("%-22s %10.1f %10.1f\n", "recorded", recorded.total / 1000.0, recorded.worst / 1000.0);
+    printf("%-22s %10.1f %10.1f\n", "current policy", current.total / 1000.0, current.worst / 1000.0);
+    printf("%-22s %10.1f %10.1f\n", "blind retry (old)", legacy.total / 1000.0, legacy.worst / 1000.0);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc == 4 && strcmp(argv[1], "capture") == 0) return capture(argv[2], argv[3]);
+    if (argc == 3 && strcmp(argv[1], "show") == 0) return show(argv[2]);
+    if (argc == 3 && strcmp(argv[1], "replay") == 0) return replay(argv[2]);
+    fprintf(stderr, "Usage: %s capture <serial device> <trace file>\n"
+                    "       %s show <trace file>\n"
+                    "       %s replay <trace file>\n", argv[0], argv[0], argv[0]);
+    return 1;
+}
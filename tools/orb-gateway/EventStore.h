@@ -0,0 +1,201 @@
+/**
+ * Append-only, memory-mapped orb event log for the gateway
+ *
+ * Every dock event about an orb is appended as one fixed size EventRecord to a file
+ * that is mapped into memory, so appending is a memcpy and reading any record is a
+ * pointer. The record count in the header is updated after the record is written,
+ * so a crash never leaves a half written record inside the log.
+ *
+ * Two indexes are kept up to date as records are appended, and rebuilt with one
+ * sequential scan when an existing log is opened:
+ *  - UID -> newest record of that orb. Each record links to the orb's previous one,
+ *    so "every visit of orb X" walks only that orb's records.
+ *  - Per station and hour rollups: events, visits and energy gained/lost there.
+ *
+ * Linux only (mremap).
+ */
+
+#ifndef EVENT_STORE_H
+#define EVENT_STORE_H
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "DockProtocol.h"
+
+#define EVENT_STORE_MAGIC "ORBLOG1"
+#define EVENT_STORE_GROW 1048576   // Records the file grows by when it's full
+#define EVENT_NONE 0xFFFFFFFF
+#define MICROS_PER_HOUR 3600000000ULL
+
+// One event, mirroring OrbInfo, StationId and TraitId in OrbDock.h
+struct EventRecord {
+    uint64_t micros;        // Wall clock time
+    uint8_t uid[7];
+    uint8_t type;           // DockEvent
+    uint8_t station;        // StationId of the dock
+    uint8_t trait;          // TraitId
+    uint8_t energy;         // Energy after the event
+    uint8_t reserved;
+    uint16_t visited;       // Bit per station, OrbInfo.stations[i].visited
+    uint16_t dock;          // Gateway's dock index
+    int16_t energyDelta;    // Energy events: change since the orb's previous record
+    uint16_t reserved2;
+    uint32_t previous;      // Index of the orb's previous record, EVENT_NONE for its first
+};
+static_assert(sizeof(EventRecord) == 32, "EventRecord must stay 32 bytes, it's the file format");
+
+struct EventStoreHeader {
+    char magic[8];
+    uint64_t count;
+    uint64_t capacity;
+    uint8_t reserved[40];
+};
+static_assert(sizeof(EventStoreHeader) == 64, "EventStoreHeader must stay 64 bytes, it's the file format");
+
+struct StationHour {
+    uint32_t events;
+    uint32_t visits;        // Orb connected events
+    uint32_t energyIn;      // Energy gained by orbs at the station
+    uint32_t energyOut;     // Energy lost by orbs at the station
+};
+
+class EventStore {
+public:
+    EventStore() : fd(-1), header(NULL), records(NULL), mappedBytes(0) {
+    }
+
+    ~EventStore() {
+        close();
+    }
+
+    // Opens or creates the log and rebuilds the indexes, returns false on failure
+    bool open(const char* path) {
+        fd = ::open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0) return false;
+        struct stat info;
+        fstat(fd, &info);
+        bool created = info.st_size == 0;
+        if (created && !resize(EVENT_STORE_GROW)) return false;
+        if (!created && !map(info.st_size)) return false;
+        if (created) {
+            memset(header, 0, sizeof(*header));
+            memcpy(header->magic, EVENT_STORE_MAGIC, 8);
+            header->capacity = EVENT_STORE_GROW;
+        } else if (memcmp(header->magic, EVENT_STORE_MAGIC, 8) != 0 || header->count > header->capacity) {
+            close();
+            return false;
+        }
+        for (uint64_t i = 0; i < header->count; i++) {
+            index(i);
+        }
+        return true;
+    }
+
+    void close() {
+        if (header) munmap(header, mappedBytes);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+        header = NULL;
+        records = NULL;
+        orbs.clear();
+        for (int i = 0; i < 256; i++) {
+            rollups[i].clear();
+        }
+    }
+
+    // Appends an event; previous and, for energy events, energyDelta are filled in from the UID index
+    bool append(EventRecord record) {
+        if (header->count == header->capacity && !resize(header->capacity + EVENT_STORE_GROW)) return false;
+        uint64_t i = header->count;
+        auto orb = orbs.find(uidKey(record.uid));
+        record.previous = orb == orbs.end() ? EVENT_NONE : orb->second.newest;
+        record.energyDelta = (orb == orbs.end() || record.type != DOCK_EVENT_ENERGY) ? 0 : record.energy - orb->second.energy;
+        records[i] = record;
+        header->count = i + 1;
+        index(i);
+        return true;
+    }
+
+    uint64_t count() const {
+        return header ? header->count : 0;
+    }
+
+    const EventRecord& record(uint32_t i) const {
+        return records[i];
+    }
+
+    // Newest record of an orb, follow record().previous for the older ones
+    uint32_t newest(const uint8_t* uid) const {
+        auto orb = orbs.find(uidKey(uid));
+        return orb == orbs.end() ? EVENT_NONE : orb->second.newest;
+    }
+
+    size_t orbCount() const {
+        return orbs.size();
+    }
+
+    // Rollups of a station ordered by hour (micros / MICROS_PER_HOUR)
+    const std::map<uint32_t, StationHour>& stationHours(uint8_t station) {
+        return rollups[station];
+    }
+
+    static uint64_t uidKey(const uint8_t* uid) {
+        uint64_t key = 0;
+        for (int i = 0; i < 7; i++) {
+            key = (key << 8) | uid[i];
+        }
+        return key;
+    }
+
+private:
+    struct OrbIndex {
+        uint32_t newest;
+        uint8_t energy;
+    };
+
+    bool map(size_t bytes) {
+        void* mapping = header
+            ? mremap(header, mappedBytes, bytes, MREMAP_MAYMOVE)
+            : mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) return false;
+        header = (EventStoreHeader*)mapping;
+        records = (EventRecord*)(header + 1);
+        mappedBytes = bytes;
+        return true;
+    }
+
+    bool resize(uint64_t capacity) {
+        size_t bytes = sizeof(EventStoreHeader) + capacity * sizeof(EventRecord);
+        if (ftruncate(fd, bytes) != 0 || !map(bytes)) return false;
+        header->capacity = capacity;
+        return true;
+    }
+
+    void index(uint64_t i) {
+        const EventRecord& record = records[i];
+        OrbIndex& orb = orbs[uidKey(record.uid)];
+        orb.newest = i;
+        orb.energy = record.energy;
+
+        StationHour& hour = rollups[record.station][record.micros / MICROS_PER_HOUR];
+        hour.events++;
+        if (record.type == DOCK_EVENT_ORB_CONNECTED) hour.visits++;
+        if (record.energyDelta > 0) hour.energyIn += record.energyDelta;
+        if (record.energyDelta < 0) hour.energyOut -= record.energyDelta;
+    }
+
+    int fd;
+    EventStoreHeader* header;
+    EventRecord* records;
+    size_t mappedBytes;
+    std::unordered_map<uint64_t, OrbIndex> orbs;
+    std::map<uint32_t, StationHour> rollups[256];
+};
+
+#endif
@@ -0,0 +1,124 @@
+/**
+ * Benchmark for the gateway's event log (EventStore.h)
+ *
+ * Appends synthetic orb visits (connect, energy change, disconnect at a random
+ * station) to a fresh log, then times the queries the gateway answers during a
+ * show: every event of an orb, and the hourly rollups of a station. Queries run
+ * between appends, the way the gateway interleaves them with ingestion.
+ *
+ * Build and run on the host:
+ *   g++ -std=c++11 -O2 -I../../src -o event-store-bench event-store-bench.cpp
+ *   ./event-store-bench [events] [orbs] [log file]
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <time.h>
+#include "EventStore.h"
+#include "OrbRegistry.h"
+
+#define NUM_QUERIES 10000
+#define EVENTS_PER_SECOND 200  // Synthetic show time between events
+
+static uint64_t nowNanos() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void makeUid(uint32_t orb, uint8_t* uid) {
+    memset(uid, 0, 7);
+    uid[0] = 0x04;
+    memcpy(uid + 1, &orb, sizeof(orb));
+}
+
+static void printLatency(const char* name, std::vector<uint32_t>& nanos) {
+    std::sort(nanos.begin(), nanos.end());
+    printf("%-14s p50 %7.2f us, p99 %7.2f us, max %7.2f us\n", name, nanos[nanos.size() / 2] / 1000.0,
+        nanos[(nanos.size() - 1) * 99 / 100] / 1000.0, nanos.back() / 1000.0);
+}
+
+int main(int argc, char** argv) {
+    uint64_t numEvents = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000000;
+    uint32_t numOrbs = argc > 2 ? atoi(argv[2]) : 20000;
+    const char* path = argc > 3 ? argv[3] : "/tmp/event-store-bench.log";
+
+    unlink(path);
+    EventStore store;
+    if (!store.open(path)) {
+        fprintf(stderr, "%s: can't create\n", path);
+        return 1;
+    }
+
+    std::mt19937 rng(1);
+    std::vector<uint8_t> energies(numOrbs, 5);
+    EventRecord record;
+    memset(&record, 0, sizeof(record));
+    uint64_t showStart = (uint64_t)time(NULL) * 1000000;
+    uint64_t start = nowNanos();
+    for (uint64_t i = 0; i < numEvents; i++) {
+        uint64_t visit = i / 3;
+        uint32_t orb = (visit * 2654435761u) % numOrbs;
+        makeUid(orb, record.uid);
+        record.micros = showStart + i * 1000000 / EVENTS_PER_SECOND;
+        if (i % 3 == 0) {
+            record.type = DOCK_EVENT_ORB_CONNECTED;
+            record.station = 1 + rng() % (NUM_STATIONS - 1);
+            record.dock = record.station;
+            record.trait = 1 + orb % 5;
+            record.visited |= 1 << (record.station - 1);
+        } else if (i % 3 == 1) {
+            record.type = DOCK_EVENT_ENERGY;
+            energies[orb] = std::min(250, std::max(0, energies[orb] + (int)(rng() % 41) - 20));
+        } else {
+            record.type = DOCK_EVENT_ORB_DISCONNECTED;
+        }
+        record.energy = energies[orb];
+        if (!store.append(record)) {
+            fprintf(stderr, "Append failed at %llu\n", (unsigned long long)i);
+            return 1;
+        }
+    }
+    double ingestSeconds = (nowNanos() - start) / 1e9;
+    printf("%llu events of %zu orbs: ingest %.2f s, %.2f M events/s\n", (unsigned long long)store.count(),
+        store.orbCount(), ingestSeconds, store.count() / ingestSeconds / 1e6);
+
+    // Queries, each followed by an append so they run against a log that's still growing
+    std::vector<uint32_t> visitLatencies;
+    std::vector<uint32_t> flowLatencies;
+    uint64_t orbEvents = 0;
+    uint64_t stationVisits = 0;
+    uint8_t uid[7];
+    for (int i = 0; i < NUM_QUERIES; i++) {
+        makeUid(rng() % numOrbs, uid);
+        uint64_t queryStart = nowNanos();
+        for (uint32_t j = store.newest(uid); j != EVENT_NONE; j = store.record(j).previous) {
+            orbEvents++;
+        }
+        visitLatencies.push_back(nowNanos() - queryStart);
+
+        queryStart = nowNanos();
+        for (const auto& hour : store.stationHours(1 + rng() % (NUM_STATIONS - 1))) {
+            stationVisits += hour.second.visits;
+        }
+        flowLatencies.push_back(nowNanos() - queryStart);
+
+        record.micros += 1000000 / EVENTS_PER_SECOND;
+        store.append(record);
+    }
+    printf("queries: %llu events per orb, %llu visits per station on average\n",
+        (unsigned long long)(orbEvents / NUM_QUERIES), (unsigned long long)(stationVisits / NUM_QUERIES));
+    printLatency("orb events", visitLatencies);
+    printLatency("station flow", flowLatencies);
+
+    store.close();
+    start = nowNanos();
+    store.open(path);
+    printf("reopen and rebuild indexes: %.2f s\n", (nowNanos() - start) / 1e9);
+    store.close();
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,247 @@
+/**
+ * Load test for orb-gateway
+ *
+ * Creates one PTY per simulated dock, starts orb-gateway on the PTYs and plays the
+ * docks: each sends orb connect / energy / disconnect events (with some debug text
+ * in between, like a real dock) at a fixed rate, and answers the gateway's pings
+ * and SET_ENERGY commands straight away. The gateway pings every dock at
+ * --ping-interval and prints its event throughput and command latency at the end.
+ *
+ * Build and run on the host:
+ *   g++ -std=c++11 -O2 -I../../src -o orb-gateway orb-gateway.cpp
+ *   g++ -std=c++11 -O2 -I../../src -o gateway-loadtest gateway-loadtest.cpp
+ *   ./gateway-loadtest [--docks 300] [--rate 20] [--duration 5] [--ping-interval 50] [--gateway ./orb-gateway] [--store file]
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include "DockProtocol.h"
+#include "OrbRegistry.h"
+
+#define NUM_ORBS 1000
+#define STATUS_SUCCEEDED 1
+#define TICK_MS 1
+#define MAX_EPOLL_EVENTS 64
+
+static const char DEBUG_TEXT[] = "Reading page 7\r\nNFC CRC/framing, retrying\r\n";
+
+struct SimDock {
+    int master;
+    int slave;                  // Kept open so the PTY stays up until the gateway opens it
+    std::string path;
+    DockFrameParser parser;
+    uint8_t station;
+    uint8_t eventSeq;
+    uint8_t uid[DOCK_UID_LENGTH];
+    uint8_t energy;
+    int step;                   // Next event of the current visit
+    double due;                 // Events owed at the configured rate
+};
+
+struct LoadStats {
+    uint64_t eventsSent;
+    uint64_t eventsDropped;     // PTY full - the gateway isn't keeping up
+    uint64_t commandsAnswered;
+};
+
+static LoadStats loadStats;
+
+static uint64_t nowMicros() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void sendFrame(SimDock& dock, uint8_t type, uint8_t seq, const uint8_t* payload, uint8_t length) {
+    uint8_t frame[DOCK_MAX_FRAME];
+    uint8_t frameLength = dockFrameEncode(DOCK_EVENT_MAGIC, type, seq, payload, length, frame);
+    if (write(dock.master, frame, frameLength) == frameLength) {
+        loadStats.eventsSent++;
+    } else {
+        loadStats.eventsDropped++;
+    }
+}
+
+// One step of an orb visit: connect, energy change, disconnect
+static void sendNextEvent(SimDock& dock, std::mt19937& rng) {
+    uint8_t payload[DOCK_MAX_PAYLOAD];
+    if (dock.step == 0) {
+        uint32_t orb = rng() % NUM_ORBS;
+        memset(dock.uid, 0, sizeof(dock.uid));
+        dock.uid[0] = 0x04;
+        memcpy(dock.uid + 1, &orb, sizeof(orb));
+        dock.energy = rng() % 250;
+    }
+    memcpy(payload, dock.uid, DOCK_UID_LENGTH);
+    switch (dock.step) {
+        case 0: {
+            uint16_t visited = rng() & ((1 << NUM_STATIONS) - 1);
+            payload[7] = 1 + rng() % 5;
+            payload[8] = dock.energy;
+            payload[9] = visited & 0xFF;
+            payload[10] = visited >> 8;
+            sendFrame(dock, DOCK_EVENT_ORB_CONNECTED, dock.eventSeq++, payload, DOCK_UID_LENGTH + 4);
+            break;
+        }
+        case 1:
+            dock.energy = rng() % 250;
+            payload[7] = dock.energy;
+            sendFrame(dock, DOCK_EVENT_ENERGY, dock.eventSeq++, payload, DOCK_UID_LENGTH + 1);
+            if (write(dock.master, DEBUG_TEXT, sizeof(DEBUG_TEXT) - 1) < 0) loadStats.eventsDropped++;
+            break;
+        default:
+            sendFrame(dock, DOCK_EVENT_ORB_DISCONNECTED, dock.eventSeq++, payload, DOCK_UID_LENGTH);
+            break;
+    }
+    dock.step = (dock.step + 1) % 3;
+}
+
+static void readCommands(SimDock& dock) {
+    uint8_t buffer[256];
+    ssize_t length = read(dock.master, buffer, sizeof(buffer));
+    for (ssize_t i = 0; i < length; i++) {
+        if (dockParserFeed(dock.parser, buffer[i]) != DOCK_PARSE_FRAME) continue;
+        loadStats.commandsAnswered++;
+        if (dock.parser.type == DOCK_COMMAND_PING) {
+            sendFrame(dock, DOCK_EVENT_PONG, dock.parser.seq, NULL, 0);
+        } else if (dock.parser.type == DOCK_COMMAND_SET_ENERGY) {
+            uint8_t status = STATUS_SUCCEEDED;
+            sendFrame(dock, DOCK_EVENT_RESULT, dock.parser.seq, &status, 1);
+        }
+    }
+}
+
+static bool openPty(SimDock& dock) {
+    dock.master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (dock.master < 0 || grantpt(dock.master) < 0 || unlockpt(dock.master) < 0) return false;
+    dock.path = ptsname(dock.master);
+    dock.slave = open(dock.path.c_str(), O_RDWR | O_NOCTTY);
+    if (dock.slave < 0) return false;
+    // Raw before the gateway opens it, so no byte of a frame is ever echoed or translated
+    termios tty;
+    tcgetattr(dock.slave, &tty);
+    cfmakeraw(&tty);
+    tcsetattr(dock.slave, TCSANOW, &tty);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    int numDocks = 300;
+    int rate = 20;
+    int duration = 5;
+    int pingInterval = 50;
+    const char* gateway = "./orb-gateway";
+    const char* store = NULL;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--docks") == 0) numDocks = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--rate") == 0) rate = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--duration") == 0) duration = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--ping-interval") == 0) pingInterval = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--gateway") == 0) gateway = argv[i + 1];
+        else if (strcmp(argv[i], "--store") == 0) store = argv[i + 1];
+    }
+
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    std::mt19937 rng(1);
+    int epollFd = epoll_create1(0);
+    std::vector<SimDock> docks(numDocks);
+    for (int i = 0; i < numDocks; i++) {
+        SimDock& dock = docks[i];
+        if (!openPty(dock)) {
+            fprintf(stderr, "Can't create PTY %d: %s\n", i, strerror(errno));
+            return 1;
+        }
+        dockParserInit(dock.parser, DOCK_COMMAND_MAGIC);
+        dock.station = 1 + i % (NUM_STATIONS - 1);
+        dock.eventSeq = 0;
+        dock.step = 0;
+        dock.due = (double)rng() / rng.max();  // Spread the docks' events over the tick
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u64 = 0;
+        event.data.fd = i;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, dock.master, &event);
+        sendFrame(dock, DOCK_EVENT_HELLO, dock.eventSeq++, &dock.station, 1);
+    }
+
+    std::vector<std::string> args = {gateway, "--ping-interval", std::to_string(pingInterval), "--duration", std::to_string(duration)};
+    if (store) {
+        args.push_back("--store");
+        args.push_back(store);
+    }
+    for (const SimDock& dock : docks) args.push_back(dock.path);
+    pid_t pid = fork();
+    if (pid == 0) {
+        std::vector<char*> argv;
+        for (std::string& arg : args) argv.push_back(&arg[0]);
+        argv.push_back(NULL);
+        int devNull = open("/dev/null", O_RDONLY);
+        dup2(devNull, STDIN_FILENO);
+        execv(gateway, argv.data());
+        perror(gateway);
+        _exit(1);
+    }
+
+    int tick = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_nsec = TICK_MS * 1000000L;
+    spec.it_interval = spec.it_value;
+    timerfd_settime(tick, 0, &spec, NULL);
+    epoll_event tickEvent;
+    tickEvent.events = EPOLLIN;
+    tickEvent.data.u64 = 0;
+    tickEvent.data.fd = -1;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, tick, &tickEvent);
+
+    memset(&loadStats, 0, sizeof(loadStats));
+    uint64_t start = nowMicros();
+    uint64_t lastTick = start;
+    int status = 0;
+    epoll_event events[MAX_EPOLL_EVENTS];
+    while (waitpid(pid, &status, WNOHANG) == 0) {
+        int count = epoll_wait(epollFd, events, MAX_EPOLL_EVENTS, 100);
+        for (int i = 0; i < count; i++) {
+            int index = events[i].data.fd;
+            if (index >= 0) {
+                readCommands(docks[index]);
+                continue;
+            }
+            uint64_t expirations;
+            if (read(tick, &expirations, sizeof(expirations)) < 0) continue;
+            uint64_t now = nowMicros();
+            double elapsed = (now - lastTick) / 1e6;
+            lastTick = now;
+            for (SimDock& dock : docks) {
+                for (dock.due += rate * elapsed; dock.due >= 1; dock.due--) {
+                    sendNextEvent(dock, rng);
+                }
+            }
+        }
+    }
+
+    double seconds = (nowMicros() - start) / 1e6;
+    printf("loadtest: %d docks at %d events/s: %llu events sent (%.0f/s), %llu dropped, %llu commands answered\n",
+        numDocks, rate, (unsigned long long)loadStats.eventsSent, loadStats.eventsSent / seconds,
+        (unsigned long long)loadStats.eventsDropped, (unsigned long long)loadStats.commandsAnswered);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
@@ -0,0 +1,608 @@
+/**
+ * Gateway daemon for many OrbDockComms docks on one Linux box
+ *
+ * Opens every dock's serial device in one epoll loop, picks the event frames out of
+ * the docks' serial output (see src/DockProtocol.h), keeps a table of every orb seen
+ * at any station indexed by UID, and sends commands back to the docks.
+ *
+ * Commands are written straight away from the event loop, so their latency doesn't
+ * depend on how busy the other docks are. A dock that stops reading can only fill
+ * its own output queue (DOCK_QUEUE_SIZE); commands for it are dropped after that.
+ *
+ * Orb events arrive as records of the docks' EEPROM journals (src/EventJournal.h). The
+ * gateway acknowledges them in order, so a dock sends again whatever got lost, and drops
+ * the ones it already has. Records from before the dock's last reset are placed in time
+ * when they arrive, the rest by the dock's clock.
+ *
+ * With --store, every orb event is also appended to a memory-mapped event log
+ * (EventStore.h), which can be queried while the show runs.
+ *
+ * Build and run on the host:
+ *   g++ -std=c++11 -O2 -I../../src -o orb-gateway orb-gateway.cpp
+ *   ./orb-gateway [--ping-interval ms] [--duration s] [--store file] /dev/ttyUSB0 /dev/ttyUSB1 ...
+ *
+ * Commands on stdin:
+ *   ping <dock>|all         Round trip to the dock(s), shows up in the latency stats
+ *   energy <dock> <value>   Sets the energy of the orb in the dock
+ *   trait <dock> <trait>    Sets the trait of the orb in the dock (TraitId, 0-5)
+ *   orbs                    Prints the orb table
+ *   stats                   Prints event and command latency stats
+ *   visits <uid>            Every stored event of an orb, newest first (UID in hex, as in the orb table)
+ *   flow <station>          Visits and energy gained/lost per hour at a station
+ *
+ * Stats are printed on exit (SIGINT, SIGTERM or --duration). gateway-loadtest.cpp
+ * runs the gateway against hundreds of simulated docks on PTYs.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include "DockProtocol.h"
+#include "EventJournal.h"
+#include "EventQueue.h"
+#include "EventStore.h"
+#include "OrbRegistry.h"
+
+#define DOCK_QUEUE_SIZE 256     // Bytes of commands waiting for a dock that isn't reading
+#define READ_CHUNK 512          // Bytes read from one dock per wakeup, so a chatty dock can't starve the rest
+#define MAX_EPOLL_EVENTS 64
+
+#define STATUS_SUCCEEDED 1     // STATUS_SUCCEEDED in OrbDock.h
+
+// Tokens in the epoll data for the non-dock file descriptors
+#define TOKEN_STDIN  -1
+#define TOKEN_SIGNAL -2
+#define TOKEN_PING   -3
+#define TOKEN_END    -4
+
+struct Dock {
+    std::string path;
+    int fd;
+    int station;                // From HELLO, -1 until then
+    DockFrameParser parser;
+    uint8_t queue[DOCK_QUEUE_SIZE];
+    size_t queued;
+    bool waitingForWrite;       // EPOLLOUT is on because the queue isn't empty
+    uint8_t commandSeq;
+    uint64_t sentAt[256];       // Send time of each outstanding command seq, 0 if none
+    uint64_t orb;               // UID of the orb in the dock, 0 if none
+    bool journalKnown;          // journalAcked is valid
+    bool ackDue;
+    uint16_t journalAcked;      // Every journal record up to this one is handled
+};
+
+struct Orb {
+    uint8_t trait;
+    uint8_t energy;
+    uint16_t visited;
+    int dock;                   // Dock it's in, -1 if none
+    int lastStation;
+    uint32_t visits;
+    uint64_t lastSeen;
+};
+
+struct Stats {
+    uint64_t events[DOCK_EVENT_JOURNAL + 1];
+    uint64_t commandsSent;
+    uint64_t commandsDropped;
+    uint64_t commandsFailed;
+    std::vector<uint32_t> latencies;   // Command round trips in us
+    uint64_t journalRecords;
+    uint64_t journalDuplicates;
+    uint64_t journalLost;              // Records the docks skipped: broken by a power cut, or overwritten
+    uint64_t journalErrors;
+    uint64_t start;
+};
+
+static std::vector<Dock> docks;
+static std::unordered_map<uint64_t, Orb> orbs;
+static Stats stats;
+static int epollFd;
+static EventStore store;
+static bool storing;
+
+static uint64_t nowMicros() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static uint64_t decodeUid(const uint8_t* uid) {
+    uint64_t key = 0;
+    for (int i = 0; i < DOCK_UID_LENGTH; i++) {
+        key = (key << 8) | uid[i];
+    }
+    return key;
+}
+
+static const char* stationName(int id) {
+    return id >= 0 && id < NUM_STATIONS ? STATION_NAMES[id] : "?";
+}
+
+static uint64_t wallMicros() {
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Appends an orb event that happened at micros (wall clock) to the event log, with the
+// orb's state from the orb table
+static void storeEvent(int index, uint8_t type, const uint8_t* uid, const Orb& orb, uint64_t micros) {
+    if (!storing) return;
+    EventRecord record;
+    memset(&record, 0, sizeof(record));
+    record.micros = micros;
+    memcpy(record.uid, uid, DOCK_UID_LENGTH);
+    record.type = type;
+    record.station = docks[index].station;
+    record.trait = orb.trait;
+    record.energy = orb.energy;
+    record.visited = orb.visited;
+    record.dock = index;
+    if (!store.append(record)) {
+        fprintf(stderr, "Event log full, no longer storing events\n");
+        storing = false;
+    }
+}
+
+static bool watch(int fd, int token, uint32_t events, int op = EPOLL_CTL_ADD) {
+    epoll_event event;
+    event.events = events;
+    event.data.u64 = 0;
+    event.data.fd = token;
+    return epoll_ctl(epollFd, op, fd, &event) == 0;
+}
+
+static void flushQueue(int index) {
+    Dock& dock = docks[index];
+    while (dock.queued > 0) {
+        ssize_t written = write(dock.fd, dock.queue, dock.queued);
+        if (written <= 0) break;
+        memmove(dock.queue, dock.queue + written, dock.queued - written);
+        dock.queued -= written;
+    }
+    bool waiting = dock.queued > 0;
+    if (waiting != dock.waitingForWrite) {
+        dock.waitingForWrite = waiting;
+        watch(dock.fd, index, EPOLLIN | (waiting ? (uint32_t)EPOLLOUT : 0), EPOLL_CTL_MOD);
+    }
+}
+
+// answered: the dock replies, counted in the command stats
+static bool sendCommand(int index, uint8_t type, const uint8_t* payload, uint8_t length, bool answered = true) {
+    Dock& dock = docks[index];
+    if (dock.queued + DOCK_FRAME_OVERHEAD + length > DOCK_QUEUE_SIZE) {
+        if (answered) stats.commandsDropped++;
+        return false;
+    }
+    uint8_t seq = dock.commandSeq++;
+    dock.queued += dockFrameEncode(DOCK_COMMAND_MAGIC, type, seq, payload, length, dock.queue + dock.queued);
+    dock.sentAt[seq] = answered ? nowMicros() : 0;
+    if (answered) stats.commandsSent++;
+    flushQueue(index);
+    return true;
+}
+
+// The reply to a command, for the latency stats
+static void commandAnswered(Dock& dock, uint8_t seq) {
+    if (dock.sentAt[seq] == 0) return;
+    stats.latencies.push_back(nowMicros() - dock.sentAt[seq]);
+    dock.sentAt[seq] = 0;
+}
+
+static void orbConnected(int index, const uint8_t* uid, uint8_t trait, uint8_t energy, uint16_t visited, uint64_t micros) {
+    Dock& dock = docks[index];
+    uint64_t key = decodeUid(uid);
+    Orb& orb = orbs[key];
+    orb.trait = trait;
+    orb.energy = energy;
+    orb.visited = visited;
+    orb.dock = index;
+    orb.lastStation = dock.station;
+    orb.visits++;
+    orb.lastSeen = nowMicros();
+    dock.orb = key;
+    storeEvent(index, DOCK_EVENT_ORB_CONNECTED, uid, orb, micros);
+}
+
+static void orbDisconnected(int index, const uint8_t* uid, uint64_t micros) {
+    auto orb = orbs.find(decodeUid(uid));
+    if (orb != orbs.end() && orb->second.dock == index) {
+        orb->second.dock = -1;
+        orb->second.lastSeen = nowMicros();
+        storeEvent(index, DOCK_EVENT_ORB_DISCONNECTED, uid, orb->second, micros);
+    }
+    docks[index].orb = 0;
+}
+
+static void energyChanged(int index, const uint8_t* uid, uint8_t energy, uint64_t micros) {
+    auto orb = orbs.find(decodeUid(uid));
+    if (orb != orbs.end()) {
+        orb->second.energy = energy;
+        orb->second.lastSeen = nowMicros();
+        storeEvent(index, DOCK_EVENT_ENERGY, uid, orb->second, micros);
+    }
+}
+
+// A journal record, handled if it's the next one of the dock (see journalUpload())
+static void handleJournal(int index, const DockFrameParser& frame) {
+    Dock& dock = docks[index];
+    if (frame.length < DOCK_JOURNAL_PAYLOAD) return;
+    JournalRecord record;
+    journalDecode(frame.payload, record);
+    const uint8_t* extra = frame.payload + JOURNAL_RECORD_DATA;
+    uint16_t prev = extra[0] | (extra[1] << 8);
+    switch (journalUpload(dock.journalKnown, dock.journalAcked, record.seq, prev)) {
+        case JOURNAL_UPLOAD_DUPLICATE:
+            stats.journalDuplicates++;
+            dock.ackDue = true;
+            return;
+        case JOURNAL_UPLOAD_HELD_BACK:
+            return;
+        case JOURNAL_UPLOAD_NEXT:
+            break;
+    }
+    uint16_t ahead = record.seq - dock.journalAcked;
+    if (dock.journalKnown && ahead < 0x8000) stats.journalLost += ahead - 1;
+    dock.journalKnown = true;
+    dock.journalAcked = record.seq;
+    dock.ackDue = true;
+    stats.journalRecords++;
+
+    // Records of the dock's current boot are placed by its clock, older ones when they arrive
+    uint8_t boot = extra[2];
+    uint16_t seconds = extra[3] | (extra[4] << 8);
+    uint64_t micros = wallMicros();
+    if (record.boot == boot) micros -= (uint64_t)(uint16_t)(seconds - record.seconds) * 1000000;
+    const uint8_t* uid = record.detail;
+    switch (record.type) {
+        case EVENT_ORB_CONNECTED:
+            orbConnected(index, uid, record.detail[DOCK_UID_LENGTH], record.value,
+                record.detail[DOCK_UID_LENGTH + 1] | (record.detail[DOCK_UID_LENGTH + 2] << 8), micros);
+            break;
+        case EVENT_ORB_DISCONNECTED:
+            orbDisconnected(index, uid, micros);
+            break;
+        case EVENT_ENERGY_CHANGED:
+            energyChanged(index, uid, record.value, micros);
+            break;
+        case EVENT_ERROR:
+            stats.journalErrors++;
+            fprintf(stderr, "%s: %.*s\n", dock.path.c_str(), JOURNAL_DETAIL, (const char*)record.detail);
+            break;
+        default:
+            break;
+    }
+}
+
+static void handleEvent(int index, const DockFrameParser& frame) {
+    Dock& dock = docks[index];
+    if (frame.type <= DOCK_EVENT_JOURNAL) {
+        stats.events[frame.type]++;
+    }
+    if (frame.type >= DOCK_EVENT_ORB_CONNECTED && frame.type <= DOCK_EVENT_ENERGY && frame.length < DOCK_UID_LENGTH) {
+        return;
+    }
+    switch (frame.type) {
+        case DOCK_EVENT_HELLO:
+            if (frame.length >= 1) dock.station = frame.payload[0];
+            break;
+        case DOCK_EVENT_ORB_CONNECTED:
+            if (frame.length < DOCK_UID_LENGTH + 4) break;
+            orbConnected(index, frame.payload, frame.payload[7], frame.payload[8], frame.payload[9] | (frame.payload[10] << 8), wallMicros());
+            break;
+        case DOCK_EVENT_ORB_DISCONNECTED:
+            orbDisconnected(index, frame.payload, wallMicros());
+            break;
+        case DOCK_EVENT_ENERGY:
+            if (frame.length < DOCK_UID_LENGTH + 1) break;
+            energyChanged(index, frame.payload, frame.payload[7], wallMicros());
+            break;
+        case DOCK_EVENT_PONG:
+            commandAnswered(dock, frame.seq);
+            break;
+        case DOCK_EVENT_RESULT:
+            commandAnswered(dock, frame.seq);
+            if (frame.length < 1 || frame.payload[0] != STATUS_SUCCEEDED) stats.commandsFailed++;
+            break;
+        case DOCK_EVENT_JOURNAL:
+            handleJournal(index, frame);
+            break;
+        default:
+            break;
+    }
+}
+
+static void readDock(int index) {
+    Dock& dock = docks[index];
+    uint8_t buffer[READ_CHUNK];
+    ssize_t length = read(dock.fd, buffer, sizeof(buffer));
+    if (length < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (length <= 0) {
+        // Unplugged - a PTY reads EIO once the other end is closed
+        fprintf(stderr, "%s: closed\n", dock.path.c_str());
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, dock.fd, NULL);
+        close(dock.fd);
+        dock.fd = -1;
+        return;
+    }
+    for (ssize_t i = 0; i < length; i++) {
+        if (dockParserFeed(dock.parser, buffer[i]) == DOCK_PARSE_FRAME) {
+            handleEvent(index, dock.parser);
+        }
+    }
+    // One acknowledgement for every journal record in the chunk
+    if (dock.ackDue) {
+        uint8_t seq[2] = {(uint8_t)(dock.journalAcked & 0xFF), (uint8_t)(dock.journalAcked >> 8)};
+        if (sendCommand(index, DOCK_COMMAND_JOURNAL_ACK, seq, sizeof(seq), false)) dock.ackDue = false;
+    }
+}
+
+static void pingAll() {
+    for (size_t i = 0; i < docks.size(); i++) {
+        if (docks[i].fd >= 0) sendCommand(i, DOCK_COMMAND_PING, NULL, 0);
+    }
+}
+
+static void printOrbs() {
+    printf("%-16s %-10s %6s %-10s %-10s %6s\n", "uid", "trait", "energy", "station", "in dock", "visits");
+    for (const auto& entry : orbs) {
+        const Orb& orb = entry.second;
+        printf("%014llx   %-10s %6u %-10s %-10s %6u\n", (unsigned long long)entry.first,
+            orb.trait < NUM_TRAITS ? TRAIT_NAMES[orb.trait] : "?", orb.energy, stationName(orb.lastStation),
+            orb.dock >= 0 ? docks[orb.dock].path.c_str() : "-", orb.visits);
+    }
+}
+
+static void printStats() {
+    double seconds = (nowMicros() - stats.start) / 1e6;
+    uint64_t events = 0;
+    for (int i = DOCK_EVENT_HELLO; i <= DOCK_EVENT_JOURNAL; i++) events += stats.events[i];
+    printf("docks %zu, orbs %zu, %.1f s\n", docks.size(), orbs.size(), seconds);
+    if (storing) printf("event log: %llu events\n", (unsigned long long)store.count());
+    printf("events %llu (%.0f/s): hello %llu, connected %llu, disconnected %llu, energy %llu, pong %llu, result %llu, journal %llu\n",
+        (unsigned long long)events, events / seconds,
+        (unsigned long long)stats.events[DOCK_EVENT_HELLO], (unsigned long long)stats.events[DOCK_EVENT_ORB_CONNECTED],
+        (unsigned long long)stats.events[DOCK_EVENT_ORB_DISCONNECTED], (unsigned long long)stats.events[DOCK_EVENT_ENERGY],
+        (unsigned long long)stats.events[DOCK_EVENT_PONG], (unsigned long long)stats.events[DOCK_EVENT_RESULT],
+        (unsigned long long)stats.events[DOCK_EVENT_JOURNAL]);
+    printf("journal records %llu, %llu sent again, %llu lost on the docks, %llu errors\n",
+        (unsigned long long)stats.journalRecords, (unsigned long long)stats.journalDuplicates,
+        (unsigned long long)stats.journalLost, (unsigned long long)stats.journalErrors);
+    printf("commands %llu sent, %zu answered, %llu failed, %llu dropped\n", (unsigned long long)stats.commandsSent,
+        stats.latencies.size(), (unsigned long long)stats.commandsFailed, (unsigned long long)stats.commandsDropped);
+    if (!stats.latencies.empty()) {
+        std::vector<uint32_t> sorted = stats.latencies;
+        std::sort(sorted.begin(), sorted.end());
+        printf("command latency us: p50 %u, p99 %u, max %u\n", sorted[sorted.size() / 2],
+            sorted[(sorted.size() - 1) * 99 / 100], sorted.back());
+    }
+    fflush(stdout);
+}
+
+static const char* eventName(uint8_t type) {
+    switch (type) {
+        case DOCK_EVENT_ORB_CONNECTED: return "connected";
+        case DOCK_EVENT_ORB_DISCONNECTED: return "disconnected";
+        case DOCK_EVENT_ENERGY: return "energy";
+        default: return "?";
+    }
+}
+
+static void printVisits(unsigned long long key) {
+    uint8_t uid[DOCK_UID_LENGTH];
+    for (int i = DOCK_UID_LENGTH - 1; i >= 0; i--, key >>= 8) {
+        uid[i] = key & 0xFF;
+    }
+    for (uint32_t i = store.newest(uid); i != EVENT_NONE; i = store.record(i).previous) {
+        const EventRecord& record = store.record(i);
+        time_t seconds = record.micros / 1000000;
+        char when[32];
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&seconds));
+        printf("%s  %-10s %-12s energy %3u (%+d)\n", when, stationName(record.station), eventName(record.type),
+            record.energy, record.energyDelta);
+    }
+}
+
+static void printFlow(int station) {
+    printf("%-13s %6s %8s %8s\n", "hour", "visits", "energy+", "energy-");
+    for (const auto& entry : store.stationHours(station)) {
+        time_t seconds = (time_t)entry.first * 3600;
+        char when[32];
+        strftime(when, sizeof(when), "%Y-%m-%d %H", localtime(&seconds));
+        printf("%-13s %6u %8u %8u\n", when, entry.second.visits, entry.second.energyIn, entry.second.energyOut);
+    }
+}
+
+static void handleLine(char* line) {
+    char command[16];
+    int dock, value;
+    unsigned long long uid;
+    if (sscanf(line, "ping %d", &dock) == 1 && dock >= 0 && dock < (int)docks.size()) {
+        sendCommand(dock, DOCK_COMMAND_PING, NULL, 0);
+    } else if (strncmp(line, "ping all", 8) == 0) {
+        pingAll();
+    } else if (sscanf(line, "energy %d %d", &dock, &value) == 2 && dock >= 0 && dock < (int)docks.size()) {
+        uint8_t energy = value;
+        sendCommand(dock, DOCK_COMMAND_SET_ENERGY, &energy, 1);
+    } else if (sscanf(line, "trait %d %d", &dock, &value) == 2 && dock >= 0 && dock < (int)docks.size()) {
+        uint8_t trait = value;
+        sendCommand(dock, DOCK_COMMAND_SET_TRAIT, &trait, 1);
+    } else if (sscanf(line, "%15s", command) == 1 && strcmp(command, "orbs") == 0) {
+        printOrbs();
+    } else if (sscanf(line, "%15s", command) == 1 && strcmp(command, "stats") == 0) {
+        printStats();
+    } else if (sscanf(line, "visits %llx", &uid) == 1 && storing) {
+        printVisits(uid);
+    } else if (sscanf(line, "flow %d", &value) == 1 && value >= 0 && value < NUM_STATIONS && storing) {
+        printFlow(value);
+    } else {
+        fprintf(stderr, "Unknown command: %s", line);
+    }
+    fflush(stdout);
+}
+
+static void readStdin() {
+    static std::string pending;
+    char buffer[256];
+    ssize_t length = read(STDIN_FILENO, buffer, sizeof(buffer));
+    if (length <= 0) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+        return;
+    }
+    pending.append(buffer, length);
+    size_t end;
+    while ((end = pending.find('\n')) != std::string::npos) {
+        std::string line = pending.substr(0, end + 1);
+        pending.erase(0, end + 1);
+        handleLine(&line[0]);
+    }
+}
+
+static int openDock(const char* path) {
+    int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) return -1;
+    termios tty;
+    if (tcgetattr(fd, &tty) == 0) {
+        cfmakeraw(&tty);
+        cfsetispeed(&tty, B115200);
+        cfsetospeed(&tty, B115200);
+        tcsetattr(fd, TCSANOW, &tty);
+    }
+    return fd;
+}
+
+static int startTimer(int intervalMs, bool repeat) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = intervalMs / 1000;
+    spec.it_value.tv_nsec = (intervalMs % 1000) * 1000000L;
+    if (repeat) spec.it_interval = spec.it_value;
+    timerfd_settime(fd, 0, &spec, NULL);
+    return fd;
+}
+
+int main(int argc, char** argv) {
+    int pingInterval = 0;
+    int duration = 0;
+    const char* storePath = NULL;
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (strcmp(argv[arg], "--ping-interval") == 0 && arg + 1 < argc) {
+            pingInterval = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--duration") == 0 && arg + 1 < argc) {
+            duration = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--store") == 0 && arg + 1 < argc) {
+            storePath = argv[++arg];
+        } else {
+            break;
+        }
+    }
+    if (arg >= argc) {
+        fprintf(stderr, "Usage: %s [--ping-interval ms] [--duration s] [--store file] <serial device>...\n", argv[0]);
+        return 1;
+    }
+
+    // One descriptor per dock
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    if (storePath) {
+        storing = store.open(storePath);
+        if (!storing) {
+            fprintf(stderr, "%s: can't open event log\n", storePath);
+            return 1;
+        }
+        printf("%s: %llu events of %zu orbs\n", storePath, (unsigned long long)store.count(), store.orbCount());
+    }
+
+    epollFd = epoll_create1(0);
+    docks.resize(argc - arg);
+    for (size_t i = 0; i < docks.size(); i++) {
+        Dock& dock = docks[i];
+        dock.path = argv[arg + i];
+        dock.fd = openDock(argv[arg + i]);
+        if (dock.fd < 0) {
+            fprintf(stderr, "%s: can't open\n", argv[arg + i]);
+            return 1;
+        }
+        dock.station = -1;
+        dockParserInit(dock.parser, DOCK_EVENT_MAGIC);
+        dock.queued = 0;
+        dock.waitingForWrite = false;
+        dock.commandSeq = 0;
+        memset(dock.sentAt, 0, sizeof(dock.sentAt));
+        dock.orb = 0;
+        dock.journalKnown = false;
+        dock.ackDue = false;
+        dock.journalAcked = 0;
+        if (!watch(dock.fd, i, EPOLLIN)) {
+            fprintf(stderr, "%s: can't poll\n", argv[arg + i]);
+            return 1;
+        }
+    }
+    // Fails if stdin is a regular file or /dev/null, which just means no commands
+    watch(STDIN_FILENO, TOKEN_STDIN, EPOLLIN);
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+    watch(signalfd(-1, &signals, SFD_NONBLOCK), TOKEN_SIGNAL, EPOLLIN);
+
+    int pingTimer = -1;
+    if (pingInterval > 0) {
+        pingTimer = startTimer(pingInterval, true);
+        watch(pingTimer, TOKEN_PING, EPOLLIN);
+    }
+    if (duration > 0) {
+        watch(startTimer(duration * 1000, false), TOKEN_END, EPOLLIN);
+    }
+
+    memset(stats.events, 0, sizeof(stats.events));
+    stats.commandsSent = stats.commandsDropped = stats.commandsFailed = 0;
+    stats.journalRecords = stats.journalDuplicates = stats.journalLost = stats.journalErrors = 0;
+    stats.start = nowMicros();
+
+    epoll_event events[MAX_EPOLL_EVENTS];
+    bool running = true;
+    while (running) {
+        int count = epoll_wait(epollFd, events, MAX_EPOLL_EVENTS, -1);
+        for (int i = 0; i < count; i++) {
+            int token = events[i].data.fd;
+            if (token >= 0) {
+                if (docks[token].fd >= 0 && (events[i].events & EPOLLOUT)) flushQueue(token);
+                if (docks[token].fd >= 0 && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) readDock(token);
+            } else if (token == TOKEN_STDIN) {
+                readStdin();
+            } else if (token == TOKEN_PING) {
+                uint64_t expirations;
+                if (read(pingTimer, &expirations, sizeof(expirations)) > 0) pingAll();
+            } else {
+                running = false;
+            }
+        }
+    }
+
+    printStats();
+    return 0;
+}
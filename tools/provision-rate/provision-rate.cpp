@@ -0,0 +1,138 @@
+/**
+ * Mass provisioning rate
+ *
+ * Runs the real OrbDockConfigurizer on the host (the virtual-time Arduino core of
+ * tools/fleet-sim, and timed tags from lib/FakePN532) through a stack of tags, fresh
+ * ones and every REUSED_EVERY-th a wiped orb with an old journey log, twice: once the
+ * usual way (onUnformattedNFC() formats the tag, then the orb session connects it), and
+ * once in mass provisioning mode. Each tag is lifted as soon
+ * as the dock is done with it and the next one placed OPERATOR_GAP_MS later.
+ *
+ * Reports per mode the dock's time per tag (placed to done), the NFC exchanges per tag
+ * and the orbs per minute including the operator's gap, and fails if provisioning isn't
+ * at least MIN_SPEEDUP times faster per tag or, in either mode, leaves a tag that isn't a
+ * valid orb or keeps an entry of the old journey log.
+ *
+ * Build and run on the host:
+ *   g++ -std=gnu++11 -O2 -I../fleet-sim/arduino -I../../lib/FakePN532/src -I../../src \
+ *       -o provision-rate provision-rate.cpp ../fleet-sim/arduino/Arduino.cpp ../../lib/FakePN532/src/FakePN532.cpp \
+ *       ../../src/OrbDock.cpp ../../src/LedOutput.cpp ../../src/ButtonDisplay.cpp
+ *   ./provision-rate
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <Arduino.h>
+#include "OrbDock.h"
+#include "OrbDockConfigurizer.cpp"
+
+#define TAGS 20
+#define OPERATOR_GAP_MS 500     // Lifting one tag to placing the next
+#define TAG_TIMEOUT_MS 10000
+#define MIN_SPEEDUP 5.0
+#define REUSED_EVERY 5          // Every fifth tag is a reused orb, see makeReused()
+
+static ArduinoClock hostClock;
+
+struct Result {
+    double msPerTag;
+    double exchangesPerTag;
+    int valid;
+};
+
+// What the mode has done with the tag, so the operator can lift it
+static bool isDone(OrbDockConfigurizer& dock, bool provisioning, const FakeNTAG& tag, int index) {
+    if (provisioning) {
+        return dock.getProvisionedCount() > index;
+    }
+    // The orb session's last write
+    return tag.pages[STATIONS_PAGE_OFFSET + StationId::CONFIGURE][0] == 1;
+}
+
+// Nothing left of an earlier orb in the journey log: provisioning and formatNFC() both blank
+// it, and the orb session after formatNFC() logs its visit to the Configurizer
+static bool isValidOrb(const FakeNTAG& tag) {
+    const TagLayout& layout = TAG_LAYOUTS[TAG_NTAG213];
+    for (uint8_t page = ENERGY_RING_PAGE + layout.energySlots; page < layout.userPageEnd; page++) {
+        if (memcmp(tag.pages[page], "\0\0\0\0", 4) != 0 &&
+            journeyLogStation(tag.pages[page]) != StationId::CONFIGURE) {
+            return false;
+        }
+    }
+    int8_t newest = energyRingFindNewest(tag.pages[ENERGY_RING_PAGE], layout.energySlots);
+    return memcmp(tag.pages[ORBS_PAGE], ORBS_HEADER, 4) == 0 &&
+        tag.pages[TRAIT_PAGE][0] == TraitId::RUMINATE &&
+        newest >= 0 && tag.pages[ENERGY_RING_PAGE + newest][0] == INIT_ENERGY;
+}
+
+// A tag that was an orb, with visits in its journey log, whose header was wiped to reuse it
+static void makeReused(FakeNTAG& tag) {
+    tag.formatOrb(TraitId::DOUBT, 80, ENERGY_RING_PAGE);
+    const TagLayout& layout = TAG_LAYOUTS[TAG_NTAG213];
+    for (uint8_t entry = 0; entry < 4; entry++) {
+        journeyLogEncode(tag.pages[ENERGY_RING_PAGE + layout.energySlots + entry], StationId::CASINO, 80, entry, 0);
+    }
+    tag.pages[STATIONS_PAGE_OFFSET + StationId::CASINO][0] = 1;
+    memset(tag.pages[ORBS_PAGE], 0, 4);
+}
+
+static Result run(bool provisioning) {
+    hostClock.micros = 0;
+    static FakeNTAG tags[TAGS];
+    FakeNTAG empty;
+    empty.present = false;
+    empty.timed = true;
+    fakeField = &empty;
+
+    OrbDockConfigurizer dock;
+    dock.begin();
+    if (provisioning) {
+        dock.setProvisioning(true);
+    }
+
+    Result result = {0, 0, 0};
+    for (int i = 0; i < TAGS; i++) {
+        tags[i] = FakeNTAG();
+        if (i % REUSED_EVERY == REUSED_EVERY - 1) {
+            makeReused(tags[i]);
+        }
+        tags[i].timed = true;
+        fakeField = &tags[i];
+        uint32_t placed = millis();
+        while (!isDone(dock, provisioning, tags[i], i) && millis() - placed < TAG_TIMEOUT_MS) {
+            dock.loop();
+            delayMicroseconds(1000);
+        }
+        result.msPerTag += millis() - placed;
+        result.exchangesPerTag += tags[i].exchanges;
+        result.valid += isValidOrb(tags[i]);
+
+        fakeField = &empty;
+        uint32_t lifted = millis();
+        while (millis() - lifted < OPERATOR_GAP_MS) {
+            dock.loop();
+            delayMicroseconds(1000);
+        }
+    }
+    result.msPerTag /= TAGS;
+    result.exchangesPerTag /= TAGS;
+    return result;
+}
+
+int main() {
+    arduinoClock = &hostClock;
+    Result normal = run(false);
+    Result provisioning = run(true);
+
+    printf("%-14s %10s %12s %9s %6s\n", "mode", "ms/tag", "exchanges", "orbs/min", "valid");
+    const char* names[] = {"format+session", "provisioning"};
+    const Result* results[] = {&normal, &provisioning};
+    for (int i = 0; i < 2; i++) {
+        printf("%-14s %10.1f %12.1f %9.1f %3d/%d\n", names[i], results[i]->msPerTag, results[i]->exchangesPerTag,
+            60000.0 / (results[i]->msPerTag + OPERATOR_GAP_MS), results[i]->valid, TAGS);
+    }
+    double speedup = normal.msPerTag / provisioning.msPerTag;
+    bool ok = speedup >= MIN_SPEEDUP && normal.valid == TAGS && provisioning.valid == TAGS;
+    printf("%.1fx faster per tag (needs %.0fx): %s\n", speedup, MIN_SPEEDUP, ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,271 @@
+/**
+ * Rule table stations against the subclasses they replace
+ *
+ * Runs the real OrbDockRules next to OrbDockBasic and OrbDockCasino on the host (the
+ * virtual-time Arduino core of tools/fleet-sim with a virtual serial port and EEPROM,
+ * and tags from lib/FakePN532), puts the same orbs through both and compares what ends
+ * up on the tags:
+ *
+ *   - the Basic preset against OrbDockBasic: a first visit and a second one
+ *   - the disconnect rules see the orb that was lifted, not the cleared one
+ *   - RULES_CASINO, uploaded over serial the way tools/station-rules does, against
+ *     OrbDockCasino for a row of button presses
+ *   - the uploaded table runs again after a reboot with the same EEPROM
+ *   - a damaged upload and one with a pin the station doesn't allow are refused and
+ *     change nothing, and an empty upload goes back to the preset
+ *
+ * Reports each check and the virtual time of an upload, and fails on any difference.
+ *
+ * Build and run on the host:
+ *   g++ -std=gnu++11 -O2 -I../fleet-sim/arduino -I../../lib/FakePN532/src -I../../src \
+ *       -o rule-check rule-check.cpp ../fleet-sim/arduino/Arduino.cpp ../../lib/FakePN532/src/FakePN532.cpp \
+ *       ../../src/OrbDock.cpp ../../src/LedOutput.cpp ../../src/ButtonDisplay.cpp
+ *   ./rule-check
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "OrbDock.h"
+#include "OrbDockBasic.cpp"
+#include "OrbDockCasino.cpp"
+#include "OrbDockRules.cpp"
+
+#undef min
+#undef max
+
+#define SETTLE_MS 1000          // Lets the dock see a tag placed or lifted
+#define HOST_TURNAROUND_US 2000
+
+// What the checks need from a dock besides its loop()
+template <class Dock>
+struct Probe : public Dock {
+    using OrbDockCore::postEvent;
+    using OrbDockCore::orbInfo;
+    using OrbDockCore::departedOrb;
+};
+
+typedef Probe<OrbDockBasic> BasicDock;
+typedef Probe<OrbDockCasino> CasinoDock;
+typedef Probe<OrbDockRules> RulesDock;
+
+// The host end of the serial port: sends the table once the dock has sent its frame
+struct Host {
+    ArduinoSerialPort port;
+    std::vector<uint8_t> table;
+    bool sent;
+};
+
+static ArduinoClock hostClock;
+static ArduinoEEPROM eeprom;
+static Host host;
+
+// Finds the last whole table frame in the dock's output
+static bool lastFrame(const std::vector<uint8_t>& output, uint8_t& source, std::vector<StationRule>& rules) {
+    bool found = false;
+    for (size_t i = 0; i + RULES_FRAME_SIZE(0) <= output.size(); i++) {
+        const uint8_t* frameRules;
+        uint8_t count;
+        if (memcmp(&output[i], RULES_MAGIC, 4) != 0 || output[i + 5] > RULES_MAX ||
+            i + RULES_FRAME_SIZE(output[i + 5]) > output.size() ||
+            !stationRulesDecodeFrame(&output[i], RULES_FRAME_SIZE(output[i + 5]), source, frameRules, count)) {
+            continue;
+        }
+        rules.resize(count);
+        memcpy(rules.data(), frameRules, count * RULE_SIZE);
+        found = true;
+    }
+    return found;
+}
+
+static void hostRefill(ArduinoSerialPort& port) {
+    uint8_t source;
+    std::vector<StationRule> rules;
+    if (!host.sent && lastFrame(port.output, source, rules)) {
+        host.sent = true;
+        delayMicroseconds(HOST_TURNAROUND_US);
+        port.input.insert(port.input.end(), host.table.begin(), host.table.end());
+    }
+}
+
+template <class Dock>
+static void settle(Dock& dock, uint32_t ms) {
+    uint32_t start = millis();
+    while (millis() - start < ms) {
+        dock.loop();
+        delayMicroseconds(1000);
+    }
+}
+
+template <class Dock>
+static void place(Dock& dock, FakeNTAG* tag) {
+    static FakeNTAG empty;
+    empty.present = false;
+    fakeField = tag ? tag : &empty;
+    settle(dock, SETTLE_MS);
+}
+
+template <class Dock>
+static void press(Dock& dock, uint8_t button) {
+    dock.postEvent(EVENT_BUTTON, button);
+    settle(dock, 10);
+}
+
+// Sends command, with table after the dock's frame for RULES_UPLOAD_COMMAND. Returns the
+// table the dock answered with last, and the virtual ms it took
+template <class Dock>
+static double command(Dock& dock, uint8_t byte, const std::vector<uint8_t>& table, uint8_t& source,
+    std::vector<StationRule>& rules) {
+    host.port.input.assign(1, byte);
+    host.port.inputRead = 0;
+    host.port.output.clear();
+    host.table = table;
+    host.sent = false;
+    uint64_t start = micros();
+    dock.loop();
+    double ms = (micros() - start) / 1000.0;
+    rules.clear();
+    source = 0xFF;
+    lastFrame(host.port.output, source, rules);
+    return ms;
+}
+
+static std::vector<uint8_t> encode(const StationRule* rules, uint8_t count) {
+    std::vector<uint8_t> table(RULES_TABLE_SIZE(count));
+    stationRulesEncode(table.data(), rules, count);
+    return table;
+}
+
+static std::vector<StationRule> casinoRules() {
+    std::vector<StationRule> rules(sizeof(RULES_CASINO) / sizeof(RULES_CASINO[0]));
+    memcpy(rules.data(), RULES_CASINO, sizeof(RULES_CASINO));
+    return rules;
+}
+
+static bool sameRules(const std::vector<StationRule>& a, const std::vector<StationRule>& b) {
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size() * RULE_SIZE) == 0;
+}
+
+// Pages the same, but for the ticks of the journey entries, the docks' uptime
+static bool sameOrb(const FakeNTAG& a, const FakeNTAG& b) {
+    const TagLayout& layout = TAG_LAYOUTS[TAG_NTAG213];
+    for (uint8_t page = 0; page < FAKE_NTAG_PAGES; page++) {
+        bool journey = page >= ENERGY_RING_PAGE + layout.energySlots && page < layout.userPageEnd;
+        if (memcmp(a.pages[page], b.pages[page], journey ? 2 : 4) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool check(bool ok, const char* name) {
+    printf("%-44s %s\n", name, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+static FakeNTAG freshOrb(uint8_t energy) {
+    FakeNTAG tag;
+    tag.formatOrb(TraitId::DOUBT, energy, ENERGY_RING_PAGE);
+    return tag;
+}
+
+// Energy after each of two visits, which the dock reads back on the second
+template <class Dock>
+static void visitTwice(Dock& dock, FakeNTAG& tag, uint8_t energies[2]) {
+    for (int visit = 0; visit < 2; visit++) {
+        place(dock, &tag);
+        energies[visit] = dock.orbInfo.energy;
+        place(dock, (FakeNTAG*)NULL);
+    }
+}
+
+static const uint8_t PRESSES[] = {1, 2, 3, 4, 2, 2, 3, 1, 4, 2};
+
+template <class Dock>
+static void pressAll(Dock& dock, FakeNTAG& tag, uint8_t* energies) {
+    place(dock, &tag);
+    for (size_t i = 0; i < sizeof(PRESSES); i++) {
+        press(dock, PRESSES[i]);
+        energies[i] = dock.orbInfo.energy;
+    }
+    place(dock, (FakeNTAG*)NULL);
+}
+
+int main() {
+    arduinoClock = &hostClock;
+    memset(eeprom.bytes, 0xFF, sizeof(eeprom.bytes));
+    arduinoEEPROM = &eeprom;
+    host.port.refill = hostRefill;
+    arduinoSerial = &host.port;
+    bool ok = true;
+    uint8_t source;
+    std::vector<StationRule> rules;
+
+    // The Basic preset: +1 on the first visit only
+    BasicDock basic;
+    basic.begin();
+    RulesDock rulesDock;
+    rulesDock.begin();
+    FakeNTAG basicTag = freshOrb(10);
+    FakeNTAG rulesTag = freshOrb(10);
+    uint8_t basicEnergies[2];
+    uint8_t rulesEnergies[2];
+    visitTwice(basic, basicTag, basicEnergies);
+    visitTwice(rulesDock, rulesTag, rulesEnergies);
+    ok &= check(basicEnergies[0] == 11 && basicEnergies[1] == 11, "basic: +1 on the first visit only");
+    ok &= check(memcmp(basicEnergies, rulesEnergies, 2) == 0 && sameOrb(basicTag, rulesTag),
+        "basic preset: same tag as OrbDockBasic");
+    ok &= check(rulesDock.orbInfo.trait == TraitId::NONE && rulesDock.departedOrb.trait == TraitId::DOUBT &&
+        rulesDock.departedOrb.energy == 11 && rulesDock.departedOrb.stations[RULES_STATION].visited,
+        "disconnect: rules see the orb lifted");
+
+    // RULES_CASINO uploaded, against the Casino
+    std::vector<StationRule> casino = casinoRules();
+    double uploadMs = command(rulesDock, RULES_UPLOAD_COMMAND, encode(casino.data(), casino.size()), source, rules);
+    ok &= check(source == RULES_FROM_EEPROM && sameRules(rules, casino), "upload: dock runs the new table");
+    printf("%-44s %.1f ms\n", "upload of 4 rules", uploadMs);
+    CasinoDock casinoDock;
+    casinoDock.begin();
+    FakeNTAG casinoTag = freshOrb(100);
+    rulesTag = freshOrb(100);
+    uint8_t casinoEnergies[sizeof(PRESSES)];
+    uint8_t uploadedEnergies[sizeof(PRESSES)];
+    pressAll(casinoDock, casinoTag, casinoEnergies);
+    pressAll(rulesDock, rulesTag, uploadedEnergies);
+    ok &= check(memcmp(casinoEnergies, uploadedEnergies, sizeof(PRESSES)) == 0 && casinoEnergies[1] == 106,
+        "casino table: same energy as OrbDockCasino");
+
+    // The table is in the EEPROM, so it outlives a reboot
+    RulesDock rebooted;
+    rebooted.begin();
+    command(rebooted, RULES_DUMP_COMMAND, std::vector<uint8_t>(), source, rules);
+    ok &= check(source == RULES_FROM_EEPROM && sameRules(rules, casino), "reboot: the uploaded table is kept");
+    rulesTag = freshOrb(100);
+    pressAll(rebooted, rulesTag, uploadedEnergies);
+    ok &= check(memcmp(casinoEnergies, uploadedEnergies, sizeof(PRESSES)) == 0, "reboot: same energy as OrbDockCasino");
+
+    // Refused uploads change nothing
+    std::vector<uint8_t> damaged = encode(casino.data(), casino.size());
+    damaged[3] ^= 0x01;
+    command(rebooted, RULES_UPLOAD_COMMAND, damaged, source, rules);
+    ok &= check(source == RULES_FROM_EEPROM && sameRules(rules, casino), "damaged upload refused");
+    StationRule badPin = {RULE_ON_CONNECT, RULE_ANY_TRAIT, 0, 255, RULE_VISITED_ANY, RULE_PULSE_PIN, 13, 5};
+    command(rebooted, RULES_UPLOAD_COMMAND, encode(&badPin, 1), source, rules);
+    ok &= check(source == RULES_FROM_EEPROM && sameRules(rules, casino), "pin the station doesn't allow refused");
+    StationRule energyOnLeave = {RULE_ON_DISCONNECT, RULE_ANY_TRAIT, 0, 255, RULE_VISITED_ANY, RULE_ENERGY, 1, 0};
+    command(rebooted, RULES_UPLOAD_COMMAND, encode(&energyOnLeave, 1), source, rules);
+    ok &= check(source == RULES_FROM_EEPROM && sameRules(rules, casino), "energy on disconnect refused");
+
+    // An empty upload goes back to the preset, where buttons do nothing
+    command(rebooted, RULES_UPLOAD_COMMAND, encode(NULL, 0), source, rules);
+    ok &= check(source == RULES_FROM_FLASH && rules.size() == 1 && memcmp(&rules[0], RULES_BASIC, RULE_SIZE) == 0,
+        "reset: back to the preset");
+    rulesTag = freshOrb(100);
+    pressAll(rebooted, rulesTag, uploadedEnergies);
+    ok &= check(uploadedEnergies[sizeof(PRESSES) - 1] == 101, "reset: buttons do nothing, first visit +1");
+
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,385 @@
+/**
+ * Writes station rule tables as text and uploads them to a dock
+ *
+ * A rules file has a rule per line (see src/StationRules.h), # starts a comment:
+ *
+ *   <trigger> [trait=<TRAIT>|any] [energy=<min>-<max>] [visited=yes|no|any] <action> [final]
+ *
+ *   trigger: connect, disconnect, button1 ... button4
+ *   action:  energy +<n> | energy -<n>     added to the orb's energy, kept within 0 and 250
+ *            custom <n>                    the station's custom byte on the orb
+ *            pin <pin> <seconds>s | pin <pin> off
+ *            led flash | led error
+ *
+ * for example the Basic station and a Casino that pays DOUBT orbs double:
+ *
+ *   connect visited=no energy +1
+ *   button1 trait=DOUBT energy +2 final
+ *   button1 energy +1
+ *
+ * Conditions left out match any orb. Energy changes of all the matching rules add up,
+ * for the other actions the last matching rule wins, and final stops at that rule.
+ *
+ * Build and run on the host:
+ *   g++ -std=c++11 -O2 -I../../src -o station-rules station-rules.cpp
+ *   ./station-rules check casino.rules              Parses a file and prints it back
+ *   ./station-rules preset casino                   A preset (basic, trigger, casino) as text
+ *   ./station-rules show /dev/ttyUSB0               The table the dock runs
+ *   ./station-rules upload /dev/ttyUSB0 casino.rules
+ *   ./station-rules reset /dev/ttyUSB0              Back to the dock's preset
+ *
+ * The dock checks an upload against the pins it allows and keeps it in its EEPROM, so it
+ * runs from then on, over reboots.
+ */
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <strings.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include "OrbRegistry.h"
+#include "StationRules.h"
+
+#define REPLY_TIMEOUT_MS 2000
+#define ALL_PINS 0xFFFFFFFFUL   // The host doesn't know the station's pins, the dock checks them
+
+static double nowMs() {
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1e6;
+}
+
+static int findName(const char* const* names, int count, const std::string& name) {
+    for (int i = 0; i < count; i++) {
+        if (strcasecmp(registryName(names, i), name.c_str()) == 0) return i;
+    }
+    return -1;
+}
+
+static bool parseNumber(const std::string& text, long min, long max, long& value) {
+    char* end;
+    value = strtol(text.c_str(), &end, 10);
+    return !text.empty() && *end == '\0' && value >= min && value <= max;
+}
+
+// One line of a rules file, false with error set if it isn't a rule
+static bool parseRule(const std::string& line, StationRule& rule, std::string& error) {
+    std::vector<std::string> words;
+    size_t position = 0;
+    while (true) {
+        position = line.find_first_not_of(" \t\r", position);
+        if (position == std::string::npos) break;
+        size_t end = line.find_first_of(" \t\r", position);
+        words.push_back(line.substr(position, end - position));
+        position = end;
+    }
+    rule = StationRule{0, RULE_ANY_TRAIT, 0, 255, RULE_VISITED_ANY, RULE_ACTIONS, 0, 0};
+
+    size_t word = 0;
+    int trigger = findName(RULE_TRIGGER_NAMES, RULE_TRIGGERS, words[word++]);
+    if (trigger < 0) {
+        error = "unknown trigger " + words[0];
+        return false;
+    }
+    rule.trigger = trigger;
+
+    // Conditions
+    for (; word < words.size() && words[word].find('=') != std::string::npos; word++) {
+        std::string key = words[word].substr(0, words[word].find('='));
+        std::string value = words[word].substr(key.size() + 1);
+        long min;
+        long max;
+        if (key == "trait") {
+            int trait = strcasecmp(value.c_str(), "any") == 0 ? RULE_ANY_TRAIT : findName(TRAIT_NAMES, NUM_TRAITS, value);
+            if (trait < 0) {
+                error = "unknown trait " + value;
+                return false;
+            }
+            rule.trait = trait;
+        } else if (key == "energy" && value.find('-') != std::string::npos &&
+            parseNumber(value.substr(0, value.find('-')), 0, 255, min) &&
+            parseNumber(value.substr(value.find('-') + 1), min, 255, max)) {
+            rule.energyMin = min;
+            rule.energyMax = max;
+        } else if (key == "visited" && (value == "yes" || value == "no" || value == "any")) {
+            rule.visited = value == "yes" ? RULE_VISITED : (value == "no" ? RULE_NOT_VISITED : RULE_VISITED_ANY);
+        } else {
+            error = "bad condition " + words[word];
+            return false;
+        }
+    }
+
+    // Action
+    if (word >= words.size()) {
+        error = "no action";
+        return false;
+    }
+    std::string action = words[word++];
+    std::string value = word < words.size() ? words[word++] : "";
+    long number;
+    if (action == "energy" && (value[0] == '+' || value[0] == '-') && parseNumber(value, -128, 127, number)) {
+        rule.action = RULE_ENERGY;
+        rule.value = (uint8_t)(int8_t)number;
+    } else if (action == "custom" && parseNumber(value, 0, 255, number)) {
+        rule.action = RULE_SET_CUSTOM;
+        rule.value = number;
+    } else if (action == "pin" && parseNumber(value, 0, 31, number) && word < words.size()) {
+        rule.action = RULE_PULSE_PIN;
+        rule.value = number;
+        std::string time = words[word++];
+        long seconds = 0;
+        if (time != "off" && (time.size() < 2 || time[time.size() - 1] != 's' ||
+            !parseNumber(time.substr(0, time.size() - 1), 1, 255, seconds))) {
+            error = "bad pin time " + time + ", <seconds>s or off";
+            return false;
+        }
+        rule.arg = seconds;
+    } else if (action == "led" && findName(RULE_LED_EFFECT_NAMES, RULE_LED_EFFECTS, value) >= 0) {
+        rule.action = RULE_LED;
+        rule.value = findName(RULE_LED_EFFECT_NAMES, RULE_LED_EFFECTS, value);
+    } else {
+        error = "bad action " + action + " " + value;
+        return false;
+    }
+    if (word < words.size() && words[word] == "final") {
+        rule.action |= RULE_FINAL;
+        word++;
+    }
+    if (word < words.size()) {
+        error = "unexpected " + words[word];
+        return false;
+    }
+    if (!stationRuleValid(rule, ALL_PINS)) {
+        error = "energy and custom actions need the orb, not on disconnect";
+        return false;
+    }
+    return true;
+}
+
+// A rule as a line of a rules file
+static std::string ruleText(const StationRule& rule) {
+    char text[128];
+    int length = snprintf(text, sizeof(text), "%s", rule.trigger < RULE_TRIGGERS ? registryName(RULE_TRIGGER_NAMES, rule.trigger) : "?");
+    if (rule.trait != RULE_ANY_TRAIT) {
+        length += snprintf(text + length, sizeof(text) - length, " trait=%s",
+            rule.trait < NUM_TRAITS ? registryName(TRAIT_NAMES, rule.trait) : "?");
+    }
+    if (rule.energyMin != 0 || rule.energyMax != 255) {
+        length += snprintf(text + length, sizeof(text) - length, " energy=%u-%u", rule.energyMin, rule.energyMax);
+    }
+    if (rule.visited != RULE_VISITED_ANY) {
+        length += snprintf(text + length, sizeof(text) - length, " visited=%s",
+            rule.visited == RULE_VISITED ? "yes" : "no");
+    }
+    switch (rule.action & ~RULE_FINAL) {
+        case RULE_ENERGY:
+            length += snprintf(text + length, sizeof(text) - length, " energy %+d", (int8_t)rule.value);
+            break;
+        case RULE_SET_CUSTOM:
+            length += snprintf(text + length, sizeof(text) - length, " custom %u", rule.value);
+            break;
+        case RULE_PULSE_PIN:
+            if (rule.arg) {
+                length += snprintf(text + length, sizeof(text) - length, " pin %u %us", rule.value, rule.arg);
+            } else {
+                length += snprintf(text + length, sizeof(text) - length, " pin %u off", rule.value);
+            }
+            break;
+        case RULE_LED:
+            length += snprintf(text + length, sizeof(text) - length, " led %s",
+                rule.value < RULE_LED_EFFECTS ? registryName(RULE_LED_EFFECT_NAMES, rule.value) : "?");
+            break;
+        default:
+            length += snprintf(text + length, sizeof(text) - length, " ?");
+            break;
+    }
+    if (rule.action & RULE_FINAL) {
+        snprintf(text + length, sizeof(text) - length, " final");
+    }
+    return text;
+}
+
+static void printRules(const StationRule* rules, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        printf("%s\n", ruleText(rules[i]).c_str());
+    }
+}
+
+static bool loadRules(const char* path, std::vector<StationRule>& rules) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "%s: can't open\n", path);
+        return false;
+    }
+    char buffer[256];
+    bool ok = true;
+    for (int lineNumber = 1; fgets(buffer, sizeof(buffer), file); lineNumber++) {
+        std::string line = buffer;
+        line = line.substr(0, line.find_first_of("#\n"));
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+        StationRule rule;
+        std::string error;
+        if (!parseRule(line, rule, error)) {
+            fprintf(stderr, "%s:%d: %s\n", path, lineNumber, error.c_str());
+            ok = false;
+            continue;
+        }
+        rules.push_back(rule);
+    }
+    fclose(file);
+    if (ok && rules.size() > RULES_MAX) {
+        fprintf(stderr, "%s: %zu rules, a dock takes %d\n", path, rules.size(), RULES_MAX);
+        ok = false;
+    }
+    return ok;
+}
+
+static int openPort(const char* device) {
+    int fd = open(device, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: can't open\n", device);
+        return -1;
+    }
+    termios tty;
+    tcgetattr(fd, &tty);
+    cfmakeraw(&tty);
+    cfsetispeed(&tty, B115200);
+    cfsetospeed(&tty, B115200);
+    tcsetattr(fd, TCSANOW, &tty);
+    tcflush(fd, TCIOFLUSH);
+    return fd;
+}
+
+// Reads one byte, returns false after REPLY_TIMEOUT_MS without data
+static bool readByte(int fd, uint8_t& byte) {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    timeval timeout = {REPLY_TIMEOUT_MS / 1000, (REPLY_TIMEOUT_MS % 1000) * 1000};
+    if (select(fd + 1, &fds, NULL, NULL, &timeout) <= 0) return false;
+    return read(fd, &byte, 1) == 1;
+}
+
+// Skips the dock's text output up to the next table frame and checks it
+static bool readRulesFrame(int fd, uint8_t& source, std::vector<StationRule>& rules) {
+    uint8_t frame[RULES_FRAME_SIZE(RULES_MAX)];
+    size_t matched = 0;
+    uint8_t byte;
+    while (matched < 4) {
+        if (!readByte(fd, byte)) return false;
+        matched = (byte == (uint8_t)RULES_MAGIC[matched]) ? matched + 1 : (byte == (uint8_t)RULES_MAGIC[0] ? 1 : 0);
+    }
+    memcpy(frame, RULES_MAGIC, 4);
+    for (size_t i = 4; i < 6; i++) {
+        if (!readByte(fd, frame[i])) return false;
+    }
+    if (frame[5] > RULES_MAX) return false;
+    for (size_t i = 6; i < (size_t)RULES_FRAME_SIZE(frame[5]); i++) {
+        if (!readByte(fd, frame[i])) return false;
+    }
+    const uint8_t* frameRules;
+    uint8_t count;
+    if (!stationRulesDecodeFrame(frame, RULES_FRAME_SIZE(frame[5]), source, frameRules, count)) return false;
+    rules.resize(count);
+    memcpy(rules.data(), frameRules, count * RULE_SIZE);
+    return true;
+}
+
+static void printTable(const char* device, uint8_t source, const std::vector<StationRule>& rules) {
+    printf("# %s: %zu rules from %s\n", device, rules.size(), source == RULES_FROM_EEPROM ? "EEPROM" : "the preset");
+    printRules(rules.data(), rules.size());
+}
+
+static int show(const char* device) {
+    int fd = openPort(device);
+    if (fd < 0) return 1;
+    char command = RULES_DUMP_COMMAND;
+    uint8_t source;
+    std::vector<StationRule> rules;
+    bool received = write(fd, &command, 1) == 1 && readRulesFrame(fd, source, rules);
+    close(fd);
+    if (!received) {
+        fprintf(stderr, "%s: no rules received\n", device);
+        return 1;
+    }
+    printTable(device, source, rules);
+    return 0;
+}
+
+// Sends rules (none for the preset) once the dock has sent its current table
+static int upload(const char* device, const std::vector<StationRule>& rules) {
+    int fd = openPort(device);
+    if (fd < 0) return 1;
+    double start = nowMs();
+    uint8_t table[RULES_TABLE_SIZE(RULES_MAX)];
+    size_t length = stationRulesEncode(table, rules.data(), rules.size());
+    char command = RULES_UPLOAD_COMMAND;
+    uint8_t source;
+    std::vector<StationRule> before;
+    std::vector<StationRule> after;
+    bool received = write(fd, &command, 1) == 1 && readRulesFrame(fd, source, before) &&
+        write(fd, table, length) == (ssize_t)length && readRulesFrame(fd, source, after);
+    close(fd);
+    if (!received) {
+        fprintf(stderr, "%s: no answer from the dock\n", device);
+        return 1;
+    }
+    bool stored = rules.empty() ? source == RULES_FROM_FLASH :
+        source == RULES_FROM_EEPROM && after.size() == rules.size() &&
+        memcmp(after.data(), rules.data(), rules.size() * RULE_SIZE) == 0;
+    if (!stored) {
+        fprintf(stderr, "%s: the dock refused the table (a pin it doesn't allow?), it still runs:\n", device);
+        printTable(device, source, after);
+        return 1;
+    }
+    printf("%s: %s in %.0f ms\n", device, rules.empty() ? "back to the preset" : "rules stored", nowMs() - start);
+    return 0;
+}
+
+static int preset(const char* name) {
+    if (strcmp(name, "basic") == 0) {
+        printRules(RULES_BASIC, sizeof(RULES_BASIC) / sizeof(RULES_BASIC[0]));
+    } else if (strcmp(name, "trigger") == 0) {
+        printRules(RULES_TRIGGER, sizeof(RULES_TRIGGER) / sizeof(RULES_TRIGGER[0]));
+    } else if (strcmp(name, "casino") == 0) {
+        printRules(RULES_CASINO, sizeof(RULES_CASINO) / sizeof(RULES_CASINO[0]));
+    } else {
+        fprintf(stderr, "unknown preset %s, basic, trigger or casino\n", name);
+        return 1;
+    }
+    return 0;
+}
+
+static int usage() {
+    fprintf(stderr,
+        "usage: station-rules check FILE\n"
+        "       station-rules preset basic|trigger|casino\n"
+        "       station-rules show DEVICE\n"
+        "       station-rules upload DEVICE FILE\n"
+        "       station-rules reset DEVICE\n");
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) return usage();
+    std::string command = argv[1];
+    std::vector<StationRule> rules;
+    if (command == "check" && argc == 3) {
+        if (!loadRules(argv[2], rules)) return 1;
+        printf("# %zu rules, %d bytes of EEPROM\n", rules.size(), RULES_TABLE_SIZE((int)rules.size()));
+        printRules(rules.data(), rules.size());
+        return 0;
+    }
+    if (command == "preset" && argc == 3) return preset(argv[2]);
+    if (command == "show" && argc == 3) return show(argv[2]);
+    if (command == "upload" && argc == 4) return loadRules(argv[3], rules) ? upload(argv[2], rules) : 1;
+    if (command == "reset" && argc == 3) return upload(argv[2], rules);
+    return usage();
+}
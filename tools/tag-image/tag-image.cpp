@@ -0,0 +1,343 @@
+/**
+ * Backs up and restores whole tags through a dock
+ *
+ * Asks the dock for a binary image of the tag on it (TAG_IMAGE_DUMP_COMMAND, see
+ * src/TagImage.h) and keeps it in an image library, a directory per tag UID with an
+ * image file per dump named after its time. Images are restored with the chunked
+ * TAG_IMAGE_RESTORE_COMMAND exchange: onto a blank tag of the same type, or back onto
+ * the orb they were taken from. Only user memory is restored, from page 4 on: the UID,
+ * lock bits, capability container and configuration pages stay the tag's own.
+ *
+ * Build and run on the host:
+ *   g++ -std=c++11 -O2 -I../../src -o tag-image tag-image.cpp
+ *   ./tag-image dump /dev/ttyUSB0               Saves the tag on the dock to the library
+ *   ./tag-image list                            Tags in the library, with their latest image
+ *   ./tag-image show 040B1E2A5C6180             Trait, energy, visits and pages of the latest image
+ *   ./tag-image show tag-images/040B1E2A5C6180/20261018-101500.orbi
+ *   ./tag-image restore /dev/ttyUSB0 040B1E2A5C6180
+ *
+ * The library is ./tag-images unless --library DIR comes first. Images are the dump
+ * frames as the dock sent them, CRC included.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include "EnergyRing.h"
+#include "OrbRegistry.h"
+#include "TagImage.h"
+
+#define REPLY_TIMEOUT_MS 2000
+#define DEFAULT_LIBRARY "tag-images"
+#define IMAGE_EXTENSION ".orbi"
+
+static const char* library = DEFAULT_LIBRARY;
+
+static double nowMs() {
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1e6;
+}
+
+static std::string uidHex(const uint8_t* uid) {
+    char hex[TAG_IMAGE_UID_LENGTH * 2 + 1];
+    for (int i = 0; i < TAG_IMAGE_UID_LENGTH; i++) {
+        sprintf(hex + i * 2, "%02X", uid[i]);
+    }
+    return hex;
+}
+
+static bool isFile(const std::string& path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+}
+
+// Image files of a tag in the library, oldest first (the names are times)
+static std::vector<std::string> tagImages(const std::string& uid) {
+    std::vector<std::string> names;
+    DIR* dir = opendir((std::string(library) + "/" + uid).c_str());
+    if (!dir) return names;
+    while (dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.size() > strlen(IMAGE_EXTENSION) &&
+            name.compare(name.size() - strlen(IMAGE_EXTENSION), std::string::npos, IMAGE_EXTENSION) == 0) {
+            names.push_back(name);
+        }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+// An image file, or the latest image of a UID in the library
+static std::string imagePath(const char* target) {
+    if (isFile(target)) return target;
+    std::string uid = target;
+    std::transform(uid.begin(), uid.end(), uid.begin(), ::toupper);
+    std::vector<std::string> names = tagImages(uid);
+    return names.empty() ? "" : std::string(library) + "/" + uid + "/" + names.back();
+}
+
+static bool loadImage(const std::string& path, std::vector<uint8_t>& frame, TagImage& image) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        fprintf(stderr, "%s: can't open\n", path.c_str());
+        return false;
+    }
+    frame.resize(tagImageFrameSize(255));
+    frame.resize(fread(frame.data(), 1, frame.size(), file));
+    fclose(file);
+    if (!tagImageDecode(frame.data(), frame.size(), image) || image.type >= TAG_TYPES) {
+        fprintf(stderr, "%s: not a valid tag image\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Trait, energy and visited stations of an orb image
+static void printOrb(const TagImage& image) {
+    const TagLayout& layout = TAG_LAYOUTS[image.type];
+    printf("%s, UID %s", TAG_TYPE_NAMES[image.type], uidHex(image.uid).c_str());
+    if (image.pages < layout.userPageEnd || memcmp(image.data + ORBS_PAGE * 4, ORBS_HEADER, 4) != 0) {
+        printf(", not an orb\n");
+        return;
+    }
+    uint8_t trait = image.data[TRAIT_PAGE * 4];
+    int8_t slot = energyRingFindNewest(image.data + ENERGY_RING_PAGE * 4, layout.energySlots);
+    uint8_t energy = slot >= 0 ? image.data[(ENERGY_RING_PAGE + slot) * 4] : image.data[ENERGY_PAGE * 4];
+    printf(", trait %s, energy %u, visited", trait < NUM_TRAITS ? TRAIT_NAMES[trait] : "?", energy);
+    int visited = 0;
+    for (int station = 0; station < NUM_STATIONS; station++) {
+        if (image.data[(STATIONS_PAGE_OFFSET + station) * 4]) {
+            printf(" %s", STATION_NAMES[station]);
+            visited++;
+        }
+    }
+    printf("%s\n", visited ? "" : " none");
+}
+
+static int openPort(const char* device) {
+    int fd = open(device, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: can't open\n", device);
+        return -1;
+    }
+    termios tty;
+    tcgetattr(fd, &tty);
+    cfmakeraw(&tty);
+    cfsetispeed(&tty, B115200);
+    cfsetospeed(&tty, B115200);
+    tcsetattr(fd, TCSANOW, &tty);
+    tcflush(fd, TCIOFLUSH);
+    return fd;
+}
+
+// Reads one byte, returns false after REPLY_TIMEOUT_MS without data
+static bool readByte(int fd, uint8_t& byte) {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    timeval timeout = {REPLY_TIMEOUT_MS / 1000, (REPLY_TIMEOUT_MS % 1000) * 1000};
+    if (select(fd + 1, &fds, NULL, NULL, &timeout) <= 0) return false;
+    return read(fd, &byte, 1) == 1;
+}
+
+// Skips the dock's text output up to magic, then reads length - 4 more bytes after it
+static bool readFrame(int fd, const char* magic, uint8_t* frame, size_t length) {
+    size_t matched = 0;
+    uint8_t byte;
+    while (matched < 4) {
+        if (!readByte(fd, byte)) return false;
+        matched = (byte == (uint8_t)magic[matched]) ? matched + 1 : (byte == (uint8_t)magic[0] ? 1 : 0);
+    }
+    memcpy(frame, magic, 4);
+    for (size_t i = 4; i < length; i++) {
+        if (!readByte(fd, frame[i])) return false;
+    }
+    return true;
+}
+
+static bool makeDirectory(const std::string& path) {
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+static int dump(const char* device) {
+    int fd = openPort(device);
+    if (fd < 0) return 1;
+    double start = nowMs();
+    char command = TAG_IMAGE_DUMP_COMMAND;
+    std::vector<uint8_t> frame(tagImageFrameSize(255));
+    bool received = write(fd, &command, 1) == 1 && readFrame(fd, TAG_IMAGE_MAGIC, frame.data(), 6);
+    if (received) {
+        frame.resize(tagImageFrameSize(frame[5]));
+        for (size_t i = 6; i < frame.size() && received; i++) {
+            received = readByte(fd, frame[i]);
+        }
+    }
+    close(fd);
+    double ms = nowMs() - start;
+    if (!received) {
+        fprintf(stderr, "%s: no image received\n", device);
+        return 1;
+    }
+
+    TagImage image;
+    if (!tagImageDecode(frame.data(), frame.size(), image)) {
+        fprintf(stderr, "%s: damaged image frame (%zu bytes)\n", device, frame.size());
+        return 1;
+    }
+    if (image.result != TAG_IMAGE_OK) {
+        fprintf(stderr, "%s: %s\n", device, registryName(TAG_IMAGE_RESULT_NAMES, image.result < TAG_IMAGE_RESULTS ? image.result : (uint8_t)TAG_IMAGE_NO_TAG));
+        return 1;
+    }
+
+    std::string directory = std::string(library) + "/" + uidHex(image.uid);
+    char name[32];
+    time_t now = time(NULL);
+    strftime(name, sizeof(name), "%Y%m%d-%H%M%S" IMAGE_EXTENSION, localtime(&now));
+    std::string path = directory + "/" + name;
+    FILE* file = NULL;
+    if (makeDirectory(library) && makeDirectory(directory)) {
+        file = fopen(path.c_str(), "wb");
+    }
+    if (!file || fwrite(frame.data(), 1, frame.size(), file) != frame.size()) {
+        fprintf(stderr, "%s: can't write\n", path.c_str());
+        return 1;
+    }
+    fclose(file);
+    printf("%u pages in %.0f ms, saved to %s\n", image.pages, ms, path.c_str());
+    printOrb(image);
+    return 0;
+}
+
+static int list() {
+    DIR* dir = opendir(library);
+    if (!dir) {
+        fprintf(stderr, "%s: no image library\n", library);
+        return 1;
+    }
+    std::vector<std::string> uids;
+    while (dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] != '.' && !tagImages(entry->d_name).empty()) uids.push_back(entry->d_name);
+    }
+    closedir(dir);
+    std::sort(uids.begin(), uids.end());
+    for (const std::string& uid : uids) {
+        std::vector<std::string> names = tagImages(uid);
+        printf("%-14s %3zu image%s, latest %s\n  ", uid.c_str(), names.size(), names.size() == 1 ? "" : "s",
+            names.back().c_str());
+        std::vector<uint8_t> frame;
+        TagImage image;
+        if (loadImage(library + ("/" + uid + "/" + names.back()), frame, image)) printOrb(image);
+    }
+    return 0;
+}
+
+static int show(const char* target) {
+    std::string path = imagePath(target);
+    std::vector<uint8_t> frame;
+    TagImage image;
+    if (path.empty()) {
+        fprintf(stderr, "%s: no such image file or tag in %s\n", target, library);
+        return 1;
+    }
+    if (!loadImage(path, frame, image)) return 1;
+    printf("%s\n", path.c_str());
+    printOrb(image);
+    for (int page = 0; page < image.pages; page++) {
+        const uint8_t* data = image.data + page * 4;
+        printf("  Page %3d: %02X %02X %02X %02X%s\n", page, data[0], data[1], data[2], data[3],
+            page < TAG_IMAGE_USER_PAGE || page >= TAG_LAYOUTS[image.type].userPageEnd ? "  (not restored)" : "");
+    }
+    return 0;
+}
+
+static int restore(const char* device, const char* target) {
+    std::string path = imagePath(target);
+    std::vector<uint8_t> frame;
+    TagImage image;
+    if (path.empty()) {
+        fprintf(stderr, "%s: no such image file or tag in %s\n", target, library);
+        return 1;
+    }
+    if (!loadImage(path, frame, image)) return 1;
+    if (image.result != TAG_IMAGE_OK || image.pages < TAG_LAYOUTS[image.type].userPageEnd) {
+        fprintf(stderr, "%s: incomplete image, not restoring it\n", path.c_str());
+        return 1;
+    }
+    printf("Restoring %s\n", path.c_str());
+
+    int fd = openPort(device);
+    if (fd < 0) return 1;
+    double start = nowMs();
+    uint8_t request[1 + TAG_IMAGE_REQUEST_SIZE];
+    request[0] = TAG_IMAGE_RESTORE_COMMAND;
+    tagImageEncodeRequest(request + 1, image.type, image.uid);
+    if (write(fd, request, sizeof(request)) != (ssize_t)sizeof(request)) {
+        fprintf(stderr, "%s: write failed\n", device);
+        close(fd);
+        return 1;
+    }
+
+    // The dock asks for the chunks one by one until its reply has page 0
+    int resent = 0;
+    uint8_t result;
+    uint8_t page;
+    for (;;) {
+        uint8_t reply[TAG_IMAGE_REPLY_SIZE];
+        if (!readFrame(fd, TAG_IMAGE_REPLY_MAGIC, reply, sizeof(reply))) {
+            fprintf(stderr, "%s: no reply from the dock\n", device);
+            close(fd);
+            return 1;
+        }
+        if (!tagImageDecodeReply(reply, result, page)) continue;
+        if (page == 0) break;
+        if (result == TAG_IMAGE_BAD_CHUNK) resent++;
+        uint8_t count = tagImageChunkPages(page);
+        uint8_t chunk[TAG_IMAGE_CHUNK_SIZE];
+        uint8_t length = tagImageEncodeChunk(chunk, page - count, count, image.data + (page - count) * 4);
+        if (write(fd, chunk, length) != length) {
+            fprintf(stderr, "%s: write failed\n", device);
+            close(fd);
+            return 1;
+        }
+    }
+    close(fd);
+
+    if (result != TAG_IMAGE_OK) {
+        fprintf(stderr, "%s: %s\n", device, result < TAG_IMAGE_RESULTS ? registryName(TAG_IMAGE_RESULT_NAMES, result) : "?");
+        return 1;
+    }
+    printf("Restored in %.0f ms", nowMs() - start);
+    if (resent) printf(", %d chunk%s sent again", resent, resent == 1 ? "" : "s");
+    printf("\n");
+    printOrb(image);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc >= 3 && strcmp(argv[1], "--library") == 0) {
+        library = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc == 3 && strcmp(argv[1], "dump") == 0) return dump(argv[2]);
+    if (argc == 2 && strcmp(argv[1], "list") == 0) return list();
+    if (argc == 3 && strcmp(argv[1], "show") == 0) return show(argv[2]);
+    if (argc == 4 && strcmp(argv[1], "restore") == 0) return restore(argv[2], argv[3]);
+    fprintf(stderr, "Usage: tag-image [--library DIR] dump <serial device>\n"
+                    "       tag-image [--library DIR] list\n"
+                    "       tag-image [--library DIR] show <uid | image file>\n"
+                    "       tag-image [--library DIR] restore <serial device> <uid | image file>\n");
+    return 1;
+}